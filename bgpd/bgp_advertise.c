@@ -35,6 +35,7 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "bgpd/bgp_packet.h"
 #include "bgpd/bgp_fsm.h"
 #include "bgpd/bgp_mplsvpn.h"
+#include "bgpd/bgp_pool.h"
 
 /* BGP advertise attribute is used for pack same attribute update into
    one packet.  To do that we maintain attribute hash in struct
@@ -120,13 +121,15 @@ bgp_advertise_delete (struct bgp_advertise_attr *baa,
     baa->adv = adv->next;
 }
 
+/* The advertisement attribute for ATTR, which is interned.  The
+   caller's reference to ATTR goes to it. */
 static struct bgp_advertise_attr *
 bgp_advertise_intern (struct hash *hash, struct attr *attr)
 {
   struct bgp_advertise_attr ref;
   struct bgp_advertise_attr *baa;
 
-  ref.attr = bgp_attr_intern (attr);
+  ref.attr = attr;
   baa = (struct bgp_advertise_attr *) hash_get (hash, &ref, baa_hash_alloc);
   baa->refcnt++;
 
@@ -156,8 +159,7 @@ bgp_advertise_unintern (struct hash *hash, struct bgp_advertise_attr *baa)
 static void
 bgp_adj_out_free (struct bgp_adj_out *adj)
 {
-  peer_unlock (adj->peer); /* adj_out peer reference */
-  XFREE (MTYPE_BGP_ADJ_OUT, adj);
+  bgp_pool_free (adj->peer, BGP_POOL_ADJ_OUT, adj);
 }
 
 int
@@ -212,6 +214,8 @@ bgp_advertise_clean (struct peer *peer, struct bgp_adj_out *adj,
   return next;
 }
 
+/* Queue the announcement of RN to PEER with ATTR, interned, taking
+   over the caller's reference to it. */
 void
 bgp_adj_out_set (struct bgp_node *rn, struct peer *peer, struct prefix *p,
 		 struct attr *attr, afi_t afi, safi_t safi,
@@ -221,7 +225,11 @@ bgp_adj_out_set (struct bgp_node *rn, struct peer *peer, struct prefix *p,
   struct bgp_advertise *adv;
 
   if (DISABLE_BGP_ANNOUNCE)
-    return;
+    {
+      if (attr)
+	bgp_attr_unintern (&attr);
+      return;
+    }
 
   /* Look for adjacency information. */
   if (rn)
@@ -233,8 +241,9 @@ bgp_adj_out_set (struct bgp_node *rn, struct peer *peer, struct prefix *p,
 
   if (! adj)
     {
-      adj = XCALLOC (MTYPE_BGP_ADJ_OUT, sizeof (struct bgp_adj_out));
-      adj->peer = peer_lock (peer); /* adj_out peer reference */
+      adj = bgp_pool_alloc (peer, BGP_POOL_ADJ_OUT);
+      adj->peer = peer;
+      adj->rn = rn;
       
       if (rn)
         {
@@ -345,20 +354,26 @@ bgp_adj_in_set (struct bgp_node *rn, struct peer *peer, struct attr *attr)
 	  return;
 	}
     }
-  adj = XCALLOC (MTYPE_BGP_ADJ_IN, sizeof (struct bgp_adj_in));
-  adj->peer = peer_lock (peer); /* adj_in peer reference */
+  adj = bgp_pool_alloc (peer, BGP_POOL_ADJ_IN);
+  adj->peer = peer;
+  adj->rn = rn;
   adj->attr = bgp_attr_intern (attr);
-  BGP_ADJ_IN_ADD (rn, adj);
+  adj->next = rn->adj_in;
+  rn->adj_in = adj;
   bgp_lock_node (rn);
 }
 
 void
 bgp_adj_in_remove (struct bgp_node *rn, struct bgp_adj_in *bai)
 {
+  struct bgp_adj_in **prev;
+
+  for (prev = &rn->adj_in; *prev != bai; prev = &(*prev)->next)
+    ;
+  *prev = bai->next;
+
   bgp_attr_unintern (&bai->attr);
-  BGP_ADJ_IN_DEL (rn, bai);
-  peer_unlock (bai->peer); /* adj_in peer reference */
-  XFREE (MTYPE_BGP_ADJ_IN, bai);
+  bgp_pool_free (bai->peer, BGP_POOL_ADJ_IN, bai);
 }
 
 void
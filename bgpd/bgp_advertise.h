@@ -73,6 +73,9 @@ struct bgp_adj_out
   /* Advertised peer.  */
   struct peer *peer;
 
+  /* The node advertised.  */
+  struct bgp_node *rn;
+
   /* Advertised attribute.  */
   struct attr *attr;
 
@@ -80,16 +83,18 @@ struct bgp_adj_out
   struct bgp_advertise *adv;
 };
 
-/* BGP adjacency in. */
+/* BGP adjacency in.  Carved out of per-peer blocks, see bgp_pool.c.  */
 struct bgp_adj_in
 {
   /* Linked list pointer.  */
   struct bgp_adj_in *next;
-  struct bgp_adj_in *prev;
 
   /* Received peer.  */
   struct peer *peer;
 
+  /* The node received.  */
+  struct bgp_node *rn;
+
   /* Received attribute.  */
   struct attr *attr;
 };
@@ -122,8 +127,6 @@ struct bgp_synchronize
       (N)->TYPE = (A)->next;                          \
   } while (0)
 
-#define BGP_ADJ_IN_ADD(N,A)    BGP_INFO_ADD(N,A,adj_in)
-#define BGP_ADJ_IN_DEL(N,A)    BGP_INFO_DEL(N,A,adj_in)
 #define BGP_ADJ_OUT_ADD(N,A)   BGP_INFO_ADD(N,A,adj_out)
 #define BGP_ADJ_OUT_DEL(N,A)   BGP_INFO_DEL(N,A,adj_out)
 
@@ -335,6 +335,8 @@ aspath_free (struct aspath *aspath)
     assegment_free_all (aspath->segments);
   if (aspath->str)
     XFREE (MTYPE_AS_STR, aspath->str);
+  if (aspath->filter)
+    XFREE (MTYPE_AS_LIST_CACHE, aspath->filter);
   XFREE (MTYPE_AS_PATH, aspath);
 }
 
@@ -628,6 +630,8 @@ aspath_intern (struct aspath *aspath)
   if (find != aspath)
     aspath_free (aspath);
 
+  if (! find->refcnt)
+    find->key = aspath_key_make (find);
   find->refcnt++;
 
   if (! find->str)
@@ -807,6 +811,8 @@ aspath_parse (struct stream *s, size_t length, int use32bit)
   
   if (! find)
     return NULL;
+  if (! find->refcnt)
+    find->key = aspath_key_make (find);
   find->refcnt++;
 
   return find;
@@ -58,6 +58,13 @@ struct aspath
   /* String expression of AS path.  This string is used by vty output
      and AS path regular expression match.  */
   char *str;
+
+  /* aspath_key_make() value, set when interned.  */
+  unsigned int key;
+
+  /* Results of AS path access-lists applied to this path while it is
+     interned, see as_list_apply().  */
+  struct as_list_cache *filter;
 };
 
 #define ASPATH_STR_DEFAULT_LEN 32
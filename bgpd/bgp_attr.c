@@ -65,6 +65,7 @@ static const struct message attr_str [] =
 static const int attr_str_max = sizeof(attr_str)/sizeof(attr_str[0]);
 
 static struct hash *cluster_hash;
+static unsigned int cluster_hash_key_make (void *);
 
 static void *
 cluster_hash_alloc (void *p)
@@ -99,6 +100,8 @@ cluster_parse (struct in_addr * pnt, int length)
   tmp.list = pnt;
 
   cluster = hash_get (cluster_hash, &tmp, cluster_hash_alloc);
+  if (! cluster->refcnt)
+    cluster->key = cluster_hash_key_make (cluster);
   cluster->refcnt++;
   return cluster;
 }
@@ -167,6 +170,8 @@ cluster_intern (struct cluster_list *cluster)
   struct cluster_list *find;
 
   find = hash_get (cluster_hash, cluster, cluster_hash_alloc);
+  if (! find->refcnt)
+    find->key = cluster_hash_key_make (find);
   find->refcnt++;
 
   return find;
@@ -202,6 +207,7 @@ cluster_finish (void)
 
 /* Unknown transit attribute. */
 static struct hash *transit_hash;
+static unsigned int transit_hash_key_make (void *);
 
 static void
 transit_free (struct transit *transit)
@@ -227,6 +233,8 @@ transit_intern (struct transit *transit)
   find = hash_get (transit_hash, transit, transit_hash_alloc);
   if (find != transit)
     transit_free (transit);
+  if (! find->refcnt)
+    find->key = transit_hash_key_make (find);
   find->refcnt++;
 
   return find;
@@ -357,26 +365,34 @@ attrhash_key_make (void *p)
       MIX(attr->extra->mp_nexthop_global_in.s_addr);
     }
   
+  /* The referenced structures are interned by the time an attribute
+     is, and carry their own hash value from then on.  */
+#define SUBKEY(obj, make)	((obj)->refcnt ? (obj)->key : make (obj))
   if (attr->aspath)
-    MIX(aspath_key_make (attr->aspath));
+    MIX(SUBKEY (attr->aspath, aspath_key_make));
   if (attr->community)
-    MIX(community_hash_make (attr->community));
+    MIX(SUBKEY (attr->community, community_hash_make));
   
   if (attr->extra)
     {
       if (attr->extra->ecommunity)
-        MIX(ecommunity_hash_make (attr->extra->ecommunity));
+        MIX(SUBKEY (attr->extra->ecommunity, ecommunity_hash_make));
       if (attr->extra->cluster)
-        MIX(cluster_hash_key_make (attr->extra->cluster));
+        MIX(SUBKEY (attr->extra->cluster, cluster_hash_key_make));
       if (attr->extra->transit)
-        MIX(transit_hash_key_make (attr->extra->transit));
+        MIX(SUBKEY (attr->extra->transit, transit_hash_key_make));
 
 #ifdef HAVE_IPV6
+      /* Most attributes carry no IPv6 next hop at all. */
       MIX(attr->extra->mp_nexthop_len);
-      key = jhash(attr->extra->mp_nexthop_global.s6_addr, 16, key);
-      key = jhash(attr->extra->mp_nexthop_local.s6_addr, 16, key);
+      if (attr->extra->mp_nexthop_len)
+        {
+          key = jhash(attr->extra->mp_nexthop_global.s6_addr, 16, key);
+          key = jhash(attr->extra->mp_nexthop_local.s6_addr, 16, key);
+        }
 #endif /* HAVE_IPV6 */
     }
+#undef SUBKEY
 
   return key;
 }
@@ -387,6 +403,10 @@ attrhash_cmp (const void *p1, const void *p2)
   const struct attr * attr1 = p1;
   const struct attr * attr2 = p2;
 
+  /* The same interned attribute, nothing to compare. */
+  if (attr1 == attr2)
+    return 1;
+
   if (attr1->flag == attr2->flag
       && attr1->origin == attr2->origin
       && attr1->nexthop.s_addr == attr2->nexthop.s_addr
@@ -421,10 +441,14 @@ attrhash_cmp (const void *p1, const void *p2)
     return 0;
 }
 
+/* A full table holds tens of thousands of distinct attributes; the
+   default of 1024 chains makes every intern walk a long list. */
+#define ATTRHASH_SIZE	32768
+
 static void
 attrhash_init (void)
 {
-  attrhash = hash_create (attrhash_key_make, attrhash_cmp);
+  attrhash = hash_create_size (ATTRHASH_SIZE, attrhash_key_make, attrhash_cmp);
 }
 
 static void
@@ -469,13 +493,11 @@ bgp_attr_hash_alloc (void *p)
   return attr;
 }
 
-/* Internet argument attribute. */
-struct attr *
-bgp_attr_intern (struct attr *attr)
+/* Intern the parts ATTR points to, or take another reference to
+   those that are already. */
+static void
+bgp_attr_intern_sub (struct attr *attr)
 {
-  struct attr *find;
-
-  /* Intern referenced strucutre. */
   if (attr->aspath)
     {
       if (! attr->aspath->refcnt)
@@ -517,6 +539,16 @@ bgp_attr_intern (struct attr *attr)
             attre->transit->refcnt++;
         }
     }
+}
+
+/* Internet argument attribute. */
+struct attr *
+bgp_attr_intern (struct attr *attr)
+{
+  struct attr *find;
+
+  /* Intern referenced strucutre. */
+  bgp_attr_intern_sub (attr);
   
   find = (struct attr *) hash_get (attrhash, attr, bgp_attr_hash_alloc);
   find->refcnt++;
@@ -524,6 +556,19 @@ bgp_attr_intern (struct attr *attr)
   return find;
 }
 
+/* Another reference to ATTR, which is interned already.  The same as
+   bgp_attr_intern() on it, without hashing ATTR to find itself. */
+struct attr *
+bgp_attr_ref (struct attr *attr)
+{
+  assert (attr->refcnt);
+
+  bgp_attr_intern_sub (attr);
+  attr->refcnt++;
+
+  return attr;
+}
+
 
 /* Make network statement's attribute. */
 struct attr *
@@ -120,6 +120,7 @@ struct cluster_list
   unsigned long refcnt;
   int length;
   struct in_addr *list;
+  unsigned int key;		/* hash value, set when interned */
 };
 
 /* Unknown transit attribute. */
@@ -128,6 +129,7 @@ struct transit
   unsigned long refcnt;
   int length;
   u_char *val;
+  unsigned int key;		/* hash value, set when interned */
 };
 
 #define ATTR_FLAG_BIT(X)  (1 << ((X) - 1))
@@ -149,6 +151,7 @@ extern struct attr_extra *bgp_attr_extra_get (struct attr *);
 extern void bgp_attr_extra_free (struct attr *);
 extern void bgp_attr_dup (struct attr *, struct attr *);
 extern struct attr *bgp_attr_intern (struct attr *attr);
+extern struct attr *bgp_attr_ref (struct attr *);
 extern void bgp_attr_unintern_sub (struct attr *);
 extern void bgp_attr_unintern (struct attr **);
 extern void bgp_attr_flush (struct attr *);
@@ -309,6 +309,10 @@ community_intern (struct community *com)
   if (find != com)
     community_free (com);
 
+  /* Keep the hash value for attrhash_key_make().  */
+  if (! find->refcnt)
+    find->key = community_hash_make (find);
+
   /* Increment refrence counter.  */
   find->refcnt++;
 
@@ -36,6 +36,9 @@ struct community
   /* String of community attribute.  This sring is used by vty output
      and expanded community-list for regular expression match.  */
   char *str;
+
+  /* community_hash_make() value, set when interned.  */
+  unsigned int key;
 };
 
 /* Well-known communities value.  */
@@ -27,12 +27,18 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "prefix.h"
 #include "thread.h"
 #include "linklist.h"
+#include "memory.h"
+#include "workqueue.h"
 #include "bgpd/bgp_table.h"
 
 #include "bgpd/bgpd.h"
 #include "bgpd/bgp_route.h"
 #include "bgpd/bgp_attr.h"
 #include "bgpd/bgp_dump.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif /* HAVE_ZLIB */
 
 enum bgp_dump_type
 {
@@ -75,6 +81,63 @@ struct bgp_dump
   struct thread *t_interval;
 };
 
+/* Where a table dump goes, buffered and maybe compressed. */
+struct bgp_dump_writer
+{
+  FILE *fp;
+#ifdef HAVE_ZLIB
+  gzFile gz;
+#endif /* HAVE_ZLIB */
+  char *buf;
+
+  /* Bytes written, before compression. */
+  unsigned long bytes;
+
+  int error;
+};
+
+#define BGP_DUMP_BUFSIZ		(256 * 1024)
+
+/* A table dump under way. */
+struct bgp_dump_table
+{
+  struct bgp_dump_writer w;
+  char path[MAXPATHLEN];
+
+  /* The peers in the index table, locked. */
+  struct peer **peers;
+  unsigned int npeers;
+
+  /* The tables, locked, and the node to go on from. */
+  struct bgp_table *table[AFI_MAX];
+  afi_t afi;
+  struct bgp_node *rn;
+
+  unsigned int seq;
+  unsigned long total;
+  unsigned long nodes;
+  unsigned long prefixes;
+  unsigned long routes;
+  unsigned long runs;
+  struct timeval start;
+
+  int cancel;
+};
+
+/* How the last table dump went. */
+struct bgp_dump_stats
+{
+  char path[MAXPATHLEN];
+  const char *status;
+  unsigned long prefixes;
+  unsigned long routes;
+  unsigned long bytes;
+  unsigned long size;
+  unsigned long runs;
+  unsigned long usec;
+  time_t end;
+};
+
 /* BGP packet dump output buffer. */
 struct stream *bgp_dump_obuf;
 
@@ -87,19 +150,20 @@ struct bgp_dump bgp_dump_updates;
 /* BGP dump structure for 'dump bgp routes' */
 struct bgp_dump bgp_dump_routes;
 
-/* Dump whole BGP table is very heavy process.  */
-struct thread *t_bgp_dump_routes;
+/* Dump whole BGP table is very heavy process, so it is done a bit at a
+   time from a work queue.  */
+static struct work_queue *bgp_dump_routes_queue;
+static struct bgp_dump_table *bgp_dump_routes_job;
+static struct bgp_dump_stats bgp_dump_routes_last;
 
-/* Some define for BGP packet dump. */
-static FILE *
-bgp_dump_open_file (struct bgp_dump *bgp_dump)
+/* The file name for this round of the dump, with the time filled in. */
+static int
+bgp_dump_path (struct bgp_dump *bgp_dump, char *realpath)
 {
   int ret;
   time_t clock;
   struct tm *tm;
   char fullpath[MAXPATHLEN];
-  char realpath[MAXPATHLEN];
-  mode_t oldumask;
 
   time (&clock);
   tm = localtime (&clock);
@@ -115,8 +179,20 @@ bgp_dump_open_file (struct bgp_dump *bgp_dump)
   if (ret == 0)
     {
       zlog_warn ("bgp_dump_open_file: strftime error");
-      return NULL;
+      return -1;
     }
+  return 0;
+}
+
+/* Some define for BGP packet dump. */
+static FILE *
+bgp_dump_open_file (struct bgp_dump *bgp_dump)
+{
+  char realpath[MAXPATHLEN];
+  mode_t oldumask;
+
+  if (bgp_dump_path (bgp_dump, realpath) < 0)
+    return NULL;
 
   if (bgp_dump->fp)
     fclose (bgp_dump->fp);
@@ -192,8 +268,101 @@ bgp_dump_set_size (struct stream *s, int type)
   stream_putl_at (s, 8, stream_get_endp (s) - BGP_DUMP_HEADER_SIZE);
 }
 
+/* Open the writer for a table dump at PATH.  A name ending in ".gz"
+   is compressed on the way out, when bgpd is built with zlib. */
+static int
+bgp_dump_writer_open (struct bgp_dump_writer *w, const char *path)
+{
+  size_t len = strlen (path);
+  mode_t oldumask;
+
+  memset (w, 0, sizeof (struct bgp_dump_writer));
+
+  oldumask = umask(0777 & ~LOGFILE_MASK);
+  if (len > 3 && strcmp (path + len - 3, ".gz") == 0)
+    {
+#ifdef HAVE_ZLIB
+      w->gz = gzopen (path, "wb");
+      umask(oldumask);
+      if (w->gz == NULL)
+	{
+	  zlog_warn ("bgp_dump_writer_open: %s: %s", path, strerror (errno));
+	  return -1;
+	}
+#if ZLIB_VERNUM >= 0x1240
+      gzbuffer (w->gz, BGP_DUMP_BUFSIZ);
+#endif
+      return 0;
+#else
+      zlog_warn ("bgp_dump_writer_open: %s: no zlib, writing it uncompressed",
+		 path);
+#endif /* HAVE_ZLIB */
+    }
+
+  w->fp = fopen (path, "w");
+  umask(oldumask);
+  if (w->fp == NULL)
+    {
+      zlog_warn ("bgp_dump_writer_open: %s: %s", path, strerror (errno));
+      return -1;
+    }
+
+  /* Records go out in large writes rather than one or two each. */
+  w->buf = XMALLOC (MTYPE_BGP_DUMP_TABLE, BGP_DUMP_BUFSIZ);
+  setvbuf (w->fp, w->buf, _IOFBF, BGP_DUMP_BUFSIZ);
+  return 0;
+}
+
+static void
+bgp_dump_writer_write (struct bgp_dump_writer *w, struct stream *s)
+{
+  size_t len = stream_get_endp (s);
+
+  if (w->error)
+    return;
+
+#ifdef HAVE_ZLIB
+  if (w->gz)
+    {
+      if (gzwrite (w->gz, STREAM_DATA (s), len) != (int) len)
+	w->error = 1;
+    }
+  else
+#endif /* HAVE_ZLIB */
+  if (fwrite (STREAM_DATA (s), len, 1, w->fp) != 1)
+    w->error = 1;
+
+  if (w->error)
+    zlog_warn ("bgp_dump_writer_write: %s", strerror (errno));
+  else
+    w->bytes += len;
+}
+
+static int
+bgp_dump_writer_close (struct bgp_dump_writer *w)
+{
+#ifdef HAVE_ZLIB
+  if (w->gz)
+    {
+      if (gzclose (w->gz) != Z_OK)
+	w->error = 1;
+      w->gz = NULL;
+    }
+#endif /* HAVE_ZLIB */
+  if (w->fp)
+    {
+      if (fclose (w->fp) != 0)
+	w->error = 1;
+      w->fp = NULL;
+    }
+  if (w->buf)
+    XFREE (MTYPE_BGP_DUMP_TABLE, w->buf);
+
+  return w->error ? -1 : 0;
+}
+
 static void
-bgp_dump_routes_index_table(struct bgp *bgp)
+bgp_dump_routes_index_table (struct bgp *bgp, struct bgp_dump_table *dt)
 {
   struct peer *peer;
   struct listnode *node;
@@ -220,190 +389,318 @@ bgp_dump_routes_index_table(struct bgp *bgp)
       stream_putw(obuf, 0);
     }
 
+  /* The peers, and last our own announcements, which the routes from
+     them can point to: the dump keeps them until it is done. */
+  dt->peers = XCALLOC (MTYPE_BGP_DUMP_TABLE,
+		       (listcount (bgp->peer) + 1) * sizeof (struct peer *));
+  for (ALL_LIST_ELEMENTS_RO (bgp->peer, node, peer))
+    dt->peers[dt->npeers++] = peer_lock (peer);
+  dt->peers[dt->npeers++] = peer_lock (bgp->peer_self);
+
   /* Peer count */
-  stream_putw (obuf, listcount(bgp->peer));
+  stream_putw (obuf, dt->npeers);
 
   /* Walk down all peers */
-  for(ALL_LIST_ELEMENTS_RO (bgp->peer, node, peer))
+  for (peerno = 0; peerno < dt->npeers; peerno++)
     {
+      peer = dt->peers[peerno];
 
-      /* Peer's type */
-      if (sockunion_family(&peer->su) == AF_INET)
-        {
-          stream_putc (obuf, TABLE_DUMP_V2_PEER_INDEX_TABLE_AS4+TABLE_DUMP_V2_PEER_INDEX_TABLE_IP);
-        }
 #ifdef HAVE_IPV6
-      else if (sockunion_family(&peer->su) == AF_INET6)
+      if (sockunion_family(&peer->su) == AF_INET6)
         {
+          /* Peer's type */
           stream_putc (obuf, TABLE_DUMP_V2_PEER_INDEX_TABLE_AS4+TABLE_DUMP_V2_PEER_INDEX_TABLE_IP6);
-        }
-#endif /* HAVE_IPV6 */
 
-      /* Peer's BGP ID */
-      stream_put_in_addr (obuf, &peer->remote_id);
+          /* Peer's BGP ID */
+          stream_put_in_addr (obuf, &peer->remote_id);
 
-      /* Peer's IP address */
-      if (sockunion_family(&peer->su) == AF_INET)
-        {
-          stream_put_in_addr (obuf, &peer->su.sin.sin_addr);
-        }
-#ifdef HAVE_IPV6
-      else if (sockunion_family(&peer->su) == AF_INET6)
-        {
+          /* Peer's IP address */
           stream_write (obuf, (u_char *)&peer->su.sin6.sin6_addr,
                         IPV6_MAX_BYTELEN);
         }
+      else
 #endif /* HAVE_IPV6 */
+      if (peer == bgp->peer_self)
+        {
+          /* Ourselves, with no address of our own */
+          stream_putc (obuf, TABLE_DUMP_V2_PEER_INDEX_TABLE_AS4+TABLE_DUMP_V2_PEER_INDEX_TABLE_IP);
+          stream_put_in_addr (obuf, &bgp->router_id);
+          stream_putl (obuf, 0);
+        }
+      else
+        {
+          /* Peer's type */
+          stream_putc (obuf, TABLE_DUMP_V2_PEER_INDEX_TABLE_AS4+TABLE_DUMP_V2_PEER_INDEX_TABLE_IP);
+
+          /* Peer's BGP ID */
+          stream_put_in_addr (obuf, &peer->remote_id);
+
+          /* Peer's IP address */
+          stream_put_in_addr (obuf, &peer->su.sin.sin_addr);
+        }
 
       /* Peer's AS number. */
       /* Note that, as this is an AS4 compliant quagga, the RIB is always AS4 */
-      stream_putl (obuf, peer->as);
+      stream_putl (obuf, peer == bgp->peer_self ? bgp->as : peer->as);
 
       /* Store the peer number for this peer */
       peer->table_dump_index = peerno;
-      peerno++;
     }
 
   bgp_dump_set_size(obuf, MSG_TABLE_DUMP_V2);
 
-  fwrite (STREAM_DATA (obuf), stream_get_endp (obuf), 1, bgp_dump_routes.fp);
-  fflush (bgp_dump_routes.fp);
+  bgp_dump_writer_write (&dt->w, obuf);
 }
 
+/* Whether the route is from a peer in the dump's index table, rather
+   than from one which came up since. */
+static int
+bgp_dump_routes_indexed (struct bgp_dump_table *dt, struct bgp_info *info)
+{
+  return (info->peer->table_dump_index < dt->npeers
+	  && dt->peers[info->peer->table_dump_index] == info->peer);
+}
 
-/* Runs under child process. */
-static unsigned int
-bgp_dump_routes_func (int afi, int first_run, unsigned int seq)
+/* Dump the routes to one prefix. */
+static void
+bgp_dump_routes_node (struct bgp_dump_table *dt, struct bgp_node *rn)
 {
   struct stream *obuf;
   struct bgp_info *info;
-  struct bgp_node *rn;
-  struct bgp *bgp;
-  struct bgp_table *table;
-
-  bgp = bgp_get_default ();
-  if (!bgp)
-    return seq;
-
-  if (bgp_dump_routes.fp == NULL)
-    return seq;
-
-  /* Note that bgp_dump_routes_index_table will do ipv4 and ipv6 peers,
-     so this should only be done on the first call to bgp_dump_routes_func.
-     ( this function will be called once for ipv4 and once for ipv6 ) */
-  if(first_run)
-    bgp_dump_routes_index_table(bgp);
+  afi_t afi = dt->afi;
 
   obuf = bgp_dump_obuf;
   stream_reset(obuf);
 
-  /* Walk down each BGP route. */
-  table = bgp->rib[afi][SAFI_UNICAST];
-
-  for (rn = bgp_table_top (table); rn; rn = bgp_route_next (rn))
+  /* MRT header */
+  if (afi == AFI_IP)
     {
-      if(!rn->info)
-        continue;
-
-      stream_reset(obuf);
-
-      /* MRT header */
-      if (afi == AFI_IP)
-        {
-          bgp_dump_header (obuf, MSG_TABLE_DUMP_V2, TABLE_DUMP_V2_RIB_IPV4_UNICAST);
-        }
+      bgp_dump_header (obuf, MSG_TABLE_DUMP_V2, TABLE_DUMP_V2_RIB_IPV4_UNICAST);
+    }
 #ifdef HAVE_IPV6
-      else if (afi == AFI_IP6)
-        {
-          bgp_dump_header (obuf, MSG_TABLE_DUMP_V2, TABLE_DUMP_V2_RIB_IPV6_UNICAST);
-        }
+  else if (afi == AFI_IP6)
+    {
+      bgp_dump_header (obuf, MSG_TABLE_DUMP_V2, TABLE_DUMP_V2_RIB_IPV6_UNICAST);
+    }
 #endif /* HAVE_IPV6 */
 
-      /* Sequence number */
-      stream_putl(obuf, seq);
+  /* Sequence number */
+  stream_putl(obuf, dt->seq);
 
-      /* Prefix length */
-      stream_putc (obuf, rn->p.prefixlen);
+  /* Prefix length */
+  stream_putc (obuf, rn->p.prefixlen);
 
-      /* Prefix */
-      if (afi == AFI_IP)
-        {
-          /* We'll dump only the useful bits (those not 0), but have to align on 8 bits */
-          stream_write(obuf, (u_char *)&rn->p.u.prefix4, (rn->p.prefixlen+7)/8);
-        }
+  /* Prefix */
+  if (afi == AFI_IP)
+    {
+      /* We'll dump only the useful bits (those not 0), but have to align on 8 bits */
+      stream_write(obuf, (u_char *)&rn->p.u.prefix4, (rn->p.prefixlen+7)/8);
+    }
 #ifdef HAVE_IPV6
-      else if (afi == AFI_IP6)
-        {
-          /* We'll dump only the useful bits (those not 0), but have to align on 8 bits */
-          stream_write (obuf, (u_char *)&rn->p.u.prefix6, (rn->p.prefixlen+7)/8);
-        }
+  else if (afi == AFI_IP6)
+    {
+      /* We'll dump only the useful bits (those not 0), but have to align on 8 bits */
+      stream_write (obuf, (u_char *)&rn->p.u.prefix6, (rn->p.prefixlen+7)/8);
+    }
 #endif /* HAVE_IPV6 */
 
-      /* Save where we are now, so we can overwride the entry count later */
-      int sizep = stream_get_endp(obuf);
+  /* Save where we are now, so we can overwride the entry count later */
+  int sizep = stream_get_endp(obuf);
 
-      /* Entry count */
-      uint16_t entry_count = 0;
+  /* Entry count */
+  uint16_t entry_count = 0;
 
-      /* Entry count, note that this is overwritten later */
-      stream_putw(obuf, 0);
+  /* Entry count, note that this is overwritten later */
+  stream_putw(obuf, 0);
 
-      for (info = rn->info; info; info = info->next)
-        {
-          entry_count++;
+  for (info = rn->info; info; info = info->next)
+    {
+      if (! bgp_dump_routes_indexed (dt, info))
+        continue;
+
+      entry_count++;
 
-          /* Peer index */
-          stream_putw(obuf, info->peer->table_dump_index);
+      /* Peer index */
+      stream_putw(obuf, info->peer->table_dump_index);
 
-          /* Originated */
+      /* Originated */
 #ifdef HAVE_CLOCK_MONOTONIC
-          stream_putl (obuf, time(NULL) - (bgp_clock() - info->uptime));
+      stream_putl (obuf, time(NULL) - (bgp_clock() - info->uptime));
 #else
-          stream_putl (obuf, info->uptime);
+      stream_putl (obuf, info->uptime);
 #endif /* HAVE_CLOCK_MONOTONIC */
 
-          /* Dump attribute. */
-          /* Skip prefix & AFI/SAFI for MP_NLRI */
-          bgp_dump_routes_attr (obuf, info->attr, &rn->p);
-        }
+      /* Dump attribute. */
+      /* Skip prefix & AFI/SAFI for MP_NLRI */
+      bgp_dump_routes_attr (obuf, info->attr, &rn->p);
+    }
+
+  if (entry_count == 0)
+    return;
+
+  /* Overwrite the entry count, now that we know the right number */
+  stream_putw_at (obuf, sizep, entry_count);
+
+  dt->seq++;
+  dt->prefixes++;
+  dt->routes += entry_count;
+
+  bgp_dump_set_size(obuf, MSG_TABLE_DUMP_V2);
+  bgp_dump_writer_write (&dt->w, obuf);
+}
+
+/* Dump the tables a slice at a time, between which bgpd gets on with
+   its peers.  The node to go on from stays locked meanwhile, so that
+   the walk can carry on from it whatever was added or removed. */
+static wq_item_status
+bgp_dump_routes_batch (struct work_queue *wq, void *data)
+{
+  struct bgp_dump_table *dt = data;
+
+  dt->runs++;
+  while (! dt->cancel && ! dt->w.error)
+    {
+      if (dt->rn == NULL)
+	{
+	  do
+	    dt->afi++;
+	  while (dt->afi < AFI_MAX && dt->table[dt->afi] == NULL);
+
+	  if (dt->afi == AFI_MAX)
+	    break;
+	  dt->rn = bgp_table_top (dt->table[dt->afi]);
+	  continue;
+	}
+
+      if (dt->rn->info)
+	bgp_dump_routes_node (dt, dt->rn);
+      dt->rn = bgp_route_next (dt->rn);
+      dt->nodes++;
 
-      /* Overwrite the entry count, now that we know the right number */
-      stream_putw_at (obuf, sizep, entry_count);
+      if (work_queue_should_yield (wq))
+	return WQ_QUEUE_BLOCKED;
+    }
+
+  return WQ_SUCCESS;
+}
+
+/* The dump is done, cancelled or failed: close the file, tell how it
+   went and let go of the table. */
+static void
+bgp_dump_routes_del (struct work_queue *wq, void *data)
+{
+  struct bgp_dump_table *dt = data;
+  struct bgp_dump_stats *last = &bgp_dump_routes_last;
+  struct timeval now;
+  struct stat st;
+  unsigned int i;
+
+  if (dt->rn)
+    bgp_unlock_node (dt->rn);
+  for (i = 0; i < AFI_MAX; i++)
+    if (dt->table[i])
+      bgp_table_unlock (dt->table[i]);
+  for (i = 0; i < dt->npeers; i++)
+    peer_unlock (dt->peers[i]);
+  if (dt->peers)
+    XFREE (MTYPE_BGP_DUMP_TABLE, dt->peers);
+
+  if (bgp_dump_writer_close (&dt->w) < 0)
+    zlog_warn ("MRT table dump to %s: write failed", dt->path);
+
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, &now);
+  memset (last, 0, sizeof (struct bgp_dump_stats));
+  strcpy (last->path, dt->path);
+  last->status = dt->cancel ? "cancelled"
+		 : dt->w.error ? "failed" : "completed";
+  last->prefixes = dt->prefixes;
+  last->routes = dt->routes;
+  last->bytes = dt->w.bytes;
+  if (stat (dt->path, &st) == 0)
+    last->size = st.st_size;
+  last->runs = dt->runs;
+  last->usec = (now.tv_sec - dt->start.tv_sec) * 1000000
+	       + (now.tv_usec - dt->start.tv_usec);
+  last->end = time (NULL);
+
+  zlog_info ("MRT table dump to %s %s: %lu prefixes, %lu routes, "
+	     "%lu bytes in %lu.%03lu s over %lu runs", last->path,
+	     last->status, last->prefixes, last->routes, last->size,
+	     last->usec / 1000000, last->usec / 1000 % 1000, last->runs);
+
+  if (bgp_dump_routes_job == dt)
+    bgp_dump_routes_job = NULL;
+  XFREE (MTYPE_BGP_DUMP_TABLE, dt);
+}
+
+/* Start dumping the default instance's unicast tables to PATH. */
+static void
+bgp_dump_routes_start (const char *path)
+{
+  struct bgp_dump_table *dt;
+  struct bgp *bgp;
+  afi_t afi;
+
+  bgp = bgp_get_default ();
+  if (!bgp)
+    return;
 
-      seq++;
+  if (bgp_dump_routes_job)
+    {
+      zlog_warn ("MRT table dump to %s still running, skipping %s",
+		 bgp_dump_routes_job->path, path);
+      return;
+    }
+
+  dt = XCALLOC (MTYPE_BGP_DUMP_TABLE, sizeof (struct bgp_dump_table));
+  if (bgp_dump_writer_open (&dt->w, path) < 0)
+    {
+      XFREE (MTYPE_BGP_DUMP_TABLE, dt);
+      return;
+    }
+  strcpy (dt->path, path);
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, &dt->start);
 
-      bgp_dump_set_size(obuf, MSG_TABLE_DUMP_V2);
-      fwrite (STREAM_DATA (obuf), stream_get_endp (obuf), 1, bgp_dump_routes.fp);
+  /* The index table is written first, for all the tables. */
+  bgp_dump_routes_index_table (bgp, dt);
 
+  for (afi = AFI_IP; afi < AFI_MAX; afi++)
+    {
+#ifndef HAVE_IPV6
+      if (afi == AFI_IP6)
+	continue;
+#endif /* HAVE_IPV6 */
+      dt->table[afi] = bgp->rib[afi][SAFI_UNICAST];
+      bgp_table_lock (dt->table[afi]);
+      dt->total += bgp_table_count (dt->table[afi]);
     }
 
-  fflush (bgp_dump_routes.fp);
+  zlog_info ("MRT table dump to %s started, %lu table nodes", path,
+	     dt->total);
 
-  return seq;
+  bgp_dump_routes_job = dt;
+  work_queue_add (bgp_dump_routes_queue, dt);
 }
 
 static int
 bgp_dump_interval_func (struct thread *t)
 {
   struct bgp_dump *bgp_dump;
+  char path[MAXPATHLEN];
+
   bgp_dump = THREAD_ARG (t);
   bgp_dump->t_interval = NULL;
 
-  /* Reschedule dump even if file couldn't be opened this time... */
-  if (bgp_dump_open_file (bgp_dump) != NULL)
+  /* In case of bgp_dump_routes, the tables are dumped in the
+   * background, to a file of the dump's own. */
+  if (bgp_dump->type == BGP_DUMP_ROUTES)
     {
-      /* In case of bgp_dump_routes, we need special route dump function. */
-      if (bgp_dump->type == BGP_DUMP_ROUTES)
-	{
-	  unsigned int seq = bgp_dump_routes_func (AFI_IP, 1, 0);
-#ifdef HAVE_IPV6
-	  bgp_dump_routes_func (AFI_IP6, 0, seq);
-#endif /* HAVE_IPV6 */
-	  /* Close the file now. For a RIB dump there's no point in leaving
-	   * it open until the next scheduled dump starts. */
-	  fclose(bgp_dump->fp); bgp_dump->fp = NULL;
-	}
+      if (bgp_dump_path (bgp_dump, path) == 0)
+	bgp_dump_routes_start (path);
     }
+  else
+    /* Reschedule dump even if file couldn't be opened this time... */
+    bgp_dump_open_file (bgp_dump);
 
   /* if interval is set reschedule */
   if (bgp_dump->interval > 0)
@@ -632,8 +929,10 @@ bgp_dump_set (struct vty *vty, struct bgp_dump *bgp_dump,
     free (bgp_dump->filename);
   bgp_dump->filename = strdup (path);
 
-  /* This should be called when interval is expired. */
-  bgp_dump_open_file (bgp_dump);
+  /* This should be called when interval is expired.  A table dump
+     opens its file when it starts. */
+  if (type != BGP_DUMP_ROUTES)
+    bgp_dump_open_file (bgp_dump);
 
   return CMD_SUCCESS;
 }
@@ -669,7 +968,13 @@ bgp_dump_unset (struct vty *vty, struct bgp_dump *bgp_dump)
       free (bgp_dump->interval_str);
       bgp_dump->interval_str = NULL;
     }
-  
+
+  /* A table dump under way is given up at its next slice. */
+  if (bgp_dump == &bgp_dump_routes && bgp_dump_routes_job)
+    {
+      bgp_dump_routes_job->cancel = 1;
+      bgp_dump_routes_job = NULL;
+    }
 
   return CMD_SUCCESS;
 }
@@ -776,6 +1081,57 @@ DEFUN (no_dump_bgp_routes,
   return bgp_dump_unset (vty, &bgp_dump_routes);
 }
 
+DEFUN (show_ip_bgp_dump,
+       show_ip_bgp_dump_cmd,
+       "show ip bgp dump",
+       SHOW_STR
+       IP_STR
+       BGP_STR
+       "MRT table dump progress\n")
+{
+  struct bgp_dump_table *dt = bgp_dump_routes_job;
+  struct bgp_dump_stats *last = &bgp_dump_routes_last;
+  struct timeval now;
+  unsigned long usec;
+  char timebuf[32];
+
+  if (dt)
+    {
+      quagga_gettime (QUAGGA_CLK_MONOTONIC, &now);
+      usec = (now.tv_sec - dt->start.tv_sec) * 1000000
+	     + (now.tv_usec - dt->start.tv_usec);
+      vty_out (vty, "Table dump to %s running for %lu.%03lu s%s", dt->path,
+	       usec / 1000000, usec / 1000 % 1000, VTY_NEWLINE);
+      vty_out (vty, "  %lu of %lu table nodes (%.1f%%), %lu prefixes, "
+	       "%lu routes, %lu bytes, %lu runs%s", dt->nodes, dt->total,
+	       dt->total ? 100.0 * dt->nodes / dt->total : 100.0,
+	       dt->prefixes, dt->routes, dt->w.bytes, dt->runs, VTY_NEWLINE);
+    }
+
+  if (last->status)
+    {
+      strftime (timebuf, sizeof (timebuf), "%Y/%m/%d %H:%M:%S",
+		localtime (&last->end));
+      vty_out (vty, "Last table dump to %s %s at %s%s", last->path,
+	       last->status, timebuf, VTY_NEWLINE);
+      vty_out (vty, "  %lu prefixes, %lu routes, %lu bytes (%lu on disk) "
+	       "in %lu.%03lu s over %lu runs%s", last->prefixes, last->routes,
+	       last->bytes, last->size, last->usec / 1000000,
+	       last->usec / 1000 % 1000, last->runs, VTY_NEWLINE);
+    }
+  else if (! dt)
+    vty_out (vty, "No table dump yet%s", VTY_NEWLINE);
+
+  return CMD_SUCCESS;
+}
+
+ALIAS (show_ip_bgp_dump,
+       show_bgp_dump_cmd,
+       "show bgp dump",
+       SHOW_STR
+       BGP_STR
+       "MRT table dump progress\n")
+
 /* BGP node structure. */
 static struct cmd_node bgp_dump_node =
 {
@@ -868,11 +1224,35 @@ bgp_dump_init (void)
   install_element (CONFIG_NODE, &dump_bgp_routes_cmd);
   install_element (CONFIG_NODE, &dump_bgp_routes_interval_cmd);
   install_element (CONFIG_NODE, &no_dump_bgp_routes_cmd);
+  install_element (VIEW_NODE, &show_ip_bgp_dump_cmd);
+  install_element (VIEW_NODE, &show_bgp_dump_cmd);
+  install_element (ENABLE_NODE, &show_ip_bgp_dump_cmd);
+  install_element (ENABLE_NODE, &show_bgp_dump_cmd);
+
+  bgp_dump_routes_queue = work_queue_new (master, "bgp_dump_routes_queue");
+  if (bgp_dump_routes_queue == NULL)
+    {
+      zlog_err ("%s: Failed to allocate work queue", __func__);
+      exit (1);
+    }
+  bgp_dump_routes_queue->spec.workfunc = &bgp_dump_routes_batch;
+  bgp_dump_routes_queue->spec.del_item_data = &bgp_dump_routes_del;
+  bgp_dump_routes_queue->spec.max_retries = 0;
+  bgp_dump_routes_queue->spec.hold = 0;
 }
 
 void
 bgp_dump_finish (void)
 {
+  struct work_queue_item *item;
+  struct listnode *node;
+
+  /* Freeing the queue leaves its items' data alone. */
+  for (ALL_LIST_ELEMENTS_RO (bgp_dump_routes_queue->items, node, item))
+    bgp_dump_routes_del (bgp_dump_routes_queue, item->data);
+  work_queue_free (bgp_dump_routes_queue);
+  bgp_dump_routes_queue = NULL;
+
   stream_free (bgp_dump_obuf);
   bgp_dump_obuf = NULL;
 }
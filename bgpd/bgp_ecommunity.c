@@ -200,6 +200,8 @@ ecommunity_intern (struct ecommunity *ecom)
   if (find != ecom)
     ecommunity_free (&ecom);
 
+  if (! find->refcnt)
+    find->key = ecommunity_hash_make (find);
   find->refcnt++;
 
   if (! find->str)
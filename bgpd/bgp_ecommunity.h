@@ -55,6 +55,9 @@ struct ecommunity
 
   /* Human readable format string.  */
   char *str;
+
+  /* ecommunity_hash_make() value, set when interned.  */
+  unsigned int key;
 };
 
 /* Extended community value is eight octet.  */
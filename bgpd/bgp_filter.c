@@ -63,6 +63,9 @@ struct as_filter
 
   regex_t *reg;
   char *reg_str;
+
+  /* Used instead of reg where the pattern compiles to a DFA. */
+  struct aspath_dfa *dfa;
 };
 
 enum as_list_type
@@ -83,7 +86,32 @@ struct as_list
 
   struct as_filter *head;
   struct as_filter *tail;
+
+  /* as_list_apply() answers from the cache and from the filters. */
+  unsigned long cache_hit;
+  unsigned long cache_miss;
 };
+
+/* Verdicts of the as-lists last applied to an interned AS path.  An
+   interned path never changes, and the cache goes away with it, so
+   only as-list edits need to invalidate entries: each edit moves
+   as_list_gen on and entries from an older generation are ignored. */
+#define AS_LIST_CACHE_SLOTS	4
+
+struct as_list_cache
+{
+  struct
+  {
+    struct as_list *aslist;
+    u_int32_t gen;
+    enum as_filter_type type;
+  } slot[AS_LIST_CACHE_SLOTS];
+
+  /* Slot to fill next. */
+  unsigned int next;
+};
+
+static u_int32_t as_list_gen;
 
 /* ip as-path access-list 10 permit AS1. */
 
@@ -108,6 +136,8 @@ as_filter_free (struct as_filter *asfilter)
 {
   if (asfilter->reg)
     bgp_regex_free (asfilter->reg);
+  if (asfilter->dfa)
+    bgp_regex_dfa_free (asfilter->dfa);
   if (asfilter->reg_str)
     XFREE (MTYPE_AS_FILTER_STR, asfilter->reg_str);
   XFREE (MTYPE_AS_FILTER, asfilter);
@@ -121,6 +151,7 @@ as_filter_make (regex_t *reg, const char *reg_str, enum as_filter_type type)
 
   asfilter = as_filter_new ();
   asfilter->reg = reg;
+  asfilter->dfa = bgp_regcomp_dfa (reg_str);
   asfilter->type = type;
   asfilter->reg_str = XSTRDUP (MTYPE_AS_FILTER_STR, reg_str);
 
@@ -150,6 +181,8 @@ as_list_filter_add (struct as_list *aslist, struct as_filter *asfilter)
   else
     aslist->head = asfilter;
   aslist->tail = asfilter;
+
+  as_list_gen++;
 }
 
 /* Lookup as_list from list of as_list by name. */
@@ -336,6 +369,7 @@ as_list_delete (struct as_list *aslist)
     list->head = aslist->next;
 
   as_list_free (aslist);
+  as_list_gen++;
 }
 
 static int
@@ -361,6 +395,7 @@ as_list_filter_delete (struct as_list *aslist, struct as_filter *asfilter)
     aslist->head = asfilter->next;
 
   as_filter_free (asfilter);
+  as_list_gen++;
 
   /* If access_list becomes empty delete it from access_master. */
   if (as_list_empty (aslist))
@@ -374,6 +409,8 @@ as_list_filter_delete (struct as_list *aslist, struct as_filter *asfilter)
 static int
 as_filter_match (struct as_filter *asfilter, struct aspath *aspath)
 {
+  if (asfilter->dfa)
+    return bgp_regexec_dfa (asfilter->dfa, aspath) != REG_NOMATCH;
   if (bgp_regexec (asfilter->reg, aspath) != REG_NOMATCH)
     return 1;
   return 0;
@@ -385,18 +422,49 @@ as_list_apply (struct as_list *aslist, void *object)
 {
   struct as_filter *asfilter;
   struct aspath *aspath;
+  struct as_list_cache *cache;
+  enum as_filter_type type;
+  unsigned int i;
 
   aspath = (struct aspath *) object;
 
   if (aslist == NULL)
     return AS_FILTER_DENY;
 
+  /* Paths not interned yet may still be changed. */
+  cache = aspath->refcnt ? aspath->filter : NULL;
+  if (cache)
+    for (i = 0; i < AS_LIST_CACHE_SLOTS; i++)
+      if (cache->slot[i].aslist == aslist
+	  && cache->slot[i].gen == as_list_gen)
+	{
+	  aslist->cache_hit++;
+	  return cache->slot[i].type;
+	}
+  aslist->cache_miss++;
+
+  type = AS_FILTER_DENY;
   for (asfilter = aslist->head; asfilter; asfilter = asfilter->next)
     {
       if (as_filter_match (asfilter, aspath))
-	return asfilter->type;
+	{
+	  type = asfilter->type;
+	  break;
+	}
     }
-  return AS_FILTER_DENY;
+
+  if (aspath->refcnt)
+    {
+      if (! aspath->filter)
+	aspath->filter = XCALLOC (MTYPE_AS_LIST_CACHE,
+				  sizeof (struct as_list_cache));
+      cache = aspath->filter;
+      i = cache->next++ % AS_LIST_CACHE_SLOTS;
+      cache->slot[i].aslist = aslist;
+      cache->slot[i].gen = as_list_gen;
+      cache->slot[i].type = type;
+    }
+  return type;
 }
 
 /* Add hook function. */
@@ -581,6 +649,7 @@ static void
 as_list_show (struct vty *vty, struct as_list *aslist)
 {
   struct as_filter *asfilter;
+  unsigned long total = aslist->cache_hit + aslist->cache_miss;
 
   vty_out (vty, "AS path access list %s%s", aslist->name, VTY_NEWLINE);
 
@@ -589,35 +658,23 @@ as_list_show (struct vty *vty, struct as_list *aslist)
       vty_out (vty, "    %s %s%s", filter_type_str (asfilter->type),
 	       asfilter->reg_str, VTY_NEWLINE);
     }
+
+  if (total)
+    vty_out (vty, "    %lu lookups, %lu from cache (%.1f%%)%s", total,
+	     aslist->cache_hit, 100.0 * aslist->cache_hit / total,
+	     VTY_NEWLINE);
 }
 
 static void
 as_list_show_all (struct vty *vty)
 {
   struct as_list *aslist;
-  struct as_filter *asfilter;
 
   for (aslist = as_list_master.num.head; aslist; aslist = aslist->next)
-    {
-      vty_out (vty, "AS path access list %s%s", aslist->name, VTY_NEWLINE);
-
-      for (asfilter = aslist->head; asfilter; asfilter = asfilter->next)
-	{
-	  vty_out (vty, "    %s %s%s", filter_type_str (asfilter->type),
-		   asfilter->reg_str, VTY_NEWLINE);
-	}
-    }
+    as_list_show (vty, aslist);
 
   for (aslist = as_list_master.str.head; aslist; aslist = aslist->next)
-    {
-      vty_out (vty, "AS path access list %s%s", aslist->name, VTY_NEWLINE);
-
-      for (asfilter = aslist->head; asfilter; asfilter = asfilter->next)
-	{
-	  vty_out (vty, "    %s %s%s", filter_type_str (asfilter->type),
-		   asfilter->reg_str, VTY_NEWLINE);
-	}
-    }
+    as_list_show (vty, aslist);
 }
 
 DEFUN (show_ip_as_path_access_list,
@@ -40,6 +40,7 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "bgpd/bgp_route.h"
 #include "bgpd/bgp_dump.h"
 #include "bgpd/bgp_open.h"
+#include "bgpd/bgp_updgrp.h"
 #ifdef HAVE_SNMP
 #include "bgpd/bgp_snmp.h"
 #endif /* HAVE_SNMP */
@@ -438,6 +439,9 @@ bgp_stop (struct peer *peer)
   safi_t safi;
   char orf_name[BUFSIZ];
 
+  /* Input left over from the last read is of no use any more. */
+  BGP_TIMER_OFF (peer->t_process_packet);
+
   /* Can't do this in Clearing; events are used for state transitions */
   if (peer->status != Clearing)
     {
@@ -508,16 +512,13 @@ bgp_stop (struct peer *peer)
   BGP_TIMER_OFF (peer->t_asorig);
   BGP_TIMER_OFF (peer->t_routeadv);
 
-  /* Stream reset. */
-  peer->packet_size = 0;
-
   /* Clear input and output buffer.  */
   if (peer->ibuf)
     stream_reset (peer->ibuf);
-  if (peer->work)
-    stream_reset (peer->work);
+  if (peer->ibuf_work)
+    stream_reset (peer->ibuf_work);
   if (peer->obuf)
-    stream_fifo_clean (peer->obuf);
+    bgp_packet_clean (peer);
 
   /* Close of file descriptor. */
   if (peer->fd >= 0)
@@ -548,6 +549,9 @@ bgp_stop (struct peer *peer)
         prefix_bgp_orf_remove_all (orf_name);
       }
 
+  /* Negotiated state is gone, so is the update group membership. */
+  bgp_updgrp_peer_leave (peer);
+
   /* Reset keepalive and holdtime */
   if (CHECK_FLAG (peer->config, PEER_CONFIG_TIMER))
     {
@@ -791,6 +795,7 @@ bgp_establish (struct peer *peer)
   /* Increment established count. */
   peer->established++;
   bgp_fsm_change_status (peer, Established);
+  bgp_updgrp_invalidate ();
 
   /* bgp log-neighbor-changes of neighbor Up */
   if (bgp_flag_check (peer->bgp, BGP_FLAG_LOG_NEIGHBOR_CHANGES))
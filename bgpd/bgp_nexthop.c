@@ -28,6 +28,10 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "network.h"
 #include "log.h"
 #include "memory.h"
+#include "hash.h"
+#include "jhash.h"
+#include "linklist.h"
+#include "buffer.h"
 
 #include "bgpd/bgpd.h"
 #include "bgpd/bgp_table.h"
@@ -36,17 +40,17 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "bgpd/bgp_nexthop.h"
 #include "bgpd/bgp_debug.h"
 #include "bgpd/bgp_damp.h"
+#include "bgpd/bgp_updgrp.h"
 #include "zebra/rib.h"
 #include "zebra/zserv.h"	/* For ZEBRA_SERV_PATH. */
 
-struct bgp_nexthop_cache *zlookup_query (struct in_addr);
-#ifdef HAVE_IPV6
-struct bgp_nexthop_cache *zlookup_query_ipv6 (struct in6_addr *);
-#endif /* HAVE_IPV6 */
-
 /* Only one BGP scan thread are activated at the same time. */
 static struct thread *bgp_scan_thread = NULL;
 
+/* Nexthop registration and connected route re-check events. */
+static struct thread *bgp_nexthop_register_thread = NULL;
+static struct thread *bgp_connected_scan_thread = NULL;
+
 /* BGP import thread */
 static struct thread *bgp_import_thread = NULL;
 
@@ -58,14 +62,15 @@ static int bgp_import_interval;
 
 /* Route table for next-hop lookup cache. */
 static struct bgp_table *bgp_nexthop_cache_table[AFI_MAX];
-static struct bgp_table *cache1_table[AFI_MAX];
-static struct bgp_table *cache2_table[AFI_MAX];
 
 /* Route table for connected route. */
 static struct bgp_table *bgp_connected_table[AFI_MAX];
 
 /* BGP nexthop lookup query client. */
 struct zclient *zlookup = NULL;
+
+/* Connection to zebra nexthops are registered on, see bgp_zebra.c. */
+extern struct zclient *zclient;
 
 /* Add nexthop to the end of the list.  */
 static void
@@ -212,183 +217,402 @@ bgp_nexthop_check_ebgp (afi_t afi, struct attr *attr)
   return 0;
 }
 
-#ifdef HAVE_IPV6
-/* Check specified next-hop is reachable or not. */
-static int
-bgp_nexthop_lookup_ipv6 (struct peer *peer, struct bgp_info *ri, int *changed,
-			 int *metricchanged)
+/* Nexthop tracking.  Every address used as the nexthop of an IBGP or
+   multihop EBGP path has a bgp_nexthop_cache entry, registered with
+   zebra, which sends ZEBRA_NEXTHOP_UPDATE whenever the route resolving
+   the address changes.  The entry keeps the paths depending on it, so
+   an IGP change only re-evaluates those paths. */
+
+/* Make the validity of RI follow BNC. */
+static void
+bnc_path_link (struct bgp_nexthop_cache *bnc, struct bgp_info *ri)
 {
-  struct bgp_node *rn;
-  struct prefix p;
+  struct bgp_info_extra *extra;
+
+  extra = bgp_info_extra_get (ri);
+  if (extra->bnc == bnc)
+    return;
+  if (extra->bnc)
+    bgp_nexthop_path_unlink (ri);
+
+  extra->bnc = bnc;
+  extra->bnc_prev = NULL;
+  extra->bnc_next = bnc->path;
+  if (bnc->path)
+    bnc->path->extra->bnc_prev = ri;
+  bnc->path = ri;
+  bnc->path_count++;
+}
+
+/* Stop tracking the nexthop of RI.  The cache entry stays until the
+   next scan, so a flapping path does not re-register its nexthop. */
+void
+bgp_nexthop_path_unlink (struct bgp_info *ri)
+{
+  struct bgp_info_extra *extra = ri->extra;
   struct bgp_nexthop_cache *bnc;
-  struct attr *attr;
 
-  /* If lookup is not enabled, return valid. */
-  if (zlookup->sock < 0)
+  if (! extra || ! (bnc = extra->bnc))
+    return;
+
+  if (extra->bnc_next)
+    extra->bnc_next->extra->bnc_prev = extra->bnc_prev;
+  if (extra->bnc_prev)
+    extra->bnc_prev->extra->bnc_next = extra->bnc_next;
+  else
+    bnc->path = extra->bnc_next;
+
+  extra->bnc = NULL;
+  extra->bnc_next = extra->bnc_prev = NULL;
+  bnc->path_count--;
+}
+
+/* Append the address of RN to the (un)registration message being built
+   in the zclient output buffer, sending the message first if full. */
+static void
+bnc_msg_add (int command, struct bgp_node *rn, int *count)
+{
+  struct stream *s = zclient->obuf;
+
+  if (*count && STREAM_WRITEABLE (s) < 1 + IPV6_MAX_BYTELEN)
+    {
+      stream_putw_at (s, 0, stream_get_endp (s));
+      zclient_send_message (zclient);
+      *count = 0;
+    }
+  if (*count == 0)
     {
-      if (ri->extra)
-        ri->extra->igpmetric = 0;
-      return 1;
+      stream_reset (s);
+      zclient_create_header (s, command);
     }
+  stream_putc (s, rn->p.family);
+  stream_put (s, &rn->p.u.prefix, PSIZE (rn->p.prefixlen));
+  (*count)++;
+}
+
+static void
+bnc_msg_flush (int *count)
+{
+  struct stream *s = zclient->obuf;
 
-  /* Only check IPv6 global address only nexthop. */
-  attr = ri->attr;
+  if (! *count)
+    return;
+  stream_putw_at (s, 0, stream_get_endp (s));
+  zclient_send_message (zclient);
+  *count = 0;
+}
 
-  if (attr->extra->mp_nexthop_len != 16 
-      || IN6_IS_ADDR_LINKLOCAL (&attr->extra->mp_nexthop_global))
-    return 1;
+/* Register every cache entry zebra has not heard about on the current
+   connection.  Run as an event so that a table load registers its
+   nexthops in a few messages. */
+static int
+bgp_nexthop_register (struct thread *t)
+{
+  struct bgp_node *rn;
+  struct bgp_nexthop_cache *bnc;
+  afi_t afi;
+  int count = 0;
 
-  memset (&p, 0, sizeof (struct prefix));
-  p.family = AF_INET6;
-  p.prefixlen = IPV6_MAX_BITLEN;
-  p.u.prefix6 = attr->extra->mp_nexthop_global;
+  bgp_nexthop_register_thread = NULL;
 
-  /* IBGP or ebgp-multihop */
-  rn = bgp_node_get (bgp_nexthop_cache_table[AFI_IP6], &p);
+  if (! zclient || zclient->sock < 0)
+    return 0;
 
-  if (rn->info)
+  for (afi = AFI_IP; afi < AFI_MAX; afi++)
     {
-      bnc = rn->info;
-      bgp_unlock_node (rn);
+      if (! bgp_nexthop_cache_table[afi])
+	continue;
+
+      for (rn = bgp_table_top (bgp_nexthop_cache_table[afi]); rn;
+	   rn = bgp_route_next (rn))
+	if ((bnc = rn->info) != NULL && ! bnc->registered)
+	  {
+	    bnc_msg_add (ZEBRA_NEXTHOP_REGISTER, rn, &count);
+	    bnc->registered = 1;
+	  }
     }
-  else
+  bnc_msg_flush (&count);
+  return 0;
+}
+
+static void
+bgp_nexthop_register_schedule (void)
+{
+  if (! bgp_nexthop_register_thread)
+    bgp_nexthop_register_thread =
+      thread_add_event (master, bgp_nexthop_register, NULL, 0);
+}
+
+/* The connection to zebra is (re)established.  Zebra keeps nothing
+   across connections, so register everything again; the answers
+   re-evaluate whatever changed meanwhile. */
+void
+bgp_nexthop_zebra_connected (struct zclient *zclient)
+{
+  struct bgp_node *rn;
+  struct bgp_nexthop_cache *bnc;
+  afi_t afi;
+
+  for (afi = AFI_IP; afi < AFI_MAX; afi++)
     {
-      bnc = zlookup_query_ipv6 (&attr->extra->mp_nexthop_global);
-      if (bnc)
-	{
-	  struct bgp_table *old;
-	  struct bgp_node *oldrn;
-	  struct bgp_nexthop_cache *oldbnc;
+      if (! bgp_nexthop_cache_table[afi])
+	continue;
 
-	  if (changed)
-	    {
-	      if (bgp_nexthop_cache_table[AFI_IP6] == cache1_table[AFI_IP6])
-		old = cache2_table[AFI_IP6];
-	      else
-		old = cache1_table[AFI_IP6];
+      for (rn = bgp_table_top (bgp_nexthop_cache_table[afi]); rn;
+	   rn = bgp_route_next (rn))
+	if ((bnc = rn->info) != NULL)
+	  bnc->registered = 0;
+    }
+  bgp_nexthop_register_schedule ();
+}
 
-	      oldrn = bgp_node_lookup (old, &p);
-	      if (oldrn)
-		{
-		  oldbnc = oldrn->info;
+/* Free the cache entries no path uses any more. */
+static void
+bgp_nexthop_cache_sweep (afi_t afi)
+{
+  struct bgp_node *rn;
+  struct bgp_nexthop_cache *bnc;
+  int count = 0;
+  int connected;
+
+  connected = (zclient && zclient->sock >= 0);
+
+  for (rn = bgp_table_top (bgp_nexthop_cache_table[afi]); rn;
+       rn = bgp_route_next (rn))
+    if ((bnc = rn->info) != NULL && ! bnc->path)
+      {
+	if (connected && bnc->registered)
+	  bnc_msg_add (ZEBRA_NEXTHOP_UNREGISTER, rn, &count);
+	bnc_free (bnc);
+	rn->info = NULL;
+	bgp_unlock_node (rn);
+      }
+
+  if (connected)
+    bnc_msg_flush (&count);
+}
+
+/* Apply the current state of BNC to the paths using it. */
+static void
+bnc_paths_evaluate (struct bgp_nexthop_cache *bnc, afi_t afi)
+{
+  struct bgp_info *ri;
+  struct bgp_node *rn;
+  struct bgp *bgp;
+  int current;
 
-		  bnc->changed = bgp_nexthop_cache_changed (bnc, oldbnc);
+  for (ri = bnc->path; ri; ri = ri->extra->bnc_next)
+    {
+      if (CHECK_FLAG (ri->flags, BGP_INFO_REMOVED))
+	continue;
 
-		  if (bnc->metric != oldbnc->metric)
-		    bnc->metricchanged = 1;
+      rn = ri->rn;
+      bgp = ri->peer->bgp;
 
-                  bgp_unlock_node (oldrn);
-		}
-	    }
-	}
+      if (bnc->changed)
+	SET_FLAG (ri->flags, BGP_INFO_IGP_CHANGED);
       else
-	{
-	  bnc = bnc_new ();
-	  bnc->valid = 0;
-	}
-      rn->info = bnc;
-    }
+	UNSET_FLAG (ri->flags, BGP_INFO_IGP_CHANGED);
 
-  if (changed)
-    *changed = bnc->changed;
+      if (bnc->valid && bnc->metric)
+	ri->extra->igpmetric = bnc->metric;
+      else
+	ri->extra->igpmetric = 0;
 
-  if (metricchanged)
-    *metricchanged = bnc->metricchanged;
+      current = CHECK_FLAG (ri->flags, BGP_INFO_VALID) ? 1 : 0;
 
-  if (bnc->valid && bnc->metric)
-    (bgp_info_extra_get (ri))->igpmetric = bnc->metric;
-  else if (ri->extra)
-    ri->extra->igpmetric = 0;
+      if (bnc->valid != current)
+	{
+	  if (CHECK_FLAG (ri->flags, BGP_INFO_VALID))
+	    {
+	      bgp_aggregate_decrement (bgp, &rn->p, ri, afi, SAFI_UNICAST);
+	      bgp_info_unset_flag (rn, ri, BGP_INFO_VALID);
+	    }
+	  else
+	    {
+	      bgp_info_set_flag (rn, ri, BGP_INFO_VALID);
+	      bgp_aggregate_increment (bgp, &rn->p, ri, afi, SAFI_UNICAST);
+	    }
+	}
 
-  return bnc->valid;
+      bgp_process (bgp, rn, afi, SAFI_UNICAST);
+    }
 }
-#endif /* HAVE_IPV6 */
 
-/* Check specified next-hop is reachable or not. */
+/* ZEBRA_NEXTHOP_UPDATE: the resolution of a registered nexthop, in
+   the layout of the nexthop lookup reply. */
 int
-bgp_nexthop_lookup (afi_t afi, struct peer *peer, struct bgp_info *ri,
-		    int *changed, int *metricchanged)
+bgp_nexthop_update (int command, struct zclient *zclient,
+		    zebra_size_t length)
 {
-  struct bgp_node *rn;
+  struct stream *s;
   struct prefix p;
+  struct bgp_node *rn;
   struct bgp_nexthop_cache *bnc;
-  struct in_addr addr;
+  struct bgp_nexthop_cache new;
+  struct nexthop *nexthop;
+  u_int32_t metric;
+  u_char nexthop_num;
+  afi_t afi;
+  int i;
 
-  /* If lookup is not enabled, return valid. */
-  if (zlookup->sock < 0)
+  s = zclient->ibuf;
+
+  memset (&p, 0, sizeof (struct prefix));
+  p.family = stream_getc (s);
+  if (p.family == AF_INET)
     {
-      if (ri->extra)
-        ri->extra->igpmetric = 0;
-      return 1;
+      p.prefixlen = IPV4_MAX_BITLEN;
+      p.u.prefix4.s_addr = stream_get_ipv4 (s);
     }
+#ifdef HAVE_IPV6
+  else if (p.family == AF_INET6)
+    {
+      p.prefixlen = IPV6_MAX_BITLEN;
+      stream_get (&p.u.prefix6, s, 16);
+    }
+#endif /* HAVE_IPV6 */
+  else
+    return -1;
+
+  afi = family2afi (p.family);
+  metric = stream_getl (s);
+  nexthop_num = stream_getc (s);
 
+  memset (&new, 0, sizeof (struct bgp_nexthop_cache));
+  for (i = 0; i < nexthop_num; i++)
+    {
+      nexthop = XCALLOC (MTYPE_NEXTHOP, sizeof (struct nexthop));
+      nexthop->type = stream_getc (s);
+      switch (nexthop->type)
+	{
+	case ZEBRA_NEXTHOP_IPV4:
+	  nexthop->gate.ipv4.s_addr = stream_get_ipv4 (s);
+	  break;
+	case ZEBRA_NEXTHOP_IFINDEX:
+	case ZEBRA_NEXTHOP_IFNAME:
+	  nexthop->ifindex = stream_getl (s);
+	  break;
 #ifdef HAVE_IPV6
-  if (afi == AFI_IP6)
-    return bgp_nexthop_lookup_ipv6 (peer, ri, changed, metricchanged);
+	case ZEBRA_NEXTHOP_IPV6:
+	  stream_get (&nexthop->gate.ipv6, s, 16);
+	  break;
+	case ZEBRA_NEXTHOP_IPV6_IFINDEX:
+	case ZEBRA_NEXTHOP_IPV6_IFNAME:
+	  stream_get (&nexthop->gate.ipv6, s, 16);
+	  nexthop->ifindex = stream_getl (s);
+	  break;
 #endif /* HAVE_IPV6 */
+	default:
+	  /* do nothing */
+	  break;
+	}
+      bnc_nexthop_add (&new, nexthop);
+    }
+  new.nexthop_num = nexthop_num;
 
-  addr = ri->attr->nexthop;
+  /* The entry may have been swept after the update was sent. */
+  rn = bgp_node_lookup (bgp_nexthop_cache_table[afi], &p);
+  if (! rn || ! rn->info)
+    {
+      if (rn)
+	bgp_unlock_node (rn);
+      bnc_nexthop_free (&new);
+      return 0;
+    }
+  bgp_unlock_node (rn);
+  bnc = rn->info;
 
-  memset (&p, 0, sizeof (struct prefix));
-  p.family = AF_INET;
-  p.prefixlen = IPV4_MAX_BITLEN;
-  p.u.prefix4 = addr;
+  if (BGP_DEBUG (events, EVENTS))
+    {
+      char buf[INET6_ADDRSTRLEN];
 
-  /* IBGP or ebgp-multihop */
-  rn = bgp_node_get (bgp_nexthop_cache_table[AFI_IP], &p);
+      zlog_debug ("nexthop %s %s, metric %u, %d path(s)",
+		  inet_ntop (p.family, &p.u.prefix, buf, sizeof (buf)),
+		  nexthop_num ? "reachable" : "unreachable", metric,
+		  (int) bnc->path_count);
+    }
 
-  if (rn->info)
+  if (bnc->resolved)
     {
-      bnc = rn->info;
-      bgp_unlock_node (rn);
+      bnc->changed = bgp_nexthop_cache_changed (bnc, &new);
+      bnc->metricchanged = (bnc->metric != metric);
     }
   else
-    {
-      bnc = zlookup_query (addr);
-      if (bnc)
-	{
-	  struct bgp_table *old;
-	  struct bgp_node *oldrn;
-	  struct bgp_nexthop_cache *oldbnc;
+    bnc->changed = bnc->metricchanged = 0;
 
-	  if (changed)
-	    {
-	      if (bgp_nexthop_cache_table[AFI_IP] == cache1_table[AFI_IP])
-		old = cache2_table[AFI_IP];
-	      else
-		old = cache1_table[AFI_IP];
+  bnc_nexthop_free (bnc);
+  bnc->nexthop = new.nexthop;
+  bnc->nexthop_num = nexthop_num;
+  bnc->metric = metric;
+  bnc->valid = nexthop_num ? 1 : 0;
+  bnc->resolved = 1;
 
-	      oldrn = bgp_node_lookup (old, &p);
-	      if (oldrn)
-		{
-		  oldbnc = oldrn->info;
+  bnc_paths_evaluate (bnc, afi);
+  return 0;
+}
 
-		  bnc->changed = bgp_nexthop_cache_changed (bnc, oldbnc);
+/* Check specified next-hop is reachable or not, and track it from now
+   on for RI. */
+int
+bgp_nexthop_lookup (afi_t afi, struct bgp_info *ri)
+{
+  struct bgp_node *bn;
+  struct prefix p;
+  struct bgp_nexthop_cache *bnc;
 
-		  if (bnc->metric != oldbnc->metric)
-		    bnc->metricchanged = 1;
+  memset (&p, 0, sizeof (struct prefix));
+#ifdef HAVE_IPV6
+  if (afi == AFI_IP6)
+    {
+      struct attr *attr = ri->attr;
 
-                  bgp_unlock_node (oldrn);
-		}
-	    }
-	}
-      else
+      /* Only check IPv6 global address only nexthop. */
+      if (attr->extra->mp_nexthop_len != 16 
+	  || IN6_IS_ADDR_LINKLOCAL (&attr->extra->mp_nexthop_global))
 	{
-	  bnc = bnc_new ();
-	  bnc->valid = 0;
+	  bgp_nexthop_path_unlink (ri);
+	  return 1;
 	}
-      rn->info = bnc;
+      p.family = AF_INET6;
+      p.prefixlen = IPV6_MAX_BITLEN;
+      p.u.prefix6 = attr->extra->mp_nexthop_global;
+    }
+  else
+#endif /* HAVE_IPV6 */
+    {
+      p.family = AF_INET;
+      p.prefixlen = IPV4_MAX_BITLEN;
+      p.u.prefix4 = ri->attr->nexthop;
+    }
+
+  /* IBGP or ebgp-multihop */
+  bn = bgp_node_get (bgp_nexthop_cache_table[afi], &p);
+  if (bn->info)
+    {
+      bnc = bn->info;
+      bgp_unlock_node (bn);
+    }
+  else
+    {
+      bnc = bnc_new ();
+      bn->info = bnc;
+      bgp_nexthop_register_schedule ();
     }
 
-  if (changed)
-    *changed = bnc->changed;
+  bnc_path_link (bnc, ri);
 
-  if (metricchanged)
-    *metricchanged = bnc->metricchanged;
+  /* Until zebra answers, the path waits.  Without zebra there is
+     nothing to check against, so it is valid. */
+  if (! bnc->resolved)
+    {
+      ri->extra->igpmetric = 0;
+      return (zclient && zclient->sock >= 0) ? 0 : 1;
+    }
 
   if (bnc->valid && bnc->metric)
-    (bgp_info_extra_get(ri))->igpmetric = bnc->metric;
-  else if (ri->extra)
+    ri->extra->igpmetric = bnc->metric;
+  else
     ri->extra->igpmetric = 0;
 
   return bnc->valid;
@@ -404,12 +628,84 @@ bgp_nexthop_cache_reset (struct bgp_table *table)
   for (rn = bgp_table_top (table); rn; rn = bgp_route_next (rn))
     if ((bnc = rn->info) != NULL)
       {
+	while (bnc->path)
+	  bgp_nexthop_path_unlink (bnc->path);
 	bnc_free (bnc);
 	rn->info = NULL;
 	bgp_unlock_node (rn);
       }
 }
 
+/* EBGP peers on a shared network are not tracked through zebra, their
+   nexthops are checked against the connected routes.  Check them again
+   when those change. */
+static int
+bgp_connected_scan (struct thread *t)
+{
+  struct bgp *bgp;
+  struct bgp_node *rn;
+  struct bgp_info *bi;
+  struct listnode *node;
+  afi_t afi;
+  int valid;
+  int current;
+
+  bgp_connected_scan_thread = NULL;
+
+  for (ALL_LIST_ELEMENTS_RO (bm->bgp, node, bgp))
+    for (afi = AFI_IP; afi < AFI_MAX; afi++)
+      for (rn = bgp_table_top (bgp->rib[afi][SAFI_UNICAST]); rn;
+	   rn = bgp_route_next (rn))
+	{
+	  int changed = 0;
+
+	  for (bi = rn->info; bi; bi = bi->next)
+	    {
+	      if (bi->type != ZEBRA_ROUTE_BGP
+		  || bi->sub_type != BGP_ROUTE_NORMAL
+		  || CHECK_FLAG (bi->flags, BGP_INFO_REMOVED)
+		  || peer_sort (bi->peer) != BGP_PEER_EBGP
+		  || bi->peer->ttl != 1
+		  || CHECK_FLAG (bi->peer->flags,
+				 PEER_FLAG_DISABLE_CONNECTED_CHECK))
+		continue;
+
+	      valid = bgp_nexthop_check_ebgp (afi, bi->attr);
+	      current = CHECK_FLAG (bi->flags, BGP_INFO_VALID) ? 1 : 0;
+	      if (valid == current)
+		continue;
+
+	      if (current)
+		{
+		  bgp_aggregate_decrement (bgp, &rn->p, bi, afi, SAFI_UNICAST);
+		  bgp_info_unset_flag (rn, bi, BGP_INFO_VALID);
+		}
+	      else
+		{
+		  bgp_info_set_flag (rn, bi, BGP_INFO_VALID);
+		  bgp_aggregate_increment (bgp, &rn->p, bi, afi, SAFI_UNICAST);
+		}
+	      changed = 1;
+	    }
+
+	  if (changed)
+	    bgp_process (bgp, rn, afi, SAFI_UNICAST);
+	}
+
+  return 0;
+}
+
+static void
+bgp_connected_scan_schedule (void)
+{
+  if (! bgp_connected_scan_thread)
+    bgp_connected_scan_thread =
+      thread_add_event (master, bgp_connected_scan, NULL, 0);
+}
+
+/* What is left for the periodic scan: maximum prefix warnings, expiry
+   of dampening history and unused nexthop cache entries.  Nexthop
+   reachability is pushed by zebra, see bgp_nexthop_update(). */
 static void
 bgp_scan (afi_t afi, safi_t safi)
 {
@@ -419,16 +715,9 @@ bgp_scan (afi_t afi, safi_t safi)
   struct bgp_info *next;
   struct peer *peer;
   struct listnode *node, *nnode;
-  int valid;
-  int current;
-  int changed;
-  int metricchanged;
+  int damped;
 
-  /* Change cache. */
-  if (bgp_nexthop_cache_table[afi] == cache1_table[afi])
-    bgp_nexthop_cache_table[afi] = cache2_table[afi];
-  else
-    bgp_nexthop_cache_table[afi] = cache1_table[afi];
+  bgp_nexthop_cache_sweep (afi);
 
   /* Get default bgp. */
   bgp = bgp_get_default ();
@@ -449,64 +738,30 @@ bgp_scan (afi_t afi, safi_t safi)
 	bgp_maximum_prefix_overflow (peer, afi, SAFI_MPLS_VPN, 1);
     }
 
+  if (! CHECK_FLAG (bgp->af_flags[afi][SAFI_UNICAST], BGP_CONFIG_DAMPENING))
+    return;
+
   for (rn = bgp_table_top (bgp->rib[afi][SAFI_UNICAST]); rn;
        rn = bgp_route_next (rn))
     {
+      damped = 0;
       for (bi = rn->info; bi; bi = next)
 	{
 	  next = bi->next;
 
-	  if (bi->type == ZEBRA_ROUTE_BGP && bi->sub_type == BGP_ROUTE_NORMAL)
+	  if (bi->type == ZEBRA_ROUTE_BGP && bi->sub_type == BGP_ROUTE_NORMAL
+	      && bi->extra && bi->extra->damp_info)
 	    {
-	      changed = 0;
-	      metricchanged = 0;
-
-	      if (peer_sort (bi->peer) == BGP_PEER_EBGP && bi->peer->ttl == 1)
-		valid = bgp_nexthop_check_ebgp (afi, bi->attr);
-	      else
-		valid = bgp_nexthop_lookup (afi, bi->peer, bi,
-					    &changed, &metricchanged);
-
-	      current = CHECK_FLAG (bi->flags, BGP_INFO_VALID) ? 1 : 0;
-
-	      if (changed)
-		SET_FLAG (bi->flags, BGP_INFO_IGP_CHANGED);
-	      else
-		UNSET_FLAG (bi->flags, BGP_INFO_IGP_CHANGED);
-
-	      if (valid != current)
-		{
-		  if (CHECK_FLAG (bi->flags, BGP_INFO_VALID))
-		    {
-		      bgp_aggregate_decrement (bgp, &rn->p, bi,
-					       afi, SAFI_UNICAST);
-		      bgp_info_unset_flag (rn, bi, BGP_INFO_VALID);
-		    }
-		  else
-		    {
-		      bgp_info_set_flag (rn, bi, BGP_INFO_VALID);
-		      bgp_aggregate_increment (bgp, &rn->p, bi,
-					       afi, SAFI_UNICAST);
-		    }
-		}
-
-              if (CHECK_FLAG (bgp->af_flags[afi][SAFI_UNICAST],
-		  BGP_CONFIG_DAMPENING)
-                  &&  bi->extra && bi->extra->damp_info )
-                if (bgp_damp_scan (bi, afi, SAFI_UNICAST))
-		  bgp_aggregate_increment (bgp, &rn->p, bi,
-					   afi, SAFI_UNICAST);
+	      damped = 1;
+	      if (bgp_damp_scan (bi, afi, SAFI_UNICAST))
+		bgp_aggregate_increment (bgp, &rn->p, bi,
+					 afi, SAFI_UNICAST);
 	    }
 	}
-      bgp_process (bgp, rn, afi, SAFI_UNICAST);
+      if (damped)
+	bgp_process (bgp, rn, afi, SAFI_UNICAST);
     }
 
-  /* Flash old cache. */
-  if (bgp_nexthop_cache_table[afi] == cache1_table[afi])
-    bgp_nexthop_cache_reset (cache2_table[afi]);
-  else
-    bgp_nexthop_cache_reset (cache1_table[afi]);
-
   if (BGP_DEBUG (events, EVENTS))
     {
       if (afi == AFI_IP)
@@ -516,7 +771,7 @@ bgp_scan (afi_t afi, safi_t safi)
     }
 }
 
-/* BGP scan thread.  This thread check nexthop reachability. */
+/* BGP scan thread. */
 static int
 bgp_scan_timer (struct thread *t)
 {
@@ -534,7 +789,7 @@ bgp_scan_timer (struct thread *t)
 
   return 0;
 }
-
+
 struct bgp_connected_ref
 {
   unsigned int refcnt;
@@ -557,6 +812,9 @@ bgp_connected_add (struct connected *ifc)
   if (if_is_loopback (ifp))
     return;
 
+  bgp_updgrp_invalidate ();
+  bgp_connected_scan_schedule ();
+
   addr = ifc->address;
 
   if (addr->family == AF_INET)
@@ -622,6 +880,9 @@ bgp_connected_delete (struct connected *ifc)
   if (if_is_loopback (ifp))
     return;
 
+  bgp_updgrp_invalidate ();
+  bgp_connected_scan_schedule ();
+
   addr = ifc->address;
 
   if (addr->family == AF_INET)
@@ -698,330 +959,386 @@ bgp_nexthop_self (afi_t afi, struct attr *attr)
   return 0;
 }
 
-static struct bgp_nexthop_cache *
-zlookup_read (void)
+/* Queries on the zlookup connection are pipelined: they are written
+   without waiting for the answer, and zebra answers them in order.
+   Answers are read from the thread loop and handed to the callback of
+   the query at the head of the queue.  A query for a prefix already
+   waiting for its answer is not sent again. */
+struct zlookup_query
 {
-  struct stream *s;
-  uint16_t length;
-  u_char marker;
-  u_char version;
-  uint16_t command;
-  int nbytes;
-  struct in_addr raddr;
-  uint32_t metric;
-  int i;
-  u_char nexthop_num;
-  struct nexthop *nexthop;
-  struct bgp_nexthop_cache *bnc;
+  u_int16_t command;
+  struct prefix p;
 
-  s = zlookup->ibuf;
-  stream_reset (s);
+  /* Called with the answer, or with a valid answer if the connection
+     goes away first, as lookups have always done without zebra. */
+  void (*func) (struct prefix *, int, u_int32_t, struct in_addr);
+};
 
-  nbytes = stream_read (s, zlookup->sock, 2);
-  length = stream_getw (s);
+static struct list *zlookup_queue;
+static struct hash *zlookup_hash;
 
-  nbytes = stream_read (s, zlookup->sock, length - 2);
-  marker = stream_getc (s);
-  version = stream_getc (s);
-  
-  if (version != ZSERV_VERSION || marker != ZEBRA_HEADER_MARKER)
-    {
-      zlog_err("%s: socket %d version mismatch, marker %d, version %d",
-               __func__, zlookup->sock, marker, version);
-      return NULL;
-    }
-    
-  command = stream_getw (s);
-  
-  raddr.s_addr = stream_get_ipv4 (s);
-  metric = stream_getl (s);
-  nexthop_num = stream_getc (s);
+static unsigned int
+zlookup_query_hash_key (void *arg)
+{
+  struct zlookup_query *q = arg;
 
-  if (nexthop_num)
-    {
-      bnc = bnc_new ();
-      bnc->valid = 1;
-      bnc->metric = metric;
-      bnc->nexthop_num = nexthop_num;
+  return jhash_3words (q->command, q->p.prefixlen, q->p.u.prefix4.s_addr,
+		       0);
+}
 
-      for (i = 0; i < nexthop_num; i++)
-	{
-	  nexthop = XCALLOC (MTYPE_NEXTHOP, sizeof (struct nexthop));
-	  nexthop->type = stream_getc (s);
-	  switch (nexthop->type)
-	    {
-	    case ZEBRA_NEXTHOP_IPV4:
-	      nexthop->gate.ipv4.s_addr = stream_get_ipv4 (s);
-	      break;
-	    case ZEBRA_NEXTHOP_IFINDEX:
-	    case ZEBRA_NEXTHOP_IFNAME:
-	      nexthop->ifindex = stream_getl (s);
-	      break;
-            default:
-              /* do nothing */
-              break;
-	    }
-	  bnc_nexthop_add (bnc, nexthop);
-	}
-    }
-  else
-    return NULL;
+static int
+zlookup_query_hash_cmp (const void *arg1, const void *arg2)
+{
+  const struct zlookup_query *q1 = arg1;
+  const struct zlookup_query *q2 = arg2;
 
-  return bnc;
+  return (q1->command == q2->command && q1->func == q2->func
+	  && prefix_same (&q1->p, &q2->p));
 }
 
-struct bgp_nexthop_cache *
-zlookup_query (struct in_addr addr)
-{
-  int ret;
-  struct stream *s;
+static void zlookup_event (int);
 
-  /* Check socket. */
-  if (zlookup->sock < 0)
-    return NULL;
+/* Answer every outstanding query as valid. */
+static void
+zlookup_queue_flush (void)
+{
+  struct zlookup_query *q;
+  struct in_addr any;
 
-  s = zlookup->obuf;
-  stream_reset (s);
-  zclient_create_header (s, ZEBRA_IPV4_NEXTHOP_LOOKUP);
-  stream_put_in_addr (s, &addr);
-  
-  stream_putw_at (s, 0, stream_get_endp (s));
-  
-  ret = writen (zlookup->sock, s->data, stream_get_endp (s));
-  if (ret < 0)
+  any.s_addr = 0;
+  while (listcount (zlookup_queue))
     {
-      zlog_err ("can't write to zlookup->sock");
-      close (zlookup->sock);
-      zlookup->sock = -1;
-      return NULL;
+      q = listgetdata (listhead (zlookup_queue));
+      list_delete_node (zlookup_queue, listhead (zlookup_queue));
+      hash_release (zlookup_hash, q);
+      (*q->func) (&q->p, 1, 0, any);
+      XFREE (MTYPE_BGP_ZLOOKUP, q);
     }
-  if (ret == 0)
+}
+
+static int
+zlookup_failed (void)
+{
+  THREAD_OFF (zlookup->t_read);
+  THREAD_OFF (zlookup->t_write);
+  stream_reset (zlookup->ibuf);
+  buffer_reset (zlookup->wb);
+  if (zlookup->sock >= 0)
     {
-      zlog_err ("zlookup->sock connection closed");
       close (zlookup->sock);
       zlookup->sock = -1;
-      return NULL;
+      /* The connected network of EBGP peers is not looked at any more. */
+      bgp_updgrp_invalidate ();
     }
+  zlookup->fail++;
 
-  return zlookup_read ();
+  zlookup_queue_flush ();
+  zlookup_event (0);
+  return -1;
 }
 
-#ifdef HAVE_IPV6
-static struct bgp_nexthop_cache *
-zlookup_read_ipv6 (void)
+static int
+zlookup_flush (struct thread *t)
 {
-  struct stream *s;
-  uint16_t length;
-  u_char version, marker;
-  uint16_t  command;
-  int nbytes;
-  struct in6_addr raddr;
-  uint32_t metric;
-  int i;
-  u_char nexthop_num;
-  struct nexthop *nexthop;
-  struct bgp_nexthop_cache *bnc;
-
-  s = zlookup->ibuf;
-  stream_reset (s);
-
-  nbytes = stream_read (s, zlookup->sock, 2);
-  length = stream_getw (s);
+  zlookup->t_write = NULL;
+  if (zlookup->sock < 0)
+    return -1;
 
-  nbytes = stream_read (s, zlookup->sock, length - 2);
-  marker = stream_getc (s);
-  version = stream_getc (s);
-  
-  if (version != ZSERV_VERSION || marker != ZEBRA_HEADER_MARKER)
+  switch (buffer_flush_available (zlookup->wb, zlookup->sock))
     {
-      zlog_err("%s: socket %d version mismatch, marker %d, version %d",
-               __func__, zlookup->sock, marker, version);
-      return NULL;
+    case BUFFER_ERROR:
+      zlog_warn ("%s: buffer_flush_available failed on zlookup fd %d, closing",
+		 __func__, zlookup->sock);
+      return zlookup_failed ();
+    case BUFFER_PENDING:
+      zlookup->t_write = thread_add_write (master, zlookup_flush, NULL,
+					   zlookup->sock);
+      break;
+    case BUFFER_EMPTY:
+      break;
     }
-    
-  command = stream_getw (s);
-  
-  stream_get (&raddr, s, 16);
-
-  metric = stream_getl (s);
-  nexthop_num = stream_getc (s);
+  return 0;
+}
 
-  if (nexthop_num)
+static int
+zlookup_send (struct stream *s)
+{
+  switch (buffer_write (zlookup->wb, zlookup->sock, STREAM_DATA (s),
+			stream_get_endp (s)))
     {
-      bnc = bnc_new ();
-      bnc->valid = 1;
-      bnc->metric = metric;
-      bnc->nexthop_num = nexthop_num;
-
-      for (i = 0; i < nexthop_num; i++)
-	{
-	  nexthop = XCALLOC (MTYPE_NEXTHOP, sizeof (struct nexthop));
-	  nexthop->type = stream_getc (s);
-	  switch (nexthop->type)
-	    {
-	    case ZEBRA_NEXTHOP_IPV6:
-	      stream_get (&nexthop->gate.ipv6, s, 16);
-	      break;
-	    case ZEBRA_NEXTHOP_IPV6_IFINDEX:
-	    case ZEBRA_NEXTHOP_IPV6_IFNAME:
-	      stream_get (&nexthop->gate.ipv6, s, 16);
-	      nexthop->ifindex = stream_getl (s);
-	      break;
-	    case ZEBRA_NEXTHOP_IFINDEX:
-	    case ZEBRA_NEXTHOP_IFNAME:
-	      nexthop->ifindex = stream_getl (s);
-	      break;
-	    default:
-	      /* do nothing */
-	      break;
-	    }
-	  bnc_nexthop_add (bnc, nexthop);
-	}
+    case BUFFER_ERROR:
+      zlog_err ("can't write to zlookup->sock");
+      return zlookup_failed ();
+    case BUFFER_EMPTY:
+      THREAD_OFF (zlookup->t_write);
+      break;
+    case BUFFER_PENDING:
+      if (! zlookup->t_write)
+	zlookup->t_write = thread_add_write (master, zlookup_flush, NULL,
+					     zlookup->sock);
+      break;
     }
-  else
-    return NULL;
-
-  return bnc;
+  return 0;
 }
 
-struct bgp_nexthop_cache *
-zlookup_query_ipv6 (struct in6_addr *addr)
+/* Ask zebra about P and call FUNC with the answer. */
+static void
+zlookup_query (u_int16_t command, struct prefix *p,
+	       void (*func) (struct prefix *, int, u_int32_t, struct in_addr))
 {
-  int ret;
+  struct zlookup_query key;
+  struct zlookup_query *q;
   struct stream *s;
+  struct in_addr any;
 
-  /* Check socket. */
+  /* If lookup connection is not available answer valid. */
   if (zlookup->sock < 0)
-    return NULL;
+    {
+      any.s_addr = 0;
+      (*func) (p, 1, 0, any);
+      return;
+    }
+
+  memset (&key, 0, sizeof (struct zlookup_query));
+  key.command = command;
+  prefix_copy (&key.p, p);
+  key.func = func;
+  if (hash_lookup (zlookup_hash, &key))
+    return;
 
   s = zlookup->obuf;
   stream_reset (s);
-  zclient_create_header (s, ZEBRA_IPV6_NEXTHOP_LOOKUP);
-  stream_put (s, addr, 16);
+  zclient_create_header (s, command);
+  stream_putc (s, p->prefixlen);
+  stream_put_in_addr (s, &p->u.prefix4);
   stream_putw_at (s, 0, stream_get_endp (s));
-  
-  ret = writen (zlookup->sock, s->data, stream_get_endp (s));
-  if (ret < 0)
+
+  q = XMALLOC (MTYPE_BGP_ZLOOKUP, sizeof (struct zlookup_query));
+  *q = key;
+  listnode_add (zlookup_queue, q);
+  hash_get (zlookup_hash, q, hash_alloc_intern);
+
+  zlookup_send (s);
+}
+
+/* An answer to the query at the head of the queue. */
+static int
+zlookup_answer (u_int16_t command)
+{
+  struct stream *s = zlookup->ibuf;
+  struct zlookup_query *q;
+  struct in_addr addr;
+  struct in_addr nexthop;
+  u_int32_t metric;
+  u_char nexthop_num;
+
+  if (! listcount (zlookup_queue))
     {
-      zlog_err ("can't write to zlookup->sock");
-      close (zlookup->sock);
-      zlookup->sock = -1;
-      return NULL;
+      zlog_warn ("%s: unsolicited %s", __func__,
+		 zserv_command_string (command));
+      return 0;
     }
-  if (ret == 0)
+  q = listgetdata (listhead (zlookup_queue));
+
+  addr.s_addr = stream_get_ipv4 (s);
+  if (command != q->command || addr.s_addr != q->p.u.prefix4.s_addr)
     {
-      zlog_err ("zlookup->sock connection closed");
-      close (zlookup->sock);
-      zlookup->sock = -1;
-      return NULL;
+      zlog_err ("%s: %s for %s does not answer the oldest query",
+		__func__, zserv_command_string (command), inet_ntoa (addr));
+      return zlookup_failed ();
     }
 
-  return zlookup_read_ipv6 ();
+  list_delete_node (zlookup_queue, listhead (zlookup_queue));
+  hash_release (zlookup_hash, q);
+
+  metric = stream_getl (s);
+  nexthop_num = stream_getc (s);
+  nexthop.s_addr = 0;
+  if (nexthop_num && stream_getc (s) == ZEBRA_NEXTHOP_IPV4)
+    nexthop.s_addr = stream_get_ipv4 (s);
+
+  /* If there is nexthop then this is active route. */
+  (*q->func) (&q->p, nexthop_num ? 1 : 0, metric, nexthop);
+  XFREE (MTYPE_BGP_ZLOOKUP, q);
+  return 0;
 }
-#endif /* HAVE_IPV6 */
 
 static int
-bgp_import_check (struct prefix *p, u_int32_t *igpmetric,
-                  struct in_addr *igpnexthop)
+zlookup_read (struct thread *t)
 {
-  struct stream *s;
-  int ret;
+  struct stream *s = zlookup->ibuf;
+  size_t already;
+  ssize_t nbyte;
   u_int16_t length, command;
-  u_char version, marker;
-  int nbytes;
-  struct in_addr addr;
-  struct in_addr nexthop;
-  u_int32_t metric = 0;
-  u_char nexthop_num;
-  u_char nexthop_type;
+  u_char marker, version;
 
-  /* If lookup connection is not available return valid. */
-  if (zlookup->sock < 0)
+  zlookup->t_read = NULL;
+
+  /* Read zebra header, if not already read. */
+  if ((already = stream_get_endp (s)) < ZEBRA_HEADER_SIZE)
     {
-      if (igpmetric)
-	*igpmetric = 0;
-      return 1;
+      nbyte = stream_read_try (s, zlookup->sock, ZEBRA_HEADER_SIZE - already);
+      if (nbyte == 0 || nbyte == -1)
+	return zlookup_failed ();
+      if (nbyte != (ssize_t) (ZEBRA_HEADER_SIZE - already))
+	{
+	  /* Try again later. */
+	  zlookup_event (1);
+	  return 0;
+	}
+      already = ZEBRA_HEADER_SIZE;
     }
 
-  /* Send query to the lookup connection */
-  s = zlookup->obuf;
-  stream_reset (s);
-  zclient_create_header (s, ZEBRA_IPV4_IMPORT_LOOKUP);
-  
-  stream_putc (s, p->prefixlen);
-  stream_put_in_addr (s, &p->u.prefix4);
-  
-  stream_putw_at (s, 0, stream_get_endp (s));
-  
-  /* Write the packet. */
-  ret = writen (zlookup->sock, s->data, stream_get_endp (s));
+  stream_set_getp (s, 0);
+  length = stream_getw (s);
+  marker = stream_getc (s);
+  version = stream_getc (s);
+  command = stream_getw (s);
 
-  if (ret < 0)
+  if (version != ZSERV_VERSION || marker != ZEBRA_HEADER_MARKER
+      || length < ZEBRA_HEADER_SIZE || length > STREAM_SIZE (s))
     {
-      zlog_err ("can't write to zlookup->sock");
-      close (zlookup->sock);
-      zlookup->sock = -1;
-      return 1;
+      zlog_err("%s: socket %d bad header, marker %d, version %d, length %d",
+               __func__, zlookup->sock, marker, version, length);
+      return zlookup_failed ();
     }
-  if (ret == 0)
+
+  /* Read rest of zebra packet. */
+  if (already < length)
     {
-      zlog_err ("zlookup->sock connection closed");
-      close (zlookup->sock);
-      zlookup->sock = -1;
-      return 1;
+      nbyte = stream_read_try (s, zlookup->sock, length - already);
+      if (nbyte == 0 || nbyte == -1)
+	return zlookup_failed ();
+      if (nbyte != (ssize_t) (length - already))
+	{
+	  /* Try again later. */
+	  zlookup_event (1);
+	  return 0;
+	}
     }
 
-  /* Get result. */
+  if (zlookup_answer (command) < 0)
+    return -1;
+
   stream_reset (s);
+  zlookup_event (1);
+  return 0;
+}
 
-  /* Fetch length. */
-  nbytes = stream_read (s, zlookup->sock, 2);
-  length = stream_getw (s);
+/* Connect to zebra for nexthop lookup. */
+static int
+zlookup_connect (struct thread *t)
+{
+  zlookup->t_connect = NULL;
 
-  /* Fetch whole data. */
-  nbytes = stream_read (s, zlookup->sock, length - 2);
-  marker = stream_getc (s);
-  version = stream_getc (s);
+  if (zlookup->sock != -1)
+    return 0;
+
+#ifdef HAVE_TCP_ZEBRA
+  zlookup->sock = zclient_socket ();
+#else
+  zlookup->sock = zclient_socket_un (ZEBRA_SERV_PATH);
+#endif /* HAVE_TCP_ZEBRA */
+  if (zlookup->sock < 0)
+    {
+      zlookup->fail++;
+      zlookup_event (0);
+      return -1;
+    }
+
+  if (set_nonblocking (zlookup->sock) < 0)
+    zlog_warn ("%s: set_nonblocking(%d) failed", __func__, zlookup->sock);
+
+  zlookup->fail = 0;
+  zlookup_event (1);
+
+  /* Update group keys made while zebra was away lack the connected
+     network of EBGP peers. */
+  bgp_updgrp_invalidate ();
+  return 0;
+}
 
-  if (version != ZSERV_VERSION || marker != ZEBRA_HEADER_MARKER)
+/* Schedule a read of the zlookup connection, or a connection attempt
+   backing off like the other zebra clients do. */
+static void
+zlookup_event (int read)
+{
+  if (read)
     {
-      zlog_err("%s: socket %d version mismatch, marker %d, version %d",
-               __func__, zlookup->sock, marker, version);
-      return 0;
+      if (! zlookup->t_read)
+	zlookup->t_read = thread_add_read (master, zlookup_read, NULL,
+					   zlookup->sock);
     }
-    
-  command = stream_getw (s);
-  
-  addr.s_addr = stream_get_ipv4 (s);
-  metric = stream_getl (s);
-  nexthop_num = stream_getc (s);
+  else if (! zlookup->t_connect)
+    zlookup->t_connect = thread_add_timer (master, zlookup_connect, NULL,
+					   zlookup->fail < 3 ? 10 : 60);
+}
 
-  /* Set IGP metric value. */
-  if (igpmetric)
-    *igpmetric = metric;
+/* Apply the import check result for a static route. */
+static void
+bgp_import_apply (struct bgp *bgp, struct bgp_node *rn,
+		  struct bgp_static *bgp_static, afi_t afi, safi_t safi,
+		  int valid, u_int32_t metric, struct in_addr nexthop)
+{
+  int old_valid;
+  u_int32_t old_metric;
+  struct in_addr old_nexthop;
 
-  /* If there is nexthop then this is active route. */
-  if (nexthop_num)
+  old_valid = bgp_static->valid;
+  old_metric = bgp_static->igpmetric;
+  old_nexthop = bgp_static->igpnexthop;
+
+  bgp_static->valid = valid;
+  bgp_static->igpmetric = metric;
+  bgp_static->igpnexthop = nexthop;
+
+  if (bgp_static->valid != old_valid)
     {
-      nexthop.s_addr = 0;
-      nexthop_type = stream_getc (s);
-      if (nexthop_type == ZEBRA_NEXTHOP_IPV4)
-	{
-	  nexthop.s_addr = stream_get_ipv4 (s);
-	  if (igpnexthop)
-	    *igpnexthop = nexthop;
-	}
+      if (bgp_static->valid)
+	bgp_static_update (bgp, &rn->p, bgp_static, afi, safi);
       else
-	*igpnexthop = nexthop;
+	bgp_static_withdraw (bgp, &rn->p, afi, safi);
+    }
+  else if (bgp_static->valid)
+    {
+      if (bgp_static->igpmetric != old_metric
+	  || bgp_static->igpnexthop.s_addr != old_nexthop.s_addr
+	  || bgp_static->rmap.name)
+	bgp_static_update (bgp, &rn->p, bgp_static, afi, safi);
+    }
+}
+
+/* Answer to an import check: apply it to every instance checking the
+   prefix.  Looked up again, as the configuration may have changed
+   while the query was outstanding. */
+static void
+bgp_import_result (struct prefix *p, int valid, u_int32_t metric,
+		   struct in_addr nexthop)
+{
+  struct bgp *bgp;
+  struct bgp_node *rn;
+  struct bgp_static *bgp_static;
+  struct listnode *node, *nnode;
+
+  for (ALL_LIST_ELEMENTS (bm->bgp, node, nnode, bgp))
+    {
+      if (! bgp_flag_check (bgp, BGP_FLAG_IMPORT_CHECK))
+	continue;
+
+      rn = bgp_node_lookup (bgp->route[AFI_IP][SAFI_UNICAST], p);
+      if (! rn)
+	continue;
 
-      return 1;
+      if ((bgp_static = rn->info) != NULL && ! bgp_static->backdoor)
+	bgp_import_apply (bgp, rn, bgp_static, AFI_IP, SAFI_UNICAST,
+			  valid, metric, nexthop);
+      bgp_unlock_node (rn);
     }
-  else
-    return 0;
 }
 
 /* Scan all configured BGP route then check the route exists in IGP or
-   not. */
+   not.  Routes under import check are validated as the answers come
+   in from zebra. */
 static int
 bgp_import (struct thread *t)
 {
@@ -1029,9 +1346,7 @@ bgp_import (struct thread *t)
   struct bgp_node *rn;
   struct bgp_static *bgp_static;
   struct listnode *node, *nnode;
-  int valid;
-  u_int32_t metric;
-  struct in_addr nexthop;
+  struct in_addr any;
   afi_t afi;
   safi_t safi;
 
@@ -1041,6 +1356,8 @@ bgp_import (struct thread *t)
   if (BGP_DEBUG (events, EVENTS))
     zlog_debug ("Import timer expired.");
 
+  any.s_addr = 0;
+
   for (ALL_LIST_ELEMENTS (bm->bgp, node, nnode, bgp))
     {
       for (afi = AFI_IP; afi < AFI_MAX; afi++)
@@ -1052,63 +1369,17 @@ bgp_import (struct thread *t)
 		if (bgp_static->backdoor)
 		  continue;
 
-		valid = bgp_static->valid;
-		metric = bgp_static->igpmetric;
-		nexthop = bgp_static->igpnexthop;
-
 		if (bgp_flag_check (bgp, BGP_FLAG_IMPORT_CHECK)
 		    && afi == AFI_IP && safi == SAFI_UNICAST)
-		  bgp_static->valid = bgp_import_check (&rn->p, &bgp_static->igpmetric,
-						        &bgp_static->igpnexthop);
+		  zlookup_query (ZEBRA_IPV4_IMPORT_LOOKUP, &rn->p,
+				 bgp_import_result);
 		else
-		  {
-		    bgp_static->valid = 1;
-		    bgp_static->igpmetric = 0;
-		    bgp_static->igpnexthop.s_addr = 0;
-		  }
-
-		if (bgp_static->valid != valid)
-		  {
-		    if (bgp_static->valid)
-		      bgp_static_update (bgp, &rn->p, bgp_static, afi, safi);
-		    else
-		      bgp_static_withdraw (bgp, &rn->p, afi, safi);
-		  }
-		else if (bgp_static->valid)
-		  {
-		    if (bgp_static->igpmetric != metric
-			|| bgp_static->igpnexthop.s_addr != nexthop.s_addr
-			|| bgp_static->rmap.name)
-		      bgp_static_update (bgp, &rn->p, bgp_static, afi, safi);
-		  }
+		  bgp_import_apply (bgp, rn, bgp_static, afi, safi, 1, 0, any);
 	      }
     }
   return 0;
 }
 
-/* Connect to zebra for nexthop lookup. */
-static int
-zlookup_connect (struct thread *t)
-{
-  struct zclient *zlookup;
-
-  zlookup = THREAD_ARG (t);
-  zlookup->t_connect = NULL;
-
-  if (zlookup->sock != -1)
-    return 0;
-
-#ifdef HAVE_TCP_ZEBRA
-  zlookup->sock = zclient_socket ();
-#else
-  zlookup->sock = zclient_socket_un (ZEBRA_SERV_PATH);
-#endif /* HAVE_TCP_ZEBRA */
-  if (zlookup->sock < 0)
-    return -1;
-
-  return 0;
-}
-
 /* Check specified multiaccess next-hop. */
 int
 bgp_multiaccess_check_v4 (struct in_addr nexthop, char *peer)
@@ -1154,6 +1425,35 @@ bgp_multiaccess_check_v4 (struct in_addr nexthop, char *peer)
 
   return 0;
 }
+
+/* Connected network PEER's address is on.  bgp_multiaccess_check_v4()
+   gives the same answer for any two peers on the same network, so
+   update groups key on it.  Returns 0 if there is none. */
+int
+bgp_multiaccess_subnet_v4 (char *peer, struct prefix *subnet)
+{
+  struct bgp_node *rn;
+  struct prefix p;
+
+  memset (subnet, 0, sizeof (struct prefix));
+
+  memset (&p, 0, sizeof (struct prefix));
+  p.family = AF_INET;
+  p.prefixlen = IPV4_MAX_BITLEN;
+  if (! inet_aton (peer, &p.u.prefix4))
+    return 0;
+
+  if (zlookup->sock < 0)
+    return 0;
+
+  rn = bgp_node_match (bgp_connected_table[AFI_IP], &p);
+  if (! rn)
+    return 0;
+  prefix_copy (subnet, &rn->p);
+  bgp_unlock_node (rn);
+
+  return 1;
+}
 
 DEFUN (bgp_scan_time,
        bgp_scan_time_cmd,
@@ -1222,12 +1522,16 @@ DEFUN (show_ip_bgp_scan,
   for (rn = bgp_table_top (bgp_nexthop_cache_table[AFI_IP]); rn; rn = bgp_route_next (rn))
     if ((bnc = rn->info) != NULL)
       {
-	if (bnc->valid)
-	  vty_out (vty, " %s valid [IGP metric %d]%s",
-		   inet_ntoa (rn->p.u.prefix4), bnc->metric, VTY_NEWLINE);
+	if (! bnc->resolved)
+	  vty_out (vty, " %s pending, %lu paths%s",
+		   inet_ntoa (rn->p.u.prefix4), bnc->path_count, VTY_NEWLINE);
+	else if (bnc->valid)
+	  vty_out (vty, " %s valid [IGP metric %d], %lu paths%s",
+		   inet_ntoa (rn->p.u.prefix4), bnc->metric, bnc->path_count,
+		   VTY_NEWLINE);
 	else
-	  vty_out (vty, " %s invalid%s",
-		   inet_ntoa (rn->p.u.prefix4), VTY_NEWLINE);
+	  vty_out (vty, " %s invalid, %lu paths%s",
+		   inet_ntoa (rn->p.u.prefix4), bnc->path_count, VTY_NEWLINE);
       }
 
 #ifdef HAVE_IPV6
@@ -1238,14 +1542,18 @@ DEFUN (show_ip_bgp_scan,
          rn = bgp_route_next (rn))
       if ((bnc = rn->info) != NULL)
 	{
-	  if (bnc->valid)
-	    vty_out (vty, " %s valid [IGP metric %d]%s",
+	  if (! bnc->resolved)
+	    vty_out (vty, " %s pending, %lu paths%s",
 		     inet_ntop (AF_INET6, &rn->p.u.prefix6, buf, BUFSIZ),
-		     bnc->metric, VTY_NEWLINE);
+		     bnc->path_count, VTY_NEWLINE);
+	  else if (bnc->valid)
+	    vty_out (vty, " %s valid [IGP metric %d], %lu paths%s",
+		     inet_ntop (AF_INET6, &rn->p.u.prefix6, buf, BUFSIZ),
+		     bnc->metric, bnc->path_count, VTY_NEWLINE);
 	  else
-	    vty_out (vty, " %s invalid%s",
+	    vty_out (vty, " %s invalid, %lu paths%s",
 		     inet_ntop (AF_INET6, &rn->p.u.prefix6, buf, BUFSIZ),
-		     VTY_NEWLINE);
+		     bnc->path_count, VTY_NEWLINE);
 	}
   }
 #endif /* HAVE_IPV6 */
@@ -1289,21 +1597,22 @@ bgp_scan_init (void)
 {
   zlookup = zclient_new ();
   zlookup->sock = -1;
-  zlookup->t_connect = thread_add_event (master, zlookup_connect, zlookup, 0);
+  zlookup_queue = list_new ();
+  zlookup_hash = hash_create (zlookup_query_hash_key, zlookup_query_hash_cmp);
+
+  /* Connect now rather than from an event, so that the first import
+     check below already has zebra to ask. */
+  zlookup_connect (NULL);
 
   bgp_scan_interval = BGP_SCAN_INTERVAL_DEFAULT;
   bgp_import_interval = BGP_IMPORT_INTERVAL_DEFAULT;
 
-  cache1_table[AFI_IP] = bgp_table_init (AFI_IP, SAFI_UNICAST);
-  cache2_table[AFI_IP] = bgp_table_init (AFI_IP, SAFI_UNICAST);
-  bgp_nexthop_cache_table[AFI_IP] = cache1_table[AFI_IP];
+  bgp_nexthop_cache_table[AFI_IP] = bgp_table_init (AFI_IP, SAFI_UNICAST);
 
   bgp_connected_table[AFI_IP] = bgp_table_init (AFI_IP, SAFI_UNICAST);
 
 #ifdef HAVE_IPV6
-  cache1_table[AFI_IP6] = bgp_table_init (AFI_IP6, SAFI_UNICAST);
-  cache2_table[AFI_IP6] = bgp_table_init (AFI_IP6, SAFI_UNICAST);
-  bgp_nexthop_cache_table[AFI_IP6] = cache1_table[AFI_IP6];
+  bgp_nexthop_cache_table[AFI_IP6] = bgp_table_init (AFI_IP6, SAFI_UNICAST);
   bgp_connected_table[AFI_IP6] = bgp_table_init (AFI_IP6, SAFI_UNICAST);
 #endif /* HAVE_IPV6 */
 
@@ -1324,27 +1633,17 @@ bgp_scan_init (void)
 void
 bgp_scan_finish (void)
 {
-  /* Only the current one needs to be reset. */
   bgp_nexthop_cache_reset (bgp_nexthop_cache_table[AFI_IP]);
-
-  bgp_table_unlock (cache1_table[AFI_IP]);
-  cache1_table[AFI_IP] = NULL;
-
-  bgp_table_unlock (cache2_table[AFI_IP]);
-  cache2_table[AFI_IP] = NULL;
+  bgp_table_unlock (bgp_nexthop_cache_table[AFI_IP]);
+  bgp_nexthop_cache_table[AFI_IP] = NULL;
 
   bgp_table_unlock (bgp_connected_table[AFI_IP]);
   bgp_connected_table[AFI_IP] = NULL;
 
 #ifdef HAVE_IPV6
-  /* Only the current one needs to be reset. */
   bgp_nexthop_cache_reset (bgp_nexthop_cache_table[AFI_IP6]);
-
-  bgp_table_unlock (cache1_table[AFI_IP6]);
-  cache1_table[AFI_IP6] = NULL;
-
-  bgp_table_unlock (cache2_table[AFI_IP6]);
-  cache2_table[AFI_IP6] = NULL;
+  bgp_table_unlock (bgp_nexthop_cache_table[AFI_IP6]);
+  bgp_nexthop_cache_table[AFI_IP6] = NULL;
 
   bgp_table_unlock (bgp_connected_table[AFI_IP6]);
   bgp_connected_table[AFI_IP6] = NULL;
@@ -22,6 +22,7 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #define _QUAGGA_BGP_NEXTHOP_H
 
 #include "if.h"
+#include "zclient.h"
 
 #define BGP_SCAN_INTERVAL_DEFAULT   60
 #define BGP_IMPORT_INTERVAL_DEFAULT 15
@@ -38,21 +39,34 @@ struct bgp_nexthop_cache
   /* Nexthop is changed. */
   u_char metricchanged;
 
+  /* Zebra has answered the registration. */
+  u_char resolved;
+
+  /* Registered with zebra on the current connection. */
+  u_char registered;
+
   /* IGP route's metric. */
   u_int32_t metric;
 
   /* Nexthop number and nexthop linked list.*/
   u_char nexthop_num;
   struct nexthop *nexthop;
+
+  /* Paths using this nexthop, linked through bgp_info_extra. */
+  struct bgp_info *path;
+  unsigned long path_count;
 };
 
 extern void bgp_scan_init (void);
 extern void bgp_scan_finish (void);
-extern int bgp_nexthop_lookup (afi_t, struct peer *peer, struct bgp_info *,
-			int *, int *);
+extern int bgp_nexthop_lookup (afi_t, struct bgp_info *);
+extern void bgp_nexthop_path_unlink (struct bgp_info *);
+extern int bgp_nexthop_update (int, struct zclient *, zebra_size_t);
+extern void bgp_nexthop_zebra_connected (struct zclient *);
 extern void bgp_connected_add (struct connected *c);
 extern void bgp_connected_delete (struct connected *c);
 extern int bgp_multiaccess_check_v4 (struct in_addr, char *);
+extern int bgp_multiaccess_subnet_v4 (char *, struct prefix *);
 extern int bgp_config_write_scan_time (struct vty *);
 extern int bgp_nexthop_check_ebgp (afi_t, struct attr *);
 extern int bgp_nexthop_self (afi_t, struct attr *);
@@ -46,6 +46,8 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "bgpd/bgp_network.h"
 #include "bgpd/bgp_mplsvpn.h"
 #include "bgpd/bgp_advertise.h"
+#include "bgpd/bgp_updgrp.h"
+#include "bgpd/bgp_pipeline.h"
 #include "bgpd/bgp_vty.h"
 
 int stream_put_prefix (struct stream *, struct prefix *);
@@ -84,6 +86,107 @@ bgp_packet_set_size (struct stream *s)
   return cp;
 }
 
+/* A packet buffer.  Members of an update group which would send the
+   same UPDATE queue views of one packet, each with a read position of
+   its own, see bgp_updgrp_packet_share().  The stream comes first, so
+   that the output queues can hold the packet as a stream. */
+struct bgp_packet
+{
+  struct stream s;
+
+  /* For a view, the packet whose data it shows. */
+  struct bgp_packet *buf;
+
+  /* References to a packet that is not a view: its own place on an
+     output queue, or an update group remembering it, and views of it. */
+  unsigned int refcnt;
+};
+
+/* Sent packets, kept for building the next ones in. */
+static struct stream_fifo bgp_packet_pool;
+
+/* Get an empty packet buffer of BGP_MAX_PACKET_SIZE.  Messages are
+   built straight into it and queued as they are. */
+static struct stream *
+bgp_packet_new (void)
+{
+  struct bgp_packet *pkt;
+
+  if (stream_fifo_head (&bgp_packet_pool))
+    {
+      pkt = (struct bgp_packet *) stream_fifo_pop (&bgp_packet_pool);
+      stream_reset (&pkt->s);
+    }
+  else
+    {
+      pkt = XCALLOC (MTYPE_STREAM, sizeof (struct bgp_packet));
+      pkt->s.data = XMALLOC (MTYPE_STREAM_DATA, BGP_MAX_PACKET_SIZE);
+      pkt->s.size = BGP_MAX_PACKET_SIZE;
+    }
+
+  pkt->refcnt = 1;
+  return &pkt->s;
+}
+
+/* A packet holding a copy of packet S, in just the space it needs. */
+struct stream *
+bgp_packet_copy (struct stream *s)
+{
+  struct bgp_packet *pkt;
+  size_t len = stream_get_endp (s);
+
+  pkt = XCALLOC (MTYPE_STREAM, sizeof (struct bgp_packet));
+  pkt->s.data = XMALLOC (MTYPE_STREAM_DATA, len);
+  pkt->s.size = pkt->s.endp = len;
+  memcpy (pkt->s.data, STREAM_DATA (s), len);
+  pkt->refcnt = 1;
+  return &pkt->s;
+}
+
+/* A view of packet S to queue, reading it from the start. */
+struct stream *
+bgp_packet_view (struct stream *s)
+{
+  struct bgp_packet *pkt = (struct bgp_packet *) s;
+  struct bgp_packet *view;
+
+  assert (! pkt->buf);
+  pkt->refcnt++;
+
+  view = XCALLOC (MTYPE_STREAM, sizeof (struct bgp_packet));
+  view->s.data = pkt->s.data;
+  view->s.size = pkt->s.size;
+  view->s.endp = pkt->s.endp;
+  view->buf = pkt;
+  return &view->s;
+}
+
+/* Done with a packet buffer, or a view of one. */
+void
+bgp_packet_free (struct stream *s)
+{
+  struct bgp_packet *pkt = (struct bgp_packet *) s;
+
+  if (pkt->buf)
+    {
+      s = &pkt->buf->s;
+      XFREE (MTYPE_STREAM, pkt);
+      pkt = (struct bgp_packet *) s;
+    }
+
+  if (--pkt->refcnt)
+    return;
+
+  if (STREAM_SIZE (s) == BGP_MAX_PACKET_SIZE
+      && bgp_packet_pool.count < BGP_PACKET_POOL_MAX)
+    stream_fifo_push (&bgp_packet_pool, s);
+  else
+    {
+      XFREE (MTYPE_STREAM_DATA, pkt->s.data);
+      XFREE (MTYPE_STREAM, pkt);
+    }
+}
+
 /* Add new packet to the peer. */
 static void
 bgp_packet_add (struct peer *peer, struct stream *s)
@@ -96,7 +199,15 @@ bgp_packet_add (struct peer *peer, struct stream *s)
 static void
 bgp_packet_delete (struct peer *peer)
 {
-  stream_free (stream_fifo_pop (peer->obuf));
+  bgp_packet_free (stream_fifo_pop (peer->obuf));
+}
+
+/* Drop all packets queued to the peer. */
+void
+bgp_packet_clean (struct peer *peer)
+{
+  while (stream_fifo_head (peer->obuf))
+    bgp_packet_delete (peer);
 }
 
 /* Check file descriptor whether connect is established. */
@@ -142,17 +253,16 @@ static struct stream *
 bgp_update_packet (struct peer *peer, afi_t afi, safi_t safi)
 {
   struct stream *s;
+  struct stream *view;
   struct bgp_adj_out *adj;
   struct bgp_advertise *adv;
-  struct stream *packet;
   struct bgp_node *rn = NULL;
   struct bgp_info *binfo = NULL;
   bgp_size_t total_attr_len = 0;
   unsigned long pos;
   char buf[BUFSIZ];
 
-  s = peer->work;
-  stream_reset (s);
+  s = bgp_packet_new ();
 
   adv = FIFO_HEAD (&peer->sync[afi][safi]->update);
 
@@ -188,10 +298,10 @@ bgp_update_packet (struct peer *peer, afi_t afi, safi_t safi)
 	  stream_putw (s, 0);		
 	  pos = stream_get_endp (s);
 	  stream_putw (s, 0);
-	  total_attr_len = bgp_packet_attribute (NULL, peer, s, 
-	                                         adv->baa->attr,
-	                                         &rn->p, afi, safi, 
-	                                         from, prd, tag);
+	  total_attr_len = bgp_updgrp_packet_attribute (peer, s,
+	                                                adv->baa->attr,
+	                                                &rn->p, afi, safi,
+	                                                from, prd, tag);
 	  stream_putw_at (s, pos, total_attr_len);
 	}
 
@@ -210,7 +320,7 @@ bgp_update_packet (struct peer *peer, afi_t afi, safi_t safi)
       else
 	peer->scount[afi][safi]++;
 
-      adj->attr = bgp_attr_intern (adv->baa->attr);
+      adj->attr = bgp_attr_ref (adv->baa->attr);
 
       adv = bgp_advertise_clean (peer, adj, afi, safi);
 
@@ -221,12 +331,21 @@ bgp_update_packet (struct peer *peer, afi_t afi, safi_t safi)
   if (! stream_empty (s))
     {
       bgp_packet_set_size (s);
-      packet = stream_dup (s);
-      bgp_packet_add (peer, packet);
+
+      /* Queue one buffer with the other members of the group that
+	 send the same packet. */
+      if (afi == AFI_IP && safi == SAFI_UNICAST
+	  && (view = bgp_updgrp_packet_share (peer, afi, safi, s)) != NULL)
+	{
+	  bgp_packet_free (s);
+	  s = view;
+	}
+
+      bgp_packet_add (peer, s);
       BGP_WRITE_ON (peer->t_write, bgp_write, peer->fd);
-      stream_reset (s);
-      return packet;
+      return s;
     }
+  bgp_packet_free (s);
   return NULL;
 }
 
@@ -234,7 +353,6 @@ static struct stream *
 bgp_update_packet_eor (struct peer *peer, afi_t afi, safi_t safi)
 {
   struct stream *s;
-  struct stream *packet;
 
   if (DISABLE_BGP_ANNOUNCE)
     return NULL;
@@ -242,7 +360,7 @@ bgp_update_packet_eor (struct peer *peer, afi_t afi, safi_t safi)
   if (BGP_DEBUG (normal, NORMAL))
     zlog_debug ("send End-of-RIB for %s to %s", afi_safi_print (afi, safi), peer->host);
 
-  s = stream_new (BGP_MAX_PACKET_SIZE);
+  s = bgp_packet_new ();
 
   /* Make BGP update packet. */
   bgp_packet_set_marker (s, BGP_MSG_UPDATE);
@@ -267,10 +385,8 @@ bgp_update_packet_eor (struct peer *peer, afi_t afi, safi_t safi)
     }
 
   bgp_packet_set_size (s);
-  packet = stream_dup (s);
-  bgp_packet_add (peer, packet);
-  stream_free (s);
-  return packet;
+  bgp_packet_add (peer, s);
+  return s;
 }
 
 /* Make BGP withdraw packet.  */
@@ -278,7 +394,6 @@ static struct stream *
 bgp_withdraw_packet (struct peer *peer, afi_t afi, safi_t safi)
 {
   struct stream *s;
-  struct stream *packet;
   struct bgp_adj_out *adj;
   struct bgp_advertise *adv;
   struct bgp_node *rn;
@@ -287,8 +402,7 @@ bgp_withdraw_packet (struct peer *peer, afi_t afi, safi_t safi)
   bgp_size_t total_attr_len;
   char buf[BUFSIZ];
 
-  s = peer->work;
-  stream_reset (s);
+  s = bgp_packet_new ();
 
   while ((adv = FIFO_HEAD (&peer->sync[afi][safi]->withdraw)) != NULL)
     {
@@ -348,12 +462,11 @@ bgp_withdraw_packet (struct peer *peer, afi_t afi, safi_t safi)
 	  stream_putw (s, 0);
 	}
       bgp_packet_set_size (s);
-      packet = stream_dup (s);
-      bgp_packet_add (peer, packet);
-      stream_reset (s);
-      return packet;
+      bgp_packet_add (peer, s);
+      return s;
     }
 
+  bgp_packet_free (s);
   return NULL;
 }
 
@@ -362,7 +475,6 @@ bgp_default_update_send (struct peer *peer, struct attr *attr,
 			 afi_t afi, safi_t safi, struct peer *from)
 {
   struct stream *s;
-  struct stream *packet;
   struct prefix p;
   unsigned long pos;
   bgp_size_t total_attr_len;
@@ -388,7 +500,7 @@ bgp_default_update_send (struct peer *peer, struct attr *attr,
 	    p.prefixlen, attrstr);
     }
 
-  s = stream_new (BGP_MAX_PACKET_SIZE);
+  s = bgp_packet_new ();
 
   /* Make BGP update packet. */
   bgp_packet_set_marker (s, BGP_MSG_UPDATE);
@@ -411,16 +523,13 @@ bgp_default_update_send (struct peer *peer, struct attr *attr,
   /* Set size. */
   bgp_packet_set_size (s);
 
-  packet = stream_dup (s);
-  stream_free (s);
-
   /* Dump packet if debug option is set. */
 #ifdef DEBUG
-  /* bgp_packet_dump (packet); */
+  /* bgp_packet_dump (s); */
 #endif /* DEBUG */
 
   /* Add packet to the peer. */
-  bgp_packet_add (peer, packet);
+  bgp_packet_add (peer, s);
 
   BGP_WRITE_ON (peer->t_write, bgp_write, peer->fd);
 }
@@ -429,7 +538,6 @@ void
 bgp_default_withdraw_send (struct peer *peer, afi_t afi, safi_t safi)
 {
   struct stream *s;
-  struct stream *packet;
   struct prefix p;
   unsigned long pos;
   unsigned long cp;
@@ -455,7 +563,7 @@ bgp_default_withdraw_send (struct peer *peer, afi_t afi, safi_t safi)
           peer->host, inet_ntop(p.family, &(p.u.prefix), buf, BUFSIZ),
           p.prefixlen);
 
-  s = stream_new (BGP_MAX_PACKET_SIZE);
+  s = bgp_packet_new ();
 
   /* Make BGP update packet. */
   bgp_packet_set_marker (s, BGP_MSG_UPDATE);
@@ -489,16 +597,14 @@ bgp_default_withdraw_send (struct peer *peer, afi_t afi, safi_t safi)
 
   bgp_packet_set_size (s);
 
-  packet = stream_dup (s);
-  stream_free (s);
-
   /* Add packet to the peer. */
-  bgp_packet_add (peer, packet);
+  bgp_packet_add (peer, s);
 
   BGP_WRITE_ON (peer->t_write, bgp_write, peer->fd);
 }
 
-/* Get next packet to be written.  */
+/* Build the next UPDATE to be written and queue it behind whatever
+   is in the output queue already.  */
 static struct stream *
 bgp_write_packet (struct peer *peer)
 {
@@ -507,10 +613,6 @@ bgp_write_packet (struct peer *peer)
   struct stream *s = NULL;
   struct bgp_advertise *adv;
 
-  s = stream_fifo_head (peer->obuf);
-  if (s)
-    return s;
-
   for (afi = AFI_IP; afi < AFI_MAX; afi++)
     for (safi = SAFI_UNICAST; safi < SAFI_MAX; safi++)
       {
@@ -589,15 +691,18 @@ bgp_write_proceed (struct peer *peer)
   return 0;
 }
 
-/* Write packet to the peer. */
+/* Write packet to the peer.  Up to BGP_WRITE_PACKET_MAX queued
+   packets go out in one writev(). */
 int
 bgp_write (struct thread *thread)
 {
   struct peer *peer;
   u_char type;
   struct stream *s; 
-  int num;
-  unsigned int count = 0;
+  struct iovec iov[BGP_WRITE_PACKET_MAX];
+  int iovcnt;
+  ssize_t num;
+  size_t len;
 
   /* Yes first of all get peer pointer. */
   peer = THREAD_ARG (thread);
@@ -610,42 +715,55 @@ bgp_write (struct thread *thread)
       return 0;
     }
 
-  s = bgp_write_packet (peer);
-  if (!s)
+  while (peer->obuf->count < BGP_WRITE_PACKET_MAX
+	 && bgp_write_packet (peer) != NULL)
+    ;
+
+  if (! stream_fifo_head (peer->obuf))
     return 0;	/* nothing to send */
 
   sockopt_cork (peer->fd, 1);
 
-  /* Nonblocking write until TCP output buffer is full.  */
-  do
+  /* Nothing behind a NOTIFICATION is worth sending. */
+  iovcnt = 0;
+  for (s = stream_fifo_head (peer->obuf);
+       s && iovcnt < (int) BGP_WRITE_PACKET_MAX; s = s->next)
     {
-      int writenum;
+      iov[iovcnt].iov_base = STREAM_PNT (s);
+      iov[iovcnt].iov_len = STREAM_READABLE (s);
+      iovcnt++;
 
-      /* Number of bytes to be sent.  */
-      writenum = stream_get_endp (s) - stream_get_getp (s);
+      if (stream_getc_from (s, BGP_MARKER_SIZE + 2) == BGP_MSG_NOTIFY)
+	break;
+    }
 
-      /* Call write() system call.  */
-      num = write (peer->fd, STREAM_PNT (s), writenum);
-      if (num < 0)
+  /* Nonblocking write until TCP output buffer is full.  */
+  num = writev (peer->fd, iov, iovcnt);
+  if (num < 0)
+    {
+      /* write failed either retry needed or error */
+      if (! ERRNO_IO_RETRY(errno))
 	{
-	  /* write failed either retry needed or error */
-	  if (ERRNO_IO_RETRY(errno))
-		break;
-
-          BGP_EVENT_ADD (peer, TCP_fatal_error);
+	  BGP_EVENT_ADD (peer, TCP_fatal_error);
 	  return 0;
 	}
+      num = 0;
+    }
 
-      if (num != writenum)
+  /* Account for the packets that went out, and keep the rest. */
+  while (num > 0 && (s = stream_fifo_head (peer->obuf)) != NULL)
+    {
+      len = STREAM_READABLE (s);
+      if ((size_t) num < len)
 	{
 	  /* Partial write */
 	  stream_forward_getp (s, num);
 	  break;
 	}
+      num -= len;
 
       /* Retrieve BGP packet type. */
-      stream_set_getp (s, BGP_MARKER_SIZE + 2);
-      type = stream_getc (s);
+      type = stream_getc_from (s, BGP_MARKER_SIZE + 2);
 
       switch (type)
 	{
@@ -682,8 +800,6 @@ bgp_write (struct thread *thread)
       /* OK we send packet so delete it. */
       bgp_packet_delete (peer);
     }
-  while (++count < BGP_WRITE_PACKET_MAX &&
-	 (s = bgp_write_packet (peer)) != NULL);
   
   if (bgp_write_proceed (peer))
     BGP_WRITE_ON (peer->t_write, bgp_write, peer->fd);
@@ -746,7 +862,7 @@ bgp_keepalive_send (struct peer *peer)
   struct stream *s;
   int length;
 
-  s = stream_new (BGP_MAX_PACKET_SIZE);
+  s = bgp_packet_new ();
 
   /* Make keepalive packet. */
   bgp_packet_set_marker (s, BGP_MSG_KEEPALIVE);
@@ -789,7 +905,7 @@ bgp_open_send (struct peer *peer)
   else
     local_as = peer->local_as; 
 
-  s = stream_new (BGP_MAX_PACKET_SIZE);
+  s = bgp_packet_new ();
 
   /* Make open packet. */
   bgp_packet_set_marker (s, BGP_MSG_OPEN);
@@ -834,7 +950,7 @@ bgp_notify_send_with_data (struct peer *peer, u_char code, u_char sub_code,
   int length;
 
   /* Allocate new stream. */
-  s = stream_new (BGP_MAX_PACKET_SIZE);
+  s = bgp_packet_new ();
 
   /* Make nitify packet. */
   bgp_packet_set_marker (s, BGP_MSG_NOTIFY);
@@ -851,7 +967,7 @@ bgp_notify_send_with_data (struct peer *peer, u_char code, u_char sub_code,
   length = bgp_packet_set_size (s);
   
   /* Add packet to the peer. */
-  stream_fifo_clean (peer->obuf);
+  bgp_packet_clean (peer);
   bgp_packet_add (peer, s);
 
   /* For debug */
@@ -934,7 +1050,6 @@ bgp_route_refresh_send (struct peer *peer, afi_t afi, safi_t safi,
 			u_char orf_type, u_char when_to_refresh, int remove)
 {
   struct stream *s;
-  struct stream *packet;
   int length;
   struct bgp_filter *filter;
   int orf_refresh = 0;
@@ -948,7 +1063,7 @@ bgp_route_refresh_send (struct peer *peer, afi_t afi, safi_t safi,
   if (safi == SAFI_MPLS_VPN)
     safi = BGP_SAFI_VPNV4;
   
-  s = stream_new (BGP_MAX_PACKET_SIZE);
+  s = bgp_packet_new ();
 
   /* Make BGP update packet. */
   if (CHECK_FLAG (peer->cap, PEER_CAP_REFRESH_NEW_RCV))
@@ -1015,12 +1130,8 @@ bgp_route_refresh_send (struct peer *peer, afi_t afi, safi_t safi,
 		 BGP_MSG_ROUTE_REFRESH_NEW : BGP_MSG_ROUTE_REFRESH_OLD, length);
     }
 
-  /* Make real packet. */
-  packet = stream_dup (s);
-  stream_free (s);
-
   /* Add packet to the peer. */
-  bgp_packet_add (peer, packet);
+  bgp_packet_add (peer, s);
 
   BGP_WRITE_ON (peer->t_write, bgp_write, peer->fd);
 }
@@ -1031,14 +1142,13 @@ bgp_capability_send (struct peer *peer, afi_t afi, safi_t safi,
 		     int capability_code, int action)
 {
   struct stream *s;
-  struct stream *packet;
   int length;
 
   /* Adjust safi code. */
   if (safi == SAFI_MPLS_VPN)
     safi = BGP_SAFI_VPNV4;
 
-  s = stream_new (BGP_MAX_PACKET_SIZE);
+  s = bgp_packet_new ();
 
   /* Make BGP update packet. */
   bgp_packet_set_marker (s, BGP_MSG_CAPABILITY);
@@ -1062,12 +1172,8 @@ bgp_capability_send (struct peer *peer, afi_t afi, safi_t safi,
   /* Set packet size. */
   length = bgp_packet_set_size (s);
 
-  /* Make real packet. */
-  packet = stream_dup (s);
-  stream_free (s);
-
   /* Add packet to the peer. */
-  bgp_packet_add (peer, packet);
+  bgp_packet_add (peer, s);
 
   if (BGP_DEBUG (normal, NORMAL))
     zlog_debug ("%s send message type %d, length (incl. header) %d",
@@ -1140,6 +1246,8 @@ bgp_collision_detect (struct peer *new, struct in_addr remote_id)
   return 0;
 }
 
+static void bgp_process_schedule (struct peer *);
+
 static int
 bgp_open_receive (struct peer *peer, bgp_size_t size)
 {
@@ -1357,11 +1465,14 @@ bgp_open_receive (struct peer *peer, bgp_size_t size)
       realpeer->fd = peer->fd;
       peer->fd = -1;
 
-      /* Transfer input buffer. */
+      /* Transfer input buffer, along with anything read behind the
+	 OPEN. */
       stream_free (realpeer->ibuf);
       realpeer->ibuf = peer->ibuf;
-      realpeer->packet_size = peer->packet_size;
       peer->ibuf = NULL;
+      stream_free (realpeer->ibuf_work);
+      realpeer->ibuf_work = peer->ibuf_work;
+      peer->ibuf_work = NULL;
 
       /* Transfer status. */
       realpeer->status = peer->status;
@@ -1484,7 +1595,10 @@ bgp_open_receive (struct peer *peer, bgp_size_t size)
 
   BGP_EVENT_ADD (peer, Receive_OPEN_message);
 
-  peer->packet_size = 0;
+  /* What came in behind the OPEN waits for the event above; on a
+     transferred connection bgp_read() has lost track of it. */
+  bgp_process_schedule (peer);
+
   if (peer->ibuf)
     stream_reset (peer->ibuf);
 
@@ -1492,7 +1606,7 @@ bgp_open_receive (struct peer *peer, bgp_size_t size)
 }
 
 /* Parse BGP Update packet and make attribute object. */
-static int
+int
 bgp_update_receive (struct peer *peer, bgp_size_t size)
 {
   int ret;
@@ -1507,6 +1621,9 @@ bgp_update_receive (struct peer *peer, bgp_size_t size)
   struct bgp_nlri mp_update;
   struct bgp_nlri mp_withdraw;
   char attrstr[BUFSIZ] = "";
+  struct timeval tv;
+
+  bgp_pipeline_start (&tv);
 
   /* Status must be Established. */
   if (peer->status != Established) 
@@ -1660,6 +1777,9 @@ bgp_update_receive (struct peer *peer, bgp_size_t size)
       stream_forward_getp (s, update_len);
     }
 
+  bgp_pipeline_time (BGP_PIPELINE_DECODE, &tv);
+  bgp_pipeline_count (BGP_PIPELINE_DECODE, 1);
+
   /* NLRI is processed only when the peer is configured specific
      Address Family and Subsequent Address Family. */
   if (peer->afc[AFI_IP][SAFI_UNICAST])
@@ -1826,6 +1946,8 @@ bgp_update_receive (struct peer *peer, bgp_size_t size)
   if (attr.extra)
     bgp_attr_extra_free (&attr);
   
+  bgp_pipeline_time (BGP_PIPELINE_RIB, &tv);
+
   /* If peering is stopped due to some reason, do not generate BGP
      event.  */
   if (peer->status != Established)
@@ -2277,21 +2399,28 @@ bgp_capability_receive (struct peer *peer, bgp_size_t size)
   return bgp_capability_msg_parse (peer, pnt, size);
 }
 
-/* BGP read utility function. */
+/* BGP read utility function.  Read whatever fits into the input
+   ring. */
 static int
 bgp_read_packet (struct peer *peer)
 {
   int nbytes;
   int readsize;
 
-  readsize = peer->packet_size - stream_get_endp (peer->ibuf);
+  /* Make room behind the input not processed yet. */
+  stream_pulldown (peer->ibuf_work);
+  readsize = STREAM_WRITEABLE (peer->ibuf_work);
 
-  /* If size is zero then return. */
+  /* Ring is full of messages waiting for bgp_process_packet(), which
+     turns reading back on once it has made room. */
   if (! readsize)
-    return 0;
+    {
+      BGP_READ_OFF (peer->t_read);
+      return -1;
+    }
 
   /* Read packet from fd. */
-  nbytes = stream_read_try (peer->ibuf, peer->fd, readsize);
+  nbytes = stream_read_try (peer->ibuf_work, peer->fd, readsize);
 
   /* If read byte is smaller than zero then error occured. */
   if (nbytes < 0) 
@@ -2340,10 +2469,8 @@ bgp_read_packet (struct peer *peer)
       return -1;
     }
 
-  /* We read partial packet. */
-  if (stream_get_endp (peer->ibuf) != peer->packet_size)
-    return -1;
-
+  peer->read_calls++;
+  bgp_pipeline_count (BGP_PIPELINE_READ, nbytes);
   return 0;
 }
 
@@ -2360,125 +2487,96 @@ bgp_marker_all_one (struct stream *s, int length)
   return 1;
 }
 
-/* Starting point of packet process function. */
-int
-bgp_read (struct thread *thread)
+/* Is there a whole message, or a header too broken to wait for the
+   rest of, at the front of the input ring? */
+static int
+bgp_input_ready (struct stream *s)
+{
+  bgp_size_t size;
+
+  if (STREAM_READABLE (s) < BGP_HEADER_SIZE)
+    return 0;
+
+  size = stream_getw_from (s, stream_get_getp (s) + BGP_MARKER_SIZE);
+  if (size < BGP_HEADER_SIZE || size > BGP_MAX_PACKET_SIZE)
+    return 1;
+
+  return STREAM_READABLE (s) >= size;
+}
+
+/* Check and process the message in peer->ibuf. */
+static void
+bgp_process_message (struct peer *peer)
 {
-  int ret;
   u_char type = 0;
-  struct peer *peer;
   bgp_size_t size;
   char notify_data_length[2];
 
-  /* Yes first of all get peer pointer. */
-  peer = THREAD_ARG (thread);
-  peer->t_read = NULL;
+  /* Get size and type. */
+  stream_forward_getp (peer->ibuf, BGP_MARKER_SIZE);
+  memcpy (notify_data_length, stream_pnt (peer->ibuf), 2);
+  size = stream_getw (peer->ibuf);
+  type = stream_getc (peer->ibuf);
 
-  /* For non-blocking IO check. */
-  if (peer->status == Connect)
+  if (BGP_DEBUG (normal, NORMAL) && type != 2 && type != 0)
+    zlog_debug ("%s rcv message type %d, length (excl. header) %d",
+	       peer->host, type, size - BGP_HEADER_SIZE);
+
+  /* Marker check */
+  if (((type == BGP_MSG_OPEN) || (type == BGP_MSG_KEEPALIVE))
+      && ! bgp_marker_all_one (peer->ibuf, BGP_MARKER_SIZE))
     {
-      bgp_connect_check (peer);
-      goto done;
+      bgp_notify_send (peer,
+		       BGP_NOTIFY_HEADER_ERR, 
+		       BGP_NOTIFY_HEADER_NOT_SYNC);
+      return;
     }
-  else
+
+  /* BGP type check. */
+  if (type != BGP_MSG_OPEN && type != BGP_MSG_UPDATE 
+      && type != BGP_MSG_NOTIFY && type != BGP_MSG_KEEPALIVE 
+      && type != BGP_MSG_ROUTE_REFRESH_NEW
+      && type != BGP_MSG_ROUTE_REFRESH_OLD
+      && type != BGP_MSG_CAPABILITY)
     {
-      if (peer->fd < 0)
-	{
-	  zlog_err ("bgp_read peer's fd is negative value %d", peer->fd);
-	  return -1;
-	}
-      BGP_READ_ON (peer->t_read, bgp_read, peer->fd);
+      if (BGP_DEBUG (normal, NORMAL))
+	plog_debug (peer->log,
+		  "%s unknown message type 0x%02x",
+		  peer->host, type);
+      bgp_notify_send_with_data (peer,
+				 BGP_NOTIFY_HEADER_ERR,
+				 BGP_NOTIFY_HEADER_BAD_MESTYPE,
+				 &type, 1);
+      return;
     }
-
-  /* Read packet header to determine type of the packet */
-  if (peer->packet_size == 0)
-    peer->packet_size = BGP_HEADER_SIZE;
-
-  if (stream_get_endp (peer->ibuf) < BGP_HEADER_SIZE)
+  /* Mimimum packet length check. */
+  if ((size < BGP_HEADER_SIZE)
+      || (size > BGP_MAX_PACKET_SIZE)
+      || (type == BGP_MSG_OPEN && size < BGP_MSG_OPEN_MIN_SIZE)
+      || (type == BGP_MSG_UPDATE && size < BGP_MSG_UPDATE_MIN_SIZE)
+      || (type == BGP_MSG_NOTIFY && size < BGP_MSG_NOTIFY_MIN_SIZE)
+      || (type == BGP_MSG_KEEPALIVE && size != BGP_MSG_KEEPALIVE_MIN_SIZE)
+      || (type == BGP_MSG_ROUTE_REFRESH_NEW && size < BGP_MSG_ROUTE_REFRESH_MIN_SIZE)
+      || (type == BGP_MSG_ROUTE_REFRESH_OLD && size < BGP_MSG_ROUTE_REFRESH_MIN_SIZE)
+      || (type == BGP_MSG_CAPABILITY && size < BGP_MSG_CAPABILITY_MIN_SIZE))
     {
-      ret = bgp_read_packet (peer);
-
-      /* Header read error or partial read packet. */
-      if (ret < 0) 
-	goto done;
-
-      /* Get size and type. */
-      stream_forward_getp (peer->ibuf, BGP_MARKER_SIZE);
-      memcpy (notify_data_length, stream_pnt (peer->ibuf), 2);
-      size = stream_getw (peer->ibuf);
-      type = stream_getc (peer->ibuf);
-
-      if (BGP_DEBUG (normal, NORMAL) && type != 2 && type != 0)
-	zlog_debug ("%s rcv message type %d, length (excl. header) %d",
-		   peer->host, type, size - BGP_HEADER_SIZE);
-
-      /* Marker check */
-      if (((type == BGP_MSG_OPEN) || (type == BGP_MSG_KEEPALIVE))
-	  && ! bgp_marker_all_one (peer->ibuf, BGP_MARKER_SIZE))
-	{
-	  bgp_notify_send (peer,
-			   BGP_NOTIFY_HEADER_ERR, 
-			   BGP_NOTIFY_HEADER_NOT_SYNC);
-	  goto done;
-	}
-
-      /* BGP type check. */
-      if (type != BGP_MSG_OPEN && type != BGP_MSG_UPDATE 
-	  && type != BGP_MSG_NOTIFY && type != BGP_MSG_KEEPALIVE 
-	  && type != BGP_MSG_ROUTE_REFRESH_NEW
-	  && type != BGP_MSG_ROUTE_REFRESH_OLD
-	  && type != BGP_MSG_CAPABILITY)
-	{
-	  if (BGP_DEBUG (normal, NORMAL))
-	    plog_debug (peer->log,
-		      "%s unknown message type 0x%02x",
-		      peer->host, type);
-	  bgp_notify_send_with_data (peer,
-				     BGP_NOTIFY_HEADER_ERR,
-			 	     BGP_NOTIFY_HEADER_BAD_MESTYPE,
-				     &type, 1);
-	  goto done;
-	}
-      /* Mimimum packet length check. */
-      if ((size < BGP_HEADER_SIZE)
-	  || (size > BGP_MAX_PACKET_SIZE)
-	  || (type == BGP_MSG_OPEN && size < BGP_MSG_OPEN_MIN_SIZE)
-	  || (type == BGP_MSG_UPDATE && size < BGP_MSG_UPDATE_MIN_SIZE)
-	  || (type == BGP_MSG_NOTIFY && size < BGP_MSG_NOTIFY_MIN_SIZE)
-	  || (type == BGP_MSG_KEEPALIVE && size != BGP_MSG_KEEPALIVE_MIN_SIZE)
-	  || (type == BGP_MSG_ROUTE_REFRESH_NEW && size < BGP_MSG_ROUTE_REFRESH_MIN_SIZE)
-	  || (type == BGP_MSG_ROUTE_REFRESH_OLD && size < BGP_MSG_ROUTE_REFRESH_MIN_SIZE)
-	  || (type == BGP_MSG_CAPABILITY && size < BGP_MSG_CAPABILITY_MIN_SIZE))
-	{
-	  if (BGP_DEBUG (normal, NORMAL))
-	    plog_debug (peer->log,
-		      "%s bad message length - %d for %s",
-		      peer->host, size, 
-		      type == 128 ? "ROUTE-REFRESH" :
-		      bgp_type_str[(int) type]);
-	  bgp_notify_send_with_data (peer,
-				     BGP_NOTIFY_HEADER_ERR,
-			  	     BGP_NOTIFY_HEADER_BAD_MESLEN,
-				     (u_char *) notify_data_length, 2);
-	  goto done;
-	}
-
-      /* Adjust size to message length. */
-      peer->packet_size = size;
+      if (BGP_DEBUG (normal, NORMAL))
+	plog_debug (peer->log,
+		  "%s bad message length - %d for %s",
+		  peer->host, size, 
+		  type == 128 ? "ROUTE-REFRESH" :
+		  bgp_type_str[(int) type]);
+      bgp_notify_send_with_data (peer,
+				 BGP_NOTIFY_HEADER_ERR,
+				 BGP_NOTIFY_HEADER_BAD_MESLEN,
+				 (u_char *) notify_data_length, 2);
+      return;
     }
 
-  ret = bgp_read_packet (peer);
-  if (ret < 0) 
-    goto done;
-
-  /* Get size and type again. */
-  size = stream_getw_from (peer->ibuf, BGP_MARKER_SIZE);
-  type = stream_getc_from (peer->ibuf, BGP_MARKER_SIZE + 2);
-
   /* BGP packet dump function. */
   bgp_dump_packet (peer, type, peer->ibuf);
   
-  size = (peer->packet_size - BGP_HEADER_SIZE);
+  size -= BGP_HEADER_SIZE;
 
   /* Read rest of the packet and call each sort of packet routine */
   switch (type) 
@@ -2510,9 +2608,126 @@ bgp_read (struct thread *thread)
     }
 
   /* Clear input buffer. */
-  peer->packet_size = 0;
   if (peer->ibuf)
     stream_reset (peer->ibuf);
+}
+
+/* Take complete messages off the input ring and process them, up to
+   BGP_READ_QUOTA of them.
+
+   Only UPDATEs and friends in Established are processed back to back.
+   Anything else queues an FSM event the next message depends on (an
+   OPEN moving us to OpenConfirm, say), so the rest of the ring waits
+   for bgp_process_packet(), which runs after that event.  Returns 1
+   when that is needed. */
+static int
+bgp_process_input (struct peer *peer)
+{
+  struct stream *s = peer->ibuf_work;
+  u_int32_t notify_out;
+  bgp_size_t size;
+  int status;
+  int count;
+
+  for (count = 0; count < BGP_READ_QUOTA; count++)
+    {
+      if (! bgp_input_ready (s))
+	return 0;
+
+      /* A broken length is rejected by the header check, which only
+	 needs the header. */
+      size = stream_getw_from (s, stream_get_getp (s) + BGP_MARKER_SIZE);
+      if (size < BGP_HEADER_SIZE || size > BGP_MAX_PACKET_SIZE)
+	size = BGP_HEADER_SIZE;
+
+      stream_reset (peer->ibuf);
+      stream_put (peer->ibuf, stream_pnt (s), size);
+      stream_forward_getp (s, size);
+
+      status = peer->status;
+      notify_out = peer->notify_out;
+
+      bgp_process_message (peer);
+      peer->read_msgs++;
+
+      /* Session going down, or the connection went over to the real
+	 peer together with the ring. */
+      if (peer->fd < 0 || peer->notify_out != notify_out)
+	return 0;
+
+      if (status != Established || peer->status != Established)
+	break;
+    }
+
+  return bgp_input_ready (s);
+}
+
+/* Carry on with input left over by bgp_read(). */
+static int
+bgp_process_packet (struct thread *thread)
+{
+  struct peer *peer;
+
+  peer = THREAD_ARG (thread);
+  peer->t_process_packet = NULL;
+
+  if (peer->fd < 0)
+    return 0;
+
+  if (bgp_process_input (peer))
+    bgp_process_schedule (peer);
+  else if (peer->fd >= 0)
+    BGP_READ_ON (peer->t_read, bgp_read, peer->fd);
+
+  return 0;
+}
+
+/* Have bgp_process_packet() carry on with input already read. */
+static void
+bgp_process_schedule (struct peer *peer)
+{
+  if (! peer->t_process_packet && peer->fd >= 0
+      && bgp_input_ready (peer->ibuf_work))
+    peer->t_process_packet =
+      thread_add_event (master, bgp_process_packet, peer, 0);
+}
+
+/* Starting point of packet process function. */
+int
+bgp_read (struct thread *thread)
+{
+  int ret;
+  struct peer *peer;
+  struct timeval tv;
+
+  /* Yes first of all get peer pointer. */
+  peer = THREAD_ARG (thread);
+  peer->t_read = NULL;
+
+  /* For non-blocking IO check. */
+  if (peer->status == Connect)
+    {
+      bgp_connect_check (peer);
+      goto done;
+    }
+  else
+    {
+      if (peer->fd < 0)
+	{
+	  zlog_err ("bgp_read peer's fd is negative value %d", peer->fd);
+	  return -1;
+	}
+      BGP_READ_ON (peer->t_read, bgp_read, peer->fd);
+    }
+
+  bgp_pipeline_start (&tv);
+  ret = bgp_read_packet (peer);
+  bgp_pipeline_time (BGP_PIPELINE_READ, &tv);
+  if (ret < 0) 
+    goto done;
+
+  if (bgp_process_input (peer))
+    bgp_process_schedule (peer);
 
  done:
   if (CHECK_FLAG (peer->sflags, PEER_STATUS_ACCEPT_PEER))
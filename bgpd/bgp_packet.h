@@ -25,6 +25,7 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #define BGP_TOTAL_ATTR_LEN    2U
 #define BGP_UNFEASIBLE_LEN    2U
 #define BGP_WRITE_PACKET_MAX 10U
+#define BGP_PACKET_POOL_MAX 256U
 
 /* When to refresh */
 #define REFRESH_IMMEDIATE 1
@@ -52,6 +53,12 @@ extern void bgp_default_update_send (struct peer *, struct attr *,
 			      afi_t, safi_t, struct peer *);
 extern void bgp_default_withdraw_send (struct peer *, afi_t, safi_t);
 
+extern struct stream *bgp_packet_copy (struct stream *);
+extern struct stream *bgp_packet_view (struct stream *);
+extern void bgp_packet_free (struct stream *);
+extern void bgp_packet_clean (struct peer *);
+
 extern int bgp_capability_receive (struct peer *, bgp_size_t);
+extern int bgp_update_receive (struct peer *, bgp_size_t);
 
 #endif /* _QUAGGA_BGP_PACKET_H */
@@ -0,0 +1,159 @@
+/* BGP UPDATE input pipeline accounting.
+
+This file is part of GNU Zebra.
+
+GNU Zebra is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation; either version 2, or (at your option) any
+later version.
+
+GNU Zebra is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GNU Zebra; see the file COPYING.  If not, write to the Free
+Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.  */
+
+/* Time spent, and work done, in each stage between a byte arriving on
+   a peer socket and the best path for its prefix being chosen.  The
+   items per second a stage manages on its own time is how fast routes
+   could come in if that stage were all there was, which tells where
+   taking a full table from several peers at once is spent.  */
+
+#include <zebra.h>
+
+#include "command.h"
+#include "prefix.h"
+#include "thread.h"
+
+#include "bgpd/bgpd.h"
+#include "bgpd/bgp_table.h"
+#include "bgpd/bgp_route.h"
+#include "bgpd/bgp_pipeline.h"
+
+struct bgp_pipeline_stat
+{
+  unsigned long items;
+  unsigned long long usec;
+};
+
+static struct bgp_pipeline_stat pipeline[BGP_PIPELINE_STAGE_MAX];
+
+static const struct
+{
+  const char *name;
+  const char *unit;
+} pipeline_desc[BGP_PIPELINE_STAGE_MAX] =
+{
+  { "read",	"bytes" },
+  { "decode",	"UPDATEs" },
+  { "intern",	"attrs" },
+  { "rib",	"prefixes" },
+  { "bestpath",	"nodes" },
+};
+
+/* Note the start of the first stage. */
+void
+bgp_pipeline_start (struct timeval *tv)
+{
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, tv);
+}
+
+/* Charge the time since TV to STAGE, and move TV on to now, which is
+   where the next stage starts. */
+void
+bgp_pipeline_time (enum bgp_pipeline_stage stage, struct timeval *tv)
+{
+  struct timeval now;
+
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, &now);
+  pipeline[stage].usec += (now.tv_sec - tv->tv_sec) * 1000000LL
+			  + (now.tv_usec - tv->tv_usec);
+  *tv = now;
+}
+
+/* The same for STAGE done inside PARENT, whose time it is not. */
+void
+bgp_pipeline_time_within (enum bgp_pipeline_stage stage,
+			  enum bgp_pipeline_stage parent, struct timeval *tv)
+{
+  unsigned long long usec = pipeline[stage].usec;
+
+  bgp_pipeline_time (stage, tv);
+  pipeline[parent].usec -= pipeline[stage].usec - usec;
+}
+
+void
+bgp_pipeline_count (enum bgp_pipeline_stage stage, unsigned long items)
+{
+  pipeline[stage].items += items;
+}
+
+DEFUN (show_ip_bgp_pipeline,
+       show_ip_bgp_pipeline_cmd,
+       "show ip bgp pipeline",
+       SHOW_STR
+       IP_STR
+       BGP_STR
+       "UPDATE input pipeline statistics\n")
+{
+  unsigned long long total = 0;
+  int i;
+
+  for (i = 0; i < BGP_PIPELINE_STAGE_MAX; i++)
+    total += pipeline[i].usec;
+
+  vty_out (vty, "%-10s %12s %-9s %10s %12s %6s%s",
+	   "Stage", "Items", "", "Time(ms)", "Items/sec", "Share",
+	   VTY_NEWLINE);
+
+  for (i = 0; i < BGP_PIPELINE_STAGE_MAX; i++)
+    vty_out (vty, "%-10s %12lu %-9s %10.1f %12llu %5.1f%%%s",
+	     pipeline_desc[i].name, pipeline[i].items, pipeline_desc[i].unit,
+	     pipeline[i].usec / 1000.0,
+	     pipeline[i].usec
+	     ? pipeline[i].items * 1000000ULL / pipeline[i].usec : 0ULL,
+	     total ? 100.0 * pipeline[i].usec / total : 0.0,
+	     VTY_NEWLINE);
+
+  vty_out (vty, "%sProcess queue: %lu queued, %lu batches, %lu yields%s",
+	   VTY_NEWLINE, bgp_process_stats.queued, bgp_process_stats.batches,
+	   bgp_process_stats.yields, VTY_NEWLINE);
+  vty_out (vty, "  %lu requests, %lu coalesced (%.1f%%)%s",
+	   bgp_process_stats.requests, bgp_process_stats.coalesced,
+	   bgp_process_stats.requests
+	   ? 100.0 * bgp_process_stats.coalesced / bgp_process_stats.requests
+	   : 0.0, VTY_NEWLINE);
+  vty_out (vty, "Best path: %lu incremental, %lu full selections%s",
+	   bgp_process_stats.incremental, bgp_process_stats.full, VTY_NEWLINE);
+  vty_out (vty, "Outbound attributes: %lu shared, %lu copied%s",
+	   bgp_process_stats.announce_shared, bgp_process_stats.announce_copied,
+	   VTY_NEWLINE);
+  vty_out (vty, "Route-map memo: %lu entries, %lu lookups, %lu hits (%.1f%%)%s",
+	   bgp_rmap_memo_stats.entries,
+	   bgp_rmap_memo_stats.lookups, bgp_rmap_memo_stats.hits,
+	   bgp_rmap_memo_stats.lookups
+	   ? 100.0 * bgp_rmap_memo_stats.hits / bgp_rmap_memo_stats.lookups
+	   : 0.0, VTY_NEWLINE);
+
+  return CMD_SUCCESS;
+}
+
+ALIAS (show_ip_bgp_pipeline,
+       show_bgp_pipeline_cmd,
+       "show bgp pipeline",
+       SHOW_STR
+       BGP_STR
+       "UPDATE input pipeline statistics\n")
+
+void
+bgp_pipeline_init (void)
+{
+  install_element (VIEW_NODE, &show_ip_bgp_pipeline_cmd);
+  install_element (VIEW_NODE, &show_bgp_pipeline_cmd);
+  install_element (ENABLE_NODE, &show_ip_bgp_pipeline_cmd);
+  install_element (ENABLE_NODE, &show_bgp_pipeline_cmd);
+}
@@ -0,0 +1,42 @@
+/* BGP UPDATE input pipeline accounting.
+
+This file is part of GNU Zebra.
+
+GNU Zebra is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation; either version 2, or (at your option) any
+later version.
+
+GNU Zebra is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GNU Zebra; see the file COPYING.  If not, write to the Free
+Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.  */
+
+#ifndef _QUAGGA_BGP_PIPELINE_H
+#define _QUAGGA_BGP_PIPELINE_H
+
+/* The stages a received route goes through.  */
+enum bgp_pipeline_stage
+{
+  BGP_PIPELINE_READ,		/* socket read, in bytes */
+  BGP_PIPELINE_DECODE,		/* UPDATE framing, attribute and NLRI checks */
+  BGP_PIPELINE_INTERN,		/* attribute interning, per prefix */
+  BGP_PIPELINE_RIB,		/* Adj-RIB-In and RIB changes, per prefix */
+  BGP_PIPELINE_BESTPATH,	/* bgp_process() work queue, per node */
+  BGP_PIPELINE_STAGE_MAX,
+};
+
+extern void bgp_pipeline_start (struct timeval *);
+extern void bgp_pipeline_time (enum bgp_pipeline_stage, struct timeval *);
+extern void bgp_pipeline_time_within (enum bgp_pipeline_stage,
+				      enum bgp_pipeline_stage,
+				      struct timeval *);
+extern void bgp_pipeline_count (enum bgp_pipeline_stage, unsigned long);
+extern void bgp_pipeline_init (void);
+
+#endif /* _QUAGGA_BGP_PIPELINE_H */
@@ -0,0 +1,316 @@
+/* BGP per-peer entry pools.
+
+This file is part of GNU Zebra.
+
+GNU Zebra is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation; either version 2, or (at your option) any
+later version.
+
+GNU Zebra is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GNU Zebra; see the file COPYING.  If not, write to the Free
+Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.  */
+
+/* A full table is a path per prefix per peer, often with an ancillary
+   for nexthop tracking, and an Adj-RIB-Out entry per prefix per peer
+   announced to, or an Adj-RIB-In one with soft-reconfiguration
+   inbound; the allocator's own overhead would be a good part of each.  So they are handed out of blocks kept per
+   peer and per kind: entries of a peer end up next to each other,
+   freed ones are reused by the same peer, and a block is released once
+   none of its entries is in use, so a peer that goes from a full table
+   to a few prefixes gives the memory back.
+
+   It also makes what a peer holds reachable from the peer, which is
+   how its routes are cleared when it goes down, see bgp_clear_route(),
+   rather than by looking for them all over the tables.  */
+
+#include <zebra.h>
+
+#include "command.h"
+#include "vty.h"
+#include "prefix.h"
+#include "memory.h"
+
+#include "bgpd/bgpd.h"
+#include "bgpd/bgp_table.h"
+#include "bgpd/bgp_route.h"
+#include "bgpd/bgp_advertise.h"
+#include "bgpd/bgp_pool.h"
+
+#define BGP_POOL_BLOCK_SIZE	1024
+
+/* Followed by BGP_POOL_BLOCK_SIZE entries of the pool's kind.  */
+struct bgp_pool_block
+{
+  /* On the pool's list of blocks with entries left to hand out. */
+  struct bgp_pool_block *next;
+  struct bgp_pool_block *prev;
+
+  /* Freed entries of the block, linked through their first word. */
+  void *free;
+
+  /* Entries handed out of this block so far, and those in use. */
+  unsigned int used;
+  unsigned int count;
+};
+
+/* What each kind of entry is, and totals over all peers.  */
+static struct bgp_pool_kind
+{
+  int mtype;
+  size_t size;
+
+  /* Where the entry points to its peer, which is cleared as the entry
+     is freed for walks to skip it.  Ancillaries have no such pointer,
+     they are not walked.  */
+  size_t peer;
+
+  unsigned long count;
+  unsigned long blocks;
+} bgp_pool_kind[BGP_POOL_MAX] =
+{
+  { MTYPE_BGP_ROUTE, sizeof (struct bgp_info),
+    offsetof (struct bgp_info, peer), 0, 0 },
+  { MTYPE_BGP_ROUTE, sizeof (struct bgp_info_extra), 0, 0, 0 },
+  { MTYPE_BGP_ADJ_IN, sizeof (struct bgp_adj_in),
+    offsetof (struct bgp_adj_in, peer), 0, 0 },
+  { MTYPE_BGP_ADJ_OUT, sizeof (struct bgp_adj_out),
+    offsetof (struct bgp_adj_out, peer), 0, 0 },
+};
+
+#define BGP_POOL_BLOCK_BYTES(K) \
+  (sizeof (struct bgp_pool_block) + BGP_POOL_BLOCK_SIZE * (K)->size)
+#define BGP_POOL_ENTRY(B,K,I) \
+  ((char *) ((B) + 1) + (K)->size * (I))
+#define BGP_POOL_ENTRY_PEER(E,K) \
+  (*(struct peer **) ((char *) (E) + (K)->peer))
+
+/* Index of the first of POOL's blocks, which are kept by address, at
+   or above P.  An entry is in the block before that. */
+static unsigned int
+bgp_pool_block_index (struct bgp_pool *pool, void *p)
+{
+  unsigned int lo = 0, hi = pool->nblocks, mid;
+
+  while (lo < hi)
+    {
+      mid = (lo + hi) / 2;
+      if ((char *) pool->blocks[mid] < (char *) p)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+static void
+bgp_pool_avail_add (struct bgp_pool *pool, struct bgp_pool_block *block)
+{
+  block->prev = NULL;
+  block->next = pool->avail;
+  if (pool->avail)
+    pool->avail->prev = block;
+  pool->avail = block;
+}
+
+static void
+bgp_pool_avail_del (struct bgp_pool *pool, struct bgp_pool_block *block)
+{
+  if (block->next)
+    block->next->prev = block->prev;
+  if (block->prev)
+    block->prev->next = block->next;
+  else
+    pool->avail = block->next;
+}
+
+static struct bgp_pool_block *
+bgp_pool_block_new (struct bgp_pool *pool, struct bgp_pool_kind *kind)
+{
+  struct bgp_pool_block *block;
+  unsigned int i;
+
+  block = XMALLOC (kind->mtype, BGP_POOL_BLOCK_BYTES (kind));
+  block->free = NULL;
+  block->used = block->count = 0;
+
+  if (pool->nblocks == pool->maxblocks)
+    {
+      pool->maxblocks = pool->maxblocks ? pool->maxblocks * 2 : 8;
+      pool->blocks = XREALLOC (kind->mtype, pool->blocks,
+			       pool->maxblocks * sizeof (block));
+    }
+  i = bgp_pool_block_index (pool, block);
+  memmove (&pool->blocks[i + 1], &pool->blocks[i],
+	   (pool->nblocks - i) * sizeof (block));
+  pool->blocks[i] = block;
+  pool->nblocks++;
+  kind->blocks++;
+
+  bgp_pool_avail_add (pool, block);
+  return block;
+}
+
+/* Release the Ith block of POOL, which has no entries in use. */
+static void
+bgp_pool_block_free (struct bgp_pool *pool, struct bgp_pool_kind *kind,
+		     unsigned int i)
+{
+  struct bgp_pool_block *block = pool->blocks[i];
+
+  bgp_pool_avail_del (pool, block);
+  pool->nblocks--;
+  memmove (&pool->blocks[i], &pool->blocks[i + 1],
+	   (pool->nblocks - i) * sizeof (block));
+  XFREE (kind->mtype, block);
+  kind->blocks--;
+}
+
+/* A zeroed entry of kind TYPE for PEER. */
+void *
+bgp_pool_alloc (struct peer *peer, enum bgp_pool_type type)
+{
+  struct bgp_pool_kind *kind = &bgp_pool_kind[type];
+  struct bgp_pool *pool = &peer->pool[type];
+  struct bgp_pool_block *block;
+  void *entry;
+
+  if (! pool->count++)
+    peer_lock (peer); /* bgp_pool peer reference */
+  kind->count++;
+
+  if ((block = pool->avail) == NULL)
+    block = bgp_pool_block_new (pool, kind);
+
+  if ((entry = block->free) != NULL)
+    block->free = *(void **) entry;
+  else
+    entry = BGP_POOL_ENTRY (block, kind, block->used++);
+
+  if (++block->count == BGP_POOL_BLOCK_SIZE)
+    bgp_pool_avail_del (pool, block);
+
+  memset (entry, 0, kind->size);
+  return entry;
+}
+
+/* Release the Ith block of POOL if none of its entries is in use,
+   unless it is the only one with room left, so that a prefix coming
+   and going does not take a block with it each time. */
+static void
+bgp_pool_block_release (struct bgp_pool *pool, struct bgp_pool_kind *kind,
+			unsigned int i)
+{
+  struct bgp_pool_block *block = pool->blocks[i];
+
+  if (! block->count && (pool->avail != block || block->next))
+    bgp_pool_block_free (pool, kind, i);
+}
+
+/* Drop a count of the pool, releasing its blocks with the last. */
+static void
+bgp_pool_unref (struct peer *peer, enum bgp_pool_type type)
+{
+  struct bgp_pool_kind *kind = &bgp_pool_kind[type];
+  struct bgp_pool *pool = &peer->pool[type];
+
+  if (--pool->count)
+    return;
+
+  while (pool->nblocks)
+    bgp_pool_block_free (pool, kind, pool->nblocks - 1);
+  XFREE (kind->mtype, pool->blocks);
+  pool->maxblocks = 0;
+
+  peer_unlock (peer); /* bgp_pool peer reference */
+}
+
+void
+bgp_pool_free (struct peer *peer, enum bgp_pool_type type, void *entry)
+{
+  struct bgp_pool_kind *kind = &bgp_pool_kind[type];
+  struct bgp_pool *pool = &peer->pool[type];
+  struct bgp_pool_block *block;
+  unsigned int i;
+
+  kind->count--;
+  BGP_POOL_ENTRY_PEER (entry, kind) = NULL;
+
+  i = bgp_pool_block_index (pool, entry) - 1;
+  block = pool->blocks[i];
+
+  *(void **) entry = block->free;
+  block->free = entry;
+  if (block->count-- == BGP_POOL_BLOCK_SIZE)
+    bgp_pool_avail_add (pool, block);
+
+  /* A walk goes on over the blocks, see bgp_pool_walk(). */
+  if (! pool->walking)
+    bgp_pool_block_release (pool, kind, i);
+
+  bgp_pool_unref (peer, type);
+}
+
+/* Call FUNC with each entry of kind TYPE that PEER holds, and ARG.
+   FUNC may free entries of the kind, but not allocate any.  */
+void
+bgp_pool_walk (struct peer *peer, enum bgp_pool_type type,
+	       void (*func) (void *, void *), void *arg)
+{
+  struct bgp_pool_kind *kind = &bgp_pool_kind[type];
+  struct bgp_pool *pool = &peer->pool[type];
+  struct bgp_pool_block *block;
+  unsigned int i, j;
+  void *entry;
+
+  assert (type != BGP_POOL_INFO_EXTRA);
+
+  if (! pool->count)
+    return;
+
+  /* The blocks stay until the walk is done, whatever FUNC frees; those
+     left empty are released after. */
+  pool->count++;
+  pool->walking = 1;
+
+  for (i = 0; i < pool->nblocks; i++)
+    {
+      block = pool->blocks[i];
+      for (j = 0; j < block->used; j++)
+	{
+	  entry = BGP_POOL_ENTRY (block, kind, j);
+	  if (BGP_POOL_ENTRY_PEER (entry, kind) == peer)
+	    (*func) (entry, arg);
+	}
+    }
+
+  pool->walking = 0;
+  for (i = pool->nblocks; i > 0; i--)
+    bgp_pool_block_release (pool, kind, i - 1);
+
+  bgp_pool_unref (peer, type);
+}
+
+/* Memory held for entries of kind TYPE by PEER, or by all peers when
+   PEER is NULL.  The number of entries in use goes to *COUNT. */
+size_t
+bgp_pool_memory (struct peer *peer, enum bgp_pool_type type,
+		 unsigned long *count)
+{
+  struct bgp_pool_kind *kind = &bgp_pool_kind[type];
+
+  if (! peer)
+    {
+      *count = kind->count;
+      return kind->blocks * BGP_POOL_BLOCK_BYTES (kind);
+    }
+
+  *count = peer->pool[type].count;
+  return peer->pool[type].nblocks * BGP_POOL_BLOCK_BYTES (kind);
+}
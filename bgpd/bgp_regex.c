@@ -91,3 +91,547 @@ bgp_regex_free (regex_t *regex)
   regfree (regex);
   XFREE (MTYPE_BGP_REGEXP, regex);
 }
+
+/* AS path patterns compiled to a DFA.
+
+   Most as-path access-lists only use AS numbers, `_', the anchors,
+   `.', bracket expressions, grouping, alternation and the `*', `+'
+   and `?' repetitions.  bgp_regcomp_dfa() compiles patterns made of
+   those into a DFA which is run over the characters of the AS
+   numbers as they are read out of the path segments, so matching
+   needs neither aspath->str nor regexec()'s backtracking.  Anything
+   else, back-references and intervals for instance, is refused, and
+   the caller keeps using bgp_regcomp() and bgp_regexec().
+
+   The DFA sees exactly the text aspath_make_str_count() renders.
+   `^' and `$' are assertions about the position rather than
+   characters, so every state has one set of transitions for the last
+   character of the path and another for all others. */
+
+/* All characters a rendered AS path is made of. */
+static const char dfa_chars[] = "0123456789 ,{}()[]";
+#define DFA_NSYM	18
+#define DFA_SYM_SPACE	10
+#define DFA_SYM_COMMA	11
+#define DFA_ALL		((1 << DFA_NSYM) - 1)
+
+#define DFA_NFA_MAX	256
+#define DFA_STATE_MAX	1024
+
+enum dfa_nfa_type
+{
+  NFA_EPS,			/* empty, to out and out1 */
+  NFA_SET,			/* a character in set, to out */
+  NFA_BOL,			/* start of the path, to out */
+  NFA_EOL,			/* end of the path, to out */
+  NFA_MATCH,
+};
+
+struct dfa_nfa
+{
+  u_char type;
+  u_int32_t set;
+  short out;
+  short out1;
+};
+
+/* A piece of NFA with one way in and one way out: END is an NFA_EPS
+   whose out is patched when the piece is joined to the next one. */
+struct dfa_frag
+{
+  short start;
+  short end;
+};
+
+struct dfa_compile
+{
+  const char *p;
+  int error;
+  int nnfa;
+  struct dfa_nfa nfa[DFA_NFA_MAX];
+};
+
+/* What a DFA state says about the path read so far. */
+#define DFA_LIVE	0	/* no answer yet */
+#define DFA_MATCH	1	/* matches, whatever follows */
+#define DFA_DEAD	2	/* cannot match, whatever follows */
+
+/* Set of NFA states. */
+struct dfa_set
+{
+  u_int32_t w[DFA_NFA_MAX / 32];
+};
+
+struct aspath_dfa
+{
+  int nstates;
+  u_int16_t init[2];		/* for a path with text, and an empty one */
+  u_char *accept;		/* DFA_LIVE, DFA_MATCH or DFA_DEAD */
+  u_int16_t (*next)[DFA_NSYM][2];	/* [state][char][last char?] */
+};
+
+static int
+dfa_sym (char c)
+{
+  const char *p;
+
+  if (c == '\0' || (p = strchr (dfa_chars, c)) == NULL)
+    return -1;
+  return p - dfa_chars;
+}
+
+static short
+dfa_nfa_new (struct dfa_compile *c, u_char type, u_int32_t set)
+{
+  struct dfa_nfa *n;
+
+  if (c->nnfa == DFA_NFA_MAX)
+    {
+      c->error = 1;
+      return 0;
+    }
+  n = &c->nfa[c->nnfa];
+  n->type = type;
+  n->set = set;
+  n->out = n->out1 = -1;
+  return c->nnfa++;
+}
+
+static struct dfa_frag
+dfa_frag_new (struct dfa_compile *c, u_char type, u_int32_t set)
+{
+  struct dfa_frag f;
+
+  f.start = dfa_nfa_new (c, type, set);
+  f.end = dfa_nfa_new (c, NFA_EPS, 0);
+  c->nfa[f.start].out = f.end;
+  return f;
+}
+
+static struct dfa_frag
+dfa_frag_alt (struct dfa_compile *c, struct dfa_frag a, struct dfa_frag b)
+{
+  struct dfa_frag f;
+
+  f.start = dfa_nfa_new (c, NFA_EPS, 0);
+  f.end = dfa_nfa_new (c, NFA_EPS, 0);
+  c->nfa[f.start].out = a.start;
+  c->nfa[f.start].out1 = b.start;
+  c->nfa[a.end].out = f.end;
+  c->nfa[b.end].out = f.end;
+  return f;
+}
+
+/* Bracket expression, after the `['. */
+static u_int32_t
+dfa_parse_bracket (struct dfa_compile *c)
+{
+  u_int32_t set = 0;
+  int negate = 0;
+  int first = 1;
+  int lo, hi, i;
+
+  if (*c->p == '^')
+    {
+      negate = 1;
+      c->p++;
+    }
+
+  while (*c->p != ']' || first)
+    {
+      first = 0;
+
+      /* Classes and collating elements are left to regcomp(), and so
+	 is `_', which bgp_regcomp() expands even in here. */
+      if (*c->p == '\0' || *c->p == '_'
+	  || (*c->p == '[' && strchr (":.=", c->p[1])))
+	{
+	  c->error = 1;
+	  return 0;
+	}
+
+      lo = hi = (u_char) *c->p++;
+      if (c->p[0] == '-' && c->p[1] != ']' && c->p[1] != '\0')
+	{
+	  hi = (u_char) c->p[1];
+	  c->p += 2;
+	  if (hi < lo || hi == '_' || hi == '[')
+	    {
+	      c->error = 1;
+	      return 0;
+	    }
+	}
+
+      for (i = 0; i < DFA_NSYM; i++)
+	if (dfa_chars[i] >= lo && dfa_chars[i] <= hi)
+	  set |= 1 << i;
+    }
+  c->p++;
+
+  return negate ? DFA_ALL & ~set : set;
+}
+
+static struct dfa_frag dfa_parse_alt (struct dfa_compile *);
+
+static struct dfa_frag
+dfa_parse_atom (struct dfa_compile *c)
+{
+  struct dfa_frag f;
+  int sym;
+
+  switch (*c->p++)
+    {
+    case '(':
+      f = dfa_parse_alt (c);
+      if (*c->p++ != ')')
+	c->error = 1;
+      return f;
+    case '[':
+      return dfa_frag_new (c, NFA_SET, dfa_parse_bracket (c));
+    case '.':
+      return dfa_frag_new (c, NFA_SET, DFA_ALL);
+    case '^':
+      return dfa_frag_new (c, NFA_BOL, 0);
+    case '$':
+      return dfa_frag_new (c, NFA_EOL, 0);
+    case '_':
+      /* (^|[,{}() ]|$) */
+      f = dfa_frag_new (c, NFA_SET, (1 << DFA_SYM_SPACE) | (1 << DFA_SYM_COMMA)
+			| (1 << dfa_sym ('{')) | (1 << dfa_sym ('}'))
+			| (1 << dfa_sym ('(')) | (1 << dfa_sym (')')));
+      f = dfa_frag_alt (c, dfa_frag_new (c, NFA_BOL, 0), f);
+      return dfa_frag_alt (c, f, dfa_frag_new (c, NFA_EOL, 0));
+    case '\\': case '{': case '}': case '*': case '+': case '?':
+      c->error = 1;
+      return dfa_frag_new (c, NFA_EPS, 0);
+    default:
+      /* Characters that never appear in a path match nothing. */
+      sym = dfa_sym (c->p[-1]);
+      return dfa_frag_new (c, NFA_SET, sym < 0 ? 0 : 1 << sym);
+    }
+}
+
+static struct dfa_frag
+dfa_parse_piece (struct dfa_compile *c)
+{
+  struct dfa_frag f, a;
+  char op;
+
+  op = *c->p;
+  a = dfa_parse_atom (c);
+  if (! strchr ("*+?", *c->p) || *c->p == '\0')
+    return a;
+
+  /* Repeated anchors and repeated repetitions are left to regcomp(). */
+  if (op == '^' || op == '$' || (c->p[1] && strchr ("*+?{", c->p[1])))
+    c->error = 1;
+
+  op = *c->p++;
+  f.start = dfa_nfa_new (c, NFA_EPS, 0);
+  f.end = dfa_nfa_new (c, NFA_EPS, 0);
+  c->nfa[f.start].out = a.start;
+  if (op != '+')
+    c->nfa[f.start].out1 = f.end;
+  c->nfa[a.end].out = f.end;
+  if (op != '?')
+    c->nfa[a.end].out1 = a.start;
+  return f;
+}
+
+static struct dfa_frag
+dfa_parse_branch (struct dfa_compile *c)
+{
+  struct dfa_frag f, piece;
+
+  f.start = f.end = dfa_nfa_new (c, NFA_EPS, 0);
+  while (! c->error && *c->p != '\0' && *c->p != '|' && *c->p != ')')
+    {
+      piece = dfa_parse_piece (c);
+      c->nfa[f.end].out = piece.start;
+      f.end = piece.end;
+    }
+  return f;
+}
+
+static struct dfa_frag
+dfa_parse_alt (struct dfa_compile *c)
+{
+  struct dfa_frag f;
+
+  f = dfa_parse_branch (c);
+  while (! c->error && *c->p == '|')
+    {
+      c->p++;
+      f = dfa_frag_alt (c, f, dfa_parse_branch (c));
+    }
+  return f;
+}
+
+/* Add NFA state N and everything reachable from it without reading a
+   character to SET. */
+static void
+dfa_closure (struct dfa_compile *c, struct dfa_set *set, short n,
+	     int bol, int eol)
+{
+  struct dfa_nfa *nfa;
+
+  while (n >= 0)
+    {
+      if (set->w[n / 32] & (1U << (n % 32)))
+	return;
+      set->w[n / 32] |= 1U << (n % 32);
+
+      nfa = &c->nfa[n];
+      switch (nfa->type)
+	{
+	case NFA_EPS:
+	  dfa_closure (c, set, nfa->out1, bol, eol);
+	  n = nfa->out;
+	  break;
+	case NFA_BOL:
+	  n = bol ? nfa->out : -1;
+	  break;
+	case NFA_EOL:
+	  n = eol ? nfa->out : -1;
+	  break;
+	default:
+	  return;
+	}
+    }
+}
+
+static int
+dfa_set_add (struct aspath_dfa *dfa, struct dfa_set **sets,
+	     struct dfa_set *set, struct dfa_compile *c, short match)
+{
+  int i;
+
+  for (i = 0; i < dfa->nstates; i++)
+    if (memcmp (&(*sets)[i], set, sizeof (struct dfa_set)) == 0)
+      return i;
+
+  if (dfa->nstates == DFA_STATE_MAX)
+    return -1;
+
+  if (dfa->nstates % 64 == 0)
+    {
+      *sets = XREALLOC (MTYPE_TMP, *sets,
+			(dfa->nstates + 64) * sizeof (struct dfa_set));
+      dfa->accept = XREALLOC (MTYPE_BGP_REGEXP_DFA, dfa->accept,
+			      dfa->nstates + 64);
+      dfa->next = XREALLOC (MTYPE_BGP_REGEXP_DFA, dfa->next,
+			    (dfa->nstates + 64) * sizeof (*dfa->next));
+    }
+
+  (*sets)[i] = *set;
+  dfa->accept[i] = (set->w[match / 32] & (1U << (match % 32)))
+		   ? DFA_MATCH : DFA_LIVE;
+  return dfa->nstates++;
+}
+
+void
+bgp_regex_dfa_free (struct aspath_dfa *dfa)
+{
+  if (dfa->accept)
+    XFREE (MTYPE_BGP_REGEXP_DFA, dfa->accept);
+  if (dfa->next)
+    XFREE (MTYPE_BGP_REGEXP_DFA, dfa->next);
+  XFREE (MTYPE_BGP_REGEXP_DFA, dfa);
+}
+
+/* Compile an AS path regular expression, NULL if it uses anything the
+   DFA does not do or grows too big. */
+struct aspath_dfa *
+bgp_regcomp_dfa (const char *regstr)
+{
+  struct dfa_compile *c;
+  struct aspath_dfa *dfa;
+  struct dfa_set *sets = NULL;
+  struct dfa_set set;
+  struct dfa_frag f;
+  short start, any, match;
+  int i, n, sym, last, next, changed;
+
+  c = XCALLOC (MTYPE_TMP, sizeof (struct dfa_compile));
+  c->p = regstr;
+
+  /* .*(regstr) and a match state: regexec() looks for the pattern
+     anywhere in the path. */
+  start = dfa_nfa_new (c, NFA_EPS, 0);
+  any = dfa_nfa_new (c, NFA_SET, DFA_ALL);
+  f = dfa_parse_alt (c);
+  if (*c->p != '\0')
+    c->error = 1;
+  match = dfa_nfa_new (c, NFA_MATCH, 0);
+  c->nfa[start].out = f.start;
+  c->nfa[start].out1 = any;
+  c->nfa[any].out = start;
+  c->nfa[f.end].out = match;
+
+  if (c->error)
+    {
+      XFREE (MTYPE_TMP, c);
+      return NULL;
+    }
+
+  dfa = XCALLOC (MTYPE_BGP_REGEXP_DFA, sizeof (struct aspath_dfa));
+
+  for (last = 0; last < 2; last++)
+    {
+      memset (&set, 0, sizeof (set));
+      dfa_closure (c, &set, start, 1, last);
+      dfa->init[last] = dfa_set_add (dfa, &sets, &set, c, match);
+    }
+
+  /* States are numbered in the order they are found, so this goes
+     through all of them.  Nothing is looked at after a match. */
+  for (n = 0; n < dfa->nstates && ! c->error; n++)
+    for (sym = 0; sym < DFA_NSYM; sym++)
+      for (last = 0; last < 2; last++)
+	{
+	  if (dfa->accept[n] == DFA_MATCH)
+	    {
+	      dfa->next[n][sym][last] = n;
+	      continue;
+	    }
+
+	  memset (&set, 0, sizeof (set));
+	  for (i = 0; i < c->nnfa; i++)
+	    if ((sets[n].w[i / 32] & (1U << (i % 32)))
+		&& c->nfa[i].type == NFA_SET
+		&& (c->nfa[i].set & (1 << sym)))
+	      dfa_closure (c, &set, c->nfa[i].out, 0, last);
+
+	  next = dfa_set_add (dfa, &sets, &set, c, match);
+	  if (next < 0)
+	    {
+	      c->error = 1;
+	      break;
+	    }
+	  dfa->next[n][sym][last] = next;
+	}
+
+  if (sets)
+    XFREE (MTYPE_TMP, sets);
+
+  /* States that no longer lead to a match answer early, which is what
+     keeps anchored patterns as quick as regexec() on paths that fail
+     at the first character.  Marked DFA_DEAD first, then brought back
+     for as long as one of them steps into a state that is not. */
+  for (n = 0; n < dfa->nstates && ! c->error; n++)
+    if (dfa->accept[n] == DFA_LIVE)
+      dfa->accept[n] = DFA_DEAD;
+  do
+    {
+      changed = 0;
+      for (n = 0; n < dfa->nstates && ! c->error; n++)
+	if (dfa->accept[n] == DFA_DEAD)
+	  for (sym = 0; sym < DFA_NSYM; sym++)
+	    for (last = 0; last < 2; last++)
+	      if (dfa->accept[dfa->next[n][sym][last]] != DFA_DEAD)
+		{
+		  dfa->accept[n] = DFA_LIVE;
+		  changed = 1;
+		  sym = DFA_NSYM;
+		  break;
+		}
+    }
+  while (changed);
+
+  if (c->error)
+    {
+      bgp_regex_dfa_free (dfa);
+      dfa = NULL;
+    }
+  XFREE (MTYPE_TMP, c);
+  return dfa;
+}
+
+/* Where a DFA run got to.  The character last read is only fed in
+   once it is known whether it is the last one. */
+struct dfa_run
+{
+  const struct aspath_dfa *dfa;
+  int state;
+  int pending;
+};
+
+static int
+dfa_feed (struct dfa_run *run, int sym)
+{
+  if (run->pending < 0)
+    run->state = run->dfa->init[0];
+  else
+    run->state = run->dfa->next[run->state][run->pending][0];
+  run->pending = sym;
+  return run->dfa->accept[run->state] != DFA_LIVE;
+}
+
+static int
+dfa_feed_asn (struct dfa_run *run, as_t as)
+{
+  u_char digit[10];
+  int n = 0;
+
+  do
+    {
+      digit[n++] = as % 10;
+      as /= 10;
+    }
+  while (as);
+
+  while (n)
+    if (dfa_feed (run, digit[--n]))
+      return 1;
+  return 0;
+}
+
+/* Same answer as bgp_regexec() with the regex_t of the same pattern. */
+int
+bgp_regexec_dfa (const struct aspath_dfa *dfa, struct aspath *aspath)
+{
+  struct dfa_run run = { dfa, 0, -1 };
+  struct assegment *seg;
+  int start, end, sep;
+  int i;
+
+  for (seg = aspath->segments; seg; seg = seg->next)
+    {
+      switch (seg->type)
+	{
+	case AS_SET:
+	  start = dfa_sym ('{'), end = dfa_sym ('}'), sep = DFA_SYM_COMMA;
+	  break;
+	case AS_CONFED_SET:
+	  start = dfa_sym ('['), end = dfa_sym (']'), sep = DFA_SYM_COMMA;
+	  break;
+	case AS_CONFED_SEQUENCE:
+	  start = dfa_sym ('('), end = dfa_sym (')'), sep = DFA_SYM_SPACE;
+	  break;
+	default:
+	  start = end = -1, sep = DFA_SYM_SPACE;
+	  break;
+	}
+
+      if (start >= 0 && dfa_feed (&run, start))
+	goto done;
+      for (i = 0; i < seg->length; i++)
+	{
+	  if (dfa_feed_asn (&run, seg->as[i]))
+	    goto done;
+	  if (i < seg->length - 1 && dfa_feed (&run, sep))
+	    goto done;
+	}
+      if (end >= 0 && dfa_feed (&run, end))
+	goto done;
+      if (seg->next && dfa_feed (&run, DFA_SYM_SPACE))
+	goto done;
+    }
+
+  if (run.pending < 0)
+    run.state = dfa->init[1];
+  else
+    run.state = dfa->next[run.state][run.pending][1];
+ done:
+  return dfa->accept[run.state] == DFA_MATCH ? 0 : REG_NOMATCH;
+}
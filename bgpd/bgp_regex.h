@@ -37,4 +37,9 @@ extern void bgp_regex_free (regex_t *regex);
 extern regex_t *bgp_regcomp (const char *str);
 extern int bgp_regexec (regex_t *regex, struct aspath *aspath);
 
+struct aspath_dfa;
+extern struct aspath_dfa *bgp_regcomp_dfa (const char *);
+extern int bgp_regexec_dfa (const struct aspath_dfa *, struct aspath *);
+extern void bgp_regex_dfa_free (struct aspath_dfa *);
+
 #endif /* _QUAGGA_BGP_REGEX_H */
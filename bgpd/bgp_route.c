@@ -52,6 +52,9 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "bgpd/bgp_nexthop.h"
 #include "bgpd/bgp_damp.h"
 #include "bgpd/bgp_advertise.h"
+#include "bgpd/bgp_updgrp.h"
+#include "bgpd/bgp_pipeline.h"
+#include "bgpd/bgp_pool.h"
 #include "bgpd/bgp_zebra.h"
 #include "bgpd/bgp_vty.h"
 
@@ -89,28 +92,35 @@ bgp_afi_node_get (struct bgp_table *table, afi_t afi, safi_t safi, struct prefix
   return rn;
 }
 
+/* Memory held for the paths of all peers and their ancillaries.  The
+   number of paths goes to *COUNT, that of ancillaries to *EXTRA. */
+size_t
+bgp_info_memory (unsigned long *count, unsigned long *extra)
+{
+  return bgp_pool_memory (NULL, BGP_POOL_INFO, count)
+	 + bgp_pool_memory (NULL, BGP_POOL_INFO_EXTRA, extra);
+}
+
 /* Allocate bgp_info_extra */
 static struct bgp_info_extra *
-bgp_info_extra_new (void)
+bgp_info_extra_new (struct peer *peer)
 {
-  struct bgp_info_extra *new;
-  new = XCALLOC (MTYPE_BGP_ROUTE_EXTRA, sizeof (struct bgp_info_extra));
-  return new;
+  return bgp_pool_alloc (peer, BGP_POOL_INFO_EXTRA);
 }
 
 static void
-bgp_info_extra_free (struct bgp_info_extra **extra)
+bgp_info_extra_free (struct bgp_info *ri)
 {
-  if (extra && *extra)
+  if (ri->extra)
     {
-      if ((*extra)->damp_info)
-        bgp_damp_info_free ((*extra)->damp_info, 0);
+      if (ri->extra->damp_info)
+        bgp_damp_info_free (ri->extra->damp_info, 0);
       
-      (*extra)->damp_info = NULL;
+      ri->extra->damp_info = NULL;
       
-      XFREE (MTYPE_BGP_ROUTE_EXTRA, *extra);
+      bgp_pool_free (ri->peer, BGP_POOL_INFO_EXTRA, ri->extra);
       
-      *extra = NULL;
+      ri->extra = NULL;
     }
 }
 
@@ -121,29 +131,36 @@ struct bgp_info_extra *
 bgp_info_extra_get (struct bgp_info *ri)
 {
   if (!ri->extra)
-    ri->extra = bgp_info_extra_new();
+    ri->extra = bgp_info_extra_new (ri->peer);
   return ri->extra;
 }
 
-/* Allocate new bgp info structure. */
+/* Allocate new bgp info structure, for a path from PEER. */
 static struct bgp_info *
-bgp_info_new (void)
+bgp_info_new (struct peer *peer)
 {
-  return XCALLOC (MTYPE_BGP_ROUTE, sizeof (struct bgp_info));
+  struct bgp_info *new;
+
+  new = bgp_pool_alloc (peer, BGP_POOL_INFO);
+  new->peer = peer;
+  return new;
 }
 
 /* Free bgp route information. */
 static void
 bgp_info_free (struct bgp_info *binfo)
 {
+  struct peer *peer = binfo->peer;
+
   if (binfo->attr)
     bgp_attr_unintern (&binfo->attr);
   
-  bgp_info_extra_free (&binfo->extra);
+  bgp_nexthop_path_unlink (binfo);
+  bgp_info_extra_free (binfo);
 
-  peer_unlock (binfo->peer); /* bgp_info peer reference */
+  bgp_pool_free (peer, BGP_POOL_INFO, binfo);
 
-  XFREE (MTYPE_BGP_ROUTE, binfo);
+  peer_unlock (peer); /* bgp_info peer reference */
 }
 
 struct bgp_info *
@@ -180,6 +197,8 @@ bgp_info_unlock (struct bgp_info *binfo)
   return binfo;
 }
 
+static void bgp_info_note (struct bgp_node *, struct bgp_info *, int);
+
 void
 bgp_info_add (struct bgp_node *rn, struct bgp_info *ri)
 {
@@ -192,10 +211,13 @@ bgp_info_add (struct bgp_node *rn, struct bgp_info *ri)
   if (top)
     top->prev = ri;
   rn->info = ri;
+  ri->rn = rn;
   
   bgp_info_lock (ri);
   bgp_lock_node (rn);
   peer_lock (ri->peer); /* bgp_info peer reference */
+
+  bgp_info_note (rn, ri, 1);
 }
 
 /* Do the actual removal of info from RIB, for use by bgp_process 
@@ -209,6 +231,12 @@ bgp_info_reap (struct bgp_node *rn, struct bgp_info *ri)
     ri->prev->next = ri->next;
   else
     rn->info = ri->next;
+
+  if (rn->changed == ri)
+    {
+      rn->changed = NULL;
+      SET_FLAG (rn->flags, BGP_NODE_RESCAN);
+    }
   
   bgp_info_unlock (ri);
   bgp_unlock_node (rn);
@@ -314,29 +342,18 @@ bgp_med_value (struct attr *attr, struct bgp *bgp)
     }
 }
 
-/* Compare two bgp route entity.  br is preferable then return 1. */
+/* Steps 1 to 5 of the decision process.  Return 1 if NEW is
+   preferable, -1 if EXIST is and 0 if they are equal so far.  Between
+   two BGP_ROUTE_NORMAL paths these steps compare plain values of each
+   path, unlike the MED check that follows. */
 static int
-bgp_info_cmp (struct bgp *bgp, struct bgp_info *new, struct bgp_info *exist)
+bgp_info_cmp_pref (struct bgp *bgp, struct bgp_info *new,
+		   struct bgp_info *exist)
 {
   u_int32_t new_pref;
   u_int32_t exist_pref;
-  u_int32_t new_med;
-  u_int32_t exist_med;
   u_int32_t new_weight = 0;
   u_int32_t exist_weight = 0;
-  struct in_addr new_id;
-  struct in_addr exist_id;
-  int new_cluster;
-  int exist_cluster;
-  int internal_as_route = 0;
-  int confed_as_route = 0;
-  int ret;
-
-  /* 0. Null check. */
-  if (new == NULL)
-    return 0;
-  if (exist == NULL)
-    return 1;
 
   /* 1. Weight check. */
   if (new->attr->extra)
@@ -346,7 +363,7 @@ bgp_info_cmp (struct bgp *bgp, struct bgp_info *new, struct bgp_info *exist)
   if (new_weight > exist_weight)
     return 1;
   if (new_weight < exist_weight)
-    return 0;
+    return -1;
 
   /* 2. Local preference check. */
   if (new->attr->flag & ATTR_FLAG_BIT (BGP_ATTR_LOCAL_PREF))
@@ -362,23 +379,23 @@ bgp_info_cmp (struct bgp *bgp, struct bgp_info *new, struct bgp_info *exist)
   if (new_pref > exist_pref)
     return 1;
   if (new_pref < exist_pref)
-    return 0;
+    return -1;
 
   /* 3. Local route check. */
   if (new->sub_type == BGP_ROUTE_STATIC)
     return 1;
   if (exist->sub_type == BGP_ROUTE_STATIC)
-    return 0;
+    return -1;
 
   if (new->sub_type == BGP_ROUTE_REDISTRIBUTE)
     return 1;
   if (exist->sub_type == BGP_ROUTE_REDISTRIBUTE)
-    return 0;
+    return -1;
 
   if (new->sub_type == BGP_ROUTE_AGGREGATE)
     return 1;
   if (exist->sub_type == BGP_ROUTE_AGGREGATE)
-    return 0;
+    return -1;
 
   /* 4. AS path length check. */
   if (! bgp_flag_check (bgp, BGP_FLAG_ASPATH_IGNORE))
@@ -396,7 +413,7 @@ bgp_info_cmp (struct bgp *bgp, struct bgp_info *new, struct bgp_info *exist)
 	  if ( aspath_hops < (exist_hops + exist_confeds))
 	    return 1;
 	  if ( aspath_hops > (exist_hops + exist_confeds))
-	    return 0;
+	    return -1;
 	}
       else
 	{
@@ -405,7 +422,7 @@ bgp_info_cmp (struct bgp *bgp, struct bgp_info *new, struct bgp_info *exist)
 	  if (newhops < exist_hops)
 	    return 1;
           if (newhops > exist_hops)
-	    return 0;
+	    return -1;
 	}
     }
 
@@ -413,7 +430,82 @@ bgp_info_cmp (struct bgp *bgp, struct bgp_info *new, struct bgp_info *exist)
   if (new->attr->origin < exist->attr->origin)
     return 1;
   if (new->attr->origin > exist->attr->origin)
+    return -1;
+
+  return 0;
+}
+
+/* Note that RI is about to change, or has just been added if NEW, so
+   that the best path selection can compare just RI with the current
+   best when nothing else on RN changes before it is processed. */
+static void
+bgp_info_note (struct bgp_node *rn, struct bgp_info *ri, int new)
+{
+  struct bgp_info *select;
+
+  if (rn->changed == ri)
+    return;
+
+  if (rn->changed || CHECK_FLAG (rn->flags, BGP_NODE_RESCAN))
+    {
+      rn->changed = NULL;
+      SET_FLAG (rn->flags, BGP_NODE_RESCAN);
+      return;
+    }
+
+  rn->changed = ri;
+
+  /* Whether RI as it is now can have had a say in choosing the
+     current best path. */
+  if (new || BGP_INFO_HOLDDOWN (ri))
+    {
+      SET_FLAG (rn->flags, BGP_NODE_CHANGED_WORSE);
+      return;
+    }
+  if (ri->sub_type != BGP_ROUTE_NORMAL)
+    return;
+
+  for (select = rn->info; select; select = select->next)
+    if (CHECK_FLAG (select->flags, BGP_INFO_SELECTED))
+      break;
+
+  if (select && select != ri
+      && select->sub_type == BGP_ROUTE_NORMAL
+      && ! BGP_INFO_HOLDDOWN (select)
+      && bgp_info_cmp_pref (ri->peer->bgp, ri, select) < 0)
+    SET_FLAG (rn->flags, BGP_NODE_CHANGED_WORSE);
+}
+
+void
+bgp_info_note_change (struct bgp_node *rn, struct bgp_info *ri)
+{
+  bgp_info_note (rn, ri, 0);
+}
+
+/* Compare two bgp route entity.  br is preferable then return 1. */
+static int
+bgp_info_cmp (struct bgp *bgp, struct bgp_info *new, struct bgp_info *exist)
+{
+  u_int32_t new_med;
+  u_int32_t exist_med;
+  struct in_addr new_id;
+  struct in_addr exist_id;
+  int new_cluster;
+  int exist_cluster;
+  int internal_as_route = 0;
+  int confed_as_route = 0;
+  int ret;
+
+  /* 0. Null check. */
+  if (new == NULL)
     return 0;
+  if (exist == NULL)
+    return 1;
+
+  /* 1. - 5. */
+  ret = bgp_info_cmp_pref (bgp, new, exist);
+  if (ret)
+    return ret > 0;
 
   /* 6. MED check. */
   internal_as_route = (aspath_count_hops (new->attr->aspath) == 0
@@ -667,7 +759,7 @@ bgp_input_modifier (struct peer *peer, struct prefix *p, struct attr *attr,
       SET_FLAG (peer->rmap_type, PEER_RMAP_TYPE_IN); 
 
       /* Apply BGP route map to the attribute. */
-      ret = route_map_apply (ROUTE_MAP_IN (filter), p, RMAP_BGP, &info);
+      ret = bgp_route_map_apply (ROUTE_MAP_IN (filter), p, &info);
 
       peer->rmap_type = 0;
 
@@ -701,7 +793,7 @@ bgp_export_modifier (struct peer *rsclient, struct peer *peer,
       SET_FLAG (rsclient->rmap_type, PEER_RMAP_TYPE_EXPORT);
 
       /* Apply BGP route map to the attribute. */
-      ret = route_map_apply (ROUTE_MAP_EXPORT (filter), p, RMAP_BGP, &info);
+      ret = bgp_route_map_apply (ROUTE_MAP_EXPORT (filter), p, &info);
 
       rsclient->rmap_type = 0;
 
@@ -739,7 +831,7 @@ bgp_import_modifier (struct peer *rsclient, struct peer *peer,
       SET_FLAG (peer->rmap_type, PEER_RMAP_TYPE_IMPORT);
 
       /* Apply BGP route map to the attribute. */
-      ret = route_map_apply (ROUTE_MAP_IMPORT (filter), p, RMAP_BGP, &info);
+      ret = bgp_route_map_apply (ROUTE_MAP_IMPORT (filter), p, &info);
 
       peer->rmap_type = 0;
 
@@ -753,31 +845,16 @@ bgp_import_modifier (struct peer *rsclient, struct peer *peer,
   return RMAP_PERMIT;
 }
 
+/* The part of the announce check which depends on who the peer is,
+   rather than on how its outbound policy is configured. */
 static int
-bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
-		    struct attr *attr, afi_t afi, safi_t safi)
+bgp_announce_check_peer (struct bgp_info *ri, struct peer *peer,
+			 struct prefix *p, afi_t afi, safi_t safi)
 {
-  int ret;
   char buf[SU_ADDRSTRLEN];
-  struct bgp_filter *filter;
-  struct peer *from;
-  struct bgp *bgp;
-  int transparent;
-  int reflect;
-
-  from = ri->peer;
-  filter = &peer->filter[afi][safi];
-  bgp = peer->bgp;
-  
-  if (DISABLE_BGP_ANNOUNCE)
-    return 0;
-
-  /* Do not send announces to RS-clients from the 'normal' bgp_table. */
-  if (CHECK_FLAG(peer->af_flags[afi][safi], PEER_FLAG_RSERVER_CLIENT))
-    return 0;
 
   /* Do not send back route to sender. */
-  if (from == peer)
+  if (ri->peer == peer)
     return 0;
 
   /* If peer's id and route's nexthop are same. draft-ietf-idr-bgp4-23 5.1.3 */
@@ -790,11 +867,6 @@ bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
     return 0;
 #endif
 
-  /* Aggregate-address suppress check. */
-  if (ri->extra && ri->extra->suppress)
-    if (! UNSUPPRESS_MAP_NAME (filter))
-      return 0;
-
   /* Default route check.  */
   if (CHECK_FLAG (peer->af_sflags[afi][safi], PEER_STATUS_DEFAULT_ORIGINATE))
     {
@@ -806,17 +878,6 @@ bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
 #endif /* HAVE_IPV6 */
     }
 
-  /* Transparency check. */
-  if (CHECK_FLAG (peer->af_flags[afi][safi], PEER_FLAG_RSERVER_CLIENT)
-      && CHECK_FLAG (from->af_flags[afi][safi], PEER_FLAG_RSERVER_CLIENT))
-    transparent = 1;
-  else
-    transparent = 0;
-
-  /* If community is not disabled check the no-export and local. */
-  if (! transparent && bgp_community_filter (peer, ri->attr)) 
-    return 0;
-
   /* If the attribute has originator-id and it is same as remote
      peer's id. */
   if (ri->attr->flag & ATTR_FLAG_BIT (BGP_ATTR_ORIGINATOR_ID))
@@ -843,6 +904,94 @@ bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
           return 0;
       }
 
+  return 1;
+}
+
+/* Outbound attributes start out as the route's own, interned ones in
+   ORIG.  The first change is made to COPY instead, which is what the
+   rest of the changes then go to. */
+static struct attr *
+bgp_announce_attr_write (struct attr *attr, struct attr *orig,
+			 struct attr *copy)
+{
+  if (attr == orig)
+    {
+      bgp_attr_dup (copy, orig);
+      attr = copy;
+    }
+  return attr;
+}
+
+/* The outbound attributes ATTR interned.  The route's own ORIG, or a
+   copy that ended up the same as them, are only referenced again. */
+static struct attr *
+bgp_announce_attr_intern (struct attr *attr, struct attr *orig)
+{
+  struct attr *new;
+
+  if (attr != orig && attrhash_cmp (attr, orig))
+    {
+      bgp_attr_extra_free (attr);
+      attr = orig;
+    }
+
+  if (attr == orig)
+    {
+      bgp_process_stats.announce_shared++;
+      return bgp_attr_ref (orig);
+    }
+
+  bgp_process_stats.announce_copied++;
+  new = bgp_attr_intern (attr);
+  bgp_attr_extra_free (attr);
+  return new;
+}
+
+/* The rest of the announce check.  The answer is the same for every
+   member of the peer's update group, see bgp_updgrp.h.  Returns the
+   interned attributes to announce, or NULL if the route is not to be
+   announced. */
+static struct attr *
+bgp_announce_check_policy (struct bgp_info *ri, struct peer *peer,
+			   struct prefix *p, afi_t afi, safi_t safi)
+{
+  int ret;
+  char buf[SU_ADDRSTRLEN];
+  struct bgp_filter *filter;
+  struct peer *from;
+  struct bgp *bgp;
+  struct attr copy;
+  struct attr *attr;
+  int transparent;
+  int reflect;
+
+  from = ri->peer;
+  filter = &peer->filter[afi][safi];
+  bgp = peer->bgp;
+  
+  if (DISABLE_BGP_ANNOUNCE)
+    return NULL;
+
+  /* Do not send announces to RS-clients from the 'normal' bgp_table. */
+  if (CHECK_FLAG(peer->af_flags[afi][safi], PEER_FLAG_RSERVER_CLIENT))
+    return NULL;
+
+  /* Aggregate-address suppress check. */
+  if (ri->extra && ri->extra->suppress)
+    if (! UNSUPPRESS_MAP_NAME (filter))
+      return NULL;
+
+  /* Transparency check. */
+  if (CHECK_FLAG (peer->af_flags[afi][safi], PEER_FLAG_RSERVER_CLIENT)
+      && CHECK_FLAG (from->af_flags[afi][safi], PEER_FLAG_RSERVER_CLIENT))
+    transparent = 1;
+  else
+    transparent = 0;
+
+  /* If community is not disabled check the no-export and local. */
+  if (! transparent && bgp_community_filter (peer, ri->attr)) 
+    return NULL;
+
   /* Output filter check. */
   if (bgp_output_filter (peer, p, ri->attr, afi, safi) == FILTER_DENY)
     {
@@ -852,7 +1001,7 @@ bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
 	      peer->host,
 	      inet_ntop(p->family, &p->u.prefix, buf, SU_ADDRSTRLEN),
 	      p->prefixlen);
-      return 0;
+      return NULL;
     }
 
 #ifdef BGP_SEND_ASPATH_CHECK
@@ -863,7 +1012,7 @@ bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
         zlog (peer->log, LOG_DEBUG, 
 	      "%s [Update:SEND] suppress announcement to peer AS %u is AS path.",
 	      peer->host, peer->as);
-      return 0;
+      return NULL;
     }
 #endif /* BGP_SEND_ASPATH_CHECK */
 
@@ -877,7 +1026,7 @@ bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
 		  "%s [Update:SEND] suppress announcement to peer AS %u is AS path.",
 		  peer->host,
 		  bgp->confed_id);
-	  return 0;
+	  return NULL;
 	}      
     }
 
@@ -899,25 +1048,26 @@ bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
 	  /* no bgp client-to-client reflection check. */
 	  if (bgp_flag_check (bgp, BGP_FLAG_NO_CLIENT_TO_CLIENT))
 	    if (CHECK_FLAG (peer->af_flags[afi][safi], PEER_FLAG_REFLECTOR_CLIENT))
-	      return 0;
+	      return NULL;
 	}
       else
 	{
 	  /* A route from a Non-client peer. Reflect to all other
 	     clients. */
 	  if (! CHECK_FLAG (peer->af_flags[afi][safi], PEER_FLAG_REFLECTOR_CLIENT))
-	    return 0;
+	    return NULL;
 	}
     }
   
-  /* For modify attribute, copy it to temporary structure. */
-  bgp_attr_dup (attr, ri->attr);
+  /* The route's attributes, copied when they are to be modified. */
+  attr = ri->attr;
   
   /* If local-preference is not set. */
   if ((peer_sort (peer) == BGP_PEER_IBGP 
        || peer_sort (peer) == BGP_PEER_CONFED) 
       && (! (attr->flag & ATTR_FLAG_BIT (BGP_ATTR_LOCAL_PREF))))
     {
+      attr = bgp_announce_attr_write (attr, ri->attr, &copy);
       attr->flag |= ATTR_FLAG_BIT (BGP_ATTR_LOCAL_PREF);
       attr->local_pref = bgp->default_local_pref;
     }
@@ -928,7 +1078,10 @@ bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
     {
       if (ri->peer != bgp->peer_self && ! transparent
 	  && ! CHECK_FLAG (peer->af_flags[afi][safi], PEER_FLAG_MED_UNCHANGED))
-	attr->flag &= ~(ATTR_FLAG_BIT (BGP_ATTR_MULTI_EXIT_DISC));
+	{
+	  attr = bgp_announce_attr_write (attr, ri->attr, &copy);
+	  attr->flag &= ~(ATTR_FLAG_BIT (BGP_ATTR_MULTI_EXIT_DISC));
+	}
     }
 
   /* next-hop-set */
@@ -956,16 +1109,29 @@ bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
       if (p->family == AF_INET)
 	{
 	  if (safi == SAFI_MPLS_VPN)
-	    memcpy (&attr->extra->mp_nexthop_global_in, &peer->nexthop.v4,
-	            IPV4_MAX_BYTELEN);
-	  else
-	    memcpy (&attr->nexthop, &peer->nexthop.v4, IPV4_MAX_BYTELEN);
+	    {
+	      if (! IPV4_ADDR_SAME (&attr->extra->mp_nexthop_global_in,
+				    &peer->nexthop.v4))
+		{
+		  attr = bgp_announce_attr_write (attr, ri->attr, &copy);
+		  memcpy (&attr->extra->mp_nexthop_global_in,
+			  &peer->nexthop.v4, IPV4_MAX_BYTELEN);
+		}
+	    }
+	  else if (! IPV4_ADDR_SAME (&attr->nexthop, &peer->nexthop.v4))
+	    {
+	      attr = bgp_announce_attr_write (attr, ri->attr, &copy);
+	      memcpy (&attr->nexthop, &peer->nexthop.v4, IPV4_MAX_BYTELEN);
+	    }
 	}
 #ifdef HAVE_IPV6
       /* Set IPv6 nexthop. */
-      if (p->family == AF_INET6)
+      if (p->family == AF_INET6
+	  && ! IPV6_ADDR_SAME (&attr->extra->mp_nexthop_global,
+			       &peer->nexthop.v6_global))
 	{
 	  /* IPv6 global nexthop must be included. */
+	  attr = bgp_announce_attr_write (attr, ri->attr, &copy);
 	  memcpy (&attr->extra->mp_nexthop_global, &peer->nexthop.v6_global, 
 		  IPV6_MAX_BYTELEN);
 	  attr->extra->mp_nexthop_len = 16;
@@ -976,41 +1142,53 @@ bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
 #ifdef HAVE_IPV6
   if (p->family == AF_INET6)
     {
+      u_char len;
+
       /* Left nexthop_local unchanged if so configured. */ 
       if ( CHECK_FLAG (peer->af_flags[afi][safi], 
            PEER_FLAG_NEXTHOP_LOCAL_UNCHANGED) )
         {
           if ( IN6_IS_ADDR_LINKLOCAL (&attr->extra->mp_nexthop_local) )
-            attr->extra->mp_nexthop_len=32;
+            len = 32;
           else
-            attr->extra->mp_nexthop_len=16;
+            len = 16;
         }
 
       /* Default nexthop_local treatment for non-RS-Clients */
       else 
         {
       /* Link-local address should not be transit to different peer. */
-      attr->extra->mp_nexthop_len = 16;
+      len = 16;
 
       /* Set link-local address for shared network peer. */
       if (peer->shared_network 
 	  && ! IN6_IS_ADDR_UNSPECIFIED (&peer->nexthop.v6_local))
 	{
-	  memcpy (&attr->extra->mp_nexthop_local, &peer->nexthop.v6_local, 
-		  IPV6_MAX_BYTELEN);
-	  attr->extra->mp_nexthop_len = 32;
+	  if (! IPV6_ADDR_SAME (&attr->extra->mp_nexthop_local,
+				&peer->nexthop.v6_local))
+	    {
+	      attr = bgp_announce_attr_write (attr, ri->attr, &copy);
+	      memcpy (&attr->extra->mp_nexthop_local, &peer->nexthop.v6_local, 
+		      IPV6_MAX_BYTELEN);
+	    }
+	  len = 32;
 	}
 
       /* If bgpd act as BGP-4+ route-reflector, do not send link-local
 	 address.*/
       if (reflect)
-	attr->extra->mp_nexthop_len = 16;
+	len = 16;
 
       /* If BGP-4+ link-local nexthop is not link-local nexthop. */
       if (! IN6_IS_ADDR_LINKLOCAL (&peer->nexthop.v6_local))
-	attr->extra->mp_nexthop_len = 16;
+	len = 16;
     }
 
+      if (attr->extra->mp_nexthop_len != len)
+	{
+	  attr = bgp_announce_attr_write (attr, ri->attr, &copy);
+	  attr->extra->mp_nexthop_len = len;
+	}
     }
 #endif /* HAVE_IPV6 */
 
@@ -1018,7 +1196,10 @@ bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
   if (peer_sort (peer) == BGP_PEER_EBGP
       && peer_af_flag_check (peer, afi, safi, PEER_FLAG_REMOVE_PRIVATE_AS)
       && aspath_private_as_check (attr->aspath))
-    attr->aspath = aspath_empty_get ();
+    {
+      attr = bgp_announce_attr_write (attr, ri->attr, &copy);
+      attr->aspath = aspath_empty_get ();
+    }
 
   /* Route map & unsuppress-map apply. */
   if (ROUTE_MAP_OUT_NAME (filter)
@@ -1028,7 +1209,6 @@ bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
       struct attr dummy_attr = { 0 };
       
       info.peer = peer;
-      info.attr = attr;
 
       /* The route reflector is not allowed to modify the attributes
 	 of the reflected IBGP routes. */
@@ -1038,13 +1218,20 @@ bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
 	  bgp_attr_dup (&dummy_attr, attr);
 	  info.attr = &dummy_attr;
 	}
+      else
+	{
+	  /* Whatever the set clauses do, they do to a copy; it is
+	     dropped again below if they did nothing. */
+	  attr = bgp_announce_attr_write (attr, ri->attr, &copy);
+	  info.attr = attr;
+	}
 
       SET_FLAG (peer->rmap_type, PEER_RMAP_TYPE_OUT); 
 
       if (ri->extra && ri->extra->suppress)
-	ret = route_map_apply (UNSUPPRESS_MAP (filter), p, RMAP_BGP, &info);
+	ret = bgp_route_map_apply (UNSUPPRESS_MAP (filter), p, &info);
       else
-	ret = route_map_apply (ROUTE_MAP_OUT (filter), p, RMAP_BGP, &info);
+	ret = bgp_route_map_apply (ROUTE_MAP_OUT (filter), p, &info);
 
       peer->rmap_type = 0;
       
@@ -1053,16 +1240,59 @@ bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
       
       if (ret == RMAP_DENYMATCH)
 	{
-	  bgp_attr_flush (attr);
-	  return 0;
+	  if (attr != ri->attr)
+	    {
+	      bgp_attr_flush (attr);
+	      bgp_attr_extra_free (attr);
+	    }
+	  return NULL;
 	}
     }
-  return 1;
+
+  return bgp_announce_attr_intern (attr, ri->attr);
 }
 
-static int
+static struct attr *
+bgp_announce_check (struct bgp_info *ri, struct peer *peer, struct prefix *p,
+		    afi_t afi, safi_t safi)
+{
+  if (! bgp_announce_check_peer (ri, peer, p, afi, safi))
+    return NULL;
+
+  return bgp_announce_check_policy (ri, peer, p, afi, safi);
+}
+
+/* Current bgp_process_main() pass, for the update group policy memo. */
+static u_int32_t bgp_process_seq;
+
+/* bgp_announce_check() for a route of the main table, reusing the
+   policy result of another member of the peer's update group when the
+   route has already been run through it in this pass. */
+static struct attr *
+bgp_announce_check_updgrp (struct bgp_info *ri, struct peer *peer,
+			   struct bgp_node *rn, afi_t afi, safi_t safi)
+{
+  struct update_group *group;
+  struct attr *attr;
+
+  if (! bgp_announce_check_peer (ri, peer, &rn->p, afi, safi))
+    return NULL;
+
+  group = bgp_updgrp_get (peer, afi, safi);
+  if (bgp_updgrp_memo_lookup (group, rn, ri, bgp_process_seq, &attr))
+    return attr;
+
+  attr = bgp_announce_check_policy (ri, peer, &rn->p, afi, safi);
+  bgp_updgrp_memo_set (group, rn, ri, bgp_process_seq, attr);
+
+  return attr;
+}
+
+/* The announce check for an RS-client, which returns the interned
+   attributes to announce like bgp_announce_check(). */
+static struct attr *
 bgp_announce_check_rsclient (struct bgp_info *ri, struct peer *rsclient,
-        struct prefix *p, struct attr *attr, afi_t afi, safi_t safi)
+			     struct prefix *p, afi_t afi, safi_t safi)
 {
   int ret;
   char buf[SU_ADDRSTRLEN];
@@ -1070,32 +1300,34 @@ bgp_announce_check_rsclient (struct bgp_info *ri, struct peer *rsclient,
   struct bgp_info info;
   struct peer *from;
   struct bgp *bgp;
+  struct attr copy;
+  struct attr *attr;
 
   from = ri->peer;
   filter = &rsclient->filter[afi][safi];
   bgp = rsclient->bgp;
 
   if (DISABLE_BGP_ANNOUNCE)
-    return 0;
+    return NULL;
 
   /* Do not send back route to sender. */
   if (from == rsclient)
-    return 0;
+    return NULL;
 
   /* Aggregate-address suppress check. */
   if (ri->extra && ri->extra->suppress)
     if (! UNSUPPRESS_MAP_NAME (filter))
-      return 0;
+      return NULL;
 
   /* Default route check.  */
   if (CHECK_FLAG (rsclient->af_sflags[afi][safi],
           PEER_STATUS_DEFAULT_ORIGINATE))
     {
       if (p->family == AF_INET && p->u.prefix4.s_addr == INADDR_ANY)
-        return 0;
+        return NULL;
 #ifdef HAVE_IPV6
       else if (p->family == AF_INET6 && p->prefixlen == 0)
-        return 0;
+        return NULL;
 #endif /* HAVE_IPV6 */
     }
 
@@ -1112,7 +1344,7 @@ bgp_announce_check_rsclient (struct bgp_info *ri, struct peer *rsclient,
                  rsclient->host,
                  inet_ntop(p->family, &p->u.prefix, buf, SU_ADDRSTRLEN),
                  p->prefixlen);
-         return 0;
+         return NULL;
        }
     }
 
@@ -1123,7 +1355,7 @@ bgp_announce_check_rsclient (struct bgp_info *ri, struct peer *rsclient,
     if (rsclient->orf_plist[afi][safi])
       {
        if (prefix_list_apply (rsclient->orf_plist[afi][safi], p) == PREFIX_DENY)
-          return 0;
+          return NULL;
       }
 
   /* Output filter check. */
@@ -1135,7 +1367,7 @@ bgp_announce_check_rsclient (struct bgp_info *ri, struct peer *rsclient,
              rsclient->host,
              inet_ntop(p->family, &p->u.prefix, buf, SU_ADDRSTRLEN),
              p->prefixlen);
-      return 0;
+      return NULL;
     }
 
 #ifdef BGP_SEND_ASPATH_CHECK
@@ -1146,12 +1378,12 @@ bgp_announce_check_rsclient (struct bgp_info *ri, struct peer *rsclient,
         zlog (rsclient->log, LOG_DEBUG,
              "%s [Update:SEND] suppress announcement to peer AS %u is AS path.",
              rsclient->host, rsclient->as);
-      return 0;
+      return NULL;
     }
 #endif /* BGP_SEND_ASPATH_CHECK */
 
-  /* For modify attribute, copy it to temporary structure. */
-  bgp_attr_dup (attr, ri->attr);
+  /* The route's attributes, copied when they are to be modified. */
+  attr = ri->attr;
 
   /* next-hop-set */
   if ((p->family == AF_INET && attr->nexthop.s_addr == 0)
@@ -1161,6 +1393,8 @@ bgp_announce_check_rsclient (struct bgp_info *ri, struct peer *rsclient,
 #endif /* HAVE_IPV6 */
      )
   {
+    attr = bgp_announce_attr_write (attr, ri->attr, &copy);
+
     /* Set IPv4 nexthop. */
     if (p->family == AF_INET)
       {
@@ -1186,6 +1420,7 @@ bgp_announce_check_rsclient (struct bgp_info *ri, struct peer *rsclient,
   if (p->family == AF_INET6)
     {
       struct attr_extra *attre = attr->extra;
+      u_char len;
       
       assert (attr->extra);
       
@@ -1194,9 +1429,9 @@ bgp_announce_check_rsclient (struct bgp_info *ri, struct peer *rsclient,
            PEER_FLAG_NEXTHOP_LOCAL_UNCHANGED) )
         {
           if ( IN6_IS_ADDR_LINKLOCAL (&attre->mp_nexthop_local) )
-            attre->mp_nexthop_len=32;
+            len = 32;
           else
-            attre->mp_nexthop_len=16;
+            len = 16;
         }
         
       /* Default nexthop_local treatment for RS-Clients */
@@ -1207,24 +1442,35 @@ bgp_announce_check_rsclient (struct bgp_info *ri, struct peer *rsclient,
               (rsclient->ifindex == from->ifindex))
             {
               if ( IN6_IS_ADDR_LINKLOCAL (&attre->mp_nexthop_local) )
-                attre->mp_nexthop_len=32;
+                len = 32;
               else
-                attre->mp_nexthop_len=16;
+                len = 16;
             }
 
           /* Set link-local address for shared network peer. */
           else if (rsclient->shared_network
               && IN6_IS_ADDR_LINKLOCAL (&rsclient->nexthop.v6_local))
             {
-              memcpy (&attre->mp_nexthop_local, &rsclient->nexthop.v6_local,
-                      IPV6_MAX_BYTELEN);
-              attre->mp_nexthop_len = 32;
+              if (! IPV6_ADDR_SAME (&attre->mp_nexthop_local,
+                                    &rsclient->nexthop.v6_local))
+                {
+                  attr = bgp_announce_attr_write (attr, ri->attr, &copy);
+                  attre = attr->extra;
+                  memcpy (&attre->mp_nexthop_local,
+                          &rsclient->nexthop.v6_local, IPV6_MAX_BYTELEN);
+                }
+              len = 32;
             }
 
           else
-            attre->mp_nexthop_len = 16;
+            len = 16;
         }
 
+      if (attre->mp_nexthop_len != len)
+        {
+          attr = bgp_announce_attr_write (attr, ri->attr, &copy);
+          attr->extra->mp_nexthop_len = len;
+        }
     }
 #endif /* HAVE_IPV6 */
 
@@ -1233,40 +1479,113 @@ bgp_announce_check_rsclient (struct bgp_info *ri, struct peer *rsclient,
   if (peer_sort (rsclient) == BGP_PEER_EBGP
       && peer_af_flag_check (rsclient, afi, safi, PEER_FLAG_REMOVE_PRIVATE_AS)
       && aspath_private_as_check (attr->aspath))
-    attr->aspath = aspath_empty_get ();
+    {
+      attr = bgp_announce_attr_write (attr, ri->attr, &copy);
+      attr->aspath = aspath_empty_get ();
+    }
 
   /* Route map & unsuppress-map apply. */
   if (ROUTE_MAP_OUT_NAME (filter) || (ri->extra && ri->extra->suppress) )
     {
+      /* Set clauses work on a copy, dropped again if they did nothing. */
+      attr = bgp_announce_attr_write (attr, ri->attr, &copy);
+
       info.peer = rsclient;
       info.attr = attr;
 
       SET_FLAG (rsclient->rmap_type, PEER_RMAP_TYPE_OUT);
 
       if (ri->extra && ri->extra->suppress)
-        ret = route_map_apply (UNSUPPRESS_MAP (filter), p, RMAP_BGP, &info);
+        ret = bgp_route_map_apply (UNSUPPRESS_MAP (filter), p, &info);
       else
-        ret = route_map_apply (ROUTE_MAP_OUT (filter), p, RMAP_BGP, &info);
+        ret = bgp_route_map_apply (ROUTE_MAP_OUT (filter), p, &info);
 
       rsclient->rmap_type = 0;
 
       if (ret == RMAP_DENYMATCH)
        {
          bgp_attr_flush (attr);
-         return 0;
+         bgp_attr_extra_free (attr);
+         return NULL;
        }
     }
 
-  return 1;
+  return bgp_announce_attr_intern (attr, ri->attr);
 }
 
-struct bgp_info_pair
+struct bgp_process_stats bgp_process_stats;
+
+/* Best path selection when only rn->changed moved since RN was last
+   processed: the old best won against every other path then, so the
+   changed path only has to be compared with it.
+
+   bgp_info_cmp() is not transitive in general, since MED is compared
+   between some pairs of paths only, and the outcome of a full scan
+   can depend on the paths that lose.  Without always-compare-med the
+   shortcut is therefore only taken where steps 1 to 5 alone decide:
+   a path better there than the old best beats everything, and a path
+   that was worse there before and after it changed cannot have made
+   a difference.  Returns 0 when the node has to be scanned in full,
+   which is also the case whenever the best path itself changed. */
+static int
+bgp_best_selection_incremental (struct bgp *bgp, struct bgp_node *rn,
+				struct bgp_info_pair *result)
 {
-  struct bgp_info *old;
-  struct bgp_info *new;
-};
+  struct bgp_info *ri = rn->changed;
+  struct bgp_info *old_select;
+  int ordered;
+  int ret;
 
-static void
+  if (ri == NULL
+      || CHECK_FLAG (rn->flags, BGP_NODE_RESCAN)
+      || bgp_flag_check (bgp, BGP_FLAG_DETERMINISTIC_MED))
+    return 0;
+
+  for (old_select = rn->info; old_select; old_select = old_select->next)
+    if (CHECK_FLAG (old_select->flags, BGP_INFO_SELECTED))
+      break;
+
+  if (old_select == NULL
+      || old_select == ri
+      || BGP_INFO_HOLDDOWN (old_select)
+      || old_select->sub_type != BGP_ROUTE_NORMAL
+      || ri->sub_type != BGP_ROUTE_NORMAL)
+    return 0;
+
+  ordered = bgp_flag_check (bgp, BGP_FLAG_ALWAYS_COMPARE_MED);
+
+  if (BGP_INFO_HOLDDOWN (ri))
+    {
+      /* RI dropped out.  It may have been next to the old best before
+	 it changed. */
+      if (! ordered && ! CHECK_FLAG (rn->flags, BGP_NODE_CHANGED_WORSE))
+	return 0;
+
+      result->new = old_select;
+    }
+  else
+    {
+      ret = bgp_info_cmp_pref (bgp, ri, old_select);
+
+      if (ret > 0)
+	result->new = ri;
+      else if (ret < 0
+	       && (ordered || CHECK_FLAG (rn->flags, BGP_NODE_CHANGED_WORSE)))
+	result->new = old_select;
+      else if (ordered)
+	result->new = bgp_info_cmp (bgp, ri, old_select) ? ri : old_select;
+      else
+	return 0;
+    }
+  result->old = old_select;
+
+  if (CHECK_FLAG (ri->flags, BGP_INFO_REMOVED))
+    bgp_info_reap (rn, ri);
+
+  return 1;
+}
+
+void
 bgp_best_selection (struct bgp *bgp, struct bgp_node *rn, struct bgp_info_pair *result)
 {
   struct bgp_info *new_select;
@@ -1275,6 +1594,13 @@ bgp_best_selection (struct bgp *bgp, struct bgp_node *rn, struct bgp_info_pair *
   struct bgp_info *ri1;
   struct bgp_info *ri2;
   struct bgp_info *nextri = NULL;
+
+  if (bgp_best_selection_incremental (bgp, rn, result))
+    {
+      bgp_process_stats.incremental++;
+      goto done;
+    }
+  bgp_process_stats.full++;
   
   /* bgp deterministic-med */
   new_select = NULL;
@@ -1348,7 +1674,9 @@ bgp_best_selection (struct bgp *bgp, struct bgp_node *rn, struct bgp_info_pair *
     result->old = old_select;
     result->new = new_select;
 
-    return;
+ done:
+  rn->changed = NULL;
+  UNSET_FLAG (rn->flags, BGP_NODE_RESCAN | BGP_NODE_CHANGED_WORSE);
 }
 
 static int
@@ -1356,7 +1684,7 @@ bgp_process_announce_selected (struct peer *peer, struct bgp_info *selected,
                                struct bgp_node *rn, afi_t afi, safi_t safi)
 {
   struct prefix *p;
-  struct attr attr = { 0 };
+  struct attr *attr;
 
   p = &rn->p;
 
@@ -1378,8 +1706,10 @@ bgp_process_announce_selected (struct peer *peer, struct bgp_info *selected,
       case BGP_TABLE_MAIN:
       /* Announcement to peer->conf.  If the route is filtered,
          withdraw it. */
-        if (selected && bgp_announce_check (selected, peer, p, &attr, afi, safi))
-          bgp_adj_out_set (rn, peer, p, &attr, afi, safi, selected);
+        if (selected
+            && (attr = bgp_announce_check_updgrp (selected, peer, rn,
+                                                  afi, safi)))
+          bgp_adj_out_set (rn, peer, p, attr, afi, safi, selected);
         else
           bgp_adj_out_unset (rn, peer, p, afi, safi);
         break;
@@ -1387,34 +1717,40 @@ bgp_process_announce_selected (struct peer *peer, struct bgp_info *selected,
         /* Announcement to peer->conf.  If the route is filtered, 
            withdraw it. */
         if (selected && 
-            bgp_announce_check_rsclient (selected, peer, p, &attr, afi, safi))
-          bgp_adj_out_set (rn, peer, p, &attr, afi, safi, selected);
+            (attr = bgp_announce_check_rsclient (selected, peer, p,
+                                                 afi, safi)))
+          bgp_adj_out_set (rn, peer, p, attr, afi, safi, selected);
         else
 	  bgp_adj_out_unset (rn, peer, p, afi, safi);
         break;
     }
   
-  bgp_attr_extra_free (&attr);
-  
   return 0;
 }
 
+/* Nodes of one instance waiting for best path selection.  Nodes are
+   added to the last batch of a queue until it is full, including
+   while it is being worked through. */
 struct bgp_process_queue 
 {
   struct bgp *bgp;
-  struct bgp_node *rn;
-  afi_t afi;
-  safi_t safi;
+  unsigned int count;
+  unsigned int done;
+  struct
+  {
+    struct bgp_node *rn;
+    afi_t afi;
+    safi_t safi;
+  } node[BGP_PROCESS_BATCH];
 };
 
-static wq_item_status
-bgp_process_rsclient (struct work_queue *wq, void *data)
+/* The batch still taking nodes, per table type. */
+static struct bgp_process_queue *bgp_process_last[BGP_TABLE_RSCLIENT + 1];
+
+static void
+bgp_process_rsclient (struct bgp *bgp, struct bgp_node *rn, afi_t afi,
+		      safi_t safi)
 {
-  struct bgp_process_queue *pq = data;
-  struct bgp *bgp = pq->bgp;
-  struct bgp_node *rn = pq->rn;
-  afi_t afi = pq->afi;
-  safi_t safi = pq->safi;
   struct bgp_info *new_select;
   struct bgp_info *old_select;
   struct bgp_info_pair old_and_new;
@@ -1464,24 +1800,24 @@ bgp_process_rsclient (struct work_queue *wq, void *data)
     bgp_info_reap (rn, old_select);
   
   UNSET_FLAG (rn->flags, BGP_NODE_PROCESS_SCHEDULED);
-  return WQ_SUCCESS;
 }
 
-static wq_item_status
-bgp_process_main (struct work_queue *wq, void *data)
+static void
+bgp_process_main (struct bgp *bgp, struct bgp_node *rn, afi_t afi,
+		  safi_t safi)
 {
-  struct bgp_process_queue *pq = data;
-  struct bgp *bgp = pq->bgp;
-  struct bgp_node *rn = pq->rn;
-  afi_t afi = pq->afi;
-  safi_t safi = pq->safi;
   struct prefix *p = &rn->p;
   struct bgp_info *new_select;
   struct bgp_info *old_select;
   struct bgp_info_pair old_and_new;
   struct listnode *node, *nnode;
   struct peer *peer;
+  struct timeval tv;
   
+  bgp_pipeline_start (&tv);
+  bgp_pipeline_count (BGP_PIPELINE_BESTPATH, 1);
+  bgp_process_seq++;
+
   /* Best path selection. */
   bgp_best_selection (bgp, rn, &old_and_new);
   old_select = old_and_new.old;
@@ -1496,7 +1832,8 @@ bgp_process_main (struct work_queue *wq, void *data)
             bgp_zebra_announce (p, old_select, bgp);
           
           UNSET_FLAG (rn->flags, BGP_NODE_PROCESS_SCHEDULED);
-          return WQ_SUCCESS;
+          bgp_pipeline_time (BGP_PIPELINE_BESTPATH, &tv);
+          return;
         }
     }
 
@@ -1538,6 +1875,37 @@ bgp_process_main (struct work_queue *wq, void *data)
     bgp_info_reap (rn, old_select);
   
   UNSET_FLAG (rn->flags, BGP_NODE_PROCESS_SCHEDULED);
+  bgp_pipeline_time (BGP_PIPELINE_BESTPATH, &tv);
+}
+
+/* Work through a batch of nodes for as long as the queue may. */
+static wq_item_status
+bgp_process_batch (struct work_queue *wq, void *data)
+{
+  struct bgp_process_queue *pq = data;
+  struct bgp_node *rn;
+
+  while (pq->done < pq->count)
+    {
+      rn = pq->node[pq->done].rn;
+
+      if (rn->table->type == BGP_TABLE_MAIN)
+	bgp_process_main (pq->bgp, rn, pq->node[pq->done].afi,
+			  pq->node[pq->done].safi);
+      else
+	bgp_process_rsclient (pq->bgp, rn, pq->node[pq->done].afi,
+			      pq->node[pq->done].safi);
+
+      pq->done++;
+      bgp_process_stats.queued--;
+
+      if (pq->done < pq->count && work_queue_should_yield (wq))
+	{
+	  bgp_process_stats.yields++;
+	  return WQ_QUEUE_BLOCKED;
+	}
+    }
+
   return WQ_SUCCESS;
 }
 
@@ -1545,11 +1913,22 @@ static void
 bgp_processq_del (struct work_queue *wq, void *data)
 {
   struct bgp_process_queue *pq = data;
-  struct bgp_table *table = pq->rn->table;
-  
+  struct bgp_table *table;
+  unsigned int i;
+
+  for (i = 0; i < BGP_TABLE_RSCLIENT + 1; i++)
+    if (bgp_process_last[i] == pq)
+      bgp_process_last[i] = NULL;
+
+  bgp_process_stats.queued -= pq->count - pq->done;
+
+  for (i = 0; i < pq->count; i++)
+    {
+      table = pq->node[i].rn->table;
+      bgp_unlock_node (pq->node[i].rn);
+      bgp_table_unlock (table);
+    }
   bgp_unlock (pq->bgp);
-  bgp_unlock_node (pq->rn);
-  bgp_table_unlock (table);
   XFREE (MTYPE_BGP_PROCESS_QUEUE, pq);
 }
 
@@ -1567,53 +1946,118 @@ bgp_process_queue_init (void)
       exit (1);
     }
   
-  bm->process_main_queue->spec.workfunc = &bgp_process_main;
+  bm->process_main_queue->spec.workfunc = &bgp_process_batch;
   bm->process_main_queue->spec.del_item_data = &bgp_processq_del;
   bm->process_main_queue->spec.max_retries = 0;
   bm->process_main_queue->spec.hold = 50;
   
-  memcpy (bm->process_rsclient_queue, bm->process_main_queue,
-          sizeof (struct work_queue *));
-  bm->process_rsclient_queue->spec.workfunc = &bgp_process_rsclient;
+  bm->process_rsclient_queue->spec = bm->process_main_queue->spec;
+
+  bgp_process_last[BGP_TABLE_MAIN] = NULL;
+  bgp_process_last[BGP_TABLE_RSCLIENT] = NULL;
 }
 
-void
-bgp_process (struct bgp *bgp, struct bgp_node *rn, afi_t afi, safi_t safi)
+static void
+bgp_process_enqueue (struct bgp *bgp, struct bgp_node *rn, afi_t afi,
+		     safi_t safi)
 {
   struct bgp_process_queue *pqnode;
+  bgp_table_t type = rn->table->type;
   
+  bgp_process_stats.requests++;
+
   /* already scheduled for processing? */
   if (CHECK_FLAG (rn->flags, BGP_NODE_PROCESS_SCHEDULED))
-    return;
+    {
+      bgp_process_stats.coalesced++;
+      return;
+    }
   
   if ( (bm->process_main_queue == NULL) ||
        (bm->process_rsclient_queue == NULL) )
     bgp_process_queue_init ();
   
-  pqnode = XCALLOC (MTYPE_BGP_PROCESS_QUEUE, 
-                    sizeof (struct bgp_process_queue));
-  if (!pqnode)
-    return;
+  pqnode = bgp_process_last[type];
+  if (! pqnode || pqnode->bgp != bgp || pqnode->count == BGP_PROCESS_BATCH)
+    {
+      pqnode = XMALLOC (MTYPE_BGP_PROCESS_QUEUE,
+                        sizeof (struct bgp_process_queue));
+      pqnode->bgp = bgp;
+      bgp_lock (bgp);
+      pqnode->count = pqnode->done = 0;
+      bgp_process_last[type] = pqnode;
+      bgp_process_stats.batches++;
+  
+      switch (type)
+        {
+          case BGP_TABLE_MAIN:
+            work_queue_add (bm->process_main_queue, pqnode);
+            break;
+          case BGP_TABLE_RSCLIENT:
+            work_queue_add (bm->process_rsclient_queue, pqnode);
+            break;
+        }
+    }
 
   /* all unlocked in bgp_processq_del */
   bgp_table_lock (rn->table);
-  pqnode->rn = bgp_lock_node (rn);
-  pqnode->bgp = bgp;
-  bgp_lock (bgp);
-  pqnode->afi = afi;
-  pqnode->safi = safi;
-  
-  switch (rn->table->type)
+  pqnode->node[pqnode->count].rn = bgp_lock_node (rn);
+  pqnode->node[pqnode->count].afi = afi;
+  pqnode->node[pqnode->count].safi = safi;
+  pqnode->count++;
+  bgp_process_stats.queued++;
+
+  SET_FLAG (rn->flags, BGP_NODE_PROCESS_SCHEDULED);
+}
+
+/* Schedule RN for best path selection after anything on it changed. */
+void
+bgp_process (struct bgp *bgp, struct bgp_node *rn, afi_t afi, safi_t safi)
+{
+  rn->changed = NULL;
+  SET_FLAG (rn->flags, BGP_NODE_RESCAN);
+  bgp_process_enqueue (bgp, rn, afi, safi);
+}
+
+/* Likewise, when RI is the only path on RN that changed, and
+   bgp_info_note_change() was told before it did. */
+static void
+bgp_process_info (struct bgp *bgp, struct bgp_node *rn, struct bgp_info *ri,
+		  afi_t afi, safi_t safi)
+{
+  if (rn->changed != ri)
     {
-      case BGP_TABLE_MAIN:
-        work_queue_add (bm->process_main_queue, pqnode);
-        break;
-      case BGP_TABLE_RSCLIENT:
-        work_queue_add (bm->process_rsclient_queue, pqnode);
-        break;
+      rn->changed = NULL;
+      SET_FLAG (rn->flags, BGP_NODE_RESCAN);
     }
-  
-  return;
+  bgp_process_enqueue (bgp, rn, afi, safi);
+}
+
+/* Something bgp_info_cmp() depends on was reconfigured, so the paths
+   selected so far need not win against a changed path any more. */
+void
+bgp_best_selection_reset (struct bgp *bgp)
+{
+  struct bgp_node *rn;
+  struct peer *peer;
+  struct listnode *node, *nnode;
+  afi_t afi;
+  safi_t safi;
+
+  for (afi = AFI_IP; afi < AFI_MAX; afi++)
+    for (safi = SAFI_UNICAST; safi < SAFI_MAX; safi++)
+      {
+	if (bgp->rib[afi][safi])
+	  for (rn = bgp_table_top (bgp->rib[afi][safi]); rn;
+	       rn = bgp_route_next (rn))
+	    SET_FLAG (rn->flags, BGP_NODE_RESCAN);
+
+	for (ALL_LIST_ELEMENTS (bgp->rsclient, node, nnode, peer))
+	  if (peer->rib[afi][safi])
+	    for (rn = bgp_table_top (peer->rib[afi][safi]); rn;
+		 rn = bgp_route_next (rn))
+	      SET_FLAG (rn->flags, BGP_NODE_RESCAN);
+      }
 }
 
 static int
@@ -1716,12 +2160,13 @@ static void
 bgp_rib_remove (struct bgp_node *rn, struct bgp_info *ri, struct peer *peer,
 		afi_t afi, safi_t safi)
 {
+  bgp_info_note_change (rn, ri);
   bgp_aggregate_decrement (peer->bgp, &rn->p, ri, afi, safi);
   
   if (!CHECK_FLAG (ri->flags, BGP_INFO_HISTORY))
     bgp_info_delete (rn, ri); /* keep historical info */
     
-  bgp_process (peer->bgp, rn, afi, safi);
+  bgp_process_info (peer->bgp, rn, ri, afi, safi);
 }
 
 static void
@@ -1730,6 +2175,8 @@ bgp_rib_withdraw (struct bgp_node *rn, struct bgp_info *ri, struct peer *peer,
 {
   int status = BGP_DAMP_NONE;
 
+  bgp_info_note_change (rn, ri);
+
   /* apply dampening, if result is suppressed, we'll be retaining 
    * the bgp_info in the RIB for historical reference.
    */
@@ -1853,6 +2300,8 @@ bgp_update_rsclient (struct peer *rsclient, afi_t afi, safi_t safi,
           return;
         }
 
+      bgp_info_note_change (rn, ri);
+
       /* Withdraw/Announce before we fully processed the withdraw */
       if (CHECK_FLAG(ri->flags, BGP_INFO_REMOVED))
         bgp_info_restore (rn, ri);
@@ -1878,7 +2327,7 @@ bgp_update_rsclient (struct peer *rsclient, afi_t afi, safi_t safi,
       bgp_info_set_flag (rn, ri, BGP_INFO_VALID);
 
       /* Process change. */
-      bgp_process (bgp, rn, afi, safi);
+      bgp_process_info (bgp, rn, ri, afi, safi);
       bgp_unlock_node (rn);
 
       return;
@@ -1894,10 +2343,9 @@ bgp_update_rsclient (struct peer *rsclient, afi_t afi, safi_t safi,
     }
 
   /* Make new BGP info. */
-  new = bgp_info_new ();
+  new = bgp_info_new (peer);
   new->type = type;
   new->sub_type = sub_type;
-  new->peer = peer;
   new->attr = attr_new;
   new->uptime = bgp_clock ();
 
@@ -1914,7 +2362,7 @@ bgp_update_rsclient (struct peer *rsclient, afi_t afi, safi_t safi,
   bgp_unlock_node (rn);
   
   /* Process change. */
-  bgp_process (bgp, rn, afi, safi);
+  bgp_process_info (bgp, rn, new, afi, safi);
   
   bgp_attr_extra_free (&new_attr);
   
@@ -1988,6 +2436,7 @@ bgp_update_main (struct peer *peer, struct prefix *p, struct attr *attr,
   struct bgp_info *new;
   const char *reason;
   char buf[SU_ADDRSTRLEN];
+  struct timeval tv;
 
   bgp = peer->bgp;
   rn = bgp_afi_node_get (bgp->rib[afi][safi], afi, safi, p, prd);
@@ -2081,7 +2530,10 @@ bgp_update_main (struct peer *peer, struct prefix *p, struct attr *attr,
 	}
     }
 
+  bgp_pipeline_start (&tv);
   attr_new = bgp_attr_intern (&new_attr);
+  bgp_pipeline_time_within (BGP_PIPELINE_INTERN, BGP_PIPELINE_RIB, &tv);
+  bgp_pipeline_count (BGP_PIPELINE_INTERN, 1);
 
   /* If the update is implicit withdraw. */
   if (ri)
@@ -2134,6 +2586,8 @@ bgp_update_main (struct peer *peer, struct prefix *p, struct attr *attr,
 	  return 0;
 	}
 
+      bgp_info_note_change (rn, ri);
+
       /* Withdraw/Announce before we fully processed the withdraw */
       if (CHECK_FLAG(ri->flags, BGP_INFO_REMOVED))
         {
@@ -2204,18 +2658,21 @@ bgp_update_main (struct peer *peer, struct prefix *p, struct attr *attr,
 	      || (peer_sort (peer) == BGP_PEER_EBGP && peer->ttl != 1)
 	      || CHECK_FLAG (peer->flags, PEER_FLAG_DISABLE_CONNECTED_CHECK)))
 	{
-	  if (bgp_nexthop_lookup (afi, peer, ri, NULL, NULL))
+	  if (bgp_nexthop_lookup (afi, ri))
 	    bgp_info_set_flag (rn, ri, BGP_INFO_VALID);
 	  else
 	    bgp_info_unset_flag (rn, ri, BGP_INFO_VALID);
 	}
       else
-        bgp_info_set_flag (rn, ri, BGP_INFO_VALID);
+        {
+          bgp_nexthop_path_unlink (ri);
+          bgp_info_set_flag (rn, ri, BGP_INFO_VALID);
+        }
 
       /* Process change. */
       bgp_aggregate_increment (bgp, p, ri, afi, safi);
 
-      bgp_process (bgp, rn, afi, safi);
+      bgp_process_info (bgp, rn, ri, afi, safi);
       bgp_unlock_node (rn);
       bgp_attr_extra_free (&new_attr);
       
@@ -2232,10 +2689,9 @@ bgp_update_main (struct peer *peer, struct prefix *p, struct attr *attr,
     }
 
   /* Make new BGP info. */
-  new = bgp_info_new ();
+  new = bgp_info_new (peer);
   new->type = type;
   new->sub_type = sub_type;
-  new->peer = peer;
   new->attr = attr_new;
   new->uptime = bgp_clock ();
 
@@ -2251,7 +2707,7 @@ bgp_update_main (struct peer *peer, struct prefix *p, struct attr *attr,
 	  || (peer_sort (peer) == BGP_PEER_EBGP && peer->ttl != 1)
 	  || CHECK_FLAG (peer->flags, PEER_FLAG_DISABLE_CONNECTED_CHECK)))
     {
-      if (bgp_nexthop_lookup (afi, peer, new, NULL, NULL))
+      if (bgp_nexthop_lookup (afi, new))
 	bgp_info_set_flag (rn, new, BGP_INFO_VALID);
       else
         bgp_info_unset_flag (rn, new, BGP_INFO_VALID);
@@ -2276,7 +2732,7 @@ bgp_update_main (struct peer *peer, struct prefix *p, struct attr *attr,
     return -1;
 
   /* Process change. */
-  bgp_process (bgp, rn, afi, safi);
+  bgp_process_info (bgp, rn, new, afi, safi);
 
   return 0;
 
@@ -2476,7 +2932,7 @@ bgp_announce_table (struct peer *peer, afi_t afi, safi_t safi,
 {
   struct bgp_node *rn;
   struct bgp_info *ri;
-  struct attr attr = { 0 };
+  struct attr *attr;
   
   if (! table)
     table = (rsclient) ? peer->rib[afi][safi] : peer->bgp->rib[afi][safi];
@@ -2490,13 +2946,11 @@ bgp_announce_table (struct peer *peer, afi_t afi, safi_t safi,
       if (CHECK_FLAG (ri->flags, BGP_INFO_SELECTED) && ri->peer != peer)
 	{
          if ( (rsclient) ?
-              (bgp_announce_check_rsclient (ri, peer, &rn->p, &attr, afi, safi))
-              : (bgp_announce_check (ri, peer, &rn->p, &attr, afi, safi)))
-	    bgp_adj_out_set (rn, peer, &rn->p, &attr, afi, safi, ri);
+              (attr = bgp_announce_check_rsclient (ri, peer, &rn->p, afi, safi))
+              : (attr = bgp_announce_check (ri, peer, &rn->p, afi, safi)))
+	    bgp_adj_out_set (rn, peer, &rn->p, attr, afi, safi, ri);
 	  else
 	    bgp_adj_out_unset (rn, peer, &rn->p, afi, safi);
-          
-          bgp_attr_extra_free (&attr);
 	}
 }
 
@@ -2701,103 +3155,113 @@ bgp_clear_node_queue_init (struct peer *peer)
   peer->clear_node_queue->spec.data = peer;
 }
 
+/* Queue RN for PEER's clear_node_queue to look at. */
+static void
+bgp_clear_node_queue_add (struct peer *peer, struct bgp_node *rn,
+			  enum bgp_clear_route_type purpose)
+{
+  struct bgp_clear_node_queue *cnq;
+
+  /* both unlocked in bgp_clear_node_queue_del */
+  bgp_table_lock (rn->table);
+  bgp_lock_node (rn);
+  cnq = XCALLOC (MTYPE_BGP_CLEAR_NODE_QUEUE,
+		 sizeof (struct bgp_clear_node_queue));
+  cnq->rn = rn;
+  cnq->purpose = purpose;
+  work_queue_add (peer->clear_node_queue, cnq);
+}
+
+/* The paths, Adj-RIB-In and Adj-RIB-Out entries to clear are those of
+   the peer for an afi/safi, whatever table they are in: the main
+   table, an MPLS VPN one or that of a route server client.  They are
+   found from the peer's pools, see bgp_pool.c, so resetting a peer
+   costs what it has, not the size of the tables, however many other
+   peers go down at the same time.  */
+struct bgp_clear_walk
+{
+  struct peer *peer;
+  afi_t afi;
+  safi_t safi;
+};
+
+#define BGP_CLEAR_WALK_MATCH(W,RN) \
+  ((RN)->table->afi == (W)->afi && (RN)->table->safi == (W)->safi)
+
+static void
+bgp_clear_route_path (void *entry, void *arg)
+{
+  struct bgp_info *ri = entry;
+  struct bgp_clear_walk *walk = arg;
+
+  if (BGP_CLEAR_WALK_MATCH (walk, ri->rn))
+    bgp_clear_node_queue_add (walk->peer, ri->rn, BGP_CLEAR_ROUTE_NORMAL);
+}
+
+static void
+bgp_clear_route_adj_in (void *entry, void *arg)
+{
+  struct bgp_adj_in *ain = entry;
+  struct bgp_clear_walk *walk = arg;
+  struct bgp_node *rn = ain->rn;
+
+  if (BGP_CLEAR_WALK_MATCH (walk, rn))
+    {
+      bgp_adj_in_remove (rn, ain);
+      bgp_unlock_node (rn);
+    }
+}
+
+static void
+bgp_clear_route_adj_out (void *entry, void *arg)
+{
+  struct bgp_adj_out *aout = entry;
+  struct bgp_clear_walk *walk = arg;
+  struct bgp_node *rn = aout->rn;
+
+  if (BGP_CLEAR_WALK_MATCH (walk, rn))
+    {
+      bgp_adj_out_remove (rn, aout, walk->peer, walk->afi, walk->safi);
+      bgp_unlock_node (rn);
+    }
+}
+
+/* Everything in the table of route server client PEER goes with it,
+   whoever it is from. */
 static void
-bgp_clear_route_table (struct peer *peer, afi_t afi, safi_t safi,
-                       struct bgp_table *table, struct peer *rsclient,
-                       enum bgp_clear_route_type purpose)
+bgp_clear_route_table (struct peer *peer, afi_t afi, safi_t safi)
 {
+  struct bgp_table *table = peer->rib[afi][safi];
   struct bgp_node *rn;
   
-  
-  if (! table)
-    table = (rsclient) ? rsclient->rib[afi][safi] : peer->bgp->rib[afi][safi];
-  
-  /* If still no table => afi/safi isn't configured at all or smth. */
   if (! table)
     return;
   
   for (rn = bgp_table_top (table); rn; rn = bgp_route_next (rn))
     {
-      struct bgp_info *ri;
-      struct bgp_adj_in *ain;
-      struct bgp_adj_out *aout;
-      
       if (rn->info == NULL)
         continue;
 
-      /* XXX:TODO: This is suboptimal, every non-empty route_node is
-       * queued for every clearing peer, regardless of whether it is
-       * relevant to the peer at hand.
-       *
-       * Overview: There are 3 different indices which need to be
-       * scrubbed, potentially, when a peer is removed:
-       *
-       * 1 peer's routes visible via the RIB (ie accepted routes)
-       * 2 peer's routes visible by the (optional) peer's adj-in index
-       * 3 other routes visible by the peer's adj-out index
-       *
-       * 3 there is no hurry in scrubbing, once the struct peer is
-       * removed from bgp->peer, we could just GC such deleted peer's
-       * adj-outs at our leisure.
-       *
-       * 1 and 2 must be 'scrubbed' in some way, at least made
-       * invisible via RIB index before peer session is allowed to be
-       * brought back up. So one needs to know when such a 'search' is
-       * complete.
-       *
-       * Ideally:
-       *
-       * - there'd be a single global queue or a single RIB walker
-       * - rather than tracking which route_nodes still need to be
-       *   examined on a peer basis, we'd track which peers still
-       *   aren't cleared
-       *
-       * Given that our per-peer prefix-counts now should be reliable,
-       * this may actually be achievable. It doesn't seem to be a huge
-       * problem at this time,
-       */
-      for (ri = rn->info; ri; ri = ri->next)
-        if (ri->peer == peer || purpose == BGP_CLEAR_ROUTE_MY_RSCLIENT)
-          {
-            struct bgp_clear_node_queue *cnq;
-
-            /* both unlocked in bgp_clear_node_queue_del */
-            bgp_table_lock (rn->table);
-            bgp_lock_node (rn);
-            cnq = XCALLOC (MTYPE_BGP_CLEAR_NODE_QUEUE,
-                           sizeof (struct bgp_clear_node_queue));
-            cnq->rn = rn;
-            cnq->purpose = purpose;
-            work_queue_add (peer->clear_node_queue, cnq);
-            break;
-          }
+      bgp_clear_node_queue_add (peer, rn, BGP_CLEAR_ROUTE_MY_RSCLIENT);
 
-      for (ain = rn->adj_in; ain; ain = ain->next)
-        if (ain->peer == peer || purpose == BGP_CLEAR_ROUTE_MY_RSCLIENT)
-          {
-            bgp_adj_in_remove (rn, ain);
-            bgp_unlock_node (rn);
-            break;
-          }
-      for (aout = rn->adj_out; aout; aout = aout->next)
-        if (aout->peer == peer || purpose == BGP_CLEAR_ROUTE_MY_RSCLIENT)
-          {
-            bgp_adj_out_remove (rn, aout, peer, afi, safi);
-            bgp_unlock_node (rn);
-            break;
-          }
+      if (rn->adj_in)
+        {
+          bgp_adj_in_remove (rn, rn->adj_in);
+          bgp_unlock_node (rn);
+        }
+      if (rn->adj_out)
+        {
+          bgp_adj_out_remove (rn, rn->adj_out, peer, afi, safi);
+          bgp_unlock_node (rn);
+        }
     }
-  return;
 }
 
 void
 bgp_clear_route (struct peer *peer, afi_t afi, safi_t safi,
                  enum bgp_clear_route_type purpose)
 {
-  struct bgp_node *rn;
-  struct bgp_table *table;
-  struct peer *rsclient;
-  struct listnode *node, *nnode;
+  struct bgp_clear_walk walk;
 
   if (peer->clear_node_queue == NULL)
     bgp_clear_node_queue_init (peer);
@@ -2820,22 +3284,21 @@ bgp_clear_route (struct peer *peer, afi_t afi, safi_t safi,
   switch (purpose)
     {
     case BGP_CLEAR_ROUTE_NORMAL:
-      if (safi != SAFI_MPLS_VPN)
-        bgp_clear_route_table (peer, afi, safi, NULL, NULL, purpose);
-      else
-        for (rn = bgp_table_top (peer->bgp->rib[afi][safi]); rn;
-             rn = bgp_route_next (rn))
-          if ((table = rn->info) != NULL)
-            bgp_clear_route_table (peer, afi, safi, table, NULL, purpose);
+      walk.peer = peer;
+      walk.afi = afi;
+      walk.safi = safi;
 
-      for (ALL_LIST_ELEMENTS (peer->bgp->rsclient, node, nnode, rsclient))
-        if (CHECK_FLAG(rsclient->af_flags[afi][safi],
-                       PEER_FLAG_RSERVER_CLIENT))
-          bgp_clear_route_table (peer, afi, safi, NULL, rsclient, purpose);
+      /* The peer's routes must be out of the RIB before the session
+       * may come back up, which the queue tells; its Adj-RIB-In and
+       * Adj-RIB-Out entries go right away.
+       */
+      bgp_pool_walk (peer, BGP_POOL_INFO, bgp_clear_route_path, &walk);
+      bgp_pool_walk (peer, BGP_POOL_ADJ_IN, bgp_clear_route_adj_in, &walk);
+      bgp_pool_walk (peer, BGP_POOL_ADJ_OUT, bgp_clear_route_adj_out, &walk);
       break;
 
     case BGP_CLEAR_ROUTE_MY_RSCLIENT:
-      bgp_clear_route_table (peer, afi, safi, NULL, peer, purpose);
+      bgp_clear_route_table (peer, afi, safi);
       break;
 
     default:
@@ -2845,8 +3308,6 @@ bgp_clear_route (struct peer *peer, afi_t afi, safi_t safi,
   
   /* If no routes were cleared, nothing was added to workqueue, the
    * completion function won't be run by workqueue code - call it here. 
-   * XXX: Actually, this assumption doesn't hold, see
-   * bgp_clear_route_table(), we queue all non-empty nodes.
    *
    * Additionally, there is a presumption in FSM that clearing is only
    * really needed if peer state is Established - peers in
@@ -2856,11 +3317,6 @@ bgp_clear_route (struct peer *peer, afi_t afi, safi_t safi,
    * We still can get here in pre-Established though, through
    * peer_delete -> bgp_fsm_change_status, so this is a useful sanity
    * check to ensure the assumption above holds.
-   *
-   * At some future point, this check could be move to the top of the
-   * function, and do a quick early-return when state is
-   * pre-Established, avoiding above list and table scans. Once we're
-   * sure it is safe..
    */
   if (!peer->clear_node_queue->thread)
     bgp_clear_node_complete (peer->clear_node_queue);
@@ -2880,43 +3336,37 @@ bgp_clear_route_all (struct peer *peer)
 void
 bgp_clear_adj_in (struct peer *peer, afi_t afi, safi_t safi)
 {
-  struct bgp_table *table;
-  struct bgp_node *rn;
-  struct bgp_adj_in *ain;
+  struct bgp_clear_walk walk;
 
-  table = peer->bgp->rib[afi][safi];
+  walk.peer = peer;
+  walk.afi = afi;
+  walk.safi = safi;
+  bgp_pool_walk (peer, BGP_POOL_ADJ_IN, bgp_clear_route_adj_in, &walk);
+}
 
-  for (rn = bgp_table_top (table); rn; rn = bgp_route_next (rn))
-    for (ain = rn->adj_in; ain ; ain = ain->next)
-      if (ain->peer == peer)
-	{
-          bgp_adj_in_remove (rn, ain);
-          bgp_unlock_node (rn);
-          break;
-	}
+static void
+bgp_clear_stale_path (void *entry, void *arg)
+{
+  struct bgp_info *ri = entry;
+  struct bgp_clear_walk *walk = arg;
+
+  if (ri->rn->table->type == BGP_TABLE_MAIN
+      && BGP_CLEAR_WALK_MATCH (walk, ri->rn)
+      && CHECK_FLAG (ri->flags, BGP_INFO_STALE))
+    bgp_rib_remove (ri->rn, ri, walk->peer, walk->afi, walk->safi);
 }
 
 void
 bgp_clear_stale_route (struct peer *peer, afi_t afi, safi_t safi)
 {
-  struct bgp_node *rn;
-  struct bgp_info *ri;
-  struct bgp_table *table;
+  struct bgp_clear_walk walk;
 
-  table = peer->bgp->rib[afi][safi];
-
-  for (rn = bgp_table_top (table); rn; rn = bgp_route_next (rn))
-    {
-      for (ri = rn->info; ri; ri = ri->next)
-	if (ri->peer == peer)
-	  {
-	    if (CHECK_FLAG (ri->flags, BGP_INFO_STALE))
-	      bgp_rib_remove (rn, ri, peer, afi, safi);
-	    break;
-	  }
-    }
+  walk.peer = peer;
+  walk.afi = afi;
+  walk.safi = safi;
+  bgp_pool_walk (peer, BGP_POOL_INFO, bgp_clear_stale_path, &walk);
 }
-
+
 /* Delete all kernel routes. */
 void
 bgp_cleanup_routes (void)
@@ -3045,6 +3495,7 @@ bgp_nlri_parse (struct peer *peer, struct attr *attr, struct bgp_nlri *packet)
       else
 	ret = bgp_withdraw (peer, &p, attr, packet->afi, packet->safi, 
 			    ZEBRA_ROUTE_BGP, BGP_ROUTE_NORMAL, NULL, NULL);
+      bgp_pipeline_count (BGP_PIPELINE_RIB, 1);
 
       /* Address family configuration mismatch or maximum-prefix count
          overflow. */
@@ -3295,10 +3746,9 @@ bgp_static_update_rsclient (struct peer *rsclient, struct prefix *p,
     }
   
   /* Make new BGP info. */
-  new = bgp_info_new ();
+  new = bgp_info_new (bgp->peer_self);
   new->type = ZEBRA_ROUTE_BGP;
   new->sub_type = BGP_ROUTE_STATIC;
-  new->peer = bgp->peer_self;
   SET_FLAG (new->flags, BGP_INFO_VALID);
   new->attr = attr_new;
   new->uptime = bgp_clock ();
@@ -3414,10 +3864,9 @@ bgp_static_update_main (struct bgp *bgp, struct prefix *p,
     }
 
   /* Make new BGP info. */
-  new = bgp_info_new ();
+  new = bgp_info_new (bgp->peer_self);
   new->type = ZEBRA_ROUTE_BGP;
   new->sub_type = BGP_ROUTE_STATIC;
-  new->peer = bgp->peer_self;
   SET_FLAG (new->flags, BGP_INFO_VALID);
   new->attr = attr_new;
   new->uptime = bgp_clock ();
@@ -3465,15 +3914,13 @@ bgp_static_update_vpnv4 (struct bgp *bgp, struct prefix *p, afi_t afi,
   rn = bgp_afi_node_get (bgp->rib[afi][safi], afi, safi, p, prd);
 
   /* Make new BGP info. */
-  new = bgp_info_new ();
+  new = bgp_info_new (bgp->peer_self);
   new->type = ZEBRA_ROUTE_BGP;
   new->sub_type = BGP_ROUTE_STATIC;
-  new->peer = bgp->peer_self;
   new->attr = bgp_attr_default_intern (BGP_ORIGIN_IGP);
   SET_FLAG (new->flags, BGP_INFO_VALID);
   new->uptime = bgp_clock ();
-  new->extra = bgp_info_extra_new();
-  memcpy (new->extra->tag, tag, 3);
+  memcpy ((bgp_info_extra_get (new))->tag, tag, 3);
 
   /* Aggregate address increment. */
   bgp_aggregate_increment (bgp, p, new, afi, safi);
@@ -4543,10 +4990,9 @@ bgp_aggregate_route (struct bgp *bgp, struct prefix *p, struct bgp_info *rinew,
   if (aggregate->count > 0)
     {
       rn = bgp_node_get (table, p);
-      new = bgp_info_new ();
+      new = bgp_info_new (bgp->peer_self);
       new->type = ZEBRA_ROUTE_BGP;
       new->sub_type = BGP_ROUTE_AGGREGATE;
-      new->peer = bgp->peer_self;
       SET_FLAG (new->flags, BGP_INFO_VALID);
       new->attr = bgp_attr_aggregate_intern (bgp, origin, aspath, community, aggregate->as_set);
       new->uptime = bgp_clock ();
@@ -4714,10 +5160,9 @@ bgp_aggregate_add (struct bgp *bgp, struct prefix *p, afi_t afi, safi_t safi,
     {
       rn = bgp_node_get (table, p);
 
-      new = bgp_info_new ();
+      new = bgp_info_new (bgp->peer_self);
       new->type = ZEBRA_ROUTE_BGP;
       new->sub_type = BGP_ROUTE_AGGREGATE;
-      new->peer = bgp->peer_self;
       SET_FLAG (new->flags, BGP_INFO_VALID);
       new->attr = bgp_attr_aggregate_intern (bgp, origin, aspath, community, aggregate->as_set);
       new->uptime = bgp_clock ();
@@ -5352,10 +5797,9 @@ bgp_redistribute_add (struct prefix *p, struct in_addr *nexthop,
  		} 
  	    }
 
-	  new = bgp_info_new ();
+	  new = bgp_info_new (bgp->peer_self);
 	  new->type = type;
 	  new->sub_type = BGP_ROUTE_REDISTRIBUTE;
-	  new->peer = bgp->peer_self;
 	  SET_FLAG (new->flags, BGP_INFO_VALID);
 	  new->attr = new_attr;
 	  new->uptime = bgp_clock ();
@@ -38,6 +38,12 @@ struct bgp_info_extra
   /* Nexthop reachability check.  */
   u_int32_t igpmetric;
 
+  /* Nexthop cache entry this path is tracked by, and the other paths
+     on it.  */
+  struct bgp_nexthop_cache *bnc;
+  struct bgp_info *bnc_next;
+  struct bgp_info *bnc_prev;
+
   /* MPLS label.  */
   u_char tag[3];  
 };
@@ -51,6 +57,9 @@ struct bgp_info
   /* Peer structure.  */
   struct peer *peer;
 
+  /* The node this path is in.  */
+  struct bgp_node *rn;
+
   /* Attribute structure.  */
   struct attr *attr;
   
@@ -184,8 +193,10 @@ extern struct bgp_info *bgp_info_unlock (struct bgp_info *);
 extern void bgp_info_add (struct bgp_node *rn, struct bgp_info *ri);
 extern void bgp_info_delete (struct bgp_node *rn, struct bgp_info *ri);
 extern struct bgp_info_extra *bgp_info_extra_get (struct bgp_info *);
+extern size_t bgp_info_memory (unsigned long *, unsigned long *);
 extern void bgp_info_set_flag (struct bgp_node *, struct bgp_info *, u_int32_t);
 extern void bgp_info_unset_flag (struct bgp_node *, struct bgp_info *, u_int32_t);
+extern void bgp_info_note_change (struct bgp_node *, struct bgp_info *);
 
 extern int bgp_nlri_sanity_check (struct peer *, int, u_char *, bgp_size_t);
 extern int bgp_nlri_parse (struct peer *, struct attr *, struct bgp_nlri *);
@@ -216,6 +227,48 @@ extern int bgp_withdraw (struct peer *, struct prefix *, struct attr *,
 
 /* for bgp_nexthop and bgp_damp */
 extern void bgp_process (struct bgp *, struct bgp_node *, afi_t, safi_t);
+
+/* Previous and newly chosen best path of a node. */
+struct bgp_info_pair
+{
+  struct bgp_info *old;
+  struct bgp_info *new;
+};
+
+extern void bgp_best_selection (struct bgp *, struct bgp_node *,
+				struct bgp_info_pair *);
+extern void bgp_best_selection_reset (struct bgp *);
+
+/* Nodes handed to bgp_process() in one work queue item. */
+#define BGP_PROCESS_BATCH	256
+
+/* Best path selection work, for "show ip bgp pipeline". */
+struct bgp_process_stats
+{
+  unsigned long requests;	/* bgp_process() calls */
+  unsigned long coalesced;	/* ... for a node queued already */
+  unsigned long batches;	/* work queue items */
+  unsigned long queued;		/* nodes waiting right now */
+  unsigned long yields;		/* batches put off to let others run */
+  unsigned long incremental;	/* selections comparing one changed path */
+  unsigned long full;		/* selections going through all paths */
+  unsigned long announce_shared; /* announced with the route's attributes */
+  unsigned long announce_copied; /* ... with a modified copy */
+};
+extern struct bgp_process_stats bgp_process_stats;
+
+/* Route-map memo, for "show ip bgp pipeline". */
+struct bgp_rmap_memo_stats
+{
+  unsigned long entries;	/* held right now */
+  unsigned long lookups;	/* attributes looked up */
+  unsigned long hits;		/* ... and found */
+};
+extern struct bgp_rmap_memo_stats bgp_rmap_memo_stats;
+extern int bgp_route_map_apply (struct route_map *, struct prefix *,
+				struct bgp_info *);
+extern void bgp_route_map_memo_flush (void);
+
 extern int bgp_config_write_network (struct vty *, struct bgp *, afi_t, safi_t, int *);
 extern int bgp_config_write_distance (struct vty *, struct bgp *);
 
@@ -28,6 +28,9 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "plist.h"
 #include "memory.h"
 #include "log.h"
+#include "hash.h"
+#include "jhash.h"
+#include "thread.h"
 #ifdef HAVE_LIBPCREPOSIX
 # include <pcreposix.h>
 #else
@@ -52,6 +55,7 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "bgpd/bgp_mplsvpn.h"
 #include "bgpd/bgp_ecommunity.h"
 #include "bgpd/bgp_vty.h"
+#include "bgpd/bgp_updgrp.h"
 
 /* Memo of route-map commands.
 
@@ -293,7 +297,8 @@ struct route_map_rule_cmd route_match_ip_next_hop_cmd =
   "ip next-hop",
   route_match_ip_next_hop,
   route_match_ip_next_hop_compile,
-  route_match_ip_next_hop_free
+  route_match_ip_next_hop_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* `match ip route-source ACCESS-LIST' */
@@ -438,7 +443,8 @@ struct route_map_rule_cmd route_match_ip_next_hop_prefix_list_cmd =
   "ip next-hop prefix-list",
   route_match_ip_next_hop_prefix_list,
   route_match_ip_next_hop_prefix_list_compile,
-  route_match_ip_next_hop_prefix_list_free
+  route_match_ip_next_hop_prefix_list_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* `match ip route-source prefix-list PREFIX_LIST' */
@@ -551,7 +557,8 @@ struct route_map_rule_cmd route_match_metric_cmd =
   "metric",
   route_match_metric,
   route_match_metric_compile,
-  route_match_metric_free
+  route_match_metric_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* `match as-path ASPATH' */
@@ -599,7 +606,8 @@ struct route_map_rule_cmd route_match_aspath_cmd =
   "as-path",
   route_match_aspath,
   route_match_aspath_compile,
-  route_match_aspath_free
+  route_match_aspath_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* `match community COMMUNIY' */
@@ -683,7 +691,8 @@ struct route_map_rule_cmd route_match_community_cmd =
   "community",
   route_match_community,
   route_match_community_compile,
-  route_match_community_free
+  route_match_community_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* Match function for extcommunity match. */
@@ -732,7 +741,8 @@ struct route_map_rule_cmd route_match_ecommunity_cmd =
   "extcommunity",
   route_match_ecommunity,
   route_match_ecommunity_compile,
-  route_match_ecommunity_free
+  route_match_ecommunity_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* `match nlri` and `set nlri` are replaced by `address-family ipv4`
@@ -788,7 +798,8 @@ struct route_map_rule_cmd route_match_origin_cmd =
   "origin",
   route_match_origin,
   route_match_origin_compile,
-  route_match_origin_free
+  route_match_origin_free,
+  RMAP_RULE_ATTR_ONLY
 };
 /* `set ip next-hop IP_ADDRESS' */
 
@@ -961,6 +972,7 @@ struct route_map_rule_cmd route_set_local_pref_cmd =
   route_set_local_pref,
   route_set_local_pref_compile,
   route_set_local_pref_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* `set weight WEIGHT' */
@@ -1030,6 +1042,7 @@ struct route_map_rule_cmd route_set_weight_cmd =
   route_set_weight,
   route_set_weight_compile,
   route_set_weight_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* `set metric METRIC' */
@@ -1128,6 +1141,7 @@ struct route_map_rule_cmd route_set_metric_cmd =
   route_set_metric,
   route_set_metric_compile,
   route_set_metric_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* `set as-path prepend ASPATH' */
@@ -1184,6 +1198,7 @@ struct route_map_rule_cmd route_set_aspath_prepend_cmd =
   route_set_aspath_prepend,
   route_set_aspath_prepend_compile,
   route_set_aspath_prepend_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* `set as-path exclude ASn' */
@@ -1242,6 +1257,7 @@ struct route_map_rule_cmd route_set_aspath_exclude_cmd =
   route_set_aspath_exclude,
   route_set_aspath_exclude_compile,
   route_set_aspath_exclude_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* `set community COMMUNITY' */
@@ -1363,6 +1379,7 @@ struct route_map_rule_cmd route_set_community_cmd =
   route_set_community,
   route_set_community_compile,
   route_set_community_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* `set comm-list (<1-99>|<100-500>|WORD) delete' */
@@ -1452,6 +1469,7 @@ struct route_map_rule_cmd route_set_community_delete_cmd =
   route_set_community_delete,
   route_set_community_delete_compile,
   route_set_community_delete_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* `set extcommunity rt COMMUNITY' */
@@ -1519,6 +1537,7 @@ struct route_map_rule_cmd route_set_ecommunity_rt_cmd =
   route_set_ecommunity_rt,
   route_set_ecommunity_rt_compile,
   route_set_ecommunity_rt_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* `set extcommunity soo COMMUNITY' */
@@ -1584,6 +1603,7 @@ struct route_map_rule_cmd route_set_ecommunity_soo_cmd =
   route_set_ecommunity_soo,
   route_set_ecommunity_soo_compile,
   route_set_ecommunity_soo_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* `set origin ORIGIN' */
@@ -1638,6 +1658,7 @@ struct route_map_rule_cmd route_set_origin_cmd =
   route_set_origin,
   route_set_origin_compile,
   route_set_origin_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* `set atomic-aggregate' */
@@ -1679,6 +1700,7 @@ struct route_map_rule_cmd route_set_atomic_aggregate_cmd =
   route_set_atomic_aggregate,
   route_set_atomic_aggregate_compile,
   route_set_atomic_aggregate_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* `set aggregator as AS A.B.C.D' */
@@ -1738,6 +1760,7 @@ struct route_map_rule_cmd route_set_aggregator_as_cmd =
   route_set_aggregator_as,
   route_set_aggregator_as_compile,
   route_set_aggregator_as_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 #ifdef HAVE_IPV6
@@ -1841,7 +1864,8 @@ struct route_map_rule_cmd route_match_ipv6_next_hop_cmd =
   "ipv6 next-hop",
   route_match_ipv6_next_hop,
   route_match_ipv6_next_hop_compile,
-  route_match_ipv6_next_hop_free
+  route_match_ipv6_next_hop_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* `match ipv6 address prefix-list PREFIX_LIST' */
@@ -1945,7 +1969,8 @@ struct route_map_rule_cmd route_set_ipv6_nexthop_global_cmd =
   "ipv6 next-hop global",
   route_set_ipv6_nexthop_global,
   route_set_ipv6_nexthop_global_compile,
-  route_set_ipv6_nexthop_global_free
+  route_set_ipv6_nexthop_global_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* `set ipv6 nexthop local IP_ADDRESS' */
@@ -2009,7 +2034,8 @@ struct route_map_rule_cmd route_set_ipv6_nexthop_local_cmd =
   "ipv6 next-hop local",
   route_set_ipv6_nexthop_local,
   route_set_ipv6_nexthop_local_compile,
-  route_set_ipv6_nexthop_local_free
+  route_set_ipv6_nexthop_local_free,
+  RMAP_RULE_ATTR_ONLY
 };
 #endif /* HAVE_IPV6 */
 
@@ -2066,7 +2092,8 @@ struct route_map_rule_cmd route_set_vpnv4_nexthop_cmd =
   "vpnv4 next-hop",
   route_set_vpnv4_nexthop,
   route_set_vpnv4_nexthop_compile,
-  route_set_vpnv4_nexthop_free
+  route_set_vpnv4_nexthop_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* `set originator-id' */
@@ -2124,6 +2151,7 @@ struct route_map_rule_cmd route_set_originator_id_cmd =
   route_set_originator_id,
   route_set_originator_id_compile,
   route_set_originator_id_free,
+  RMAP_RULE_ATTR_ONLY
 };
 
 /* Add bgp route map rule. */
@@ -2218,6 +2246,226 @@ bgp_route_set_delete (struct vty *vty, struct route_map_index *index,
   return CMD_SUCCESS;
 }
 
+/* Route-map outcomes memoized per attribute set.  Most of a policy
+   looks at nothing but the attributes, and the same attributes come by
+   prefix after prefix: all the NLRI of an UPDATE, the routes of one
+   origin in the next UPDATEs, and every route on its way out.  Entries
+   are keyed by map and attributes, and hold the whole outcome,
+   attributes left included, so a hit costs one hash lookup.  Maps with
+   rules looking at the prefix or the peer are not memoized: what is
+   left to evaluate per route costs more than the lookup saves.
+
+   Entries hold on to the interned parts of the attributes they keep,
+   and only attributes whose parts are all interned are looked up.
+   Parts of the attributes left by a hit belong to the memo, which is
+   why it is never flushed in the middle of an event: configuration
+   changes come from the vty, and a full memo is flushed by an event of
+   its own. */
+struct bgp_rmap_memo
+{
+  struct route_map *map;
+  u_int32_t version;		/* of the map */
+  unsigned int key;
+
+  /* The attributes looked at. */
+  struct attr in;
+
+  /* What the map made of them. */
+  route_map_result_t result;
+  struct attr out;
+};
+
+#define BGP_RMAP_MEMO_MAX	32768
+
+static struct hash *bgp_rmap_memo;
+static struct thread *bgp_rmap_memo_t_flush;
+
+struct bgp_rmap_memo_stats bgp_rmap_memo_stats;
+
+static unsigned int
+bgp_rmap_memo_key (void *p)
+{
+  return ((struct bgp_rmap_memo *) p)->key;
+}
+
+static int
+bgp_rmap_memo_cmp (const void *p1, const void *p2)
+{
+  const struct bgp_rmap_memo *m1 = p1;
+  const struct bgp_rmap_memo *m2 = p2;
+  const struct attr_extra *ae1 = m1->in.extra;
+  const struct attr_extra *ae2 = m2->in.extra;
+
+  if (m1->map != m2->map || ! attrhash_cmp (&m1->in, &m2->in))
+    return 0;
+
+  /* attrhash_cmp() leaves these out, and route-maps may pass them
+     on. */
+  return ! ae1
+	 || (IPV4_ADDR_SAME (&ae1->originator_id, &ae2->originator_id)
+	     && IPV4_ADDR_SAME (&ae1->mp_nexthop_local_in,
+				&ae2->mp_nexthop_local_in));
+}
+
+static int
+bgp_rmap_memo_interned (struct attr *attr)
+{
+  struct attr_extra *ae = attr->extra;
+
+  return (! attr->aspath || attr->aspath->refcnt)
+	 && (! attr->community || attr->community->refcnt)
+	 && (! ae || ((! ae->ecommunity || ae->ecommunity->refcnt)
+		      && (! ae->cluster || ae->cluster->refcnt)
+		      && (! ae->transit || ae->transit->refcnt)));
+}
+
+/* Copy FROM into TO, taking a reference on each part.  Parts a
+   route-map made are not interned yet, and are interned copies. */
+static void
+bgp_rmap_memo_hold (struct attr *to, struct attr *from)
+{
+  struct attr_extra *ae;
+
+  *to = *from;
+  to->extra = NULL;
+  if (from->extra)
+    *bgp_attr_extra_get (to) = *from->extra;
+
+  if (to->aspath)
+    {
+      if (to->aspath->refcnt)
+	to->aspath->refcnt++;
+      else
+	to->aspath = aspath_intern (aspath_dup (to->aspath));
+    }
+  if (to->community)
+    {
+      if (to->community->refcnt)
+	to->community->refcnt++;
+      else
+	to->community = community_intern (community_dup (to->community));
+    }
+
+  if ((ae = to->extra) == NULL)
+    return;
+  if (ae->ecommunity)
+    {
+      if (ae->ecommunity->refcnt)
+	ae->ecommunity->refcnt++;
+      else
+	ae->ecommunity = ecommunity_intern (ecommunity_dup (ae->ecommunity));
+    }
+  if (ae->cluster)
+    ae->cluster->refcnt++;
+  if (ae->transit)
+    ae->transit->refcnt++;
+}
+
+static void
+bgp_rmap_memo_release (struct attr *attr)
+{
+  bgp_attr_unintern_sub (attr);
+  bgp_attr_extra_free (attr);
+}
+
+static void
+bgp_rmap_memo_free (void *p)
+{
+  struct bgp_rmap_memo *memo = p;
+
+  bgp_rmap_memo_release (&memo->in);
+  if (memo->result != RMAP_DENYMATCH)
+    bgp_rmap_memo_release (&memo->out);
+  XFREE (MTYPE_BGP_RMAP_MEMO, memo);
+  bgp_rmap_memo_stats.entries--;
+}
+
+/* Forget everything, for a change to a route-map or to a list one
+   may look at. */
+void
+bgp_route_map_memo_flush (void)
+{
+  if (bgp_rmap_memo)
+    hash_clean (bgp_rmap_memo, bgp_rmap_memo_free);
+}
+
+static int
+bgp_rmap_memo_flush_event (struct thread *t)
+{
+  bgp_rmap_memo_t_flush = NULL;
+  bgp_route_map_memo_flush ();
+  return 0;
+}
+
+/* route_map_apply() of MAP to INFO, taken from the memo when MAP looks
+   at nothing but the attributes. */
+int
+bgp_route_map_apply (struct route_map *map, struct prefix *p,
+		     struct bgp_info *info)
+{
+  struct attr *attr = info->attr;
+  struct bgp_rmap_memo lookup;
+  struct bgp_rmap_memo *memo;
+  struct attr_extra *ae;
+  route_map_result_t ret;
+
+  if (! map || map->other || ! bgp_rmap_memo
+      || ! bgp_rmap_memo_interned (attr))
+    return route_map_apply (map, p, RMAP_BGP, info);
+
+  bgp_rmap_memo_stats.lookups++;
+  lookup.map = map;
+  lookup.in = *attr;
+  lookup.key = jhash_1word ((unsigned long) map, attrhash_key_make (attr));
+
+  memo = hash_lookup (bgp_rmap_memo, &lookup);
+  if (memo && memo->version != map->version)
+    {
+      hash_release (bgp_rmap_memo, memo);
+      bgp_rmap_memo_free (memo);
+      memo = NULL;
+    }
+
+  if (memo)
+    {
+      bgp_rmap_memo_stats.hits++;
+
+      /* What the map left last time, the parts being the memo's. */
+      if (memo->result != RMAP_DENYMATCH)
+	{
+	  ae = attr->extra;
+	  *attr = memo->out;
+	  attr->extra = ae;
+	  if (memo->out.extra)
+	    *bgp_attr_extra_get (attr) = *memo->out.extra;
+	}
+      return memo->result;
+    }
+
+  if (bgp_rmap_memo->count >= BGP_RMAP_MEMO_MAX)
+    {
+      if (! bgp_rmap_memo_t_flush)
+	bgp_rmap_memo_t_flush =
+	  thread_add_event (master, bgp_rmap_memo_flush_event, NULL, 0);
+      return route_map_apply (map, p, RMAP_BGP, info);
+    }
+
+  memo = XCALLOC (MTYPE_BGP_RMAP_MEMO, sizeof (struct bgp_rmap_memo));
+  memo->map = map;
+  memo->version = map->version;
+  memo->key = lookup.key;
+  bgp_rmap_memo_hold (&memo->in, attr);
+
+  ret = route_map_apply (map, p, RMAP_BGP, info);
+  memo->result = ret;
+  if (ret != RMAP_DENYMATCH)
+    bgp_rmap_memo_hold (&memo->out, attr);
+
+  hash_get (bgp_rmap_memo, memo, hash_alloc_intern);
+  bgp_rmap_memo_stats.entries++;
+  return ret;
+}
+
 /* Hook function for updating route_map assignment. */
 static void
 bgp_route_map_update (const char *unused)
@@ -2235,6 +2483,10 @@ bgp_route_map_update (const char *unused)
   struct bgp_node *bn;
   struct bgp_static *bgp_static;
 
+  /* A route-map may now look at the peer it is applied for. */
+  bgp_updgrp_invalidate ();
+  bgp_route_map_memo_flush ();
+
   /* For neighbor route-map updates. */
   for (ALL_LIST_ELEMENTS (bm->bgp, mnode, mnnode, bgp))
     {
@@ -3737,6 +3989,9 @@ bgp_route_map_init (void)
   route_map_add_hook (bgp_route_map_update);
   route_map_delete_hook (bgp_route_map_update);
 
+  bgp_rmap_memo = hash_create_size (BGP_RMAP_MEMO_MAX, bgp_rmap_memo_key,
+				    bgp_rmap_memo_cmp);
+
   route_map_install_match (&route_match_peer_cmd);
   route_map_install_match (&route_match_ip_address_cmd);
   route_map_install_match (&route_match_ip_next_hop_cmd);
@@ -63,10 +63,18 @@ struct bgp_node
 
   struct bgp_node *prn;
 
+  /* The one path added or changed since the node was last processed,
+     unless BGP_NODE_RESCAN says there was more than that.  With
+     BGP_NODE_CHANGED_WORSE, it lost to the best path at the first
+     steps of the decision process before it changed. */
+  struct bgp_info *changed;
+
   int lock;
 
   u_char flags;
 #define BGP_NODE_PROCESS_SCHEDULED	(1 << 0)
+#define BGP_NODE_RESCAN			(1 << 1)
+#define BGP_NODE_CHANGED_WORSE		(1 << 2)
 };
 
 extern struct bgp_table *bgp_table_init (afi_t, safi_t);
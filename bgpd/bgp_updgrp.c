@@ -0,0 +1,545 @@
+/* BGP update groups.
+
+This file is part of GNU Zebra.
+
+GNU Zebra is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation; either version 2, or (at your option) any
+later version.
+
+GNU Zebra is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GNU Zebra; see the file COPYING.  If not, write to the Free
+Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.  */
+
+/* Peers of one address family whose outbound policy is configured the
+   same way are put in an update group.  The group remembers the result
+   of the last outbound policy run and the last encoded path attribute
+   block, so that a route going out to N peers of a group is filtered
+   and encoded once instead of N times.  It also remembers the last
+   UPDATE packets built for its members, so that members sending the
+   same bytes queue one packet buffer between them.
+
+   Membership is worked out lazily.  Anything which may change a key
+   bumps a generation number, and a peer whose stamp is stale has its
+   key rebuilt the next time it is asked for its group.  */
+
+#include <zebra.h>
+
+#include "command.h"
+#include "prefix.h"
+#include "linklist.h"
+#include "memory.h"
+#include "stream.h"
+#include "jhash.h"
+#include "routemap.h"
+#include "log.h"
+
+#include "bgpd/bgpd.h"
+#include "bgpd/bgp_table.h"
+#include "bgpd/bgp_attr.h"
+#include "bgpd/bgp_route.h"
+#include "bgpd/bgp_nexthop.h"
+#include "bgpd/bgp_packet.h"
+#include "bgpd/bgp_vty.h"
+#include "bgpd/bgp_updgrp.h"
+
+/* Current membership generation.  Starts at 1 so that a zeroed peer
+   never looks up to date. */
+static u_int32_t updgrp_generation = 1;
+
+/* Group numbers, for show output only. */
+static u_int32_t updgrp_id;
+
+void
+bgp_updgrp_invalidate (void)
+{
+  updgrp_generation++;
+}
+
+/* Does the route-map look at the peer it is applied for, rather than
+   only at the route. */
+static int
+updgrp_rmap_peer (struct route_map *map)
+{
+  if (map == NULL)
+    return 0;
+
+  return (route_map_uses_rule (map, "peer", NULL)
+	  || route_map_uses_rule (map, "ip route-source", NULL)
+	  || route_map_uses_rule (map, "ip route-source prefix-list", NULL)
+	  || route_map_uses_rule (map, "ip next-hop", "peer-address"));
+}
+
+static void
+updgrp_key_make (struct peer *peer, afi_t afi, safi_t safi,
+		 struct update_group_key *key)
+{
+  struct bgp_filter *filter = &peer->filter[afi][safi];
+
+  memset (key, 0, sizeof (struct update_group_key));
+
+  key->sort = peer_sort (peer);
+  key->local_as = peer->local_as;
+  key->change_local_as = peer->change_local_as;
+#ifdef BGP_SEND_ASPATH_CHECK
+  key->as = peer->as;
+#endif /* BGP_SEND_ASPATH_CHECK */
+  key->as4 = CHECK_FLAG (peer->cap, PEER_CAP_AS4_RCV) ? 1 : 0;
+  key->af_flags = peer->af_flags[afi][safi];
+
+  key->nexthop = peer->nexthop.v4;
+#ifdef HAVE_IPV6
+  key->nexthop_global = peer->nexthop.v6_global;
+  key->nexthop_local = peer->nexthop.v6_local;
+#endif /* HAVE_IPV6 */
+  key->shared_network = peer->shared_network;
+  if (key->sort == BGP_PEER_EBGP)
+    bgp_multiaccess_subnet_v4 (peer->host, &key->subnet);
+
+  if (updgrp_rmap_peer (ROUTE_MAP_OUT (filter))
+      || updgrp_rmap_peer (UNSUPPRESS_MAP (filter)))
+    key->owner = peer;
+
+  key->dlist = filter->dlist[FILTER_OUT].name;
+  key->plist = filter->plist[FILTER_OUT].name;
+  key->aslist = filter->aslist[FILTER_OUT].name;
+  key->rmap = filter->map[RMAP_OUT].name;
+  key->usmap = filter->usmap.name;
+}
+
+static int
+updgrp_str_same (const char *s1, const char *s2)
+{
+  if (s1 == NULL || s2 == NULL)
+    return s1 == s2;
+  return strcmp (s1, s2) == 0;
+}
+
+static int
+updgrp_key_same (struct update_group_key *k1, struct update_group_key *k2)
+{
+  if (k1->sort != k2->sort
+      || k1->local_as != k2->local_as
+      || k1->change_local_as != k2->change_local_as
+      || k1->as != k2->as
+      || k1->as4 != k2->as4
+      || k1->af_flags != k2->af_flags
+      || k1->owner != k2->owner
+      || k1->shared_network != k2->shared_network)
+    return 0;
+
+  if (! IPV4_ADDR_SAME (&k1->nexthop, &k2->nexthop))
+    return 0;
+#ifdef HAVE_IPV6
+  if (! IPV6_ADDR_SAME (&k1->nexthop_global, &k2->nexthop_global)
+      || ! IPV6_ADDR_SAME (&k1->nexthop_local, &k2->nexthop_local))
+    return 0;
+#endif /* HAVE_IPV6 */
+
+  if (k1->subnet.family != k2->subnet.family
+      || (k1->subnet.family && ! prefix_same (&k1->subnet, &k2->subnet)))
+    return 0;
+
+  return (updgrp_str_same (k1->dlist, k2->dlist)
+	  && updgrp_str_same (k1->plist, k2->plist)
+	  && updgrp_str_same (k1->aslist, k2->aslist)
+	  && updgrp_str_same (k1->rmap, k2->rmap)
+	  && updgrp_str_same (k1->usmap, k2->usmap));
+}
+
+static char *
+updgrp_strdup (const char *str)
+{
+  return str ? XSTRDUP (MTYPE_BGP_UPDGRP, str) : NULL;
+}
+
+static void
+updgrp_strfree (char *str)
+{
+  if (str)
+    XFREE (MTYPE_BGP_UPDGRP, str);
+}
+
+static struct update_group *
+updgrp_new (struct bgp *bgp, afi_t afi, safi_t safi,
+	    struct update_group_key *key)
+{
+  struct update_group *group;
+
+  group = XCALLOC (MTYPE_BGP_UPDGRP, sizeof (struct update_group));
+  group->bgp = bgp;
+  group->afi = afi;
+  group->safi = safi;
+  group->id = ++updgrp_id;
+
+  /* The names belong to the peer which created the group; take our
+     own copies. */
+  group->key = *key;
+  group->key.dlist = updgrp_strdup (key->dlist);
+  group->key.plist = updgrp_strdup (key->plist);
+  group->key.aslist = updgrp_strdup (key->aslist);
+  group->key.rmap = updgrp_strdup (key->rmap);
+  group->key.usmap = updgrp_strdup (key->usmap);
+
+  group->peer = list_new ();
+
+  if (! bgp->update_groups[afi][safi])
+    bgp->update_groups[afi][safi] = list_new ();
+  listnode_add (bgp->update_groups[afi][safi], group);
+
+  return group;
+}
+
+static void
+updgrp_enc_reset (struct update_group *group)
+{
+  if (group->enc.attr)
+    bgp_attr_unintern (&group->enc.attr);
+  group->enc.attr = NULL;
+  if (group->enc.from)
+    peer_unlock (group->enc.from);
+  group->enc.from = NULL;
+  if (group->enc.data)
+    XFREE (MTYPE_BGP_UPDGRP, group->enc.data);
+  group->enc.data = NULL;
+  group->enc.len = 0;
+}
+
+static void
+updgrp_packet_release (struct update_group *group, int i)
+{
+  if (group->pkt[i].s)
+    bgp_packet_free (group->pkt[i].s);
+  group->pkt[i].s = NULL;
+}
+
+static void
+updgrp_free (struct update_group *group)
+{
+  int i;
+
+  listnode_delete (group->bgp->update_groups[group->afi][group->safi], group);
+
+  if (group->memo.attr)
+    bgp_attr_unintern (&group->memo.attr);
+  updgrp_enc_reset (group);
+  for (i = 0; i < UPDGRP_PACKET_MAX; i++)
+    updgrp_packet_release (group, i);
+
+  updgrp_strfree (group->key.dlist);
+  updgrp_strfree (group->key.plist);
+  updgrp_strfree (group->key.aslist);
+  updgrp_strfree (group->key.rmap);
+  updgrp_strfree (group->key.usmap);
+
+  list_delete (group->peer);
+  XFREE (MTYPE_BGP_UPDGRP, group);
+}
+
+static void
+updgrp_leave (struct peer *peer, afi_t afi, safi_t safi)
+{
+  struct update_group *group = peer->updgrp[afi][safi];
+
+  if (! group)
+    return;
+
+  peer->updgrp[afi][safi] = NULL;
+  listnode_delete (group->peer, peer);
+  if (list_isempty (group->peer))
+    updgrp_free (group);
+
+  peer_unlock (peer); /* update group reference */
+}
+
+/* Drop PEER from all its update groups. */
+void
+bgp_updgrp_peer_leave (struct peer *peer)
+{
+  afi_t afi;
+  safi_t safi;
+
+  for (afi = AFI_IP; afi < AFI_MAX; afi++)
+    for (safi = SAFI_UNICAST; safi < SAFI_MAX; safi++)
+      updgrp_leave (peer, afi, safi);
+}
+
+/* Return the update group PEER belongs to for AFI/SAFI, moving it to
+   another group first if its outbound configuration changed. */
+struct update_group *
+bgp_updgrp_get (struct peer *peer, afi_t afi, safi_t safi)
+{
+  struct update_group *group = peer->updgrp[afi][safi];
+  struct update_group_key key;
+  struct listnode *node = NULL;
+  struct bgp *bgp = peer->bgp;
+
+  if (group && peer->updgrp_gen[afi][safi] == updgrp_generation)
+    return group;
+
+  updgrp_key_make (peer, afi, safi, &key);
+
+  if (group)
+    {
+      if (updgrp_key_same (&group->key, &key))
+	{
+	  peer->updgrp_gen[afi][safi] = updgrp_generation;
+	  return group;
+	}
+      updgrp_leave (peer, afi, safi);
+    }
+
+  group = NULL;
+  if (bgp->update_groups[afi][safi])
+    for (ALL_LIST_ELEMENTS_RO (bgp->update_groups[afi][safi], node, group))
+      if (updgrp_key_same (&group->key, &key))
+	break;
+
+  if (! node)
+    group = updgrp_new (bgp, afi, safi, &key);
+
+  listnode_add (group->peer, peer_lock (peer)); /* update group reference */
+  peer->updgrp[afi][safi] = group;
+  peer->updgrp_gen[afi][safi] = updgrp_generation;
+
+  return group;
+}
+
+/* Look up the outbound policy result for route RI of node RN in the
+   current processing pass SEQ.  Returns 0 if it has not been worked out
+   yet, otherwise sets ATTR as bgp_announce_check() would have: to a
+   reference to the interned attributes, or to NULL if filtered. */
+int
+bgp_updgrp_memo_lookup (struct update_group *group, struct bgp_node *rn,
+			struct bgp_info *ri, u_int32_t seq,
+			struct attr **attr)
+{
+  if (group->memo.rn != rn || group->memo.ri != ri || group->memo.seq != seq)
+    return 0;
+
+  group->policy_shared++;
+
+  *attr = group->memo.attr ? bgp_attr_ref (group->memo.attr) : NULL;
+  return 1;
+}
+
+/* Remember the outbound policy result for the rest of the group.  ATTR
+   is interned, or NULL if the route was filtered. */
+void
+bgp_updgrp_memo_set (struct update_group *group, struct bgp_node *rn,
+		     struct bgp_info *ri, u_int32_t seq, struct attr *attr)
+{
+  group->policy_runs++;
+
+  if (group->memo.attr)
+    bgp_attr_unintern (&group->memo.attr);
+
+  group->memo.rn = rn;
+  group->memo.ri = ri;
+  group->memo.seq = seq;
+  group->memo.attr = attr ? bgp_attr_ref (attr) : NULL;
+}
+
+/* bgp_packet_attribute() for UPDATE packets.  ATTR is interned, so the
+   pointer identifies the attribute set; together with FROM and the
+   group key it fixes the encoding.  Only IPv4 unicast is cached since
+   the other families carry the NLRI inside the attributes. */
+bgp_size_t
+bgp_updgrp_packet_attribute (struct peer *peer, struct stream *s,
+			     struct attr *attr, struct prefix *p,
+			     afi_t afi, safi_t safi, struct peer *from,
+			     struct prefix_rd *prd, u_char *tag)
+{
+  struct update_group *group;
+  size_t start;
+  bgp_size_t len;
+
+  if (! (afi == AFI_IP && safi == SAFI_UNICAST))
+    return bgp_packet_attribute (NULL, peer, s, attr, p, afi, safi,
+				 from, prd, tag);
+
+  group = bgp_updgrp_get (peer, afi, safi);
+
+  if (group->enc.data
+      && group->enc.attr == attr
+      && group->enc.from == from
+      && group->enc.gen == updgrp_generation)
+    {
+      group->encode_shared++;
+      stream_put (s, group->enc.data, group->enc.len);
+      return group->enc.len;
+    }
+
+  group->encode_runs++;
+
+  start = stream_get_endp (s);
+  len = bgp_packet_attribute (NULL, peer, s, attr, p, afi, safi,
+			      from, prd, tag);
+
+  updgrp_enc_reset (group);
+  if (len)
+    {
+      group->enc.data = XMALLOC (MTYPE_BGP_UPDGRP, len);
+      memcpy (group->enc.data, STREAM_DATA (s) + start, len);
+      group->enc.len = len;
+      group->enc.attr = bgp_attr_ref (attr);
+      group->enc.from = from ? peer_lock (from) : NULL;
+      group->enc.gen = updgrp_generation;
+    }
+
+  return len;
+}
+
+/* PEER built UPDATE packet S.  Returns a view for it to queue instead,
+   so that members sending the very same bytes share one buffer: of a
+   packet another member built lately, or else of a copy of S kept for
+   the others.  Returns NULL if PEER is alone in its group.  Comparing
+   the bytes makes it safe whatever the members differ in. */
+struct stream *
+bgp_updgrp_packet_share (struct peer *peer, afi_t afi, safi_t safi,
+			 struct stream *s)
+{
+  struct update_group *group;
+  struct stream *pkt, *view;
+  size_t len = stream_get_endp (s);
+  u_int32_t key;
+  int i, n;
+
+  group = bgp_updgrp_get (peer, afi, safi);
+  if (listcount (group->peer) < 2)
+    return NULL;
+
+  key = jhash (STREAM_DATA (s), len, 0);
+
+  /* Newest first, members mostly come along in step. */
+  for (n = 1; n <= UPDGRP_PACKET_MAX; n++)
+    {
+      i = (group->pkt_next - n) % UPDGRP_PACKET_MAX;
+      pkt = group->pkt[i].s;
+      if (pkt == NULL
+	  || group->pkt[i].key != key
+	  || stream_get_endp (pkt) != len
+	  || memcmp (STREAM_DATA (pkt), STREAM_DATA (s), len) != 0)
+	continue;
+
+      group->packet_shared++;
+      view = bgp_packet_view (pkt);
+      if (++group->pkt[i].users >= listcount (group->peer))
+	updgrp_packet_release (group, i);
+      return view;
+    }
+
+  group->packet_runs++;
+
+  i = group->pkt_next++ % UPDGRP_PACKET_MAX;
+  updgrp_packet_release (group, i);
+  group->pkt[i].s = bgp_packet_copy (s);
+  group->pkt[i].key = key;
+  group->pkt[i].users = 1;
+  return bgp_packet_view (group->pkt[i].s);
+}
+
+static void
+updgrp_show_policy (struct vty *vty, struct update_group_key *key)
+{
+  if (key->dlist)
+    vty_out (vty, "  Outgoing distribute-list %s%s", key->dlist, VTY_NEWLINE);
+  if (key->plist)
+    vty_out (vty, "  Outgoing prefix-list %s%s", key->plist, VTY_NEWLINE);
+  if (key->aslist)
+    vty_out (vty, "  Outgoing filter-list %s%s", key->aslist, VTY_NEWLINE);
+  if (key->rmap)
+    vty_out (vty, "  Outgoing route-map %s%s%s", key->rmap,
+	     key->owner ? " (peer specific)" : "", VTY_NEWLINE);
+  if (key->usmap)
+    vty_out (vty, "  Unsuppress-map %s%s", key->usmap, VTY_NEWLINE);
+}
+
+static void
+updgrp_show_bgp (struct vty *vty, struct bgp *bgp)
+{
+  struct listnode *node, *nnode;
+  struct update_group *group;
+  struct peer *peer;
+  afi_t afi;
+  safi_t safi;
+
+  /* Bring memberships up to date first. */
+  for (ALL_LIST_ELEMENTS_RO (bgp->peer, node, peer))
+    {
+      if (peer->status != Established)
+	continue;
+      for (afi = AFI_IP; afi < AFI_MAX; afi++)
+	for (safi = SAFI_UNICAST; safi < SAFI_MAX; safi++)
+	  if (peer->afc_nego[afi][safi])
+	    bgp_updgrp_get (peer, afi, safi);
+    }
+
+  for (afi = AFI_IP; afi < AFI_MAX; afi++)
+    for (safi = SAFI_UNICAST; safi < SAFI_MAX; safi++)
+      {
+	if (! bgp->update_groups[afi][safi])
+	  continue;
+
+	for (ALL_LIST_ELEMENTS_RO (bgp->update_groups[afi][safi], node, group))
+	  {
+	    vty_out (vty, "Update group %u, %s, %d peer%s%s",
+		     group->id, afi_safi_print (afi, safi),
+		     listcount (group->peer),
+		     listcount (group->peer) == 1 ? "" : "s", VTY_NEWLINE);
+	    updgrp_show_policy (vty, &group->key);
+	    vty_out (vty, "  Policy runs %lu, shared %lu%s",
+		     group->policy_runs, group->policy_shared, VTY_NEWLINE);
+	    vty_out (vty, "  Attribute encodings %lu, shared %lu%s",
+		     group->encode_runs, group->encode_shared, VTY_NEWLINE);
+	    vty_out (vty, "  UPDATE packets %lu, shared %lu%s",
+		     group->packet_runs, group->packet_shared, VTY_NEWLINE);
+	    vty_out (vty, "  Members:");
+	    for (ALL_LIST_ELEMENTS_RO (group->peer, nnode, peer))
+	      vty_out (vty, " %s", peer->host);
+	    vty_out (vty, "%s%s", VTY_NEWLINE, VTY_NEWLINE);
+	  }
+      }
+}
+
+DEFUN (show_ip_bgp_update_groups,
+       show_ip_bgp_update_groups_cmd,
+       "show ip bgp update-groups",
+       SHOW_STR
+       IP_STR
+       BGP_STR
+       "Update groups\n")
+{
+  struct listnode *node;
+  struct bgp *bgp;
+
+  for (ALL_LIST_ELEMENTS_RO (bm->bgp, node, bgp))
+    {
+      if (bgp->name)
+	vty_out (vty, "BGP view %s%s%s", bgp->name, VTY_NEWLINE, VTY_NEWLINE);
+      updgrp_show_bgp (vty, bgp);
+    }
+  return CMD_SUCCESS;
+}
+
+ALIAS (show_ip_bgp_update_groups,
+       show_bgp_update_groups_cmd,
+       "show bgp update-groups",
+       SHOW_STR
+       BGP_STR
+       "Update groups\n")
+
+void
+bgp_updgrp_init (void)
+{
+  install_element (VIEW_NODE, &show_ip_bgp_update_groups_cmd);
+  install_element (VIEW_NODE, &show_bgp_update_groups_cmd);
+  install_element (ENABLE_NODE, &show_ip_bgp_update_groups_cmd);
+  install_element (ENABLE_NODE, &show_bgp_update_groups_cmd);
+}
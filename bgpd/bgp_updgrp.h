@@ -0,0 +1,132 @@
+/* BGP update groups.
+
+This file is part of GNU Zebra.
+
+GNU Zebra is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation; either version 2, or (at your option) any
+later version.
+
+GNU Zebra is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with GNU Zebra; see the file COPYING.  If not, write to the Free
+Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+02111-1307, USA.  */
+
+#ifndef _QUAGGA_BGP_UPDGRP_H
+#define _QUAGGA_BGP_UPDGRP_H
+
+/* UPDATE packets a group remembers for its members to share, which is
+   how far behind the first of them the others may be. */
+#define UPDGRP_PACKET_MAX 256
+
+/* Everything about a peer that outbound policy and attribute encoding
+   look at, apart from the per-peer loop checks done by
+   bgp_announce_check_peer().  Peers with equal keys get the same
+   answer from bgp_announce_check() and the same bytes out of
+   bgp_packet_attribute(). */
+struct update_group_key
+{
+  int sort;
+  as_t local_as;
+  as_t change_local_as;
+  as_t as;			/* only with BGP_SEND_ASPATH_CHECK */
+  int as4;
+
+  u_int32_t af_flags;
+
+  struct in_addr nexthop;
+#ifdef HAVE_IPV6
+  struct in6_addr nexthop_global;
+  struct in6_addr nexthop_local;
+#endif /* HAVE_IPV6 */
+  int shared_network;
+  struct prefix subnet;
+
+  /* Set when an outbound route-map looks at the peer itself. */
+  struct peer *owner;
+
+  char *dlist;
+  char *plist;
+  char *aslist;
+  char *rmap;
+  char *usmap;
+};
+
+struct update_group
+{
+  struct bgp *bgp;
+  afi_t afi;
+  safi_t safi;
+  u_int32_t id;
+
+  struct update_group_key key;
+
+  /* Member peers. */
+  struct list *peer;
+
+  /* Result of the last outbound policy run for the group.  Valid for
+     one bgp_process_main() pass, identified by seq. */
+  struct
+  {
+    struct bgp_node *rn;
+    struct bgp_info *ri;
+    u_int32_t seq;
+    struct attr *attr;		/* interned, NULL if denied */
+  } memo;
+
+  /* Last encoded path attribute block, IPv4 unicast only. */
+  struct
+  {
+    struct attr *attr;		/* interned */
+    struct peer *from;		/* locked */
+    u_int32_t gen;
+    bgp_size_t len;
+    u_char *data;
+  } enc;
+
+  /* Last UPDATE packets built for members, IPv4 unicast only, each
+     until all members queued it.  They hold a reference to the packet,
+     see bgp_packet_view(). */
+  struct
+  {
+    struct stream *s;
+    u_int32_t key;
+    unsigned int users;
+  } pkt[UPDGRP_PACKET_MAX];
+  unsigned int pkt_next;
+
+  /* Statistics. */
+  unsigned long policy_runs;
+  unsigned long policy_shared;
+  unsigned long encode_runs;
+  unsigned long encode_shared;
+  unsigned long packet_runs;
+  unsigned long packet_shared;
+};
+
+extern struct update_group *bgp_updgrp_get (struct peer *, afi_t, safi_t);
+extern void bgp_updgrp_peer_leave (struct peer *);
+extern void bgp_updgrp_invalidate (void);
+
+extern int bgp_updgrp_memo_lookup (struct update_group *, struct bgp_node *,
+				   struct bgp_info *, u_int32_t,
+				   struct attr **);
+extern void bgp_updgrp_memo_set (struct update_group *, struct bgp_node *,
+				 struct bgp_info *, u_int32_t, struct attr *);
+
+extern bgp_size_t bgp_updgrp_packet_attribute (struct peer *, struct stream *,
+					       struct attr *, struct prefix *,
+					       afi_t, safi_t, struct peer *,
+					       struct prefix_rd *, u_char *);
+
+extern struct stream *bgp_updgrp_packet_share (struct peer *, afi_t, safi_t,
+					       struct stream *);
+
+extern void bgp_updgrp_init (void);
+
+#endif /* _QUAGGA_BGP_UPDGRP_H */
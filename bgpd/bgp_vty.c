@@ -47,6 +47,7 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "bgpd/bgp_route.h"
 #include "bgpd/bgp_zebra.h"
 #include "bgpd/bgp_table.h"
+#include "bgpd/bgp_pool.h"
 #include "bgpd/bgp_vty.h"
 
 extern struct in_addr router_id_zebra;
@@ -6594,7 +6595,8 @@ DEFUN (show_bgp_memory,
        "Global BGP memory statistics\n")
 {
   char memstrbuf[MTYPE_MEMSTR_LEN];
-  unsigned long count;
+  unsigned long count, extra;
+  size_t size;
   
   /* RIB related usage stats */
   count = mtype_stats_alloc (MTYPE_BGP_NODE);
@@ -6603,16 +6605,21 @@ DEFUN (show_bgp_memory,
                          count * sizeof (struct bgp_node)),
            VTY_NEWLINE);
   
-  count = mtype_stats_alloc (MTYPE_BGP_ROUTE);
+  /* Routes and their ancillaries come out of per-peer blocks. */
+  size = bgp_pool_memory (NULL, BGP_POOL_INFO, &count);
   vty_out (vty, "%ld BGP routes, using %s of memory%s", count,
-           mtype_memstr (memstrbuf, sizeof (memstrbuf),
-                         count * sizeof (struct bgp_info)),
+           mtype_memstr (memstrbuf, sizeof (memstrbuf), size),
            VTY_NEWLINE);
-  if ((count = mtype_stats_alloc (MTYPE_BGP_ROUTE_EXTRA)))
-    vty_out (vty, "%ld BGP route ancillaries, using %s of memory%s", count,
-             mtype_memstr (memstrbuf, sizeof (memstrbuf),
-                           count * sizeof (struct bgp_info_extra)),
+  size = bgp_pool_memory (NULL, BGP_POOL_INFO_EXTRA, &extra);
+  if (extra)
+    vty_out (vty, "%ld BGP route ancillaries, using %s of memory%s", extra,
+             mtype_memstr (memstrbuf, sizeof (memstrbuf), size),
              VTY_NEWLINE);
+  size = bgp_info_memory (&count, &extra);
+  if (count)
+    vty_out (vty, "%lu bytes per route, %lu for the route itself%s",
+             (unsigned long) (size / count),
+             (unsigned long) sizeof (struct bgp_info), VTY_NEWLINE);
   
   if ((count = mtype_stats_alloc (MTYPE_BGP_STATIC)))
     vty_out (vty, "%ld Static routes, using %s of memory%s", count,
@@ -6621,15 +6628,15 @@ DEFUN (show_bgp_memory,
              VTY_NEWLINE);
   
   /* Adj-In/Out */
-  if ((count = mtype_stats_alloc (MTYPE_BGP_ADJ_IN)))
+  size = bgp_pool_memory (NULL, BGP_POOL_ADJ_IN, &count);
+  if (count)
     vty_out (vty, "%ld Adj-In entries, using %s of memory%s", count,
-             mtype_memstr (memstrbuf, sizeof (memstrbuf),
-                           count * sizeof (struct bgp_adj_in)),
+             mtype_memstr (memstrbuf, sizeof (memstrbuf), size),
              VTY_NEWLINE);
-  if ((count = mtype_stats_alloc (MTYPE_BGP_ADJ_OUT)))
+  size = bgp_pool_memory (NULL, BGP_POOL_ADJ_OUT, &count);
+  if (count)
     vty_out (vty, "%ld Adj-Out entries, using %s of memory%s", count,
-             mtype_memstr (memstrbuf, sizeof (memstrbuf),
-                           count * sizeof (struct bgp_adj_out)),
+             mtype_memstr (memstrbuf, sizeof (memstrbuf), size),
              VTY_NEWLINE);
   
   if ((count = mtype_stats_alloc (MTYPE_BGP_NEXTHOP_CACHE)))
@@ -7352,6 +7359,9 @@ bgp_show_peer (struct vty *vty, struct peer *p)
   struct bgp *bgp;
   char buf1[BUFSIZ];
   char timebuf[BGP_UPTIME_LEN];
+  char memstrbuf[MTYPE_MEMSTR_LEN];
+  unsigned long adj_in_count;
+  size_t adj_in_size;
   afi_t afi;
   safi_t safi;
 
@@ -7592,6 +7602,18 @@ bgp_show_peer (struct vty *vty, struct peer *p)
 	   p->update_out + p->keepalive_out + p->refresh_out + p->dynamic_cap_out,
 	   p->open_in + p->notify_in + p->update_in + p->keepalive_in + p->refresh_in +
 	   p->dynamic_cap_in, VTY_NEWLINE);
+  vty_out (vty, "    Input: %u messages in %u reads, %lu bytes buffered%s",
+	   p->read_msgs, p->read_calls,
+	   p->ibuf_work ? (unsigned long) STREAM_READABLE (p->ibuf_work) : 0UL,
+	   VTY_NEWLINE);
+
+  /* Adj-RIB-In kept for soft-reconfiguration. */
+  adj_in_size = bgp_pool_memory (p, BGP_POOL_ADJ_IN, &adj_in_count);
+  if (adj_in_count)
+    vty_out (vty, "  Adj-RIB-In has %lu entries, using %s of memory%s",
+	     adj_in_count,
+	     mtype_memstr (memstrbuf, sizeof (memstrbuf), adj_in_size),
+	     VTY_NEWLINE);
 
   /* advertisement-interval */
   vty_out (vty, "  Minimum time between advertisement runs is %d seconds%s",
@@ -10202,6 +10224,7 @@ community_list_set_vty (struct vty *vty, int argc, const char **argv,
   /* When community_list_set() return nevetive value, it means
      malformed community string.  */
   ret = community_list_set (bgp_clist, argv[0], str, direct, style);
+  bgp_route_map_memo_flush ();
 
   /* Free temporary community list string allocated by
      argv_concat().  */
@@ -10247,6 +10270,7 @@ community_list_unset_vty (struct vty *vty, int argc, const char **argv,
 
   /* Unset community list.  */
   ret = community_list_unset (bgp_clist, argv[0], str, direct, style);
+  bgp_route_map_memo_flush ();
 
   /* Free temporary community list string allocated by
      argv_concat().  */
@@ -10555,6 +10579,7 @@ extcommunity_list_set_vty (struct vty *vty, int argc, const char **argv,
     str = NULL;
 
   ret = extcommunity_list_set (bgp_clist, argv[0], str, direct, style);
+  bgp_route_map_memo_flush ();
 
   /* Free temporary community list string allocated by
      argv_concat().  */
@@ -10597,6 +10622,7 @@ extcommunity_list_unset_vty (struct vty *vty, int argc, const char **argv,
 
   /* Unset community list.  */
   ret = extcommunity_list_unset (bgp_clist, argv[0], str, direct, style);
+  bgp_route_map_memo_flush ();
 
   /* Free temporary community list string allocated by
      argv_concat().  */
@@ -700,8 +700,8 @@ bgp_zebra_announce (struct prefix *p, struct bgp_info *info, struct bgp *bgp)
 		     api.metric);
 	}
 
-      zapi_ipv4_route (ZEBRA_IPV4_ROUTE_ADD, zclient, 
-                       (struct prefix_ipv4 *) p, &api);
+      zapi_ipv4_route_bulk (ZEBRA_IPV4_ROUTE_ADD, zclient,
+                            (struct prefix_ipv4 *) p, &api);
     }
 #ifdef HAVE_IPV6
   /* We have to think about a IPv6 link-local address curse. */
@@ -768,8 +768,8 @@ bgp_zebra_announce (struct prefix *p, struct bgp_info *info, struct bgp *bgp)
 		     api.metric);
 	}
 
-      zapi_ipv6_route (ZEBRA_IPV6_ROUTE_ADD, zclient, 
-                       (struct prefix_ipv6 *) p, &api);
+      zapi_ipv6_route_bulk (ZEBRA_IPV6_ROUTE_ADD, zclient,
+                            (struct prefix_ipv6 *) p, &api);
     }
 #endif /* HAVE_IPV6 */
 }
@@ -826,8 +826,8 @@ bgp_zebra_withdraw (struct prefix *p, struct bgp_info *info)
 		     api.metric);
 	}
 
-      zapi_ipv4_route (ZEBRA_IPV4_ROUTE_DELETE, zclient, 
-                       (struct prefix_ipv4 *) p, &api);
+      zapi_ipv4_route_bulk (ZEBRA_IPV4_ROUTE_DELETE, zclient,
+                            (struct prefix_ipv4 *) p, &api);
     }
 #ifdef HAVE_IPV6
   /* We have to think about a IPv6 link-local address curse. */
@@ -883,8 +883,8 @@ bgp_zebra_withdraw (struct prefix *p, struct bgp_info *info)
 		     api.metric);
 	}
 
-      zapi_ipv6_route (ZEBRA_IPV6_ROUTE_DELETE, zclient, 
-                       (struct prefix_ipv6 *) p, &api);
+      zapi_ipv6_route_bulk (ZEBRA_IPV6_ROUTE_DELETE, zclient,
+                            (struct prefix_ipv6 *) p, &api);
     }
 #endif /* HAVE_IPV6 */
 }
@@ -1036,6 +1036,8 @@ bgp_zebra_init (void)
   zclient->ipv4_route_delete = zebra_read_ipv4;
   zclient->interface_up = bgp_interface_up;
   zclient->interface_down = bgp_interface_down;
+  zclient->nexthop_update = bgp_nexthop_update;
+  zclient->zebra_connected = bgp_nexthop_zebra_connected;
 #ifdef HAVE_IPV6
   zclient->ipv6_route_add = zebra_read_ipv6;
   zclient->ipv6_route_delete = zebra_read_ipv6;
@@ -55,6 +55,8 @@ Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
 #include "bgpd/bgp_damp.h"
 #include "bgpd/bgp_mplsvpn.h"
 #include "bgpd/bgp_advertise.h"
+#include "bgpd/bgp_updgrp.h"
+#include "bgpd/bgp_pipeline.h"
 #include "bgpd/bgp_network.h"
 #include "bgpd/bgp_vty.h"
 #ifdef HAVE_SNMP
@@ -118,6 +120,8 @@ bgp_option_check (int flag)
 int
 bgp_flag_set (struct bgp *bgp, int flag)
 {
+  if (CHECK_FLAG (flag, BGP_FLAG_BESTPATH) && ! CHECK_FLAG (bgp->flags, flag))
+    bgp_best_selection_reset (bgp);
   SET_FLAG (bgp->flags, flag);
   return 0;
 }
@@ -125,6 +129,8 @@ bgp_flag_set (struct bgp *bgp, int flag)
 int
 bgp_flag_unset (struct bgp *bgp, int flag)
 {
+  if (CHECK_FLAG (flag, BGP_FLAG_BESTPATH) && CHECK_FLAG (bgp->flags, flag))
+    bgp_best_selection_reset (bgp);
   UNSET_FLAG (bgp->flags, flag);
   return 0;
 }
@@ -161,6 +167,8 @@ bgp_router_id_set (struct bgp *bgp, struct in_addr *id)
   struct peer *peer;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (bgp_config_check (bgp, BGP_CONFIG_ROUTER_ID)
       && IPV4_ADDR_SAME (&bgp->router_id, id))
     return 0;
@@ -190,6 +198,8 @@ bgp_cluster_id_set (struct bgp *bgp, struct in_addr *cluster_id)
   struct peer *peer;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (bgp_config_check (bgp, BGP_CONFIG_CLUSTER_ID)
       && IPV4_ADDR_SAME (&bgp->cluster_id, cluster_id))
     return 0;
@@ -219,6 +229,8 @@ bgp_cluster_id_unset (struct bgp *bgp)
   struct peer *peer;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! bgp_config_check (bgp, BGP_CONFIG_CLUSTER_ID))
     return 0;
 
@@ -280,6 +292,8 @@ bgp_confederation_id_set (struct bgp *bgp, as_t as)
   struct listnode *node, *nnode;
   int already_confed;
 
+  bgp_updgrp_invalidate ();
+
   if (as == 0)
     return BGP_ERR_INVALID_AS;
 
@@ -340,6 +354,8 @@ bgp_confederation_id_unset (struct bgp *bgp)
   struct peer *peer;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   bgp->confed_id = 0;
   bgp_config_unset (bgp, BGP_CONFIG_CONFEDERATION);
       
@@ -386,6 +402,8 @@ bgp_confederation_peers_add (struct bgp *bgp, as_t as)
   struct peer *peer;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! bgp)
     return BGP_ERR_INVALID_BGP;
 
@@ -436,6 +454,8 @@ bgp_confederation_peers_remove (struct bgp *bgp, as_t as)
   struct peer *peer;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! bgp)
     return -1;
 
@@ -491,6 +511,8 @@ bgp_default_local_preference_set (struct bgp *bgp, u_int32_t local_pref)
   if (! bgp)
     return -1;
 
+  if (bgp->default_local_pref != local_pref)
+    bgp_best_selection_reset (bgp);
   bgp->default_local_pref = local_pref;
 
   return 0;
@@ -502,6 +524,8 @@ bgp_default_local_preference_unset (struct bgp *bgp)
   if (! bgp)
     return -1;
 
+  if (bgp->default_local_pref != BGP_DEFAULT_LOCAL_PREF)
+    bgp_best_selection_reset (bgp);
   bgp->default_local_pref = BGP_DEFAULT_LOCAL_PREF;
 
   return 0;
@@ -708,6 +732,7 @@ peer_free (struct peer *peer)
   bgp_timer_set (peer);
   BGP_READ_OFF (peer->t_read);
   BGP_WRITE_OFF (peer->t_write);
+  BGP_TIMER_OFF (peer->t_process_packet);
   BGP_EVENT_FLUSH (peer);
   
   if (peer->desc)
@@ -820,8 +845,8 @@ peer_new (struct bgp *bgp)
 
   /* Create buffers.  */
   peer->ibuf = stream_new (BGP_MAX_PACKET_SIZE);
+  peer->ibuf_work = stream_new (BGP_INPUT_BUFSIZ);
   peer->obuf = stream_fifo_new ();
-  peer->work = stream_new (BGP_MAX_PACKET_SIZE);
 
   bgp_sync_init (peer);
 
@@ -898,6 +923,8 @@ peer_as_change (struct peer *peer, as_t as)
 {
   int type;
 
+  bgp_updgrp_invalidate ();
+
   /* Stop peer. */
   if (! CHECK_FLAG (peer->sflags, PEER_STATUS_GROUP))
     {
@@ -1030,6 +1057,8 @@ peer_activate (struct peer *peer, afi_t afi, safi_t safi)
 {
   int active;
 
+  bgp_updgrp_invalidate ();
+
   if (peer->afc[afi][safi])
     return 0;
 
@@ -1079,6 +1108,8 @@ peer_deactivate (struct peer *peer, afi_t afi, safi_t safi)
   struct peer *peer1;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (CHECK_FLAG (peer->sflags, PEER_STATUS_GROUP))
     {
       group = peer->group;
@@ -1190,6 +1221,8 @@ peer_delete (struct peer *peer)
   
   bgp = peer->bgp;
 
+  bgp_updgrp_peer_leave (peer);
+
   if (CHECK_FLAG (peer->sflags, PEER_STATUS_NSF_WAIT))
     peer_nsf_stop (peer);
 
@@ -1257,12 +1290,15 @@ peer_delete (struct peer *peer)
   /* Buffers.  */
   if (peer->ibuf)
     stream_free (peer->ibuf);
+  if (peer->ibuf_work)
+    stream_free (peer->ibuf_work);
   if (peer->obuf)
-    stream_fifo_free (peer->obuf);
-  if (peer->work)
-    stream_free (peer->work);
+    {
+      bgp_packet_clean (peer);
+      stream_fifo_free (peer->obuf);
+    }
   peer->obuf = NULL;
-  peer->work = peer->ibuf = NULL;
+  peer->ibuf = peer->ibuf_work = NULL;
 
   /* Local and remote addresses. */
   if (peer->su_local)
@@ -1739,6 +1775,8 @@ peer_group_bind (struct bgp *bgp, union sockunion *su,
   struct peer *peer;
   int first_member = 0;
 
+  bgp_updgrp_invalidate ();
+
   /* Check peer group's address family.  */
   if (! group->conf->afc[afi][safi])
     return BGP_ERR_PEER_GROUP_AF_UNCONFIGURED;
@@ -1878,6 +1916,8 @@ int
 peer_group_unbind (struct bgp *bgp, struct peer *peer,
 		   struct peer_group *group, afi_t afi, safi_t safi)
 {
+  bgp_updgrp_invalidate ();
+
   if (! peer->af_group[afi][safi])
       return 0;
 
@@ -2140,6 +2180,8 @@ bgp_free (struct bgp *bgp)
   for (afi = AFI_IP; afi < AFI_MAX; afi++)
     for (safi = SAFI_UNICAST; safi < SAFI_MAX; safi++)
       {
+	if (bgp->update_groups[afi][safi])
+	  list_delete (bgp->update_groups[afi][safi]);
 	if (bgp->route[afi][safi])
           bgp_table_finish (&bgp->route[afi][safi]);
 	if (bgp->aggregate[afi][safi])
@@ -2433,6 +2475,8 @@ peer_flag_modify (struct peer *peer, u_int32_t flag, int set)
   struct listnode *node, *nnode;
   struct peer_flag_action action;
 
+  bgp_updgrp_invalidate ();
+
   memset (&action, 0, sizeof (struct peer_flag_action));
   size = sizeof peer_flag_action_list / sizeof (struct peer_flag_action);
 
@@ -2536,6 +2580,8 @@ peer_af_flag_modify (struct peer *peer, afi_t afi, safi_t safi, u_int32_t flag,
   struct peer_group *group;
   struct peer_flag_action action;
 
+  bgp_updgrp_invalidate ();
+
   memset (&action, 0, sizeof (struct peer_flag_action));
   size = sizeof peer_af_flag_action_list / sizeof (struct peer_flag_action);
   
@@ -3010,6 +3056,8 @@ peer_default_originate_set (struct peer *peer, afi_t afi, safi_t safi,
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   /* Adress family must be activated.  */
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
@@ -3066,6 +3114,8 @@ peer_default_originate_unset (struct peer *peer, afi_t afi, safi_t safi)
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   /* Adress family must be activated.  */
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
@@ -3397,6 +3447,8 @@ peer_local_as_set (struct peer *peer, as_t as, int no_prepend)
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (peer_sort (peer) != BGP_PEER_EBGP
       && peer_sort (peer) != BGP_PEER_INTERNAL)
     return BGP_ERR_LOCAL_AS_ALLOWED_ONLY_FOR_EBGP;
@@ -3460,6 +3512,8 @@ peer_local_as_unset (struct peer *peer)
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (peer_group_active (peer))
     return BGP_ERR_INVALID_FOR_PEER_GROUP_MEMBER;
 
@@ -3615,6 +3669,8 @@ peer_distribute_set (struct peer *peer, afi_t afi, safi_t safi, int direct,
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
 
@@ -3662,6 +3718,8 @@ peer_distribute_unset (struct peer *peer, afi_t afi, safi_t safi, int direct)
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
 
@@ -3727,6 +3785,9 @@ peer_distribute_update (struct access_list *access)
   struct peer_group *group;
   struct bgp_filter *filter;
 
+  bgp_updgrp_invalidate ();
+  bgp_route_map_memo_flush ();
+
   for (ALL_LIST_ELEMENTS (bm->bgp, mnode, mnnode, bgp))
     {
       for (ALL_LIST_ELEMENTS (bgp->peer, node, nnode, peer))
@@ -3775,6 +3836,8 @@ peer_prefix_list_set (struct peer *peer, afi_t afi, safi_t safi, int direct,
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
 
@@ -3821,6 +3884,8 @@ peer_prefix_list_unset (struct peer *peer, afi_t afi, safi_t safi, int direct)
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
 
@@ -3886,6 +3951,9 @@ peer_prefix_list_update (struct prefix_list *plist)
   safi_t safi;
   int direct;
 
+  bgp_updgrp_invalidate ();
+  bgp_route_map_memo_flush ();
+
   for (ALL_LIST_ELEMENTS (bm->bgp, mnode, mnnode, bgp))
     {
       for (ALL_LIST_ELEMENTS (bgp->peer, node, nnode, peer))
@@ -3933,6 +4001,8 @@ peer_aslist_set (struct peer *peer, afi_t afi, safi_t safi, int direct,
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
 
@@ -3976,6 +4046,8 @@ peer_aslist_unset (struct peer *peer,afi_t afi, safi_t safi, int direct)
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
 
@@ -4040,6 +4112,9 @@ peer_aslist_update (void)
   struct peer_group *group;
   struct bgp_filter *filter;
 
+  bgp_updgrp_invalidate ();
+  bgp_route_map_memo_flush ();
+
   for (ALL_LIST_ELEMENTS (bm->bgp, mnode, mnnode, bgp))
     {
       for (ALL_LIST_ELEMENTS (bgp->peer, node, nnode, peer))
@@ -4088,6 +4163,8 @@ peer_route_map_set (struct peer *peer, afi_t afi, safi_t safi, int direct,
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
 
@@ -4135,6 +4212,8 @@ peer_route_map_unset (struct peer *peer, afi_t afi, safi_t safi, int direct)
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
 
@@ -4196,6 +4275,8 @@ peer_unsuppress_map_set (struct peer *peer, afi_t afi, safi_t safi,
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
 
@@ -4237,6 +4318,8 @@ peer_unsuppress_map_unset (struct peer *peer, afi_t afi, safi_t safi)
   struct peer_group *group;
   struct listnode *node, *nnode;
 
+  bgp_updgrp_invalidate ();
+
   if (! peer->afc[afi][safi])
     return BGP_ERR_PEER_INACTIVE;
   
@@ -5344,6 +5427,8 @@ bgp_init (void)
   bgp_route_init ();
   bgp_route_map_init ();
   bgp_scan_init ();
+  bgp_updgrp_init ();
+  bgp_pipeline_init ();
   bgp_mplsvpn_init ();
 
   /* Access list initialize. */
@@ -120,6 +120,13 @@ struct bgp
 #define BGP_FLAG_GRACEFUL_RESTART         (1 << 12)
 #define BGP_FLAG_ASPATH_CONFED            (1 << 13)
 
+/* Flags changing the outcome of best path selection. */
+#define BGP_FLAG_BESTPATH \
+  (BGP_FLAG_ALWAYS_COMPARE_MED | BGP_FLAG_DETERMINISTIC_MED \
+   | BGP_FLAG_MED_MISSING_AS_WORST | BGP_FLAG_MED_CONFED \
+   | BGP_FLAG_COMPARE_ROUTER_ID | BGP_FLAG_ASPATH_IGNORE \
+   | BGP_FLAG_ASPATH_CONFED)
+
   /* BGP Per AF flags */
   u_int16_t af_flags[AFI_MAX][SAFI_MAX];
 #define BGP_CONFIG_DAMPENING              (1 << 0)
@@ -133,6 +140,9 @@ struct bgp
   /* BGP routing information base.  */
   struct bgp_table *rib[AFI_MAX][SAFI_MAX];
 
+  /* Update groups, peers sharing the same outbound policy.  */
+  struct list *update_groups[AFI_MAX][SAFI_MAX];
+
   /* BGP redistribute configuration. */
   u_char redist[AFI_MAX][ZEBRA_ROUTE_MAX];
 
@@ -253,6 +263,34 @@ struct bgp_filter
   } usmap;
 };
 
+/* Entries a peer holds one of per prefix, which are handed out of
+   per-peer blocks, see bgp_pool.c.  */
+enum bgp_pool_type
+{
+  BGP_POOL_INFO,		/* struct bgp_info */
+  BGP_POOL_INFO_EXTRA,		/* struct bgp_info_extra */
+  BGP_POOL_ADJ_IN,		/* struct bgp_adj_in */
+  BGP_POOL_ADJ_OUT,		/* struct bgp_adj_out */
+  BGP_POOL_MAX
+};
+
+struct bgp_pool
+{
+  /* Blocks by address, for finding the one an entry is in. */
+  struct bgp_pool_block **blocks;
+  unsigned int nblocks;
+  unsigned int maxblocks;
+
+  /* Blocks with entries left to hand out. */
+  struct bgp_pool_block *avail;
+
+  /* Entries in use. */
+  unsigned long count;
+
+  /* Set while bgp_pool_walk() goes over the blocks. */
+  int walking;
+};
+
 /* BGP neighbor structure. */
 struct peer
 {
@@ -288,10 +326,12 @@ struct peer
   /* Peer specific RIB when configured as route-server-client. */
   struct bgp_table *rib[AFI_MAX][SAFI_MAX];
 
-  /* Packet receive and send buffer. */
+  /* Packet receive and send buffer.  Input is read into ibuf_work in
+     large chunks, and each complete message is copied to ibuf for the
+     receive functions. */
   struct stream *ibuf;
+  struct stream *ibuf_work;
   struct stream_fifo *obuf;
-  struct stream *work;
 
   /* Status of the peer. */
   int status;
@@ -441,6 +481,7 @@ struct peer
   /* Threads. */
   struct thread *t_read;
   struct thread *t_write;
+  struct thread *t_process_packet;
   struct thread *t_start;
   struct thread *t_connect;
   struct thread *t_holdtime;
@@ -468,6 +509,8 @@ struct peer
   u_int32_t refresh_out;	/* Route Refresh output count */
   u_int32_t dynamic_cap_in;	/* Dynamic Capability input count.  */
   u_int32_t dynamic_cap_out;	/* Dynamic Capability output count.  */
+  u_int32_t read_calls;		/* Socket reads returning data */
+  u_int32_t read_msgs;		/* Messages taken from those reads */
 
   /* BGP state count */
   u_int32_t established;	/* Established */
@@ -483,12 +526,13 @@ struct peer
   /* Announcement attribute hash.  */
   struct hash *hash[AFI_MAX][SAFI_MAX];
 
+  /* Update group, valid while updgrp_gen is current.  */
+  struct update_group *updgrp[AFI_MAX][SAFI_MAX];
+  u_int32_t updgrp_gen[AFI_MAX][SAFI_MAX];
+
   /* Notify data. */
   struct bgp_notify notify;
 
-  /* Whole packet size to be read. */
-  unsigned long packet_size;
-
   /* Filter structure. */
   struct bgp_filter filter[AFI_MAX][SAFI_MAX];
 
@@ -498,6 +542,10 @@ struct peer
   /* Prefix count. */
   unsigned long pcount[AFI_MAX][SAFI_MAX];
 
+  /* Paths from the peer, their ancillaries and the peer's Adj-RIB-In
+     and Adj-RIB-Out entries. */
+  struct bgp_pool pool[BGP_POOL_MAX];
+
   /* Max prefix count. */
   unsigned long pmax[AFI_MAX][SAFI_MAX];
   u_char pmax_threshold[AFI_MAX][SAFI_MAX];
@@ -575,6 +623,11 @@ struct bgp_nlri
 #define BGP_HEADER_SIZE		                19
 #define BGP_MAX_PACKET_SIZE                   4096
 
+/* Input ring size, and the number of messages one read wakeup may
+   process before other peers get a turn.  */
+#define BGP_INPUT_BUFSIZ                     65536
+#define BGP_READ_QUOTA                          64
+
 /* BGP minimum message size.  */
 #define BGP_MSG_OPEN_MIN_SIZE                   (BGP_HEADER_SIZE + 10)
 #define BGP_MSG_UPDATE_MIN_SIZE                 (BGP_HEADER_SIZE + 4)
@@ -28,6 +28,9 @@
 #include "sockunion.h"
 #include "buffer.h"
 #include "log.h"
+#include "table.h"
+#include "hash.h"
+#include "jhash.h"
 
 struct filter_cisco
 {
@@ -66,6 +69,27 @@ struct filter
       struct filter_cisco cfilter;
       struct filter_zebra zfilter;
     } u;
+
+  /* Position in the list, for first match. */
+  unsigned long seq;
+
+  /* Next filter with the same prefix or address, by seq. */
+  struct filter *chain;
+
+  /* Times this filter decided. */
+  unsigned long hitcnt;
+};
+
+/* Cisco filters with these wildcard masks. */
+struct filter_mask
+{
+  struct filter_mask *next;
+
+  int extended;
+  struct in_addr addr_mask;
+  struct in_addr mask_mask;
+
+  unsigned long count;
 };
 
 /* List of access_list. */
@@ -158,33 +182,6 @@ filter_type_str (struct filter *filter)
     }
 }
 
-/* If filter match to the prefix then return 1. */
-static int
-filter_match_cisco (struct filter *mfilter, struct prefix *p)
-{
-  struct filter_cisco *filter;
-  struct in_addr mask;
-  u_int32_t check_addr;
-  u_int32_t check_mask;
-
-  filter = &mfilter->u.cfilter;
-  check_addr = p->u.prefix4.s_addr & ~filter->addr_mask.s_addr;
-
-  if (filter->extended)
-    {
-      masklen2ip (p->prefixlen, &mask);
-      check_mask = mask.s_addr & ~filter->mask_mask.s_addr;
-
-      if (memcmp (&check_addr, &filter->addr.s_addr, 4) == 0
-          && memcmp (&check_mask, &filter->mask.s_addr, 4) == 0)
-	return 1;
-    }
-  else if (memcmp (&check_addr, &filter->addr.s_addr, 4) == 0)
-    return 1;
-
-  return 0;
-}
-
 /* If filter match to the prefix then return 1. */
 static int
 filter_match_zebra (struct filter *mfilter, struct prefix *p)
@@ -209,6 +206,234 @@ filter_match_zebra (struct filter *mfilter, struct prefix *p)
     return 0;
 }
 
+/* The filters of an access-list are also kept for lookup by prefix.
+   Zebra filters hang off the route_table node of their prefix, so the
+   ones that may match are on the nodes covering it.  Cisco filters are
+   grouped by wildcard masks, which are few in a list; the prefix,
+   masked with those of each group, is then looked up among the
+   addresses of its filters.  Filters for the same prefix or address
+   are chained in list order, and the first in that order wins. */
+static unsigned int
+filter_cisco_key (void *arg)
+{
+  struct filter_cisco *filter = &((struct filter *) arg)->u.cfilter;
+
+  return jhash_3words (filter->addr.s_addr, filter->mask.s_addr,
+		       filter->addr_mask.s_addr,
+		       filter->mask_mask.s_addr ^ filter->extended);
+}
+
+static int
+filter_cisco_cmp (const void *arg1, const void *arg2)
+{
+  const struct filter_cisco *f1 = &((const struct filter *) arg1)->u.cfilter;
+  const struct filter_cisco *f2 = &((const struct filter *) arg2)->u.cfilter;
+
+  return f1->extended == f2->extended
+	 && f1->addr.s_addr == f2->addr.s_addr
+	 && f1->addr_mask.s_addr == f2->addr_mask.s_addr
+	 && f1->mask.s_addr == f2->mask.s_addr
+	 && f1->mask_mask.s_addr == f2->mask_mask.s_addr;
+}
+
+/* The address hash starts small, as most lists are, and grows with
+   the list. */
+#define FILTER_CISCO_HASH_SIZE	64
+
+static void
+filter_cisco_rehash (struct hash_backet *hb, void *arg)
+{
+  hash_get ((struct hash *) arg, hb->data, hash_alloc_intern);
+}
+
+static void
+filter_cisco_grow (struct access_list *access)
+{
+  struct hash *new;
+
+  new = hash_create_size (access->cisco->size * 4, filter_cisco_key,
+			  filter_cisco_cmp);
+  hash_iterate (access->cisco, filter_cisco_rehash, new);
+  hash_clean (access->cisco, NULL);
+  hash_free (access->cisco);
+  access->cisco = new;
+}
+
+/* Put FILTER in the chain starting at *HEAD, by seq. */
+static void
+filter_chain_add (struct filter **head, struct filter *filter)
+{
+  while (*head && (*head)->seq < filter->seq)
+    head = &(*head)->chain;
+  filter->chain = *head;
+  *head = filter;
+}
+
+static void
+filter_chain_delete (struct filter **head, struct filter *filter)
+{
+  while (*head && *head != filter)
+    head = &(*head)->chain;
+  if (*head)
+    *head = filter->chain;
+  filter->chain = NULL;
+}
+
+static void
+filter_index_add_zebra (struct access_list *access, struct filter *filter)
+{
+  struct route_node *rn;
+  struct filter *head;
+
+  if (access->trie == NULL)
+    access->trie = route_table_init ();
+
+  rn = route_node_get (access->trie, &filter->u.zfilter.prefix);
+  if (rn->info)
+    route_unlock_node (rn);
+
+  head = rn->info;
+  filter_chain_add (&head, filter);
+  rn->info = head;
+}
+
+static void
+filter_index_delete_zebra (struct access_list *access, struct filter *filter)
+{
+  struct route_node *rn;
+  struct filter *head;
+
+  if (access->trie == NULL)
+    return;
+  rn = route_node_lookup (access->trie, &filter->u.zfilter.prefix);
+  if (rn == NULL)
+    return;
+  route_unlock_node (rn);
+
+  head = rn->info;
+  filter_chain_delete (&head, filter);
+  rn->info = head;
+  if (rn->info == NULL)
+    route_unlock_node (rn);
+}
+
+static void
+filter_index_add_cisco (struct access_list *access, struct filter *filter)
+{
+  struct filter_cisco *cfilter = &filter->u.cfilter;
+  struct filter_mask *mask;
+  struct filter *head;
+
+  for (mask = access->masks; mask; mask = mask->next)
+    if (mask->extended == cfilter->extended
+	&& mask->addr_mask.s_addr == cfilter->addr_mask.s_addr
+	&& mask->mask_mask.s_addr == cfilter->mask_mask.s_addr)
+      break;
+  if (mask == NULL)
+    {
+      mask = XCALLOC (MTYPE_ACCESS_FILTER_MASK, sizeof (struct filter_mask));
+      mask->extended = cfilter->extended;
+      mask->addr_mask = cfilter->addr_mask;
+      mask->mask_mask = cfilter->mask_mask;
+      mask->next = access->masks;
+      access->masks = mask;
+    }
+  mask->count++;
+
+  if (access->cisco == NULL)
+    access->cisco = hash_create_size (FILTER_CISCO_HASH_SIZE,
+				      filter_cisco_key, filter_cisco_cmp);
+  else if (access->cisco->count >= access->cisco->size)
+    filter_cisco_grow (access);
+
+  head = hash_get (access->cisco, filter, hash_alloc_intern);
+  if (head == filter)
+    return;
+  if (head->seq < filter->seq)
+    {
+      filter_chain_add (&head->chain, filter);
+      return;
+    }
+  hash_release (access->cisco, head);
+  filter->chain = head;
+  hash_get (access->cisco, filter, hash_alloc_intern);
+}
+
+static void
+filter_index_delete_cisco (struct access_list *access, struct filter *filter)
+{
+  struct filter_cisco *cfilter = &filter->u.cfilter;
+  struct filter_mask *mask;
+  struct filter_mask **prev;
+  struct filter *head;
+
+  for (prev = &access->masks; (mask = *prev) != NULL; prev = &mask->next)
+    if (mask->extended == cfilter->extended
+	&& mask->addr_mask.s_addr == cfilter->addr_mask.s_addr
+	&& mask->mask_mask.s_addr == cfilter->mask_mask.s_addr)
+      {
+	if (--mask->count == 0)
+	  {
+	    *prev = mask->next;
+	    XFREE (MTYPE_ACCESS_FILTER_MASK, mask);
+	  }
+	break;
+      }
+
+  if (access->cisco == NULL)
+    return;
+  head = hash_lookup (access->cisco, filter);
+  if (head == NULL)
+    return;
+  if (head != filter)
+    {
+      filter_chain_delete (&head->chain, filter);
+      return;
+    }
+  hash_release (access->cisco, head);
+  if (filter->chain)
+    hash_get (access->cisco, filter->chain, hash_alloc_intern);
+  filter->chain = NULL;
+}
+
+static void
+filter_index_add (struct access_list *access, struct filter *filter)
+{
+  filter->seq = ++access->seq;
+  if (filter->cisco)
+    filter_index_add_cisco (access, filter);
+  else
+    filter_index_add_zebra (access, filter);
+}
+
+static void
+filter_index_delete (struct access_list *access, struct filter *filter)
+{
+  if (filter->cisco)
+    filter_index_delete_cisco (access, filter);
+  else
+    filter_index_delete_zebra (access, filter);
+}
+
+static void
+filter_index_free (struct access_list *access)
+{
+  struct filter_mask *mask;
+
+  if (access->trie)
+    route_table_finish (access->trie);
+  if (access->cisco)
+    {
+      hash_clean (access->cisco, NULL);
+      hash_free (access->cisco);
+    }
+  while ((mask = access->masks) != NULL)
+    {
+      access->masks = mask->next;
+      XFREE (MTYPE_ACCESS_FILTER_MASK, mask);
+    }
+}
+
 /* Allocate new access list structure. */
 static struct access_list *
 access_list_new (void)
@@ -238,6 +463,7 @@ access_list_delete (struct access_list *access)
       next = filter->next;
       filter_free (filter);
     }
+  filter_index_free (access);
 
   master = access->master;
 
@@ -400,6 +626,10 @@ enum filter_type
 access_list_apply (struct access_list *access, void *object)
 {
   struct filter *filter;
+  struct filter *match;
+  struct filter_mask *mask;
+  struct filter key;
+  struct route_node *node;
   struct prefix *p;
 
   p = (struct prefix *) object;
@@ -407,21 +637,53 @@ access_list_apply (struct access_list *access, void *object)
   if (access == NULL)
     return FILTER_DENY;
 
-  for (filter = access->head; filter; filter = filter->next)
+  match = NULL;
+
+  /* Zebra filters on the way down to P. */
+  node = access->trie ? access->trie->top : NULL;
+  while (node && node->p.prefixlen <= p->prefixlen
+	 && prefix_match (&node->p, p))
     {
-      if (filter->cisco)
+      for (filter = node->info; filter; filter = filter->chain)
 	{
-	  if (filter_match_cisco (filter, p))
-	    return filter->type;
+	  if (match && filter->seq > match->seq)
+	    break;
+	  if (filter_match_zebra (filter, p))
+	    {
+	      match = filter;
+	      break;
+	    }
 	}
-      else
+
+      if (node->p.prefixlen == p->prefixlen)
+	break;
+      node = node->link[prefix_bit (&p->u.prefix, node->p.prefixlen)];
+    }
+
+  /* Cisco filters, one lookup per set of wildcard masks. */
+  for (mask = access->masks; mask; mask = mask->next)
+    {
+      key.u.cfilter.extended = mask->extended;
+      key.u.cfilter.addr_mask = mask->addr_mask;
+      key.u.cfilter.mask_mask = mask->mask_mask;
+      key.u.cfilter.addr.s_addr = p->u.prefix4.s_addr & ~mask->addr_mask.s_addr;
+      key.u.cfilter.mask.s_addr = 0;
+      if (mask->extended)
 	{
-	  if (filter_match_zebra (filter, p))
-	    return filter->type;
+	  masklen2ip (p->prefixlen, &key.u.cfilter.mask);
+	  key.u.cfilter.mask.s_addr &= ~mask->mask_mask.s_addr;
 	}
+
+      filter = hash_lookup (access->cisco, &key);
+      if (filter && (match == NULL || filter->seq < match->seq))
+	match = filter;
     }
 
-  return FILTER_DENY;
+  if (match == NULL)
+    return FILTER_DENY;
+
+  match->hitcnt++;
+  return match->type;
 }
 
 /* Add hook function. */
@@ -457,6 +719,8 @@ access_list_filter_add (struct access_list *access, struct filter *filter)
     access->head = filter;
   access->tail = filter;
 
+  filter_index_add (access, filter);
+
   /* Run hook function. */
   if (access->master->add_hook)
     (*access->master->add_hook) (access);
@@ -491,6 +755,7 @@ access_list_filter_delete (struct access_list *access, struct filter *filter)
   else
     access->head = filter->next;
 
+  filter_index_delete (access, filter);
   filter_free (filter);
 
   /* If access_list becomes empty delete it from access_master. */
@@ -523,7 +788,11 @@ filter_lookup_cisco (struct access_list *access, struct filter *mnew)
 
   new = &mnew->u.cfilter;
 
-  for (mfilter = access->head; mfilter; mfilter = mfilter->next)
+  if (access->cisco == NULL)
+    return NULL;
+
+  for (mfilter = hash_lookup (access->cisco, mnew); mfilter;
+       mfilter = mfilter->chain)
     {
       filter = &mfilter->u.cfilter;
 
@@ -554,10 +823,18 @@ filter_lookup_zebra (struct access_list *access, struct filter *mnew)
   struct filter *mfilter;
   struct filter_zebra *filter;
   struct filter_zebra *new;
+  struct route_node *rn;
 
   new = &mnew->u.zfilter;
 
-  for (mfilter = access->head; mfilter; mfilter = mfilter->next)
+  if (access->trie == NULL)
+    return NULL;
+  rn = route_node_lookup (access->trie, &new->prefix);
+  if (rn == NULL)
+    return NULL;
+  route_unlock_node (rn);
+
+  for (mfilter = rn->info; mfilter; mfilter = mfilter->chain)
     {
       filter = &mfilter->u.zfilter;
 
@@ -1617,15 +1894,17 @@ filter_show (struct vty *vty, const char *name, afi_t afi)
 	  else
 	    {
 	      if (filter->addr_mask.s_addr == 0xffffffff)
-		vty_out (vty, " any%s", VTY_NEWLINE);
+		vty_out (vty, " any");
 	      else
 		{
 		  vty_out (vty, " %s", inet_ntoa (filter->addr));
 		  if (filter->addr_mask.s_addr != 0)
 		    vty_out (vty, ", wildcard bits %s", inet_ntoa (filter->addr_mask));
-		  vty_out (vty, "%s", VTY_NEWLINE);
 		}
 	    }
+	  if (mfilter->hitcnt)
+	    vty_out (vty, " (hit count: %lu)", mfilter->hitcnt);
+	  vty_out (vty, "%s", VTY_NEWLINE);
 	}
     }
 
@@ -1660,15 +1939,17 @@ filter_show (struct vty *vty, const char *name, afi_t afi)
 	  else
 	    {
 	      if (filter->addr_mask.s_addr == 0xffffffff)
-		vty_out (vty, " any%s", VTY_NEWLINE);
+		vty_out (vty, " any");
 	      else
 		{
 		  vty_out (vty, " %s", inet_ntoa (filter->addr));
 		  if (filter->addr_mask.s_addr != 0)
 		    vty_out (vty, ", wildcard bits %s", inet_ntoa (filter->addr_mask));
-		  vty_out (vty, "%s", VTY_NEWLINE);
 		}
 	    }
+	  if (mfilter->hitcnt)
+	    vty_out (vty, " (hit count: %lu)", mfilter->hitcnt);
+	  vty_out (vty, "%s", VTY_NEWLINE);
 	}
     }
   return CMD_SUCCESS;
@@ -1722,6 +2003,79 @@ DEFUN (show_ipv6_access_list_name,
 }
 #endif /* HAVE_IPV6 */
 
+/* clear access-list command. */
+static int
+filter_clear (struct vty *vty, const char *name, afi_t afi)
+{
+  struct access_list *access;
+  struct access_master *master;
+  struct filter *mfilter;
+
+  master = access_master_get (afi);
+  if (master == NULL)
+    return CMD_WARNING;
+
+  for (access = master->num.head; access; access = access->next)
+    if (name == NULL || strcmp (access->name, name) == 0)
+      for (mfilter = access->head; mfilter; mfilter = mfilter->next)
+	mfilter->hitcnt = 0;
+
+  for (access = master->str.head; access; access = access->next)
+    if (name == NULL || strcmp (access->name, name) == 0)
+      for (mfilter = access->head; mfilter; mfilter = mfilter->next)
+	mfilter->hitcnt = 0;
+
+  return CMD_SUCCESS;
+}
+
+DEFUN (clear_ip_access_list,
+       clear_ip_access_list_cmd,
+       "clear ip access-list",
+       CLEAR_STR
+       IP_STR
+       "Reset IP access list hit counts\n")
+{
+  return filter_clear (vty, NULL, AFI_IP);
+}
+
+DEFUN (clear_ip_access_list_name,
+       clear_ip_access_list_name_cmd,
+       "clear ip access-list (<1-99>|<100-199>|<1300-1999>|<2000-2699>|WORD)",
+       CLEAR_STR
+       IP_STR
+       "Reset IP access list hit counts\n"
+       "IP standard access list\n"
+       "IP extended access list\n"
+       "IP standard access list (expanded range)\n"
+       "IP extended access list (expanded range)\n"
+       "IP zebra access-list\n")
+{
+  return filter_clear (vty, argv[0], AFI_IP);
+}
+
+#ifdef HAVE_IPV6
+DEFUN (clear_ipv6_access_list,
+       clear_ipv6_access_list_cmd,
+       "clear ipv6 access-list",
+       CLEAR_STR
+       IPV6_STR
+       "Reset IPv6 access list hit counts\n")
+{
+  return filter_clear (vty, NULL, AFI_IP6);
+}
+
+DEFUN (clear_ipv6_access_list_name,
+       clear_ipv6_access_list_name_cmd,
+       "clear ipv6 access-list WORD",
+       CLEAR_STR
+       IPV6_STR
+       "Reset IPv6 access list hit counts\n"
+       "IPv6 zebra access-list\n")
+{
+  return filter_clear (vty, argv[0], AFI_IP6);
+}
+#endif /* HAVE_IPV6 */
+
 void
 config_write_access_cisco (struct vty *vty, struct filter *mfilter)
 {
@@ -1751,18 +2105,16 @@ config_write_access_cisco (struct vty *vty, struct filter *mfilter)
 	  vty_out (vty, " %s", inet_ntoa (filter->mask));
 	  vty_out (vty, " %s", inet_ntoa (filter->mask_mask));
 	}
-      vty_out (vty, "%s", VTY_NEWLINE);
     }
   else
     {
       if (filter->addr_mask.s_addr == 0xffffffff)
-	vty_out (vty, " any%s", VTY_NEWLINE);
+	vty_out (vty, " any");
       else
 	{
 	  vty_out (vty, " %s", inet_ntoa (filter->addr));
 	  if (filter->addr_mask.s_addr != 0)
 	    vty_out (vty, " %s", inet_ntoa (filter->addr_mask));
-	  vty_out (vty, "%s", VTY_NEWLINE);
 	}
     }
 }
@@ -1784,8 +2136,6 @@ config_write_access_zebra (struct vty *vty, struct filter *mfilter)
 	     inet_ntop (p->family, &p->u.prefix, buf, BUFSIZ),
 	     p->prefixlen,
 	     filter->exact ? " exact-match" : "");
-
-  vty_out (vty, "%s", VTY_NEWLINE);
 }
 
 static int
@@ -1822,6 +2172,7 @@ config_write_access (struct vty *vty, afi_t afi)
 	    config_write_access_cisco (vty, mfilter);
 	  else
 	    config_write_access_zebra (vty, mfilter);
+	  vty_out (vty, "%s", VTY_NEWLINE);
 
 	  write++;
 	}
@@ -1849,6 +2200,7 @@ config_write_access (struct vty *vty, afi_t afi)
 	    config_write_access_cisco (vty, mfilter);
 	  else
 	    config_write_access_zebra (vty, mfilter);
+	  vty_out (vty, "%s", VTY_NEWLINE);
 
 	  write++;
 	}
@@ -1907,6 +2259,8 @@ access_list_init_ipv4 (void)
 
   install_element (ENABLE_NODE, &show_ip_access_list_cmd);
   install_element (ENABLE_NODE, &show_ip_access_list_name_cmd);
+  install_element (ENABLE_NODE, &clear_ip_access_list_cmd);
+  install_element (ENABLE_NODE, &clear_ip_access_list_name_cmd);
 
   /* Zebra access-list */
   install_element (CONFIG_NODE, &access_list_cmd);
@@ -2002,6 +2356,8 @@ access_list_init_ipv6 (void)
 
   install_element (ENABLE_NODE, &show_ipv6_access_list_cmd);
   install_element (ENABLE_NODE, &show_ipv6_access_list_name_cmd);
+  install_element (ENABLE_NODE, &clear_ipv6_access_list_cmd);
+  install_element (ENABLE_NODE, &clear_ipv6_access_list_name_cmd);
 
   install_element (CONFIG_NODE, &ipv6_access_list_cmd);
   install_element (CONFIG_NODE, &ipv6_access_list_exact_cmd);
@@ -54,6 +54,15 @@ struct access_list
 
   struct filter *head;
   struct filter *tail;
+
+  /* Position given to the last filter added. */
+  unsigned long seq;
+
+  /* The filters again, for access_list_apply(): zebra filters by
+     prefix, cisco filters by wildcard masks and then by address. */
+  struct route_table *trie;
+  struct filter_mask *masks;
+  struct hash *cisco;
 };
 
 /* Prototypes for access-list. */
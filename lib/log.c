@@ -864,6 +864,13 @@ static const struct zebra_desc_table command_types[] = {
   DESC_ENTRY	(ZEBRA_ROUTER_ID_ADD),
   DESC_ENTRY	(ZEBRA_ROUTER_ID_DELETE),
   DESC_ENTRY	(ZEBRA_ROUTER_ID_UPDATE),
+  DESC_ENTRY	(ZEBRA_IPV4_ROUTE_BULK_ADD),
+  DESC_ENTRY	(ZEBRA_IPV4_ROUTE_BULK_DELETE),
+  DESC_ENTRY	(ZEBRA_IPV6_ROUTE_BULK_ADD),
+  DESC_ENTRY	(ZEBRA_IPV6_ROUTE_BULK_DELETE),
+  DESC_ENTRY	(ZEBRA_NEXTHOP_REGISTER),
+  DESC_ENTRY	(ZEBRA_NEXTHOP_UNREGISTER),
+  DESC_ENTRY	(ZEBRA_NEXTHOP_UPDATE),
 };
 #undef DESC_ENTRY
 
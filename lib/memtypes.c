@@ -46,6 +46,7 @@ struct memory_list memory_list_lib[] =
   { MTYPE_ACCESS_LIST,		"Access List"			},
   { MTYPE_ACCESS_LIST_STR,	"Access List Str"		},
   { MTYPE_ACCESS_FILTER,	"Access Filter"			},
+  { MTYPE_ACCESS_FILTER_MASK,	"Access Filter Mask"		},
   { MTYPE_PREFIX_LIST,		"Prefix List"			},
   { MTYPE_PREFIX_LIST_ENTRY,	"Prefix List Entry"		},
   { MTYPE_PREFIX_LIST_STR,	"Prefix List Str"		},
@@ -81,6 +82,9 @@ struct memory_list memory_list_zebra[] =
   { MTYPE_NEXTHOP,		"Nexthop"			},
   { MTYPE_RIB,			"RIB"				},
   { MTYPE_RIB_QUEUE,		"RIB process work queue"	},
+  { MTYPE_RIB_PROF,		"RIB convergence profile"	},
+  { MTYPE_ZSERV_REDIST,		"Zserv redistribution outbox"	},
+  { MTYPE_RNH,			"Registered nexthop"		},
   { MTYPE_STATIC_IPV4,		"Static IPv4 route"		},
   { MTYPE_STATIC_IPV6,		"Static IPv6 route"		},
   { -1, NULL },
@@ -105,7 +109,6 @@ struct memory_list memory_list_bgp[] =
   { MTYPE_BGP_TABLE,		"BGP table"			},
   { MTYPE_BGP_NODE,		"BGP node"			},
   { MTYPE_BGP_ROUTE,		"BGP route"			},
-  { MTYPE_BGP_ROUTE_EXTRA,	"BGP ancillary route info"	},
   { MTYPE_BGP_CONN,		"BGP connected"			},
   { MTYPE_BGP_STATIC,		"BGP static"			},
   { MTYPE_BGP_ADVERTISE_ATTR,	"BGP adv attr"			},
@@ -113,10 +116,13 @@ struct memory_list memory_list_bgp[] =
   { MTYPE_BGP_SYNCHRONISE,	"BGP synchronise"		},
   { MTYPE_BGP_ADJ_IN,		"BGP adj in"			},
   { MTYPE_BGP_ADJ_OUT,		"BGP adj out"			},
+  { MTYPE_BGP_UPDGRP,		"BGP update group"		},
+  { MTYPE_BGP_RMAP_MEMO,	"BGP route-map memo"		},
   { 0, NULL },
   { MTYPE_AS_LIST,		"BGP AS list"			},
   { MTYPE_AS_FILTER,		"BGP AS filter"			},
   { MTYPE_AS_FILTER_STR,	"BGP AS filter str"		},
+  { MTYPE_AS_LIST_CACHE,	"BGP AS list verdict cache"	},
   { 0, NULL },
   { MTYPE_COMMUNITY,		"community"			},
   { MTYPE_COMMUNITY_VAL,	"community val"			},
@@ -137,17 +143,20 @@ struct memory_list memory_list_bgp[] =
   { 0, NULL },
   { MTYPE_BGP_PROCESS_QUEUE,	"BGP Process queue"		},
   { MTYPE_BGP_CLEAR_NODE_QUEUE, "BGP node clear queue"		},
+  { MTYPE_BGP_DUMP_TABLE,	"BGP table dump"		},
   { 0, NULL },
   { MTYPE_TRANSIT,		"BGP transit attr"		},
   { MTYPE_TRANSIT_VAL,		"BGP transit val"		},
   { 0, NULL },
   { MTYPE_BGP_DISTANCE,		"BGP distance"			},
   { MTYPE_BGP_NEXTHOP_CACHE,	"BGP nexthop"			},
+  { MTYPE_BGP_ZLOOKUP,		"BGP zebra lookup query"	},
   { MTYPE_BGP_CONFED_LIST,	"BGP confed list"		},
   { MTYPE_PEER_UPDATE_SOURCE,	"BGP peer update interface"	},
   { MTYPE_BGP_DAMP_INFO,	"Dampening info"		},
   { MTYPE_BGP_DAMP_ARRAY,	"BGP Dampening array"		},
   { MTYPE_BGP_REGEXP,		"BGP regexp"			},
+  { MTYPE_BGP_REGEXP_DFA,	"BGP regexp DFA"		},
   { MTYPE_BGP_AGGREGATE,	"BGP aggregate"			},
   { -1, NULL }
 };
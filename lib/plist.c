@@ -29,6 +29,7 @@
 #include "buffer.h"
 #include "stream.h"
 #include "log.h"
+#include "table.h"
 
 /* Each prefix-list's entry. */
 struct prefix_list_entry
@@ -48,6 +49,9 @@ struct prefix_list_entry
 
   struct prefix_list_entry *next;
   struct prefix_list_entry *prev;
+
+  /* Next entry on the same trie node, by seq. */
+  struct prefix_list_entry *chain;
 };
 
 /* List of struct prefix_list. */
@@ -300,6 +304,8 @@ prefix_list_delete (struct prefix_list *plist)
       prefix_list_entry_free (pentry);
       plist->count--;
     }
+  if (plist->trie)
+    route_table_finish (plist->trie);
 
   master = plist->master;
 
@@ -374,21 +380,17 @@ prefix_list_delete_hook (void (*func) (struct prefix_list *plist))
 #endif /* HAVE_IPVt6 */
 }
 
-/* Calculate new sequential number. */
+/* Calculate new sequential number.  The entries are kept in seq
+   order, so the last one has the highest. */
 static int
 prefix_new_seq_get (struct prefix_list *plist)
 {
   int maxseq;
   int newseq;
-  struct prefix_list_entry *pentry;
 
-  maxseq = newseq = 0;
-
-  for (pentry = plist->head; pentry; pentry = pentry->next)
-    {
-      if (maxseq < pentry->seq)
-	maxseq = pentry->seq;
-    }
+  maxseq = plist->tail ? plist->tail->seq : 0;
+  if (maxseq < 0)
+    maxseq = 0;
 
   newseq = ((maxseq / 5) * 5) + 5;
   
@@ -401,19 +403,101 @@ prefix_seq_check (struct prefix_list *plist, int seq)
 {
   struct prefix_list_entry *pentry;
 
+  /* Lists are mostly written in seq order. */
+  if (plist->tail == NULL || plist->tail->seq < seq)
+    return NULL;
+
   for (pentry = plist->head; pentry; pentry = pentry->next)
     if (pentry->seq == seq)
       return pentry;
   return NULL;
 }
 
+/* The entries for the prefix of P, or NULL. */
+static struct prefix_list_entry *
+prefix_list_trie_lookup (struct prefix_list *plist, struct prefix *p)
+{
+  struct route_node *rn;
+
+  if (plist->trie == NULL)
+    return NULL;
+
+  rn = route_node_lookup (plist->trie, p);
+  if (rn == NULL)
+    return NULL;
+  route_unlock_node (rn);
+  return rn->info;
+}
+
+/* Put PENTRY on the trie node of its prefix, where the entries are
+   kept in seq order.  The node is locked while it has entries. */
+static void
+prefix_list_trie_add (struct prefix_list *plist,
+		      struct prefix_list_entry *pentry)
+{
+  struct route_node *rn;
+  struct prefix_list_entry *point;
+
+  if (plist->trie == NULL)
+    plist->trie = route_table_init ();
+
+  rn = route_node_get (plist->trie, &pentry->prefix);
+  point = rn->info;
+  if (point)
+    route_unlock_node (rn);
+
+  if (point == NULL || point->seq > pentry->seq)
+    {
+      pentry->chain = point;
+      rn->info = pentry;
+      return;
+    }
+
+  while (point->chain && point->chain->seq < pentry->seq)
+    point = point->chain;
+  pentry->chain = point->chain;
+  point->chain = pentry;
+}
+
+static void
+prefix_list_trie_delete (struct prefix_list *plist,
+			 struct prefix_list_entry *pentry)
+{
+  struct route_node *rn;
+  struct prefix_list_entry *point;
+
+  if (plist->trie == NULL)
+    return;
+
+  rn = route_node_lookup (plist->trie, &pentry->prefix);
+  if (rn == NULL)
+    return;
+  route_unlock_node (rn);
+
+  point = rn->info;
+  if (point == pentry)
+    rn->info = pentry->chain;
+  else
+    {
+      while (point && point->chain != pentry)
+	point = point->chain;
+      if (point)
+	point->chain = pentry->chain;
+    }
+  pentry->chain = NULL;
+
+  if (rn->info == NULL)
+    route_unlock_node (rn);
+}
+
 static struct prefix_list_entry *
 prefix_list_entry_lookup (struct prefix_list *plist, struct prefix *prefix,
 			  enum prefix_list_type type, int seq, int le, int ge)
 {
   struct prefix_list_entry *pentry;
 
-  for (pentry = plist->head; pentry; pentry = pentry->next)
+  for (pentry = prefix_list_trie_lookup (plist, prefix); pentry;
+       pentry = pentry->chain)
     if (prefix_same (&pentry->prefix, prefix) && pentry->type == type)
       {
 	if (seq >= 0 && pentry->seq != seq)
@@ -446,6 +530,7 @@ prefix_list_entry_delete (struct prefix_list *plist,
   else
     plist->tail = pentry->prev;
 
+  prefix_list_trie_delete (plist, pentry);
   prefix_list_entry_free (pentry);
 
   plist->count--;
@@ -479,9 +564,12 @@ prefix_list_entry_add (struct prefix_list *plist,
     prefix_list_entry_delete (plist, replace, 0);
 
   /* Check insert point. */
-  for (point = plist->head; point; point = point->next)
-    if (point->seq >= pentry->seq)
-      break;
+  if (plist->tail && plist->tail->seq < pentry->seq)
+    point = NULL;
+  else
+    for (point = plist->head; point; point = point->next)
+      if (point->seq >= pentry->seq)
+	break;
 
   /* In case of this is the first element of the list. */
   pentry->next = point;
@@ -507,6 +595,8 @@ prefix_list_entry_add (struct prefix_list *plist,
       plist->tail = pentry;
     }
 
+  prefix_list_trie_add (plist, pentry);
+
   /* Increment count. */
   plist->count++;
 
@@ -564,6 +654,8 @@ enum prefix_list_type
 prefix_list_apply (struct prefix_list *plist, void *object)
 {
   struct prefix_list_entry *pentry;
+  struct prefix_list_entry *match;
+  struct route_node *node;
   struct prefix *p;
 
   p = (struct prefix *) object;
@@ -574,17 +666,37 @@ prefix_list_apply (struct prefix_list *plist, void *object)
   if (plist->count == 0)
     return PREFIX_PERMIT;
 
-  for (pentry = plist->head; pentry; pentry = pentry->next)
+  /* The entries that may match are those on the trie nodes covering
+     P, found on the way down to it.  The first to match in seq order
+     wins, as if the list had been walked; only the entries looked at
+     on the way count as referenced. */
+  match = NULL;
+  node = plist->trie->top;
+  while (node && node->p.prefixlen <= p->prefixlen
+	 && prefix_match (&node->p, p))
     {
-      pentry->refcnt++;
-      if (prefix_list_entry_match (pentry, p))
+      for (pentry = node->info; pentry; pentry = pentry->chain)
 	{
-	  pentry->hitcnt++;
-	  return pentry->type;
+	  if (match && pentry->seq > match->seq)
+	    break;
+	  pentry->refcnt++;
+	  if (prefix_list_entry_match (pentry, p))
+	    {
+	      match = pentry;
+	      break;
+	    }
 	}
+
+      if (node->p.prefixlen == p->prefixlen)
+	break;
+      node = node->link[prefix_bit (&p->u.prefix, node->p.prefixlen)];
     }
 
-  return PREFIX_DENY;
+  if (match == NULL)
+    return PREFIX_DENY;
+
+  match->hitcnt++;
+  return match->type;
 }
 
 static void __attribute__ ((unused))
@@ -635,7 +747,8 @@ prefix_entry_dup_check (struct prefix_list *plist,
   else
     seq = new->seq;
 
-  for (pentry = plist->head; pentry; pentry = pentry->next)
+  for (pentry = prefix_list_trie_lookup (plist, &new->prefix); pentry;
+       pentry = pentry->chain)
     {
       if (prefix_same (&pentry->prefix, &new->prefix)
 	  && pentry->type == new->type
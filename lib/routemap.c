@@ -72,6 +72,29 @@ route_map_rule_delete (struct route_map_rule_list *,
 
 static void
 route_map_index_delete (struct route_map_index *, int);
+
+/* Note a change to MAP: bump its version and count again the rules
+   that keep its outcome from being memoized. */
+static void
+route_map_changed (struct route_map *map)
+{
+  struct route_map_index *index;
+  struct route_map_rule *rule;
+
+  map->version++;
+  map->other = 0;
+  for (index = map->head; index; index = index->next)
+    {
+      for (rule = index->match_list.head; rule; rule = rule->next)
+	if (! CHECK_FLAG (rule->cmd->flags, RMAP_RULE_ATTR_ONLY))
+	  map->other++;
+      for (rule = index->set_list.head; rule; rule = rule->next)
+	if (! CHECK_FLAG (rule->cmd->flags, RMAP_RULE_ATTR_ONLY))
+	  map->other++;
+      if (index->nextrm)
+	map->other++;
+    }
+}
 
 /* New route map allocation. Please note route map's name must be
    specified. */
@@ -158,6 +181,35 @@ route_map_lookup_by_name (const char *name)
   return NULL;
 }
 
+/* Return 1 if any match or set clause of MAP uses the rule command
+   NAME, optionally restricted to clauses whose argument is ARG.  A map
+   that calls out to another map is assumed to use it, since the callee
+   can change underneath us. */
+int
+route_map_uses_rule (struct route_map *map, const char *name, const char *arg)
+{
+  struct route_map_index *index;
+  struct route_map_rule *rule;
+  struct route_map_rule_list *lists[2];
+  int i;
+
+  for (index = map->head; index; index = index->next)
+    {
+      if (index->nextrm)
+	return 1;
+
+      lists[0] = &index->match_list;
+      lists[1] = &index->set_list;
+      for (i = 0; i < 2; i++)
+	for (rule = lists[i]->head; rule; rule = rule->next)
+	  if (strcmp (rule->cmd->str, name) == 0
+	      && (arg == NULL
+		  || (rule->rule_str && strcmp (rule->rule_str, arg) == 0)))
+	    return 1;
+    }
+  return 0;
+}
+
 /* Lookup route map.  If there isn't route map create one and return
    it. */
 static struct route_map *
@@ -318,6 +370,8 @@ route_map_index_delete (struct route_map_index *index, int notify)
   if (index->nextrm)
     XFREE (MTYPE_ROUTE_MAP_NAME, index->nextrm);
 
+  route_map_changed (index->map);
+
     /* Execute event hook. */
   if (route_map_master.event_hook && notify)
     (*route_map_master.event_hook) (RMAP_EVENT_INDEX_DELETED,
@@ -384,6 +438,8 @@ route_map_index_add (struct route_map *map, enum route_map_type type,
       point->prev = index;
     }
 
+  route_map_changed (map);
+
   /* Execute event hook. */
   if (route_map_master.event_hook)
     (*route_map_master.event_hook) (RMAP_EVENT_INDEX_ADDED,
@@ -569,6 +625,7 @@ route_map_add_match (struct route_map_index *index, const char *match_name,
 
   /* Add new route match rule to linked list. */
   route_map_rule_add (&index->match_list, rule);
+  route_map_changed (index->map);
 
   /* Execute event hook. */
   if (route_map_master.event_hook)
@@ -597,6 +654,7 @@ route_map_delete_match (struct route_map_index *index, const char *match_name,
 	(rulecmp (rule->rule_str, match_arg) == 0 || match_arg == NULL))
       {
 	route_map_rule_delete (&index->match_list, rule);
+	route_map_changed (index->map);
 	/* Execute event hook. */
 	if (route_map_master.event_hook)
 	  (*route_map_master.event_hook) (RMAP_EVENT_MATCH_DELETED,
@@ -656,6 +714,7 @@ route_map_add_set (struct route_map_index *index, const char *set_name,
 
   /* Add new route match rule to linked list. */
   route_map_rule_add (&index->set_list, rule);
+  route_map_changed (index->map);
 
   /* Execute event hook. */
   if (route_map_master.event_hook)
@@ -683,6 +742,7 @@ route_map_delete_set (struct route_map_index *index, const char *set_name,
          (rulecmp (rule->rule_str, set_arg) == 0 || set_arg == NULL))
       {
         route_map_rule_delete (&index->set_list, rule);
+	route_map_changed (index->map);
 	/* Execute event hook. */
 	if (route_map_master.event_hook)
 	  (*route_map_master.event_hook) (RMAP_EVENT_SET_DELETED,
@@ -1051,7 +1111,10 @@ DEFUN (rmap_onmatch_next,
   index = vty->index;
 
   if (index)
-    index->exitpolicy = RMAP_NEXT;
+    {
+      index->exitpolicy = RMAP_NEXT;
+      route_map_changed (index->map);
+    }
 
   return CMD_SUCCESS;
 }
@@ -1068,7 +1131,10 @@ DEFUN (no_rmap_onmatch_next,
   index = vty->index;
   
   if (index)
-    index->exitpolicy = RMAP_EXIT;
+    {
+      index->exitpolicy = RMAP_EXIT;
+      route_map_changed (index->map);
+    }
 
   return CMD_SUCCESS;
 }
@@ -1101,6 +1167,7 @@ DEFUN (rmap_onmatch_goto,
 	{
 	  index->exitpolicy = RMAP_GOTO;
 	  index->nextpref = d;
+	  route_map_changed (index->map);
 	}
     }
   return CMD_SUCCESS;
@@ -1118,7 +1185,10 @@ DEFUN (no_rmap_onmatch_goto,
   index = vty->index;
 
   if (index)
-    index->exitpolicy = RMAP_EXIT;
+    {
+      index->exitpolicy = RMAP_EXIT;
+      route_map_changed (index->map);
+    }
   
   return CMD_SUCCESS;
 }
@@ -1182,6 +1252,7 @@ DEFUN (rmap_call,
       if (index->nextrm)
           XFREE (MTYPE_ROUTE_MAP_NAME, index->nextrm);
       index->nextrm = XSTRDUP (MTYPE_ROUTE_MAP_NAME, argv[0]);
+      route_map_changed (index->map);
     }
   return CMD_SUCCESS;
 }
@@ -1200,6 +1271,7 @@ DEFUN (no_rmap_call,
     {
       XFREE (MTYPE_ROUTE_MAP_NAME, index->nextrm);
       index->nextrm = NULL;
+      route_map_changed (index->map);
     }
 
   return CMD_SUCCESS;
@@ -86,8 +86,16 @@ struct route_map_rule_cmd
 
   /* Free allocated value by func_compile (). */
   void (*func_free)(void *);
+
+  /* RMAP_RULE_* flags. */
+  int flags;
 };
 
+/* The rule looks at nothing but the attributes of the object, never at
+   the prefix or anything else, so its outcome can be memoized per
+   attribute set. */
+#define RMAP_RULE_ATTR_ONLY	(1 << 0)
+
 /* Route map apply error. */
 enum
 {
@@ -145,6 +153,13 @@ struct route_map
   struct route_map_index *head;
   struct route_map_index *tail;
 
+  /* Bumped on every change, for callers memoizing what the map does. */
+  u_int32_t version;
+
+  /* Rules without RMAP_RULE_ATTR_ONLY and calls to other maps.  While
+     there are none, the whole outcome depends on the attributes. */
+  int other;
+
   /* Make linked list. */
   struct route_map *next;
   struct route_map *prev;
@@ -184,6 +199,10 @@ extern void route_map_install_set (struct route_map_rule_cmd *cmd);
 /* Lookup route map by name. */
 extern struct route_map * route_map_lookup_by_name (const char *name);
 
+/* Does the route map use a given match or set rule. */
+extern int route_map_uses_rule (struct route_map *, const char *,
+                                const char *);
+
 /* Apply route map to the object. */
 extern route_map_result_t route_map_apply (struct route_map *map,
                                            struct prefix *,
@@ -882,6 +882,22 @@ stream_reset (struct stream *s)
   s->getp = s->endp = 0;
 }
 
+/* Move the unread part of the stream to its start, making room for
+   more data at the end. */
+void
+stream_pulldown (struct stream *s)
+{
+  size_t len;
+
+  STREAM_VERIFY_SANE (s);
+
+  len = STREAM_READABLE (s);
+  if (s->getp && len)
+    memmove (s->data, s->data + s->getp, len);
+  s->getp = 0;
+  s->endp = len;
+}
+
 /* Write stream contens to the file discriptor. */
 int
 stream_flush (struct stream *s, int fd)
@@ -910,6 +926,8 @@ stream_fifo_new (void)
 void
 stream_fifo_push (struct stream_fifo *fifo, struct stream *s)
 {
+  s->next = NULL;
+
   if (fifo->tail)
     fifo->tail->next = s;
   else
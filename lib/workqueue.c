@@ -230,6 +230,12 @@ work_queue_unplug (struct work_queue *wq)
   work_queue_schedule (wq, wq->spec.hold);
 }
 
+int
+work_queue_should_yield (struct work_queue *wq)
+{
+  return (wq->running && thread_should_yield (wq->running));
+}
+
 /* timer thread to process a work queue
  * will reschedule itself if required,
  * otherwise work_queue_item_add 
@@ -248,6 +254,7 @@ work_queue_run (struct thread *thread)
   wq->thread = NULL;
 
   assert (wq && wq->items);
+  wq->running = thread;
 
   /* calculate cycle granularity:
    * list iteration == 1 cycle
@@ -364,6 +371,7 @@ stats:
     }
 #undef WQ_HYSTERIS_FACTOR
   
+  wq->running = NULL;
   wq->runs++;
   wq->cycles.total += cycles;
 
@@ -98,6 +98,7 @@ struct work_queue
   
   /* private state */
   u_int16_t flags;		/* user set flag */
+  struct thread *running;	/* thread running the queue right now */
 };
 
 /* User API */
@@ -119,6 +120,12 @@ extern void work_queue_plug (struct work_queue *wq);
 /* unplug the queue, allow it to be drained again */
 extern void work_queue_unplug (struct work_queue *wq);
 
+/* for a workfunc going through a large item in steps: whether the
+ * queue has used up its time slot, and the item should return
+ * WQ_QUEUE_BLOCKED to be continued on the next run
+ */
+extern int work_queue_should_yield (struct work_queue *wq);
+
 /* Helpers, exported for thread.c and command.c */
 extern int work_queue_run (struct thread *);
 extern struct cmd_element show_work_queues_cmd;
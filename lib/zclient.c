@@ -53,6 +53,7 @@ zclient_new ()
 
   zclient->ibuf = stream_new (ZEBRA_MAX_PACKET_SIZ);
   zclient->obuf = stream_new (ZEBRA_MAX_PACKET_SIZ);
+  zclient->bulk = stream_new (ZEBRA_MAX_PACKET_SIZ);
   zclient->wb = buffer_new(0);
 
   return zclient;
@@ -70,6 +71,8 @@ zclient_free (struct zclient *zclient)
     stream_free(zclient->ibuf);
   if (zclient->obuf)
     stream_free(zclient->obuf);
+  if (zclient->bulk)
+    stream_free(zclient->bulk);
   if (zclient->wb)
     buffer_free(zclient->wb);
 
@@ -119,10 +122,13 @@ zclient_stop (struct zclient *zclient)
   THREAD_OFF(zclient->t_read);
   THREAD_OFF(zclient->t_connect);
   THREAD_OFF(zclient->t_write);
+  THREAD_OFF(zclient->t_bulk);
 
-  /* Reset streams. */
+  /* Reset streams, dropping any unsent bulk message. */
   stream_reset(zclient->ibuf);
   stream_reset(zclient->obuf);
+  stream_reset(zclient->bulk);
+  zclient->bulk_count = 0;
 
   /* Empty the write buffer. */
   buffer_reset(zclient->wb);
@@ -242,13 +248,13 @@ zclient_flush_data(struct thread *thread)
   return 0;
 }
 
-int
-zclient_send_message(struct zclient *zclient)
+static int
+zclient_send_stream (struct zclient *zclient, struct stream *s)
 {
   if (zclient->sock < 0)
     return -1;
-  switch (buffer_write(zclient->wb, zclient->sock, STREAM_DATA(zclient->obuf),
-		       stream_get_endp(zclient->obuf)))
+  switch (buffer_write(zclient->wb, zclient->sock, STREAM_DATA(s),
+		       stream_get_endp(s)))
     {
     case BUFFER_ERROR:
       zlog_warn("%s: buffer_write failed to zclient fd %d, closing",
@@ -266,6 +272,46 @@ zclient_send_message(struct zclient *zclient)
   return 0;
 }
 
+int
+zclient_send_message(struct zclient *zclient)
+{
+  /* Keep ordering with routes still waiting in the bulk message. */
+  if (zclient->bulk_count && zclient_bulk_flush (zclient) < 0)
+    return -1;
+  return zclient_send_stream (zclient, zclient->obuf);
+}
+
+int
+zclient_bulk_flush (struct zclient *zclient)
+{
+  struct stream *s = zclient->bulk;
+
+  THREAD_OFF (zclient->t_bulk);
+
+  if (! zclient->bulk_count)
+    return 0;
+
+  stream_putw_at (s, 0, stream_get_endp (s));
+  stream_putw_at (s, zclient->bulk_countp, zclient->bulk_count);
+
+  if (zclient_debug)
+    zlog_debug ("zclient sending %s with %u prefixes",
+                zserv_command_string (stream_getw_from (s, 4)),
+                zclient->bulk_count);
+
+  zclient->bulk_count = 0;
+  return zclient_send_stream (zclient, s);
+}
+
+static int
+zclient_bulk_flush_event (struct thread *thread)
+{
+  struct zclient *zclient = THREAD_ARG (thread);
+
+  zclient->t_bulk = NULL;
+  return zclient_bulk_flush (zclient);
+}
+
 void
 zclient_create_header (struct stream *s, uint16_t command)
 {
@@ -354,6 +400,9 @@ zclient_start (struct zclient *zclient)
   if (zclient->default_information)
     zebra_message_send (zclient, ZEBRA_REDISTRIBUTE_DEFAULT_ADD);
 
+  if (zclient->zebra_connected)
+    (*zclient->zebra_connected) (zclient);
+
   return 0;
 }
 
@@ -373,6 +422,43 @@ zclient_connect (struct thread *t)
   return zclient_start (zclient);
 }
 
+/* Encode the nexthop, distance and metric part of an IPv4 route message. */
+static void
+zapi_ipv4_nexthop_put (struct stream *s, struct zapi_ipv4 *api)
+{
+  int i;
+
+  /* Nexthop, ifindex, distance and metric information. */
+  if (CHECK_FLAG (api->message, ZAPI_MESSAGE_NEXTHOP))
+    {
+      if (CHECK_FLAG (api->flags, ZEBRA_FLAG_BLACKHOLE))
+        {
+          stream_putc (s, 1);
+          stream_putc (s, ZEBRA_NEXTHOP_BLACKHOLE);
+          /* XXX assert(api->nexthop_num == 0); */
+          /* XXX assert(api->ifindex_num == 0); */
+        }
+      else
+        stream_putc (s, api->nexthop_num + api->ifindex_num);
+
+      for (i = 0; i < api->nexthop_num; i++)
+        {
+          stream_putc (s, ZEBRA_NEXTHOP_IPV4);
+          stream_put_in_addr (s, api->nexthop[i]);
+        }
+      for (i = 0; i < api->ifindex_num; i++)
+        {
+          stream_putc (s, ZEBRA_NEXTHOP_IFINDEX);
+          stream_putl (s, api->ifindex[i]);
+        }
+    }
+
+  if (CHECK_FLAG (api->message, ZAPI_MESSAGE_DISTANCE))
+    stream_putc (s, api->distance);
+  if (CHECK_FLAG (api->message, ZAPI_MESSAGE_METRIC))
+    stream_putl (s, api->metric);
+}
+
  /* 
   * "xdr_encode"-like interface that allows daemon (client) to send
   * a message to zebra server for a route that needs to be
@@ -421,7 +507,6 @@ int
 zapi_ipv4_route (u_char cmd, struct zclient *zclient, struct prefix_ipv4 *p,
                  struct zapi_ipv4 *api)
 {
-  int i;
   int psize;
   struct stream *s;
 
@@ -441,35 +526,7 @@ zapi_ipv4_route (u_char cmd, struct zclient *zclient, struct prefix_ipv4 *p,
   stream_putc (s, p->prefixlen);
   stream_write (s, (u_char *) & p->prefix, psize);
 
-  /* Nexthop, ifindex, distance and metric information. */
-  if (CHECK_FLAG (api->message, ZAPI_MESSAGE_NEXTHOP))
-    {
-      if (CHECK_FLAG (api->flags, ZEBRA_FLAG_BLACKHOLE))
-        {
-          stream_putc (s, 1);
-          stream_putc (s, ZEBRA_NEXTHOP_BLACKHOLE);
-          /* XXX assert(api->nexthop_num == 0); */
-          /* XXX assert(api->ifindex_num == 0); */
-        }
-      else
-        stream_putc (s, api->nexthop_num + api->ifindex_num);
-
-      for (i = 0; i < api->nexthop_num; i++)
-        {
-          stream_putc (s, ZEBRA_NEXTHOP_IPV4);
-          stream_put_in_addr (s, api->nexthop[i]);
-        }
-      for (i = 0; i < api->ifindex_num; i++)
-        {
-          stream_putc (s, ZEBRA_NEXTHOP_IFINDEX);
-          stream_putl (s, api->ifindex[i]);
-        }
-    }
-
-  if (CHECK_FLAG (api->message, ZAPI_MESSAGE_DISTANCE))
-    stream_putc (s, api->distance);
-  if (CHECK_FLAG (api->message, ZAPI_MESSAGE_METRIC))
-    stream_putl (s, api->metric);
+  zapi_ipv4_nexthop_put (s, api);
 
   /* Put length at the first point of the stream. */
   stream_putw_at (s, 0, stream_get_endp (s));
@@ -477,30 +534,99 @@ zapi_ipv4_route (u_char cmd, struct zclient *zclient, struct prefix_ipv4 *p,
   return zclient_send_message(zclient);
 }
 
-#ifdef HAVE_IPV6
+/*
+ * Append prefix P to the bulk message for BULK_CMD.  The route
+ * attributes shared by every prefix of the message have already been
+ * encoded by the caller into zclient->obuf, which is only used as
+ * scratch space here.
+ *
+ * A ZEBRA_IPV4_ROUTE_BULK_ADD/DELETE (and IPv6) message is laid out as:
+ *
+ *  0 1 2 3 4 5 6 7 8 9 A B C D E F 0 1 2 3 4 5 6 7 8 9 A B C D E F
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |          zserv header (6): Length, Marker, Version, Command   |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * | Route Type    | ZEBRA Flags   | Message Flags |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * | Nexthops, distance and metric, as in the single route messages
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |        Prefix count (2)       |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * | Prefix length | Destination prefix, PSIZE(prefix length) bytes
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * | ... repeated Prefix count times
+ *
+ * The corresponding read function on the server side is
+ * zread_ipv4_bulk()/zread_ipv6_bulk().
+ */
+static int
+zclient_bulk_add (struct zclient *zclient, u_int16_t bulk_cmd,
+                  struct prefix *p)
+{
+  struct stream *s = zclient->bulk;
+  struct stream *attr = zclient->obuf;
+  size_t attrlen = stream_get_endp (attr);
+  size_t psize = PSIZE (p->prefixlen);
+
+  /* Send the open message first if this prefix cannot share it. */
+  if (zclient->bulk_count
+      && (stream_getw_from (s, 4) != bulk_cmd
+          || zclient->bulk_countp != ZEBRA_HEADER_SIZE + attrlen
+          || memcmp (STREAM_DATA (s) + ZEBRA_HEADER_SIZE,
+                     STREAM_DATA (attr), attrlen) != 0
+          || zclient->bulk_count == UINT16_MAX
+          || STREAM_WRITEABLE (s) < 1 + psize))
+    if (zclient_bulk_flush (zclient) < 0)
+      return -1;
+
+  if (zclient->sock < 0)
+    return -1;
+
+  if (! zclient->bulk_count)
+    {
+      stream_reset (s);
+      zclient_create_header (s, bulk_cmd);
+      stream_put (s, STREAM_DATA (attr), attrlen);
+      zclient->bulk_countp = stream_get_endp (s);
+      stream_putw (s, 0);
+    }
+
+  stream_putc (s, p->prefixlen);
+  stream_put (s, &p->u.prefix, psize);
+  zclient->bulk_count++;
+
+  if (! zclient->t_bulk)
+    zclient->t_bulk = thread_add_event (master, zclient_bulk_flush_event,
+                                        zclient, 0);
+  return 0;
+}
+
 int
-zapi_ipv6_route (u_char cmd, struct zclient *zclient, struct prefix_ipv6 *p,
-	       struct zapi_ipv6 *api)
+zapi_ipv4_route_bulk (u_char cmd, struct zclient *zclient,
+                      struct prefix_ipv4 *p, struct zapi_ipv4 *api)
 {
-  int i;
-  int psize;
   struct stream *s;
 
-  /* Reset stream. */
   s = zclient->obuf;
   stream_reset (s);
 
-  zclient_create_header (s, cmd);
-
-  /* Put type and nexthop. */
   stream_putc (s, api->type);
   stream_putc (s, api->flags);
   stream_putc (s, api->message);
-  
-  /* Put prefix information. */
-  psize = PSIZE (p->prefixlen);
-  stream_putc (s, p->prefixlen);
-  stream_write (s, (u_char *)&p->prefix, psize);
+  zapi_ipv4_nexthop_put (s, api);
+
+  return zclient_bulk_add (zclient, (cmd == ZEBRA_IPV4_ROUTE_ADD
+                                     ? ZEBRA_IPV4_ROUTE_BULK_ADD
+                                     : ZEBRA_IPV4_ROUTE_BULK_DELETE),
+                           (struct prefix *) p);
+}
+
+#ifdef HAVE_IPV6
+/* IPv6 counterpart of zapi_ipv4_nexthop_put(). */
+static void
+zapi_ipv6_nexthop_put (struct stream *s, struct zapi_ipv6 *api)
+{
+  int i;
 
   /* Nexthop, ifindex, distance and metric information. */
   if (CHECK_FLAG (api->message, ZAPI_MESSAGE_NEXTHOP))
@@ -523,12 +649,58 @@ zapi_ipv6_route (u_char cmd, struct zclient *zclient, struct prefix_ipv6 *p,
     stream_putc (s, api->distance);
   if (CHECK_FLAG (api->message, ZAPI_MESSAGE_METRIC))
     stream_putl (s, api->metric);
+}
+
+int
+zapi_ipv6_route (u_char cmd, struct zclient *zclient, struct prefix_ipv6 *p,
+	       struct zapi_ipv6 *api)
+{
+  int psize;
+  struct stream *s;
+
+  /* Reset stream. */
+  s = zclient->obuf;
+  stream_reset (s);
+
+  zclient_create_header (s, cmd);
+
+  /* Put type and nexthop. */
+  stream_putc (s, api->type);
+  stream_putc (s, api->flags);
+  stream_putc (s, api->message);
+  
+  /* Put prefix information. */
+  psize = PSIZE (p->prefixlen);
+  stream_putc (s, p->prefixlen);
+  stream_write (s, (u_char *)&p->prefix, psize);
+
+  zapi_ipv6_nexthop_put (s, api);
 
   /* Put length at the first point of the stream. */
   stream_putw_at (s, 0, stream_get_endp (s));
 
   return zclient_send_message(zclient);
 }
+
+int
+zapi_ipv6_route_bulk (u_char cmd, struct zclient *zclient,
+                      struct prefix_ipv6 *p, struct zapi_ipv6 *api)
+{
+  struct stream *s;
+
+  s = zclient->obuf;
+  stream_reset (s);
+
+  stream_putc (s, api->type);
+  stream_putc (s, api->flags);
+  stream_putc (s, api->message);
+  zapi_ipv6_nexthop_put (s, api);
+
+  return zclient_bulk_add (zclient, (cmd == ZEBRA_IPV6_ROUTE_ADD
+                                     ? ZEBRA_IPV6_ROUTE_BULK_ADD
+                                     : ZEBRA_IPV6_ROUTE_BULK_DELETE),
+                           (struct prefix *) p);
+}
 #endif /* HAVE_IPV6 */
 
 /* 
@@ -933,6 +1105,10 @@ zclient_read (struct thread *thread)
       if (zclient->ipv6_route_delete)
 	ret = (*zclient->ipv6_route_delete) (command, zclient, length);
       break;
+    case ZEBRA_NEXTHOP_UPDATE:
+      if (zclient->nexthop_update)
+	ret = (*zclient->nexthop_update) (command, zclient, length);
+      break;
     default:
       break;
     }
@@ -60,6 +60,16 @@ struct zclient
   /* Thread to write buffered data to zebra. */
   struct thread *t_write;
 
+  /* Bulk route message being accumulated, see zapi_ipv4_route_bulk(). */
+  struct stream *bulk;
+
+  /* Position of the prefix count in the bulk message, and its value. */
+  size_t bulk_countp;
+  u_int16_t bulk_count;
+
+  /* Event to send the bulk message once the caller has run to completion. */
+  struct thread *t_bulk;
+
   /* Redistribute information. */
   u_char redist_default;
   u_char redist[ZEBRA_ROUTE_MAX];
@@ -79,6 +89,11 @@ struct zclient
   int (*ipv4_route_delete) (int, struct zclient *, uint16_t);
   int (*ipv6_route_add) (int, struct zclient *, uint16_t);
   int (*ipv6_route_delete) (int, struct zclient *, uint16_t);
+  int (*nexthop_update) (int, struct zclient *, uint16_t);
+
+  /* Called once the connection to zebra is up, so the client can
+     replay state zebra keeps per connection. */
+  void (*zebra_connected) (struct zclient *);
 };
 
 /* Zebra API message flag. */
@@ -149,6 +164,11 @@ extern int zclient_send_message(struct zclient *);
 /* create header for command, length to be filled in by user later */
 extern void zclient_create_header (struct stream *, uint16_t);
 
+/* Send any partially filled bulk route message now.  Returns 0 for
+   success or -1 on an I/O error.  zclient_send_message() calls this
+   itself, so messages are never reordered with respect to bulk ones. */
+extern int zclient_bulk_flush (struct zclient *);
+
 extern struct interface *zebra_interface_add_read (struct stream *);
 extern struct interface *zebra_interface_state_read (struct stream *s);
 extern struct connected *zebra_interface_address_read (int, struct stream *);
@@ -157,6 +177,17 @@ extern void zebra_router_id_update_read (struct stream *s, struct prefix *rid);
 extern int zapi_ipv4_route (u_char, struct zclient *, struct prefix_ipv4 *, 
                             struct zapi_ipv4 *);
 
+/* Queue an IPv4 route add or delete (ZEBRA_IPV4_ROUTE_ADD or
+   ZEBRA_IPV4_ROUTE_DELETE) for sending to zebra as part of a bulk
+   message.  Consecutive calls with the same command and identical
+   type, flags, nexthops, distance and metric are packed into a single
+   ZEBRA_IPV4_ROUTE_BULK_ADD/DELETE message, which is sent when it is
+   full, when the attributes change, when any other message is sent or,
+   at the latest, from an event once the caller returns to the thread
+   loop.  Returns 0 for success or -1 on an I/O error. */
+extern int zapi_ipv4_route_bulk (u_char, struct zclient *,
+                                 struct prefix_ipv4 *, struct zapi_ipv4 *);
+
 #ifdef HAVE_IPV6
 /* IPv6 prefix add and delete function prototype. */
 
@@ -181,6 +212,10 @@ struct zapi_ipv6
 
 extern int zapi_ipv6_route (u_char cmd, struct zclient *zclient, 
                      struct prefix_ipv6 *p, struct zapi_ipv6 *api);
+
+/* IPv6 counterpart of zapi_ipv4_route_bulk(). */
+extern int zapi_ipv6_route_bulk (u_char cmd, struct zclient *zclient,
+                                 struct prefix_ipv6 *p, struct zapi_ipv6 *api);
 #endif /* HAVE_IPV6 */
 
 #endif /* _ZEBRA_ZCLIENT_H */
@@ -417,7 +417,14 @@ struct in_pktinfo
 #define ZEBRA_ROUTER_ID_ADD               20
 #define ZEBRA_ROUTER_ID_DELETE            21
 #define ZEBRA_ROUTER_ID_UPDATE            22
-#define ZEBRA_MESSAGE_MAX                 23
+#define ZEBRA_IPV4_ROUTE_BULK_ADD         23
+#define ZEBRA_IPV4_ROUTE_BULK_DELETE      24
+#define ZEBRA_IPV6_ROUTE_BULK_ADD         25
+#define ZEBRA_IPV6_ROUTE_BULK_DELETE      26
+#define ZEBRA_NEXTHOP_REGISTER            27
+#define ZEBRA_NEXTHOP_UNREGISTER          28
+#define ZEBRA_NEXTHOP_UPDATE              29
+#define ZEBRA_MESSAGE_MAX                 30
 
 /* Marker value used in new Zserv, in the byte location corresponding
  * the command value in the old zserv header. To allow old and new
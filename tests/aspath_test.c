@@ -7,6 +7,7 @@
 #include "bgpd/bgpd.h"
 #include "bgpd/bgp_aspath.h"
 #include "bgpd/bgp_attr.h"
+#include "bgpd/bgp_regex.h"
 
 #define VT100_RESET "\x1b[0m"
 #define VT100_RED "\x1b[31m"
@@ -983,8 +984,8 @@ validate (struct aspath *as, const struct test_spec *sp)
       printf ("private check: %d %d\n", sp->private_as,
               aspath_private_as_check (as));
     }
-  aspath_unintern (asinout);
-  aspath_unintern (as4);
+  aspath_unintern (&asinout);
+  aspath_unintern (&as4);
   
   aspath_free (asconfeddel);
   aspath_free (asstr);
@@ -1030,7 +1031,7 @@ parse_test (struct test_segment *t)
   printf ("\n");
   
   if (asp)
-    aspath_unintern (asp);
+    aspath_unintern (&asp);
 }
 
 /* prepend testing */
@@ -1046,7 +1047,7 @@ prepend_test (struct tests *t)
   asp2 = make_aspath (t->test2->asdata, t->test2->len, 0);
   
   ascratch = aspath_dup (asp2);
-  aspath_unintern (asp2);
+  aspath_unintern (&asp2);
   
   asp2 = aspath_prepend (asp1, ascratch);
   
@@ -1058,7 +1059,7 @@ prepend_test (struct tests *t)
     printf ("%s!\n", FAILED);
   
   printf ("\n");
-  aspath_unintern (asp1);
+  aspath_unintern (&asp1);
   aspath_free (asp2);
 }
 
@@ -1074,7 +1075,7 @@ empty_prepend_test (struct test_segment *t)
   asp2 = aspath_empty ();
   
   ascratch = aspath_dup (asp2);
-  aspath_unintern (asp2);
+  aspath_unintern (&asp2);
   
   asp2 = aspath_prepend (asp1, ascratch);
   
@@ -1087,7 +1088,7 @@ empty_prepend_test (struct test_segment *t)
   
   printf ("\n");
   if (asp1)
-    aspath_unintern (asp1);
+    aspath_unintern (&asp1);
   aspath_free (asp2);
 }
 
@@ -1111,8 +1112,8 @@ as4_reconcile_test (struct tests *t)
     printf (FAILED "!\n");
   
   printf ("\n");
-  aspath_unintern (asp1);
-  aspath_unintern (asp2);
+  aspath_unintern (&asp1);
+  aspath_unintern (&asp2);
   aspath_free (ascratch);
 }
 
@@ -1137,8 +1138,8 @@ aggregate_test (struct tests *t)
     printf (FAILED "!\n");
   
   printf ("\n");
-  aspath_unintern (asp1);
-  aspath_unintern (asp2);
+  aspath_unintern (&asp1);
+  aspath_unintern (&asp2);
   aspath_free (ascratch);
 /*  aspath_unintern (ascratch);*/
 }
@@ -1185,8 +1186,136 @@ cmp_test ()
         printf (OK "\n");
       
       printf ("\n");
-      aspath_unintern (asp1);
-      aspath_unintern (asp2);
+      aspath_unintern (&asp1);
+      aspath_unintern (&asp2);
+    }
+}
+
+/* as-path access-list patterns, and whether bgp_regcomp_dfa() takes
+   them rather than leaving them to regexec() */
+static struct regex_test
+{
+  const char *regex;
+  int dfa;
+} regex_tests[] =
+{
+  { "",				1 },
+  { ".*",			1 },
+  { "^$",			1 },
+  { "8466",			1 },
+  { "_8466_",			1 },
+  { "^8466_",			1 },
+  { "^8466$",			1 },
+  { "_4096$",			1 },
+  { "_4_",			1 },
+  { "_3_52737_",		1 },
+  { "^8466_3_",			1 },
+  { "_8466_.*_4096_",		1 },
+  { "_(3|4096)_",		1 },
+  { "_(3|4096|8722)$",		1 },
+  { "^(8466_)+",		1 },
+  { "_(23456_)+",		1 },
+  { "_2345[0-9]_",		1 },
+  { "_6[0-9]*_",		1 },
+  { "^[0-9]+$",			1 },
+  { "^[0-9 ]+$",		1 },
+  { "[^0-9 ]",			1 },
+  { "^[^ ]+$",			1 },
+  { "^.$",			1 },
+  { "..*",			1 },
+  { "^_8466",			1 },
+  { "_$",			1 },
+  { "^_$",			1 },
+  { "_*8466_*",			1 },
+  { "_?4_?",			1 },
+  { "$^",			1 },
+  { "(^|_)3",			1 },
+  { "{",			0 },
+  { "[{]",			1 },
+  { "[(]",			1 },
+  { "[]]",			1 },
+  { "[[]",			1 },
+  { "},",			0 },
+  { ",",			1 },
+  { "[{,]5204",			1 },
+  { "_5204[,}]",		1 },
+  { "\\(",			0 },
+  { "(65001)?_",		1 },
+  { "()",			1 },
+  { "a",			1 },
+  { "^8466_a?3",		1 },
+  { "[a-z]",			1 },
+  { "[0-9]{2}",			0 },
+  { "[[:digit:]]",		0 },
+  { "[_]",			0 },
+  { "^*",			0 },
+  { "3**",			0 },
+  { "(8466",			0 },
+  { "8466)",			0 },
+  { NULL, 0 },
+};
+
+/* The DFA answers what regexec() answers, for every path above */
+static void
+regex_test (void)
+{
+  static const char *extra[] = { "", "65001", "64512 65001 {1,2}",
+				 "(65001 65002) 3", "[1,2] 3 {4}", NULL };
+  struct regex_test *t;
+  struct aspath *asp;
+  struct aspath_dfa *dfa;
+  regex_t *reg;
+  int i, fails, re, df;
+
+  for (t = regex_tests; t->regex; t++)
+    {
+      printf ("regex %s\n", t->regex);
+      fails = 0;
+
+      reg = bgp_regcomp (t->regex);
+      dfa = bgp_regcomp_dfa (t->regex);
+      if (!dfa != !t->dfa)
+	{
+	  printf ("DFA %s, expected %s\n", dfa ? "compiled" : "refused",
+		  t->dfa ? "compiled" : "refused");
+	  fails++;
+	}
+
+      for (i = 0; dfa && reg && test_segments[i].name; i++)
+	{
+	  asp = make_aspath (test_segments[i].asdata, test_segments[i].len, 0);
+	  if (!asp)
+	    continue;
+	  re = bgp_regexec (reg, asp) != REG_NOMATCH;
+	  df = bgp_regexec_dfa (dfa, asp) != REG_NOMATCH;
+	  if (re != df)
+	    {
+	      printf ("%s: regexec %d, DFA %d\n", asp->str, re, df);
+	      fails++;
+	    }
+	  aspath_unintern (&asp);
+	}
+
+      for (i = 0; dfa && reg && extra[i]; i++)
+	{
+	  asp = aspath_str2aspath (extra[i]);
+	  re = bgp_regexec (reg, asp) != REG_NOMATCH;
+	  df = bgp_regexec_dfa (dfa, asp) != REG_NOMATCH;
+	  if (re != df)
+	    {
+	      printf ("%s: regexec %d, DFA %d\n", asp->str, re, df);
+	      fails++;
+	    }
+	  aspath_free (asp);
+	}
+
+      if (reg)
+	bgp_regex_free (reg);
+      if (dfa)
+	bgp_regex_dfa_free (dfa);
+
+      printf ("%s\n\n", fails ? FAILED : OK);
+      failed += fails;
     }
 }
 
@@ -1240,9 +1369,9 @@ handle_attr_test (struct aspath_tests *t)
 
 out:
   if (attr.aspath)
-    aspath_unintern (attr.aspath);
+    aspath_unintern (&attr.aspath);
   if (asp)
-    aspath_unintern (asp);
+    aspath_unintern (&asp);
   return failed - initfail;
 }
 
@@ -1294,6 +1423,8 @@ main (void)
   
   cmp_test();
   
+  regex_test ();
+  
   i = 0;
   
   empty_get_test();
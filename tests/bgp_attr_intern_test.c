@@ -0,0 +1,206 @@
+#include <zebra.h>
+
+#include "vty.h"
+#include "stream.h"
+#include "privs.h"
+#include "memory.h"
+
+#include "bgpd/bgpd.h"
+#include "bgpd/bgp_attr.h"
+#include "bgpd/bgp_aspath.h"
+#include "bgpd/bgp_community.h"
+#include "bgpd/bgp_ecommunity.h"
+
+/* need these to link in libbgp */
+struct zebra_privs_t *bgpd_privs = NULL;
+struct thread_master *master = NULL;
+
+static int failed = 0;
+
+#define PATHS		4000	/* distinct AS paths */
+#define COMMS		200	/* distinct community sets */
+#define NEXTHOPS	16	/* peers */
+#define ROUNDS		200000
+
+static struct aspath *paths[PATHS];
+static struct community *comms[COMMS];
+static struct ecommunity *ecomm;
+
+/* An AS path as received: written out and parsed back, the way
+   bgp_attr_parse() gets it from an UPDATE rather than interned. */
+static struct aspath *
+parse_aspath (const char *str)
+{
+  struct aspath *as = aspath_str2aspath (str);
+  struct stream *s = stream_new (4096);
+  struct aspath *parsed;
+  size_t len;
+
+  len = aspath_put (s, as, 1);
+  parsed = aspath_parse (s, len, 1);
+  if (! parsed || parsed->key != aspath_key_make (parsed))
+    {
+      printf ("parsed path %s has no key\n", str);
+      failed++;
+    }
+
+  aspath_free (as);
+  stream_free (s);
+  return parsed;
+}
+
+/* A full table's worth of variety: AS paths of 2 to 8 hops through a
+   few hundred transit ASes, a community set on about half of the
+   routes, an extended community on a few, and the MED and next hop
+   of a handful of peers. */
+static void
+make_pool (void)
+{
+  char buf[256];
+  int i, j, len, n;
+
+  for (i = 0; i < PATHS; i++)
+    {
+      len = 2 + random () % 7;
+      for (n = j = 0; j < len; j++)
+	n += snprintf (buf + n, sizeof (buf) - n, "%s%ld", j ? " " : "",
+		       j < len - 1 ? 64512 + random () % 300
+		       : 1 + random () % 60000);
+      paths[i] = parse_aspath (buf);
+    }
+
+  for (i = 0; i < COMMS; i++)
+    {
+      snprintf (buf, sizeof (buf), "%ld:%ld %ld:%ld no-export",
+		64512 + random () % 300, random () % 1000,
+		64512 + random () % 300, random () % 1000);
+      comms[i] = community_intern (community_str2com (buf));
+    }
+
+  ecomm = ecommunity_intern (ecommunity_str2com ("64512:1",
+						 ECOMMUNITY_ROUTE_TARGET, 0));
+}
+
+static void
+random_attr (struct attr *attr, struct attr_extra *extra)
+{
+  memset (attr, 0, sizeof (struct attr));
+  memset (extra, 0, sizeof (struct attr_extra));
+  attr->extra = extra;
+
+  attr->origin = random () % 3;
+  attr->flag |= ATTR_FLAG_BIT (BGP_ATTR_ORIGIN);
+  attr->aspath = paths[random () % PATHS];
+  attr->flag |= ATTR_FLAG_BIT (BGP_ATTR_AS_PATH);
+  attr->nexthop.s_addr = htonl (0x0a000001 + random () % NEXTHOPS);
+  attr->flag |= ATTR_FLAG_BIT (BGP_ATTR_NEXT_HOP);
+  attr->med = random () % 4 * 10;
+  attr->flag |= ATTR_FLAG_BIT (BGP_ATTR_MULTI_EXIT_DISC);
+
+  if (random () % 2)
+    {
+      attr->community = comms[random () % COMMS];
+      attr->flag |= ATTR_FLAG_BIT (BGP_ATTR_COMMUNITIES);
+    }
+  if (random () % 16 == 0)
+    {
+      extra->ecommunity = ecomm;
+      attr->flag |= ATTR_FLAG_BIT (BGP_ATTR_EXT_COMMUNITIES);
+    }
+}
+
+/* Equal attributes hash the same whether their parts are interned
+   or not, and intern to the same structure. */
+static void
+check_test (void)
+{
+  struct attr attr, copy;
+  struct attr_extra extra, copy_extra;
+  struct attr *a1, *a2;
+  int i;
+
+  printf ("check: ");
+  for (i = 0; i < 1000; i++)
+    {
+      random_attr (&attr, &extra);
+      copy = attr;
+      copy_extra = extra;
+      copy.extra = &copy_extra;
+      copy.aspath = aspath_dup (attr.aspath);
+      if (attr.community)
+	copy.community = community_dup (attr.community);
+
+      if (attrhash_key_make (&attr) != attrhash_key_make (&copy))
+	{
+	  printf ("key of %d differs uninterned\n", i);
+	  failed++;
+	}
+
+      aspath_free (copy.aspath);
+      if (copy.community)
+	community_free (copy.community);
+
+      a1 = bgp_attr_intern (&attr);
+      a2 = bgp_attr_intern (&attr);
+      if (a1 != a2 || ! attrhash_cmp (a1, a2))
+	{
+	  printf ("attribute %d interned twice\n", i);
+	  failed++;
+	}
+      if (attrhash_key_make (a1) != attrhash_key_make (&attr))
+	{
+	  printf ("key of %d differs interned\n", i);
+	  failed++;
+	}
+      bgp_attr_unintern (&a1);
+      bgp_attr_unintern (&a2);
+    }
+  printf ("%s\n", failed ? "failed" : "OK");
+}
+
+/* Intern and drop the attributes of ROUNDS received routes, holding on
+   to the last quarter of them so that lookups find a full table. */
+static void
+bench_test (void)
+{
+  static struct attr *held[ROUNDS / 4];
+  struct attr attr;
+  struct attr_extra extra;
+  struct timeval start, end;
+  unsigned long usec;
+  int i;
+
+  memset (held, 0, sizeof (held));
+  gettimeofday (&start, NULL);
+  for (i = 0; i < ROUNDS; i++)
+    {
+      random_attr (&attr, &extra);
+      if (held[i % (ROUNDS / 4)])
+	bgp_attr_unintern (&held[i % (ROUNDS / 4)]);
+      held[i % (ROUNDS / 4)] = bgp_attr_intern (&attr);
+    }
+  gettimeofday (&end, NULL);
+
+  usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+  printf ("%d interns: %lu attributes, %.3f us per intern and unintern\n",
+	  ROUNDS, attr_count (), (double) usec / ROUNDS);
+
+  for (i = 0; i < ROUNDS / 4; i++)
+    if (held[i])
+      bgp_attr_unintern (&held[i]);
+}
+
+int
+main (void)
+{
+  master = thread_master_create ();
+  bgp_attr_init ();
+  srandom (1);
+  make_pool ();
+
+  check_test ();
+  bench_test ();
+
+  printf ("failures: %d\n", failed);
+  return failed;
+}
@@ -0,0 +1,267 @@
+#include <zebra.h>
+
+#include "vty.h"
+#include "stream.h"
+#include "privs.h"
+#include "memory.h"
+#include "sockunion.h"
+
+#include "bgpd/bgpd.h"
+#include "bgpd/bgp_attr.h"
+#include "bgpd/bgp_aspath.h"
+#include "bgpd/bgp_table.h"
+#include "bgpd/bgp_route.h"
+
+static int
+privs_change (zebra_privs_ops_t op)
+{
+  return 0;
+}
+
+/* need these to link in libbgp, bgp_get() opens the listen socket */
+struct zebra_privs_t bgpd_privs = { .change = privs_change };
+struct thread_master *master = NULL;
+
+static int failed = 0;
+static struct bgp *bgp;
+static as_t asn = 65000;
+
+#define MAX_PATHS	256
+#define CHANGES		20000
+
+static struct peer *peers[MAX_PATHS];
+static struct bgp_info *paths[MAX_PATHS];
+
+/* A random path from neighbor AS NEIGH: a couple of local-preference
+   and AS path length values so that the decision goes past step 5
+   often, and MED all over the place. */
+static struct attr *
+random_attr (as_t neigh)
+{
+  struct attr attr;
+  struct attr *new;
+  char buf[64];
+
+  bgp_attr_default_set (&attr, BGP_ORIGIN_IGP);
+  aspath_unintern (&attr.aspath);
+
+  switch (random () % 3)
+    {
+    case 0:
+      snprintf (buf, sizeof (buf), "%u", neigh);
+      break;
+    case 1:
+      snprintf (buf, sizeof (buf), "%u 64999", neigh);
+      break;
+    default:
+      snprintf (buf, sizeof (buf), "%u 64998 64999", neigh);
+      break;
+    }
+  attr.aspath = aspath_intern (aspath_str2aspath (buf));
+
+  attr.local_pref = 100 + (random () % 2) * 10;
+  attr.flag |= ATTR_FLAG_BIT (BGP_ATTR_LOCAL_PREF);
+  attr.med = random () % 4;
+  attr.flag |= ATTR_FLAG_BIT (BGP_ATTR_MULTI_EXIT_DISC);
+  attr.origin = random () % 2;
+
+  new = bgp_attr_intern (&attr);
+  aspath_unintern (&attr.aspath);
+  bgp_attr_extra_free (&attr);
+  return new;
+}
+
+/* Do what bgp_process_main() does with the outcome. */
+static struct bgp_info *
+select_best (struct bgp_node *rn, int full)
+{
+  struct bgp_info_pair pair;
+
+  if (full)
+    SET_FLAG (rn->flags, BGP_NODE_RESCAN);
+
+  bgp_best_selection (bgp, rn, &pair);
+
+  if (pair.old)
+    bgp_info_unset_flag (rn, pair.old, BGP_INFO_SELECTED);
+  if (pair.new)
+    bgp_info_set_flag (rn, pair.new, BGP_INFO_SELECTED);
+  return pair.new;
+}
+
+/* Change one path of RN the way an UPDATE or a next-hop going away
+   would. */
+static struct bgp_info *
+random_change (struct bgp_node *rn, int npaths, int nas)
+{
+  struct bgp_info *ri;
+  int i;
+
+  i = random () % npaths;
+  ri = paths[i];
+  bgp_info_note_change (rn, ri);
+
+  if (random () % 4 == 0)
+    {
+      if (CHECK_FLAG (ri->flags, BGP_INFO_VALID))
+	bgp_info_unset_flag (rn, ri, BGP_INFO_VALID);
+      else
+	bgp_info_set_flag (rn, ri, BGP_INFO_VALID);
+    }
+  else
+    {
+      bgp_attr_unintern (&ri->attr);
+      ri->attr = random_attr (65100 + i % nas);
+    }
+  return ri;
+}
+
+static struct bgp_node *
+make_node (int npaths, int nas, int check)
+{
+  struct bgp_table *table;
+  struct bgp_node *rn;
+  struct prefix p;
+  struct bgp_info *ri, *best;
+  int i;
+
+  table = bgp_table_init (AFI_IP, SAFI_UNICAST);
+  str2prefix ("10.0.0.0/8", &p);
+  rn = bgp_node_get (table, &p);
+
+  for (i = 0; i < npaths; i++)
+    {
+      ri = XCALLOC (MTYPE_BGP_ROUTE, sizeof (struct bgp_info));
+      ri->type = ZEBRA_ROUTE_BGP;
+      ri->sub_type = BGP_ROUTE_NORMAL;
+      ri->peer = peers[i];
+      ri->attr = random_attr (65100 + i % nas);
+      ri->uptime = i;
+      bgp_info_set_flag (rn, ri, BGP_INFO_VALID);
+      bgp_info_add (rn, ri);
+      paths[i] = ri;
+
+      best = select_best (rn, 0);
+      if (check && best != select_best (rn, 1))
+	{
+	  printf ("add %d of %d paths: incremental and full disagree\n",
+		  i, npaths);
+	  failed++;
+	}
+    }
+  return rn;
+}
+
+/* Check that selecting from just the changed path agrees with a full
+   scan, for NPATHS paths from NAS different neighbor ASes. */
+static void
+check_test (const char *name, int npaths, int nas)
+{
+  struct bgp_node *rn;
+  struct bgp_info *best;
+  unsigned long inc = bgp_process_stats.incremental;
+  int i, fails = failed;
+
+  printf ("%s: %d paths from %d neighbor AS\n", name, npaths, nas);
+
+  rn = make_node (npaths, nas, 1);
+
+  for (i = 0; i < CHANGES / 10; i++)
+    {
+      random_change (rn, npaths, nas);
+      best = select_best (rn, 0);
+      if (best != select_best (rn, 1))
+	{
+	  printf ("change %d: incremental and full disagree\n", i);
+	  failed++;
+	  break;
+	}
+    }
+
+  printf ("%lu incremental selections\n", bgp_process_stats.incremental - inc);
+  printf ("%s\n\n", fails == failed ? "OK" : "failed");
+}
+
+/* Time CHANGES single path changes on a node of NPATHS paths. */
+static void
+bench_test (int npaths, int nas)
+{
+  struct bgp_node *rn;
+  struct timeval start, end;
+  unsigned long usec[2];
+  int full, i;
+
+  for (full = 0; full < 2; full++)
+    {
+      srandom (npaths);
+      rn = make_node (npaths, nas, 0);
+
+      usec[full] = 0;
+      for (i = 0; i < CHANGES; i++)
+	{
+	  random_change (rn, npaths, nas);
+
+	  gettimeofday (&start, NULL);
+	  select_best (rn, full);
+	  gettimeofday (&end, NULL);
+
+	  usec[full] += (end.tv_sec - start.tv_sec) * 1000000
+			+ (end.tv_usec - start.tv_usec);
+	}
+    }
+
+  printf ("%4d paths: %8.3f us full, %8.3f us incremental\n", npaths,
+	  (double) usec[1] / CHANGES, (double) usec[0] / CHANGES);
+}
+
+int
+main (void)
+{
+  struct peer *peer;
+  char buf[32];
+  int i;
+
+  master = thread_master_create ();
+  bgp_master_init ();
+  bgp_attr_init ();
+  bm->port = 0;
+
+  if (bgp_get (&bgp, &asn, NULL))
+    return -1;
+
+  for (i = 0; i < MAX_PATHS; i++)
+    {
+      peer = peer_create_accept (bgp);
+      snprintf (buf, sizeof (buf), "10.1.%d.%d", i / 256, i % 256);
+      peer->host = strdup (buf);
+      peer->su_remote = sockunion_str2su (buf);
+      peer->remote_id.s_addr = htonl (0x0a000001 + (i * 7919) % MAX_PATHS);
+      peer->local_as = asn;
+      peer->as = 65100 + i;
+      peers[i] = peer;
+    }
+
+  srandom (1);
+
+  /* Every pair of paths from different AS: MED never compared. */
+  check_test ("distinct-as", 50, 50);
+
+  /* MED compared between all of them. */
+  bgp_flag_set (bgp, BGP_FLAG_ALWAYS_COMPARE_MED);
+  check_test ("always-compare-med", 50, 4);
+  check_test ("always-compare-med-small", 3, 2);
+  bgp_flag_unset (bgp, BGP_FLAG_ALWAYS_COMPARE_MED);
+
+  /* Falls back to full scans whenever MED could matter. */
+  check_test ("shared-as", 50, 4);
+
+  bgp_flag_set (bgp, BGP_FLAG_DETERMINISTIC_MED);
+  check_test ("deterministic-med", 50, 4);
+  bgp_flag_unset (bgp, BGP_FLAG_DETERMINISTIC_MED);
+
+  for (i = 2; i <= MAX_PATHS; i *= 2)
+    bench_test (i, i);
+
+  printf ("failures: %d\n", failed);
+  return failed;
+}
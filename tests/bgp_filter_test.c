@@ -0,0 +1,150 @@
+#include <zebra.h>
+
+#include "vty.h"
+#include "command.h"
+#include "privs.h"
+#include "memory.h"
+
+#include "bgpd/bgpd.h"
+#include "bgpd/bgp_aspath.h"
+#include "bgpd/bgp_regex.h"
+#include "bgpd/bgp_filter.h"
+
+/* need these to link in libbgp */
+struct zebra_privs_t *bgpd_privs = NULL;
+struct thread_master *master = NULL;
+
+extern struct cmd_element ip_as_path_cmd;
+extern struct cmd_element no_ip_as_path_cmd;
+
+static int failed = 0;
+static struct vty *vty;
+
+#define PATHS		20000	/* distinct AS paths in the table */
+#define PEERS		8	/* times each path is filtered */
+
+static struct aspath *paths[PATHS];
+
+/* The regexes in the list, for working the answer out the slow way. */
+static struct
+{
+  const char *str;
+  enum as_filter_type type;
+  regex_t *reg;
+} filters[] =
+{
+  { "_64666_",			AS_FILTER_DENY },
+  { "^6451[0-9]_",		AS_FILTER_PERMIT },
+  { "_(645[2-5][0-9])_6",	AS_FILTER_PERMIT },
+  { "^$",			AS_FILTER_PERMIT },
+};
+#define FILTERS		(int) (sizeof (filters) / sizeof (filters[0]))
+
+static void
+filter_cmd (struct cmd_element *cmd, int i)
+{
+  const char *argv[3];
+
+  argv[0] = "test";
+  argv[1] = filters[i].type == AS_FILTER_PERMIT ? "permit" : "deny";
+  argv[2] = filters[i].str;
+  if ((*cmd->func) (cmd, vty, 3, argv) != CMD_SUCCESS)
+    {
+      printf ("command for filter %d failed\n", i);
+      failed++;
+    }
+}
+
+static enum as_filter_type
+slow_apply (struct aspath *aspath, int nfilters)
+{
+  int i;
+
+  for (i = 0; i < nfilters; i++)
+    if (filters[i].reg && bgp_regexec (filters[i].reg, aspath) != REG_NOMATCH)
+      return filters[i].type;
+  return AS_FILTER_DENY;
+}
+
+static void
+make_paths (void)
+{
+  char buf[256];
+  int i, j, len, n;
+
+  for (i = 0; i < PATHS; i++)
+    {
+      len = random () % 8;
+      buf[0] = '\0';
+      for (n = j = 0; j < len; j++)
+	n += snprintf (buf + n, sizeof (buf) - n, "%s%ld", j ? " " : "",
+		       j < len - 1 ? 64500 + random () % 200
+		       : 1 + random () % 60000);
+      paths[i] = aspath_intern (aspath_str2aspath (buf));
+    }
+}
+
+/* Every path through the list PEERS times, as many peers with the
+   same filter-list would; USEC gets the microseconds taken by the
+   first round and by all the others.  Then check the answers. */
+static void
+run (struct as_list *aslist, int nfilters, unsigned long usec[2])
+{
+  struct timeval start, end;
+  int i, peer;
+
+  usec[0] = usec[1] = 0;
+  for (peer = 0; peer < PEERS; peer++)
+    {
+      gettimeofday (&start, NULL);
+      for (i = 0; i < PATHS; i++)
+	as_list_apply (aslist, paths[i]);
+      gettimeofday (&end, NULL);
+      usec[peer > 0] += (end.tv_sec - start.tv_sec) * 1000000
+			+ (end.tv_usec - start.tv_usec);
+    }
+
+  for (i = 0; i < PATHS; i++)
+    if (as_list_apply (aslist, paths[i]) != slow_apply (paths[i], nfilters))
+      {
+	printf ("path %s: cached verdict differs\n", paths[i]->str);
+	failed++;
+      }
+}
+
+int
+main (void)
+{
+  struct as_list *aslist;
+  unsigned long usec[2];
+  int i;
+
+  master = thread_master_create ();
+  aspath_init ();
+  vty = vty_new ();
+  srandom (1);
+  make_paths ();
+
+  for (i = 0; i < FILTERS; i++)
+    filters[i].reg = bgp_regcomp (filters[i].str);
+
+  /* All but the last filter first, then check that adding and taking
+     away a filter changes the cached answers. */
+  for (i = 0; i < FILTERS - 1; i++)
+    filter_cmd (&ip_as_path_cmd, i);
+  aslist = as_list_lookup ("test");
+
+  run (aslist, FILTERS - 1, usec);
+  printf ("%d paths, %d peers: %.3f us per path uncached, "
+	  "%.3f us cached\n", PATHS, PEERS,
+	  (double) usec[0] / PATHS, (double) usec[1] / PATHS / (PEERS - 1));
+
+  filter_cmd (&ip_as_path_cmd, FILTERS - 1);
+  run (aslist, FILTERS, usec);
+
+  filter_cmd (&no_ip_as_path_cmd, FILTERS - 1);
+  run (aslist, FILTERS - 1, usec);
+
+  printf ("failures: %d\n", failed);
+  return failed;
+}
@@ -0,0 +1,602 @@
+/* Replay the BGP4MP UPDATEs of an MRT file through bgpd's input path.
+ *
+ * Each peer in the file becomes a receive-only peer with no socket, and
+ * its UPDATEs are handed to bgp_update_receive() as though they had just
+ * been read, with the best path work queue drained every so many
+ * messages.  What it took is reported from the UPDATE pipeline
+ * accounting, per stage, along with the memory the RIB grew by.
+ *
+ * Without a file, a synthetic table is replayed instead: a few peers
+ * sending the same prefixes with attributes shared as in a full table,
+ * then some churn.  Either way the numbers are a baseline that does not
+ * depend on live peers.
+ *
+ *   bgpreplay [-b batch] [file]
+ */
+
+#include <zebra.h>
+
+#include "command.h"
+#include "vty.h"
+#include "stream.h"
+#include "privs.h"
+#include "memory.h"
+#include "sockunion.h"
+#include "if.h"
+#include "linklist.h"
+#include "thread.h"
+#include "workqueue.h"
+#include "zclient.h"
+
+#include "bgpd/bgpd.h"
+#include "bgpd/bgp_attr.h"
+#include "bgpd/bgp_aspath.h"
+#include "bgpd/bgp_table.h"
+#include "bgpd/bgp_route.h"
+#include "bgpd/bgp_packet.h"
+#include "bgpd/bgp_nexthop.h"
+#include "bgpd/bgp_dump.h"
+
+#if defined (HAVE_MALLINFO) || defined (HAVE_MALLINFO2)
+#include <malloc.h>
+#endif /* HAVE_MALLINFO || HAVE_MALLINFO2 */
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif /* HAVE_ZLIB */
+
+static int
+privs_change (zebra_privs_ops_t op)
+{
+  return 0;
+}
+
+/* need these to link in libbgp, bgp_get() opens the listen socket */
+struct zebra_privs_t bgpd_privs = { .change = privs_change };
+struct thread_master *master = NULL;
+
+extern struct cmd_element show_ip_bgp_pipeline_cmd;
+extern struct zclient *zclient;
+
+/* Where bgp_scan_init() puts its commands. */
+static struct cmd_node bgp_node =
+{
+  BGP_NODE,
+  "",
+  1
+};
+
+#define MSG_PROTOCOL_BGP4MP_ET	17
+
+#define MAX_PEERS	1024
+
+/* The synthetic table. */
+#define SYN_PEERS	4
+#define SYN_PREFIXES	100000
+#define SYN_ATTRS	10000
+#define SYN_CHURN	(SYN_PREFIXES / 10)
+
+static struct bgp *bgp;
+
+/* The peers met in the file, by address. */
+static struct
+{
+  union sockunion su;
+  as_t as;
+  struct peer *peer;
+} peers[MAX_PEERS];
+static int npeers;
+
+/* The UPDATEs to replay, read in before any is. */
+struct replay_msg
+{
+  int peer;
+  int as4;
+  size_t offset;
+  bgp_size_t size;		/* without the BGP header */
+};
+static struct replay_msg *messages;
+static int nmessages, maxmessages;
+
+static u_char *data;
+static size_t datalen, datasize;
+
+static unsigned long skipped;
+
+static void *
+grow (void *p, size_t size)
+{
+  if ((p = realloc (p, size)) == NULL)
+    {
+      fprintf (stderr, "out of memory\n");
+      exit (1);
+    }
+  return p;
+}
+
+static int
+peer_index (union sockunion *su, as_t as)
+{
+  int i;
+
+  for (i = 0; i < npeers; i++)
+    if (sockunion_same (&peers[i].su, su))
+      return i;
+
+  if (npeers == MAX_PEERS)
+    return -1;
+  peers[npeers].su = *su;
+  peers[npeers].as = as;
+  return npeers++;
+}
+
+/* Keep the BGP message at P, LEN bytes with its header, if it is an
+   UPDATE. */
+static void
+message_add (union sockunion *su, as_t as, int as4, u_char *p, size_t len)
+{
+  struct replay_msg *m;
+  int peer;
+
+  if (len < BGP_HEADER_SIZE || p[18] != BGP_MSG_UPDATE
+      || (peer = peer_index (su, as)) < 0)
+    {
+      skipped++;
+      return;
+    }
+
+  if (nmessages == maxmessages)
+    {
+      maxmessages = maxmessages ? maxmessages * 2 : 65536;
+      messages = grow (messages, maxmessages * sizeof (struct replay_msg));
+    }
+  if (datalen + len > datasize)
+    {
+      datasize = datasize ? datasize * 2 : 16 * 1024 * 1024;
+      while (datalen + len > datasize)
+	datasize *= 2;
+      data = grow (data, datasize);
+    }
+
+  m = &messages[nmessages++];
+  m->peer = peer;
+  m->as4 = as4;
+  m->offset = datalen;
+  m->size = len - BGP_HEADER_SIZE;
+  memcpy (data + datalen, p + BGP_HEADER_SIZE, m->size);
+  datalen += m->size;
+}
+
+/* One MRT record: a BGP4MP message is kept, anything else skipped. */
+static void
+mrt_record (u_char *p, size_t len, int type, int subtype)
+{
+  union sockunion su;
+  int as4, alen;
+  as_t as;
+  u_int16_t afi;
+
+  if (type == MSG_PROTOCOL_BGP4MP_ET)
+    {
+      /* Microseconds ahead of the message. */
+      if (len < 4)
+	goto skip;
+      p += 4;
+      len -= 4;
+    }
+  else if (type != MSG_PROTOCOL_BGP4MP)
+    goto skip;
+
+  if (subtype == BGP4MP_MESSAGE)
+    as4 = 0;
+  else if (subtype == BGP4MP_MESSAGE_AS4)
+    as4 = 1;
+  else
+    goto skip;
+
+  /* Peer AS, local AS, interface index, AFI and the two addresses. */
+  alen = as4 ? 4 : 2;
+  if (len < (size_t) alen * 2 + 4)
+    goto skip;
+  as = as4 ? (p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]) : (p[0] << 8 | p[1]);
+  p += alen * 2 + 2;
+  len -= alen * 2 + 2;
+  afi = p[0] << 8 | p[1];
+  p += 2;
+  len -= 2;
+
+  memset (&su, 0, sizeof (union sockunion));
+  if (afi == AFI_IP && len >= 8)
+    {
+      su.sin.sin_family = AF_INET;
+      memcpy (&su.sin.sin_addr, p, 4);
+      p += 8;
+      len -= 8;
+    }
+#ifdef HAVE_IPV6
+  else if (afi == AFI_IP6 && len >= 32)
+    {
+      su.sin6.sin6_family = AF_INET6;
+      memcpy (&su.sin6.sin6_addr, p, 16);
+      p += 32;
+      len -= 32;
+    }
+#endif /* HAVE_IPV6 */
+  else
+    goto skip;
+
+  message_add (&su, as, as4, p, len);
+  return;
+
+ skip:
+  skipped++;
+}
+
+/* Read in the whole of an MRT file, compressed or not. */
+static int
+mrt_read (const char *path)
+{
+  u_char hdr[BGP_DUMP_HEADER_SIZE];
+  u_char *buf = NULL;
+  size_t bufsize = 0, len;
+#ifdef HAVE_ZLIB
+  gzFile f;
+
+  if ((f = gzopen (path, "rb")) == NULL)
+#define mrt_fread(p, n)	((size_t) gzread (f, (p), (n)) == (n))
+#else
+  FILE *f;
+
+  if ((f = fopen (path, "r")) == NULL)
+#define mrt_fread(p, n)	(fread ((p), 1, (n), f) == (n))
+#endif /* HAVE_ZLIB */
+    {
+      perror (path);
+      return -1;
+    }
+
+  while (mrt_fread (hdr, BGP_DUMP_HEADER_SIZE))
+    {
+      len = hdr[8] << 24 | hdr[9] << 16 | hdr[10] << 8 | hdr[11];
+      if (len > bufsize)
+	buf = grow (buf, bufsize = len);
+      if (! mrt_fread (buf, len))
+	{
+	  fprintf (stderr, "%s: truncated record\n", path);
+	  break;
+	}
+      mrt_record (buf, len, hdr[4] << 8 | hdr[5], hdr[6] << 8 | hdr[7]);
+    }
+#undef mrt_fread
+
+#ifdef HAVE_ZLIB
+  gzclose (f);
+#else
+  fclose (f);
+#endif /* HAVE_ZLIB */
+  free (buf);
+  return 0;
+}
+
+/* An UPDATE from synthetic peer PEER for prefixes FIRST to FIRST + N -
+   1, with attribute set ATTR, or withdrawing them when ATTR < 0.  It
+   goes through mrt_record() like one from a file. */
+static void
+synthetic_update (int peer, int attr, int first, int n, u_int32_t med)
+{
+  u_char rec[BGP_MAX_PACKET_SIZE + 64];
+  u_char *p, *msg, *attrs;
+  int i, hops, wlen;
+
+  p = rec;
+  /* BGP4MP_MESSAGE_AS4 common part, IPv4. */
+  *p++ = 0; *p++ = 0; *p++ = 0xfd; *p++ = 0xe9;		/* peer AS */
+  *p++ = 0; *p++ = 0; *p++ = 0xfd; *p++ = 0xe8;		/* local AS */
+  *p++ = 0; *p++ = 0;
+  *p++ = 0; *p++ = AFI_IP;
+  *p++ = 10; *p++ = 0; *p++ = 0; *p++ = peer + 1;
+  *p++ = 10; *p++ = 0; *p++ = 0; *p++ = 254;
+
+  msg = p;
+  memset (p, 0xff, 16);
+  p += 19;
+
+  /* Withdrawn routes. */
+  wlen = attr < 0 ? n * 4 : 0;
+  *p++ = wlen >> 8;
+  *p++ = wlen;
+  if (attr < 0)
+    for (i = first; i < first + n; i++)
+      {
+	*p++ = 24;
+	*p++ = 1 + i / 65536;
+	*p++ = i / 256;
+	*p++ = i;
+      }
+
+  attrs = p;
+  p += 2;
+  if (attr >= 0)
+    {
+      /* ORIGIN */
+      *p++ = 0x40; *p++ = BGP_ATTR_ORIGIN; *p++ = 1; *p++ = attr % 3;
+
+      /* AS_PATH: the peer, then a path of 1 to 6 hops picked by ATTR. */
+      hops = 1 + attr % 6;
+      *p++ = 0x40; *p++ = BGP_ATTR_AS_PATH; *p++ = 2 + (hops + 1) * 4;
+      *p++ = AS_SEQUENCE; *p++ = hops + 1;
+      *p++ = 0; *p++ = 0; *p++ = 0xfd; *p++ = 0xe9;
+      for (i = 0; i < hops; i++)
+	{
+	  as_t as = 1 + (attr * 7919 + i * 104729) % 60000;
+
+	  *p++ = 0; *p++ = 0; *p++ = as >> 8; *p++ = as;
+	}
+
+      /* NEXT_HOP */
+      *p++ = 0x40; *p++ = BGP_ATTR_NEXT_HOP; *p++ = 4;
+      *p++ = 10; *p++ = 0; *p++ = 0; *p++ = peer + 1;
+
+      /* MULTI_EXIT_DISC */
+      *p++ = 0x80; *p++ = BGP_ATTR_MULTI_EXIT_DISC; *p++ = 4;
+      *p++ = med >> 24; *p++ = med >> 16; *p++ = med >> 8; *p++ = med;
+
+      /* COMMUNITIES, on every other set */
+      if (attr % 2)
+	{
+	  *p++ = 0xc0; *p++ = BGP_ATTR_COMMUNITIES; *p++ = 8;
+	  *p++ = 0xfd; *p++ = 0xe9; *p++ = attr >> 8; *p++ = attr;
+	  *p++ = 0xfd; *p++ = 0xe9; *p++ = 0; *p++ = peer;
+	}
+    }
+  attrs[0] = (p - attrs - 2) >> 8;
+  attrs[1] = (p - attrs - 2);
+
+  if (attr >= 0)
+    for (i = first; i < first + n; i++)
+      {
+	*p++ = 24;
+	*p++ = 1 + i / 65536;
+	*p++ = i / 256;
+	*p++ = i;
+      }
+
+  msg[16] = (p - msg) >> 8;
+  msg[17] = (p - msg);
+  msg[18] = BGP_MSG_UPDATE;
+
+  mrt_record (rec, p - rec, MSG_PROTOCOL_BGP4MP, BGP4MP_MESSAGE_AS4);
+}
+
+/* A table's worth of prefixes from each peer, in UPDATEs of the
+   prefixes that share attributes, then a tenth of them withdrawn and
+   announced again. */
+static void
+synthetic_table (void)
+{
+  int peer, i, n, attr;
+
+  srandom (1);
+  for (peer = 0; peer < SYN_PEERS; peer++)
+    for (i = 0; i < SYN_PREFIXES; i += n)
+      {
+	n = 1 + random () % 20;
+	if (i + n > SYN_PREFIXES)
+	  n = SYN_PREFIXES - i;
+	attr = (i * 31 + peer) % SYN_ATTRS;
+	synthetic_update (peer, attr, i, n, peer * 10);
+      }
+
+  for (i = 0; i < SYN_CHURN; i++)
+    {
+      peer = random () % SYN_PEERS;
+      n = random () % (SYN_PREFIXES - 4);
+      synthetic_update (peer, -1, n, 4, 0);
+      synthetic_update (peer, random () % SYN_ATTRS, n, 4, random () % 100);
+    }
+}
+
+static struct peer *
+replay_peer (int i)
+{
+  struct peer *peer;
+  char buf[SU_ADDRSTRLEN];
+
+  if (peers[i].peer)
+    return peers[i].peer;
+
+  peer = peer_create_accept (bgp);
+  sockunion2str (&peers[i].su, buf, sizeof (buf));
+  peer->host = strdup (buf);
+  peer->su = peers[i].su;
+  if (peers[i].su.sa.sa_family == AF_INET)
+    peer->remote_id = peers[i].su.sin.sin_addr;
+  else
+    peer->remote_id.s_addr = htonl (i + 1);
+  peer->as = peers[i].as;
+  peer->local_as = bgp->as;
+  peer->ttl = 255;
+
+  /* Receive only: nothing is announced to it. */
+  peer->afc[AFI_IP][SAFI_UNICAST] = 1;
+  peer->afc[AFI_IP6][SAFI_UNICAST] = 1;
+  peer->status = Established;
+
+  return peers[i].peer = peer;
+}
+
+/* Run the best path work queue until it has nothing left. */
+static void
+drain (void)
+{
+  struct thread thread;
+
+  if (bm->process_main_queue == NULL)
+    return;
+  bm->process_main_queue->spec.hold = 0;
+  while (listcount (bm->process_main_queue->items))
+    if (thread_fetch (master, &thread))
+      thread_call (&thread);
+}
+
+/* What the RIB is made of, for the memory it grows by in each stage. */
+static const struct
+{
+  const char *stage;
+  int mtypes[12];
+} memory_stages[] =
+{
+  { "decode",	{ MTYPE_AS_PATH, MTYPE_AS_SEG, MTYPE_AS_SEG_DATA,
+		  MTYPE_COMMUNITY, MTYPE_COMMUNITY_VAL, MTYPE_ECOMMUNITY,
+		  MTYPE_ECOMMUNITY_VAL, MTYPE_CLUSTER, MTYPE_CLUSTER_VAL,
+		  MTYPE_TRANSIT, MTYPE_TRANSIT_VAL, 0 } },
+  { "intern",	{ MTYPE_ATTR, MTYPE_ATTR_EXTRA, 0 } },
+  { "rib",	{ MTYPE_BGP_NODE, MTYPE_BGP_ROUTE, MTYPE_BGP_ADJ_IN, 0 } },
+  { "bestpath",	{ MTYPE_BGP_PROCESS_QUEUE, 0 } },
+};
+#define MEMORY_STAGES	(int) (sizeof (memory_stages) / sizeof (memory_stages[0]))
+
+static long
+memory_objects (int stage)
+{
+  long n = 0;
+  int i;
+
+  for (i = 0; memory_stages[stage].mtypes[i]; i++)
+    n += mtype_stats_alloc (memory_stages[stage].mtypes[i]);
+  return n;
+}
+
+static long
+memory_heap (void)
+{
+#if defined (HAVE_MALLINFO2)
+  struct mallinfo2 mi = mallinfo2 ();
+
+  return mi.uordblks + mi.hblkhd;
+#elif defined (HAVE_MALLINFO)
+  struct mallinfo mi = mallinfo ();
+
+  return mi.uordblks + mi.hblkhd;
+#else
+  return 0;
+#endif /* HAVE_MALLINFO */
+}
+
+static double
+elapsed (struct timeval *start)
+{
+  struct timeval now;
+
+  gettimeofday (&now, NULL);
+  return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+int
+main (int argc, char **argv)
+{
+  struct vty *vty;
+  struct peer *peer;
+  struct replay_msg *m;
+  struct timeval start;
+  long objects[MEMORY_STAGES], heap;
+  unsigned long paths, extras;
+  size_t size;
+  as_t asn = 65000;
+  int batch = 1000;
+  int ch, i, step;
+  double secs;
+
+  setvbuf (stdout, NULL, _IOLBF, 0);
+
+  while ((ch = getopt (argc, argv, "b:")) != -1)
+    switch (ch)
+      {
+      case 'b':
+	batch = atoi (optarg);
+	break;
+      default:
+	fprintf (stderr, "usage: %s [-b batch] [file]\n", argv[0]);
+	return 1;
+      }
+
+  if (optind < argc)
+    {
+      if (mrt_read (argv[optind]) < 0)
+	return 1;
+    }
+  else
+    synthetic_table ();
+
+  printf ("%d UPDATEs from %d peers, %lu records skipped, %.1f MB\n",
+	  nmessages, npeers, skipped, datalen / 1048576.0);
+  if (nmessages == 0)
+    return 1;
+
+  cmd_init (1);
+  bgp_master_init ();
+  master = bm->master;
+  bgp_attr_init ();
+  install_node (&bgp_node, NULL);
+  bgp_scan_init ();
+
+  /* No zebra: next hops are taken as reachable, nothing is installed. */
+  zclient = zclient_new ();
+  zclient->sock = -1;
+  if_init ();
+  bm->port = 0;
+  if (bgp_get (&bgp, &asn, NULL))
+    return 1;
+
+  for (i = 0; i < MEMORY_STAGES; i++)
+    objects[i] = memory_objects (i);
+  heap = memory_heap ();
+
+  printf ("%10s %10s %12s %12s %10s\n",
+	  "UPDATEs", "paths", "UPDATEs/sec", "paths/sec", "heap MB");
+
+  step = nmessages / 10 ? nmessages / 10 : 1;
+  gettimeofday (&start, NULL);
+  for (i = 0; i < nmessages; i++)
+    {
+      m = &messages[i];
+      peer = replay_peer (m->peer);
+      if (m->as4)
+	SET_FLAG (peer->cap, PEER_CAP_AS4_RCV | PEER_CAP_AS4_ADV);
+      else
+	UNSET_FLAG (peer->cap, PEER_CAP_AS4_RCV | PEER_CAP_AS4_ADV);
+
+      stream_reset (peer->ibuf);
+      stream_put (peer->ibuf, data + m->offset, m->size);
+      bgp_update_receive (peer, m->size);
+
+      if ((i + 1) % batch == 0 || i + 1 == nmessages)
+	drain ();
+
+      if ((i + 1) % step == 0 || i + 1 == nmessages)
+	{
+	  secs = elapsed (&start);
+	  bgp_info_memory (&paths, &extras);
+	  printf ("%10d %10lu %12.0f %12.0f %10.1f\n", i + 1, paths,
+		  (i + 1) / secs, paths / secs,
+		  memory_heap () / 1048576.0);
+	}
+    }
+  secs = elapsed (&start);
+
+  size = bgp_info_memory (&paths, &extras);
+  printf ("\n%d UPDATEs in %.3f s: %.0f UPDATEs/sec, %lu paths, "
+	  "%.0f bytes each\n", nmessages, secs, nmessages / secs, paths,
+	  paths ? (double) size / paths : 0.0);
+
+  printf ("\n%-10s %12s\n", "Memory", "objects");
+  for (i = 0; i < MEMORY_STAGES; i++)
+    printf ("%-10s %+12ld\n", memory_stages[i].stage,
+	    memory_objects (i) - objects[i]);
+  printf ("%-10s %+11.1fMB\n\n", "heap", (memory_heap () - heap) / 1048576.0);
+
+  vty = vty_new ();
+  vty->type = VTY_SHELL;
+  (*show_ip_bgp_pipeline_cmd.func) (&show_ip_bgp_pipeline_cmd, vty, 0, NULL);
+
+  return 0;
+}
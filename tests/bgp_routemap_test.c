@@ -0,0 +1,305 @@
+#include <zebra.h>
+
+#include "vty.h"
+#include "command.h"
+#include "privs.h"
+#include "memory.h"
+#include "prefix.h"
+#include "plist.h"
+#include "routemap.h"
+
+#include "bgpd/bgpd.h"
+#include "bgpd/bgp_attr.h"
+#include "bgpd/bgp_aspath.h"
+#include "bgpd/bgp_community.h"
+#include "bgpd/bgp_regex.h"
+#include "bgpd/bgp_clist.h"
+#include "bgpd/bgp_table.h"
+#include "bgpd/bgp_route.h"
+#include "bgpd/bgp_filter.h"
+
+/* need these to link in libbgp */
+struct zebra_privs_t *bgpd_privs = NULL;
+struct thread_master *master = NULL;
+
+extern struct cmd_element route_map_cmd;
+extern struct cmd_element ip_as_path_cmd;
+extern struct cmd_element ip_prefix_list_cmd;
+extern struct cmd_element ip_community_list_expanded_cmd;
+extern struct cmd_element match_aspath_cmd;
+extern struct cmd_element match_metric_cmd;
+extern struct cmd_element match_origin_cmd;
+extern struct cmd_element match_community_cmd;
+extern struct cmd_element match_ip_address_prefix_list_cmd;
+extern struct cmd_element set_local_pref_cmd;
+extern struct cmd_element set_metric_cmd;
+extern struct cmd_element set_aspath_prepend_cmd;
+extern struct cmd_element set_community_cmd;
+
+static int failed = 0;
+static struct vty *vty;
+
+#define PATHS		2000	/* distinct AS paths */
+#define COMMS		50	/* distinct community sets */
+#define ATTRS		5000	/* distinct attribute sets */
+#define PREFIXES	4	/* 10.0.0.0/16 to 10.3.0.0/16 */
+#define ROUNDS		200000
+
+static struct aspath *paths[PATHS];
+static struct community *comms[COMMS];
+static struct attr attrs[ATTRS];
+
+static void
+run_cmd (struct cmd_element *cmd, const char *a0, const char *a1,
+	 const char *a2)
+{
+  const char *argv[3] = { a0, a1, a2 };
+  int argc;
+
+  for (argc = 0; argc < 3 && argv[argc]; argc++)
+    ;
+  if ((*cmd->func) (cmd, vty, argc, argv) != CMD_SUCCESS)
+    {
+      printf ("command %s %s failed\n", cmd->string, a0 ? a0 : "");
+      failed++;
+    }
+}
+
+/* A policy looking at nothing but the attributes, and the same with a
+   prefix-list in the middle. */
+static void
+make_maps (void)
+{
+  const char *names[2] = { "attr", "mixed" };
+  int i;
+
+  run_cmd (&ip_as_path_cmd, "bogons", "permit", "_6449[0-9]_");
+  run_cmd (&ip_community_list_expanded_cmd, "100", "deny", "^645[3-5][0-9]:");
+  run_cmd (&ip_community_list_expanded_cmd, "100", "permit", ":[0-4][0-9]*$");
+  run_cmd (&ip_prefix_list_cmd, "some", "permit", "10.1.0.0/16");
+  run_cmd (&ip_prefix_list_cmd, "some", "permit", "10.2.0.0/16");
+
+  for (i = 0; i < 2; i++)
+    {
+      run_cmd (&route_map_cmd, names[i], "deny", "10");
+      run_cmd (&match_aspath_cmd, "bogons", NULL, NULL);
+
+      run_cmd (&route_map_cmd, names[i], "permit", "20");
+      run_cmd (&match_metric_cmd, "10", NULL, NULL);
+      if (i)
+	run_cmd (&match_ip_address_prefix_list_cmd, "some", NULL, NULL);
+      run_cmd (&set_local_pref_cmd, "200", NULL, NULL);
+      run_cmd (&set_aspath_prepend_cmd, "65000", NULL, NULL);
+
+      run_cmd (&route_map_cmd, names[i], "permit", "30");
+      run_cmd (&match_origin_cmd, "igp", NULL, NULL);
+      run_cmd (&match_community_cmd, "100", NULL, NULL);
+      run_cmd (&set_metric_cmd, "5", NULL, NULL);
+
+      run_cmd (&route_map_cmd, names[i], "permit", "40");
+      run_cmd (&set_community_cmd, "65000:1", NULL, NULL);
+    }
+}
+
+static void
+make_pool (void)
+{
+  char buf[256];
+  int i, j, len, n;
+
+  for (i = 0; i < PATHS; i++)
+    {
+      len = 1 + random () % 6;
+      for (n = j = 0; j < len; j++)
+	n += snprintf (buf + n, sizeof (buf) - n, "%s%ld", j ? " " : "",
+		       64400 + random () % 200);
+      paths[i] = aspath_intern (aspath_str2aspath (buf));
+    }
+
+  for (i = 0; i < COMMS; i++)
+    {
+      snprintf (buf, sizeof (buf), "%ld:%ld", 64512 + random () % 300,
+		random () % 1000);
+      comms[i] = community_intern (community_str2com (buf));
+    }
+}
+
+/* Received attribute sets: interned parts, as bgp_attr_parse() leaves
+   them, each shared by a number of prefixes as in a full table. */
+static void
+make_attrs (void)
+{
+  struct attr *attr;
+  int i;
+
+  for (i = 0; i < ATTRS; i++)
+    {
+      attr = &attrs[i];
+      attr->origin = random () % 3;
+      attr->flag |= ATTR_FLAG_BIT (BGP_ATTR_ORIGIN);
+      attr->aspath = paths[random () % PATHS];
+      attr->flag |= ATTR_FLAG_BIT (BGP_ATTR_AS_PATH);
+      attr->nexthop.s_addr = htonl (0x0a000001 + random () % 4);
+      attr->flag |= ATTR_FLAG_BIT (BGP_ATTR_NEXT_HOP);
+      attr->med = random () % 3 * 10;
+      attr->flag |= ATTR_FLAG_BIT (BGP_ATTR_MULTI_EXIT_DISC);
+      if (random () % 2)
+	{
+	  attr->community = comms[random () % COMMS];
+	  attr->flag |= ATTR_FLAG_BIT (BGP_ATTR_COMMUNITIES);
+	}
+      if (random () % 4 == 0)
+	bgp_attr_extra_get (attr)->weight = 100;
+    }
+}
+
+static void
+random_attr (struct attr *attr)
+{
+  bgp_attr_dup (attr, &attrs[random () % ATTRS]);
+}
+
+static void
+random_prefix (struct prefix *p)
+{
+  char buf[32];
+
+  snprintf (buf, sizeof (buf), "10.%ld.0.0/16", random () % PREFIXES);
+  str2prefix (buf, p);
+}
+
+/* What bgp_update_main() does with the outcome: the interned
+   attributes, or NULL when denied. */
+static struct attr *
+outcome (route_map_result_t ret, struct attr *attr)
+{
+  struct attr *new = NULL;
+
+  if (ret == RMAP_DENYMATCH)
+    bgp_attr_flush (attr);
+  else
+    new = bgp_attr_intern (attr);
+  bgp_attr_extra_free (attr);
+  return new;
+}
+
+/* The memoized and the plain route-map give the same answers. */
+static void
+check_test (const char *name)
+{
+  struct route_map *map = route_map_lookup_by_name (name);
+  struct bgp_info info;
+  struct attr attr, a1, a2;
+  struct attr *r1, *r2;
+  struct prefix p;
+  unsigned long hits = bgp_rmap_memo_stats.hits;
+  int i, fails = failed;
+
+  memset (&info, 0, sizeof (info));
+  for (i = 0; i < ROUNDS / 10; i++)
+    {
+      random_attr (&attr);
+      random_prefix (&p);
+      bgp_attr_dup (&a2, &attr);
+      a1 = attr;
+
+      info.attr = &a1;
+      r1 = outcome (route_map_apply (map, &p, RMAP_BGP, &info), &a1);
+      info.attr = &a2;
+      r2 = outcome (bgp_route_map_apply (map, &p, &info), &a2);
+
+      if (r1 != r2)
+	{
+	  printf ("%s: round %d: memoized outcome differs\n", name, i);
+	  failed++;
+	}
+      if (r1)
+	bgp_attr_unintern (&r1);
+      if (r2)
+	bgp_attr_unintern (&r2);
+    }
+
+  printf ("%s: %lu hits: %s\n", name, bgp_rmap_memo_stats.hits - hits,
+	  fails == failed ? "OK" : "failed");
+}
+
+static void
+bench_test (const char *name)
+{
+  struct route_map *map = route_map_lookup_by_name (name);
+  struct bgp_info info;
+  struct attr attr;
+  struct attr *new;
+  struct prefix p;
+  struct timeval start, end;
+  unsigned long usec[2];
+  route_map_result_t ret;
+  int memo, i;
+
+  memset (&info, 0, sizeof (info));
+  info.attr = &attr;
+  for (memo = 0; memo < 2; memo++)
+    {
+      srandom (2);
+      usec[memo] = 0;
+      for (i = 0; i < ROUNDS; i++)
+	{
+	  random_attr (&attr);
+	  random_prefix (&p);
+
+	  gettimeofday (&start, NULL);
+	  if (memo)
+	    ret = bgp_route_map_apply (map, &p, &info);
+	  else
+	    ret = route_map_apply (map, &p, RMAP_BGP, &info);
+	  gettimeofday (&end, NULL);
+
+	  usec[memo] += (end.tv_sec - start.tv_sec) * 1000000
+			+ (end.tv_usec - start.tv_usec);
+	  if ((new = outcome (ret, &attr)) != NULL)
+	    bgp_attr_unintern (&new);
+	}
+    }
+
+  printf ("%s: %.3f us per route plain, %.3f us memoized\n", name,
+	  (double) usec[0] / ROUNDS, (double) usec[1] / ROUNDS);
+}
+
+int
+main (void)
+{
+  master = thread_master_create ();
+  cmd_init (1);
+  vty = vty_new ();
+  bgp_master_init ();
+  bgp_attr_init ();
+  bgp_clist = community_list_init ();
+  bgp_route_map_init ();
+  prefix_list_init ();
+  as_list_add_hook (bgp_route_map_memo_flush);
+  as_list_delete_hook (bgp_route_map_memo_flush);
+  srandom (1);
+  make_pool ();
+  make_attrs ();
+  make_maps ();
+
+  check_test ("attr");
+  check_test ("mixed");
+
+  /* Changes to the map and to a list it uses are seen. */
+  run_cmd (&route_map_cmd, "attr", "permit", "20");
+  run_cmd (&set_local_pref_cmd, "300", NULL, NULL);
+  run_cmd (&route_map_cmd, "mixed", "permit", "30");
+  run_cmd (&match_metric_cmd, "20", NULL, NULL);
+  run_cmd (&ip_as_path_cmd, "bogons", "permit", "^6440[0-9]_");
+  check_test ("attr");
+  check_test ("mixed");
+
+  bench_test ("attr");
+  bench_test ("mixed");
+
+  bgp_route_map_memo_flush ();
+  printf ("memo entries: %lu\n", bgp_rmap_memo_stats.entries);
+  printf ("failures: %d\n", failed);
+  return failed;
+}
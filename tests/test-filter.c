@@ -0,0 +1,332 @@
+#include <zebra.h>
+
+#include "vty.h"
+#include "command.h"
+#include "prefix.h"
+#include "filter.h"
+
+struct thread_master *master;
+
+extern struct cmd_element access_list_cmd;
+extern struct cmd_element access_list_exact_cmd;
+extern struct cmd_element access_list_standard_cmd;
+extern struct cmd_element access_list_extended_cmd;
+extern struct cmd_element no_access_list_cmd;
+extern struct cmd_element no_access_list_exact_cmd;
+extern struct cmd_element no_access_list_standard_cmd;
+extern struct cmd_element no_access_list_extended_cmd;
+
+#define ENTRIES		20000
+#define ROUTES		200000
+#define SLOW		2000	/* routes checked the slow way */
+#define DELETES		500
+
+static int failed = 0;
+static struct vty *vty;
+
+/* Wildcard bits as found in distribute-lists. */
+static const char *wildcards[] =
+{
+  "0.0.0.0", "0.0.0.255", "0.0.255.255", "0.255.255.255", "0.0.3.255",
+};
+#define WILDCARDS	(int) (sizeof (wildcards) / sizeof (wildcards[0]))
+
+/* The filters as configured, in list order. */
+struct entry
+{
+  int cisco;
+  int extended;
+  int exact;
+  enum filter_type type;
+  struct prefix p;
+  struct in_addr addr, addr_mask, mask, mask_mask;
+  int gone;
+};
+static struct entry entries[ENTRIES + 1];
+static int nentries;
+
+static struct prefix routes[ROUTES];
+
+static void
+random_prefix (struct prefix *p, int len)
+{
+  memset (p, 0, sizeof (struct prefix));
+  p->family = AF_INET;
+  p->prefixlen = len;
+  p->u.prefix4.s_addr = htonl (random () << 8 ^ random ());
+  apply_mask (p);
+}
+
+/* Whether E is the same filter as one configured, which the commands
+   leave alone. */
+static int
+entry_dup (struct entry *e)
+{
+  int i;
+
+  for (i = 0; i < nentries; i++)
+    {
+      struct entry *o = &entries[i];
+
+      if (o->gone || o->cisco != e->cisco || o->type != e->type)
+	continue;
+      if (! e->cisco)
+	{
+	  if (o->exact == e->exact && prefix_same (&o->p, &e->p))
+	    return 1;
+	}
+      else if (o->addr.s_addr == e->addr.s_addr
+	       && o->addr_mask.s_addr == e->addr_mask.s_addr
+	       && (! o->extended
+		   || (o->mask.s_addr == e->mask.s_addr
+		       && o->mask_mask.s_addr == e->mask_mask.s_addr)))
+	return 1;
+    }
+  return 0;
+}
+
+static struct cmd_element *
+entry_argv (struct entry *e, int set, char buf[4][INET_ADDRSTRLEN + 4],
+	    const char *argv[6], int *argc)
+{
+  argv[0] = "10";
+  argv[1] = e->type == FILTER_PERMIT ? "permit" : "deny";
+  if (! e->cisco)
+    {
+      prefix2str (&e->p, buf[0], INET_ADDRSTRLEN + 4);
+      argv[2] = buf[0];
+      *argc = 3;
+      if (e->exact)
+	return set ? &access_list_exact_cmd : &no_access_list_exact_cmd;
+      return set ? &access_list_cmd : &no_access_list_cmd;
+    }
+
+  strcpy (buf[0], inet_ntoa (e->addr));
+  strcpy (buf[1], inet_ntoa (e->addr_mask));
+  argv[2] = buf[0];
+  argv[3] = buf[1];
+  *argc = 4;
+  if (! e->extended)
+    return set ? &access_list_standard_cmd : &no_access_list_standard_cmd;
+
+  strcpy (buf[2], inet_ntoa (e->mask));
+  strcpy (buf[3], inet_ntoa (e->mask_mask));
+  argv[4] = buf[2];
+  argv[5] = buf[3];
+  *argc = 6;
+  return set ? &access_list_extended_cmd : &no_access_list_extended_cmd;
+}
+
+/* A random filter, through the same command as configuration would.
+   Zebra and cisco filters share the list, which only the commands'
+   name ranges keep apart. */
+static void
+add_entry (void)
+{
+  char buf[4][INET_ADDRSTRLEN + 4];
+  const char *argv[6];
+  struct cmd_element *cmd;
+  struct entry *e = &entries[nentries];
+  int kind, argc;
+
+  memset (e, 0, sizeof (struct entry));
+  e->type = random () % 5 ? FILTER_PERMIT : FILTER_DENY;
+  kind = random () % 10;
+  if (kind < 4)
+    {
+      random_prefix (&e->p, 8 + random () % 17);
+      e->exact = random () % 2;
+    }
+  else
+    {
+      e->cisco = 1;
+      e->extended = kind >= 7;
+      inet_aton (wildcards[random () % WILDCARDS], &e->addr_mask);
+      e->addr.s_addr = htonl (random () << 8 ^ random ())
+		       & ~e->addr_mask.s_addr;
+      if (e->extended)
+	{
+	  masklen2ip (8 + random () % 17, &e->mask);
+	  inet_aton (random () % 2 ? "0.0.0.0" : "0.0.0.255", &e->mask_mask);
+	  e->mask.s_addr &= ~e->mask_mask.s_addr;
+	}
+    }
+
+  cmd = entry_argv (e, 1, buf, argv, &argc);
+  if ((*cmd->func) (cmd, vty, argc, argv) != CMD_SUCCESS)
+    {
+      printf ("adding filter %d failed\n", nentries);
+      failed++;
+      return;
+    }
+  if (! entry_dup (e))
+    nentries++;
+}
+
+/* What is left is denied, by a last filter. */
+static void
+add_any (void)
+{
+  const char *argv[4] = { "10", "deny", "0.0.0.0", "255.255.255.255" };
+  struct entry *e = &entries[nentries];
+
+  memset (e, 0, sizeof (struct entry));
+  e->cisco = 1;
+  e->type = FILTER_DENY;
+  e->addr_mask.s_addr = 0xffffffff;
+  if ((*access_list_standard_cmd.func) (&access_list_standard_cmd, vty, 4,
+					argv) != CMD_SUCCESS)
+    failed++;
+  nentries++;
+}
+
+static void
+delete_entry (int i)
+{
+  char buf[4][INET_ADDRSTRLEN + 4];
+  const char *argv[6];
+  struct cmd_element *cmd;
+  int argc;
+
+  if (entries[i].gone)
+    return;
+  cmd = entry_argv (&entries[i], 0, buf, argv, &argc);
+  if ((*cmd->func) (cmd, vty, argc, argv) != CMD_SUCCESS)
+    {
+      printf ("deleting filter %d failed\n", i);
+      failed++;
+    }
+  entries[i].gone = 1;
+}
+
+/* The list walked in order, as access_list_apply() used to. */
+static enum filter_type
+slow_apply (struct prefix *p)
+{
+  struct in_addr mask;
+  int i;
+
+  for (i = 0; i < nentries; i++)
+    {
+      struct entry *e = &entries[i];
+
+      if (e->gone)
+	continue;
+      if (! e->cisco)
+	{
+	  if (e->p.family == p->family && prefix_match (&e->p, p)
+	      && (! e->exact || e->p.prefixlen == p->prefixlen))
+	    return e->type;
+	  continue;
+	}
+      if ((p->u.prefix4.s_addr & ~e->addr_mask.s_addr) != e->addr.s_addr)
+	continue;
+      if (e->extended)
+	{
+	  masklen2ip (p->prefixlen, &mask);
+	  if ((mask.s_addr & ~e->mask_mask.s_addr) != e->mask.s_addr)
+	    continue;
+	}
+      return e->type;
+    }
+  return FILTER_DENY;
+}
+
+/* Routes around the filters, most of them matched by one. */
+static void
+make_routes (void)
+{
+  struct in_addr mask;
+  struct entry *e;
+  int i;
+
+  for (i = 0; i < ROUTES; i++)
+    {
+      e = &entries[random () % nentries];
+      if (random () % 4 == 0)
+	random_prefix (&routes[i], 8 + random () % 25);
+      else if (! e->cisco)
+	{
+	  routes[i] = e->p;
+	  masklen2ip (routes[i].prefixlen, &mask);
+	  routes[i].u.prefix4.s_addr |= htonl (random ()) & ~mask.s_addr;
+	  if (! e->exact)
+	    routes[i].prefixlen += random () % (33 - routes[i].prefixlen);
+	  apply_mask (&routes[i]);
+	}
+      else
+	{
+	  random_prefix (&routes[i], e->extended ? ip_masklen (e->mask)
+			 : 8 + random () % 25);
+	  routes[i].u.prefix4.s_addr = e->addr.s_addr
+	    | (htonl (random ()) & e->addr_mask.s_addr);
+	}
+    }
+}
+
+/* The first SLOW routes against the list walked the slow way, which
+   is timed. */
+static void
+check (struct access_list *access, const char *what)
+{
+  enum filter_type verdict[SLOW];
+  struct timeval start, end;
+  unsigned long usec;
+  int i, fails = failed;
+
+  gettimeofday (&start, NULL);
+  for (i = 0; i < SLOW; i++)
+    verdict[i] = slow_apply (&routes[i]);
+  gettimeofday (&end, NULL);
+  usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+
+  for (i = 0; i < SLOW; i++)
+    if (access_list_apply (access, &routes[i]) != verdict[i])
+      {
+	char buf[INET_ADDRSTRLEN + 4];
+
+	prefix2str (&routes[i], buf, sizeof (buf));
+	printf ("%s: %s: verdict differs\n", what, buf);
+	failed++;
+      }
+
+  printf ("%s: %d routes checked, %.3f us per route walking the list: "
+	  "%s\n", what, SLOW, (double) usec / SLOW,
+	  fails == failed ? "OK" : "failed");
+}
+
+int
+main (void)
+{
+  struct access_list *access;
+  struct timeval start, end;
+  unsigned long usec;
+  int i, permit;
+
+  srandom (1);
+  vty = vty_new ();
+
+  for (i = 0; i < ENTRIES; i++)
+    add_entry ();
+  add_any ();
+  printf ("%d filters\n", nentries);
+
+  access = access_list_lookup (AFI_IP, "10");
+  make_routes ();
+  check (access, "configured");
+
+  gettimeofday (&start, NULL);
+  for (permit = i = 0; i < ROUTES; i++)
+    permit += access_list_apply (access, &routes[i]) == FILTER_PERMIT;
+  gettimeofday (&end, NULL);
+  usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+  printf ("%d routes, %d permitted: %.3f us per route\n", ROUTES, permit,
+	  (double) usec / ROUTES);
+
+  for (i = 0; i < DELETES; i++)
+    delete_entry (random () % (nentries - 1));
+  check (access, "deleted");
+
+  printf ("failures: %d\n", failed);
+  return failed;
+}
@@ -0,0 +1,290 @@
+#include <zebra.h>
+
+#include "vty.h"
+#include "command.h"
+#include "prefix.h"
+#include "plist.h"
+
+struct thread_master *master;
+
+extern struct cmd_element ip_prefix_list_seq_cmd;
+extern struct cmd_element ip_prefix_list_seq_le_cmd;
+extern struct cmd_element ip_prefix_list_seq_ge_le_cmd;
+extern struct cmd_element no_ip_prefix_list_seq_cmd;
+extern struct cmd_element no_ip_prefix_list_seq_ge_cmd;
+extern struct cmd_element no_ip_prefix_list_seq_le_cmd;
+extern struct cmd_element no_ip_prefix_list_seq_ge_le_cmd;
+
+#define ENTRIES		100000	/* an IRR generated customer filter */
+#define ROUTES		500000	/* a full table */
+#define SLOW		2000	/* routes checked the slow way */
+#define DELETES		1000
+
+static int failed = 0;
+static struct vty *vty;
+
+/* The entries as configured, in the order the list is to try them. */
+struct entry
+{
+  struct prefix p;
+  int seq;
+  int ge;
+  int le;
+  enum prefix_list_type type;
+  int gone;
+};
+static struct entry entries[ENTRIES + ENTRIES / 100];
+static int nentries;
+
+static struct prefix routes[ROUTES];
+
+static void
+random_prefix (struct prefix *p, int len)
+{
+  memset (p, 0, sizeof (struct prefix));
+  p->family = AF_INET;
+  p->prefixlen = len;
+  p->u.prefix4.s_addr = htonl (random () << 8 ^ random ());
+  apply_mask (p);
+}
+
+/* One entry with seq SEQ, through the same command as configuration
+   would. */
+static void
+add_entry (int seq)
+{
+  char pstr[INET_ADDRSTRLEN + 4], seqstr[12], gestr[12], lestr[12];
+  const char *argv[6];
+  struct prefix p;
+  int kind, ge, le, argc, ret;
+  enum prefix_list_type type;
+  struct cmd_element *cmd;
+
+  random_prefix (&p, 8 + random () % 17);
+  type = random () % 10 ? PREFIX_PERMIT : PREFIX_DENY;
+  ge = le = 0;
+  kind = random () % 10;
+  if (kind >= 5)
+    le = p.prefixlen + 1 + random () % (32 - p.prefixlen);
+  if (kind >= 8)
+    ge = p.prefixlen + 1 + random () % (le - p.prefixlen);
+
+  prefix2str (&p, pstr, sizeof (pstr));
+  snprintf (seqstr, sizeof (seqstr), "%d", seq);
+  snprintf (gestr, sizeof (gestr), "%d", ge);
+  snprintf (lestr, sizeof (lestr), "%d", le);
+  argv[0] = "test";
+  argv[1] = seqstr;
+  argv[2] = type == PREFIX_PERMIT ? "permit" : "deny";
+  argv[3] = pstr;
+  argc = 4;
+  if (ge)
+    {
+      cmd = &ip_prefix_list_seq_ge_le_cmd;
+      argv[argc++] = gestr;
+      argv[argc++] = lestr;
+    }
+  else if (le)
+    {
+      cmd = &ip_prefix_list_seq_le_cmd;
+      argv[argc++] = lestr;
+    }
+  else
+    cmd = &ip_prefix_list_seq_cmd;
+
+  /* The same entry under another seq is refused. */
+  ret = (*cmd->func) (cmd, vty, argc, argv);
+  if (ret != CMD_SUCCESS)
+    return;
+
+  entries[nentries].p = p;
+  entries[nentries].seq = seq;
+  entries[nentries].ge = ge;
+  entries[nentries].le = le == 32 && ge ? 0 : le;
+  entries[nentries].type = type;
+  nentries++;
+}
+
+static void
+delete_entry (int i)
+{
+  char pstr[INET_ADDRSTRLEN + 4], seqstr[12], gestr[12], lestr[12];
+  const char *argv[6];
+  struct cmd_element *cmd;
+  int argc;
+
+  if (entries[i].gone)
+    return;
+  prefix2str (&entries[i].p, pstr, sizeof (pstr));
+  snprintf (seqstr, sizeof (seqstr), "%d", entries[i].seq);
+  snprintf (gestr, sizeof (gestr), "%d", entries[i].ge);
+  snprintf (lestr, sizeof (lestr), "%d", entries[i].le);
+  argv[0] = "test";
+  argv[1] = seqstr;
+  argv[2] = entries[i].type == PREFIX_PERMIT ? "permit" : "deny";
+  argv[3] = pstr;
+  argc = 4;
+  if (entries[i].ge && entries[i].le)
+    {
+      cmd = &no_ip_prefix_list_seq_ge_le_cmd;
+      argv[argc++] = gestr;
+      argv[argc++] = lestr;
+    }
+  else if (entries[i].ge)
+    {
+      cmd = &no_ip_prefix_list_seq_ge_cmd;
+      argv[argc++] = gestr;
+    }
+  else if (entries[i].le)
+    {
+      cmd = &no_ip_prefix_list_seq_le_cmd;
+      argv[argc++] = lestr;
+    }
+  else
+    cmd = &no_ip_prefix_list_seq_cmd;
+
+  if ((*cmd->func) (cmd, vty, argc, argv) != CMD_SUCCESS)
+    {
+      printf ("deleting seq %d failed\n", entries[i].seq);
+      failed++;
+    }
+  entries[i].gone = 1;
+}
+
+static int
+seq_cmp (const void *a, const void *b)
+{
+  return *(const int *) a - *(const int *) b;
+}
+
+static int
+entry_cmp (const void *a, const void *b)
+{
+  return ((const struct entry *) a)->seq - ((const struct entry *) b)->seq;
+}
+
+/* The list walked in seq order, as prefix_list_apply() used to. */
+static enum prefix_list_type
+slow_apply (struct prefix *p)
+{
+  int i;
+
+  for (i = 0; i < nentries; i++)
+    {
+      if (entries[i].gone || ! prefix_match (&entries[i].p, p))
+	continue;
+      if (! entries[i].le && ! entries[i].ge)
+	{
+	  if (entries[i].p.prefixlen != p->prefixlen)
+	    continue;
+	}
+      else if ((entries[i].le && p->prefixlen > entries[i].le)
+	       || (entries[i].ge && p->prefixlen < entries[i].ge))
+	continue;
+      return entries[i].type;
+    }
+  return PREFIX_DENY;
+}
+
+/* Routes around the entries, most of them covered by one. */
+static void
+make_routes (void)
+{
+  struct in_addr mask;
+  int i, len;
+
+  for (i = 0; i < ROUTES; i++)
+    {
+      if (random () % 4 == 0)
+	{
+	  random_prefix (&routes[i], 8 + random () % 25);
+	  continue;
+	}
+      routes[i] = entries[random () % nentries].p;
+      masklen2ip (routes[i].prefixlen, &mask);
+      routes[i].u.prefix4.s_addr |= htonl (random ()) & ~mask.s_addr;
+      len = routes[i].prefixlen + random () % (33 - routes[i].prefixlen);
+      routes[i].prefixlen = len;
+      apply_mask (&routes[i]);
+    }
+}
+
+/* The first SLOW routes against the list walked the slow way, which
+   is timed. */
+static void
+check (struct prefix_list *plist, const char *what)
+{
+  enum prefix_list_type verdict[SLOW];
+  struct timeval start, end;
+  unsigned long usec;
+  int i, fails = failed;
+
+  gettimeofday (&start, NULL);
+  for (i = 0; i < SLOW; i++)
+    verdict[i] = slow_apply (&routes[i]);
+  gettimeofday (&end, NULL);
+  usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+
+  for (i = 0; i < SLOW; i++)
+    if (prefix_list_apply (plist, &routes[i]) != verdict[i])
+      {
+	char buf[INET_ADDRSTRLEN + 4];
+
+	prefix2str (&routes[i], buf, sizeof (buf));
+	printf ("%s: %s: verdict differs\n", what, buf);
+	failed++;
+      }
+
+  printf ("%s: %d entries, %d routes checked, %.3f us per route "
+	  "walking the list: %s\n", what, plist->count, SLOW,
+	  (double) usec / SLOW, fails == failed ? "OK" : "failed");
+}
+
+int
+main (void)
+{
+  struct prefix_list *plist;
+  struct timeval start, end;
+  unsigned long usec;
+  int seqs[ENTRIES / 100];
+  int i, permit;
+
+  srandom (1);
+  vty = vty_new ();
+
+  /* Written in seq order, then some entries slotted in between. */
+  gettimeofday (&start, NULL);
+  for (i = 0; i < ENTRIES; i++)
+    add_entry ((i + 1) * 5);
+  for (i = 0; i < ENTRIES / 100; i++)
+    seqs[i] = (random () % ENTRIES) * 5 + 1 + random () % 4;
+  qsort (seqs, ENTRIES / 100, sizeof (int), seq_cmp);
+  for (i = 0; i < ENTRIES / 100; i++)
+    if (i == 0 || seqs[i] != seqs[i - 1])
+      add_entry (seqs[i]);
+  gettimeofday (&end, NULL);
+  usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+  printf ("%d entries configured in %.3f s\n", nentries, usec / 1e6);
+
+  /* The reference walk wants them in seq order. */
+  qsort (entries, nentries, sizeof (struct entry), entry_cmp);
+
+  plist = prefix_list_lookup (AFI_IP, "test");
+  make_routes ();
+  check (plist, "configured");
+
+  gettimeofday (&start, NULL);
+  for (permit = i = 0; i < ROUTES; i++)
+    permit += prefix_list_apply (plist, &routes[i]) == PREFIX_PERMIT;
+  gettimeofday (&end, NULL);
+  usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+  printf ("%d routes, %d permitted: %.3f us per route\n", ROUTES, permit,
+	  (double) usec / ROUTES);
+
+  for (i = 0; i < DELETES; i++)
+    delete_entry (random () % (nentries - 1));
+  check (plist, "deleted");
+
+  printf ("failures: %d\n", failed);
+  return failed;
+}
@@ -39,6 +39,8 @@
 #include "zebra/router-id.h"
 #include "zebra/irdp.h"
 #include "zebra/rtadv.h"
+#include "zebra/zebra_prof.h"
+#include "zebra/zebra_rnh.h"
 
 /* Zebra instance */
 struct zebra_t zebrad =
@@ -58,6 +60,9 @@ int retain_mode = 0;
 /* Don't delete kernel route. */
 int keep_kernel_mode = 0;
 
+/* Keep kernel routes as stale for this many seconds on startup. */
+long graceful_restart_time = 0;
+
 #ifdef HAVE_NETLINK
 /* Receive buffer size for netlink socket */
 u_int32_t nl_rcvbufsize = 0;
@@ -69,6 +74,7 @@ struct option longopts[] =
   { "batch",       no_argument,       NULL, 'b'},
   { "daemon",      no_argument,       NULL, 'd'},
   { "keep_kernel", no_argument,       NULL, 'k'},
+  { "graceful_restart", required_argument, NULL, 'K'},
   { "config_file", required_argument, NULL, 'f'},
   { "pid_file",    required_argument, NULL, 'i'},
   { "help",        no_argument,       NULL, 'h'},
@@ -130,6 +136,11 @@ usage (char *progname, int status)
 	      "-i, --pid_file     Set process identifier file name\n"\
 	      "-k, --keep_kernel  Don't delete old routes which installed by "\
 				  "zebra.\n"\
+	      "-K, --graceful_restart TIME\n"\
+	      "                   Keep old routes which installed by zebra "\
+				  "until\n"\
+	      "                   re-announced, sweep the rest after TIME "\
+				  "seconds.\n"\
 	      "-C, --dryrun       Check configuration for validity and exit\n"\
 	      "-A, --vty_addr     Set vty's bind address\n"\
 	      "-P, --vty_port     Set vty's port number\n"\
@@ -229,9 +240,9 @@ main (int argc, char **argv)
       int opt;
   
 #ifdef HAVE_NETLINK  
-      opt = getopt_long (argc, argv, "bdkf:i:hA:P:ru:g:vs:C", longopts, 0);
+      opt = getopt_long (argc, argv, "bdkK:f:i:hA:P:ru:g:vs:C", longopts, 0);
 #else
-      opt = getopt_long (argc, argv, "bdkf:i:hA:P:ru:g:vC", longopts, 0);
+      opt = getopt_long (argc, argv, "bdkK:f:i:hA:P:ru:g:vC", longopts, 0);
 #endif /* HAVE_NETLINK */
 
       if (opt == EOF)
@@ -249,6 +260,11 @@ main (int argc, char **argv)
 	case 'k':
 	  keep_kernel_mode = 1;
 	  break;
+	case 'K':
+	  graceful_restart_time = atol (optarg);
+	  if (graceful_restart_time <= 0)
+	    usage (progname, 1);
+	  break;
 	case 'C':
 	  dryrun = 1;
 	  break;
@@ -317,6 +333,8 @@ main (int argc, char **argv)
   rib_init ();
   zebra_if_init ();
   zebra_debug_init ();
+  zebra_prof_init ();
+  zebra_rnh_init ();
   router_id_init();
   zebra_vty_init ();
   access_list_init ();
@@ -379,7 +397,9 @@ main (int argc, char **argv)
   *  will be equal to the current getpid(). To know about such routes,
   * we have to have route_read() called before.
   */
-  if (! keep_kernel_mode)
+  if (graceful_restart_time)
+    rib_sweep_defer (graceful_restart_time);
+  else if (! keep_kernel_mode)
     rib_sweep_route ();
 
   /* Needed for BSD routing socket. */
@@ -109,7 +109,8 @@ zebra_redistribute_default (struct zserv *client)
 	{
 	  for (newrib = rn->info; newrib; newrib = newrib->next)
 	    if (CHECK_FLAG (newrib->flags, ZEBRA_FLAG_SELECTED)
-		&& newrib->distance != DISTANCE_INFINITY)
+		&& newrib->distance != DISTANCE_INFINITY
+		&& ! CHECK_FLAG (newrib->status, RIB_ENTRY_STALE))
 	      zsend_route_multipath (ZEBRA_IPV4_ROUTE_ADD, client, &rn->p, newrib);
 	  route_unlock_node (rn);
 	}
@@ -129,7 +130,8 @@ zebra_redistribute_default (struct zserv *client)
 	{
 	  for (newrib = rn->info; newrib; newrib = newrib->next)
 	    if (CHECK_FLAG (newrib->flags, ZEBRA_FLAG_SELECTED)
-		&& newrib->distance != DISTANCE_INFINITY)
+		&& newrib->distance != DISTANCE_INFINITY
+		&& ! CHECK_FLAG (newrib->status, RIB_ENTRY_STALE))
 	      zsend_route_multipath (ZEBRA_IPV6_ROUTE_ADD, client, &rn->p, newrib);
 	  route_unlock_node (rn);
 	}
@@ -152,6 +154,7 @@ zebra_redistribute (struct zserv *client, int type)
 	if (CHECK_FLAG (newrib->flags, ZEBRA_FLAG_SELECTED) 
 	    && newrib->type == type 
 	    && newrib->distance != DISTANCE_INFINITY
+	    && ! CHECK_FLAG (newrib->status, RIB_ENTRY_STALE)
 	    && zebra_check_addr (&rn->p))
 	  zsend_route_multipath (ZEBRA_IPV4_ROUTE_ADD, client, &rn->p, newrib);
   
@@ -163,6 +166,7 @@ zebra_redistribute (struct zserv *client, int type)
 	if (CHECK_FLAG (newrib->flags, ZEBRA_FLAG_SELECTED)
 	    && newrib->type == type 
 	    && newrib->distance != DISTANCE_INFINITY
+	    && ! CHECK_FLAG (newrib->status, RIB_ENTRY_STALE)
 	    && zebra_check_addr (&rn->p))
 	  zsend_route_multipath (ZEBRA_IPV6_ROUTE_ADD, client, &rn->p, newrib);
 #endif /* HAVE_IPV6 */
@@ -174,6 +178,10 @@ redistribute_add (struct prefix *p, struct rib *rib)
   struct listnode *node, *nnode;
   struct zserv *client;
 
+  /* Stale routes from a previous instance are not announced. */
+  if (CHECK_FLAG (rib->status, RIB_ENTRY_STALE))
+    return;
+
   for (ALL_LIST_ELEMENTS (zebrad.client_list, node, nnode, client))
     {
       if (is_default (p))
@@ -181,20 +189,20 @@ redistribute_add (struct prefix *p, struct rib *rib)
           if (client->redist_default || client->redist[rib->type])
             {
               if (p->family == AF_INET)
-                zsend_route_multipath (ZEBRA_IPV4_ROUTE_ADD, client, p, rib);
+                zsend_redistribute_route (ZEBRA_IPV4_ROUTE_ADD, client, p, rib);
 #ifdef HAVE_IPV6
               if (p->family == AF_INET6)
-                zsend_route_multipath (ZEBRA_IPV6_ROUTE_ADD, client, p, rib);
+                zsend_redistribute_route (ZEBRA_IPV6_ROUTE_ADD, client, p, rib);
 #endif /* HAVE_IPV6 */	  
 	    }
         }
       else if (client->redist[rib->type])
         {
           if (p->family == AF_INET)
-            zsend_route_multipath (ZEBRA_IPV4_ROUTE_ADD, client, p, rib);
+            zsend_redistribute_route (ZEBRA_IPV4_ROUTE_ADD, client, p, rib);
 #ifdef HAVE_IPV6
           if (p->family == AF_INET6)
-            zsend_route_multipath (ZEBRA_IPV6_ROUTE_ADD, client, p, rib);
+            zsend_redistribute_route (ZEBRA_IPV6_ROUTE_ADD, client, p, rib);
 #endif /* HAVE_IPV6 */	  
         }
     }
@@ -210,6 +218,9 @@ redistribute_delete (struct prefix *p, struct rib *rib)
   if (rib->distance == DISTANCE_INFINITY)
     return;
 
+  if (CHECK_FLAG (rib->status, RIB_ENTRY_STALE))
+    return;
+
   for (ALL_LIST_ELEMENTS (zebrad.client_list, node, nnode, client))
     {
       if (is_default (p))
@@ -217,22 +228,22 @@ redistribute_delete (struct prefix *p, struct rib *rib)
 	  if (client->redist_default || client->redist[rib->type])
 	    {
 	      if (p->family == AF_INET)
-		zsend_route_multipath (ZEBRA_IPV4_ROUTE_DELETE, client, p,
-				       rib);
+		zsend_redistribute_route (ZEBRA_IPV4_ROUTE_DELETE, client, p,
+					  rib);
 #ifdef HAVE_IPV6
 	      if (p->family == AF_INET6)
-		zsend_route_multipath (ZEBRA_IPV6_ROUTE_DELETE, client, p,
-				       rib);
+		zsend_redistribute_route (ZEBRA_IPV6_ROUTE_DELETE, client, p,
+					  rib);
 #endif /* HAVE_IPV6 */
 	    }
 	}
       else if (client->redist[rib->type])
 	{
 	  if (p->family == AF_INET)
-	    zsend_route_multipath (ZEBRA_IPV4_ROUTE_DELETE, client, p, rib);
+	    zsend_redistribute_route (ZEBRA_IPV4_ROUTE_DELETE, client, p, rib);
 #ifdef HAVE_IPV6
 	  if (p->family == AF_INET6)
-	    zsend_route_multipath (ZEBRA_IPV6_ROUTE_DELETE, client, p, rib);
+	    zsend_redistribute_route (ZEBRA_IPV6_ROUTE_DELETE, client, p, rib);
 #endif /* HAVE_IPV6 */
 	}
     }
@@ -284,6 +295,7 @@ zebra_redistribute_delete (int command, struct zserv *client, int length)
     case ZEBRA_ROUTE_OSPF6:
     case ZEBRA_ROUTE_BGP:
       client->redist[type] = 0;
+      zserv_redist_purge (client, type);
       break;
     default:
       break;
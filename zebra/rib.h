@@ -76,6 +76,8 @@ struct rib
   /* RIB internal status */
   u_char status;
 #define RIB_ENTRY_REMOVED	(1 << 0)
+#define RIB_ENTRY_STALE		(1 << 1)
+#define RIB_ENTRY_REPLACE	(1 << 2) /* install over the stale route */
 
   /* Nexthop information. */
   u_char nexthop_num;
@@ -264,6 +266,7 @@ extern struct rib *rib_lookup_ipv4 (struct prefix_ipv4 *);
 extern void rib_update (void);
 extern void rib_weed_tables (void);
 extern void rib_sweep_route (void);
+extern void rib_sweep_defer (long);
 extern void rib_close (void);
 extern void rib_init (void);
 
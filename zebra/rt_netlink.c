@@ -35,6 +35,7 @@
 #include "rib.h"
 #include "thread.h"
 #include "privs.h"
+#include "memory.h"
 
 #include "zebra/zserv.h"
 #include "zebra/rt.h"
@@ -268,6 +269,163 @@ netlink_request (int family, int type, struct nlsock *nl)
   return 0;
 }
 
+/* Receive buffer shared by all netlink sockets.  It starts large, as
+   the kernel sizes dump datagrams after the reader's buffer, and is
+   grown whenever netlink_recv() peeks at a bigger datagram. */
+#define NL_PKT_BUF_SIZE 32768
+static char *nl_rcvbuf = NULL;
+static size_t nl_rcvbuf_size = 0;
+
+/* Counters of what netlink_parse_info() received, used to report the
+   throughput of the startup dumps. */
+static struct
+{
+  unsigned long datagrams;
+  unsigned long messages;
+  unsigned long bytes;
+} nl_dump_stats;
+
+/* Receive the next datagram from NL into nl_rcvbuf, growing the buffer
+   first if the datagram would not fit.  Returns as recvmsg(). */
+static int
+netlink_recv (struct nlsock *nl, struct msghdr *msg, struct iovec *iov)
+{
+  int status;
+
+  /* A zero length peek with MSG_TRUNC returns the real datagram size. */
+  iov->iov_base = nl_rcvbuf;
+  iov->iov_len = 0;
+  status = recvmsg (nl->sock, msg, MSG_PEEK | MSG_TRUNC);
+  if (status < 0)
+    return status;
+
+  if ((size_t) status > nl_rcvbuf_size || nl_rcvbuf == NULL)
+    {
+      nl_rcvbuf_size = MAX ((size_t) status, NL_PKT_BUF_SIZE);
+      nl_rcvbuf = XREALLOC (MTYPE_TMP, nl_rcvbuf, nl_rcvbuf_size);
+      if (IS_ZEBRA_DEBUG_KERNEL)
+	zlog_debug ("%s: receive buffer grown to %lu bytes", nl->name,
+		    (u_long) nl_rcvbuf_size);
+    }
+
+  iov->iov_base = nl_rcvbuf;
+  iov->iov_len = nl_rcvbuf_size;
+  msg->msg_namelen = sizeof (struct sockaddr_nl);
+  return recvmsg (nl->sock, msg, 0);
+}
+
+/* Pass the STATUS bytes of netlink messages in BUF to FILTER.  Returns
+   1 once the reply is complete, with the result for the caller stored
+   in *RET, or 0 if more datagrams are to be read. */
+static int
+netlink_parse_buf (int (*filter) (struct sockaddr_nl *, struct nlmsghdr *),
+                   struct nlsock *nl, struct sockaddr_nl *snl, char *buf,
+                   int status, int *ret)
+{
+  int error;
+  struct nlmsghdr *h;
+
+  for (h = (struct nlmsghdr *) buf; NLMSG_OK (h, (unsigned int) status);
+       h = NLMSG_NEXT (h, status))
+    {
+      /* Finish of reading. */
+      if (h->nlmsg_type == NLMSG_DONE)
+        return 1;
+
+      /* Error handling. */
+      if (h->nlmsg_type == NLMSG_ERROR)
+        {
+          struct nlmsgerr *err = (struct nlmsgerr *) NLMSG_DATA (h);
+          int errnum = err->error;
+          int msg_type = err->msg.nlmsg_type;
+
+          /* If the error field is zero, then this is an ACK */
+          if (err->error == 0)
+            {
+              if (IS_ZEBRA_DEBUG_KERNEL)
+                {
+                  zlog_debug ("%s: %s ACK: type=%s(%u), seq=%u, pid=%u",
+                             __FUNCTION__, nl->name,
+                             lookup (nlmsg_str, err->msg.nlmsg_type),
+                             err->msg.nlmsg_type, err->msg.nlmsg_seq,
+                             err->msg.nlmsg_pid);
+                }
+
+              /* return if not a multipart message, otherwise continue */
+              if (!(h->nlmsg_flags & NLM_F_MULTI))
+                {
+                  *ret = 0;
+                  return 1;
+                }
+              continue;
+            }
+
+          if (h->nlmsg_len < NLMSG_LENGTH (sizeof (struct nlmsgerr)))
+            {
+              zlog (NULL, LOG_ERR, "%s error: message truncated",
+                    nl->name);
+              *ret = -1;
+              return 1;
+            }
+
+          /* Deal with errors that occur because of races in link handling */
+          if (nl == &netlink_cmd
+              && ((msg_type == RTM_DELROUTE &&
+                   (-errnum == ENODEV || -errnum == ESRCH))
+                  || (msg_type == RTM_NEWROUTE && -errnum == EEXIST)))
+            {
+              if (IS_ZEBRA_DEBUG_KERNEL)
+                zlog_debug ("%s: error: %s type=%s(%u), seq=%u, pid=%u",
+                            nl->name, safe_strerror (-errnum),
+                            lookup (nlmsg_str, msg_type),
+                            msg_type, err->msg.nlmsg_seq, err->msg.nlmsg_pid);
+              *ret = 0;
+              return 1;
+            }
+
+          zlog_err ("%s error: %s, type=%s(%u), seq=%u, pid=%u",
+                    nl->name, safe_strerror (-errnum),
+                    lookup (nlmsg_str, msg_type),
+                    msg_type, err->msg.nlmsg_seq, err->msg.nlmsg_pid);
+          *ret = -1;
+          return 1;
+        }
+
+      /* OK we got netlink message. */
+      if (IS_ZEBRA_DEBUG_KERNEL)
+        zlog_debug ("netlink_parse_info: %s type %s(%u), seq=%u, pid=%u",
+                   nl->name,
+                   lookup (nlmsg_str, h->nlmsg_type), h->nlmsg_type,
+                   h->nlmsg_seq, h->nlmsg_pid);
+
+      /* skip unsolicited messages originating from command socket */
+      if (nl != &netlink_cmd && h->nlmsg_pid == netlink_cmd.snl.nl_pid)
+        {
+          if (IS_ZEBRA_DEBUG_KERNEL)
+            zlog_debug ("netlink_parse_info: %s packet comes from %s",
+                        netlink_cmd.name, nl->name);
+          continue;
+        }
+
+      nl_dump_stats.messages++;
+      error = (*filter) (snl, h);
+      if (error < 0)
+        {
+          zlog (NULL, LOG_ERR, "%s filter function error", nl->name);
+          *ret = error;
+        }
+    }
+
+  if (status)
+    {
+      zlog (NULL, LOG_ERR, "%s error: data remnant size %d", nl->name,
+            status);
+      *ret = -1;
+      return 1;
+    }
+  return 0;
+}
+
 /* Receive message from netlink interface and pass those information
    to the given function. */
 static int
@@ -276,17 +434,14 @@ netlink_parse_info (int (*filter) (struct sockaddr_nl *, struct nlmsghdr *),
 {
   int status;
   int ret = 0;
-  int error;
 
   while (1)
     {
-      char buf[4096];
-      struct iovec iov = { buf, sizeof buf };
+      struct iovec iov;
       struct sockaddr_nl snl;
       struct msghdr msg = { (void *) &snl, sizeof snl, &iov, 1, NULL, 0, 0 };
-      struct nlmsghdr *h;
 
-      status = recvmsg (nl->sock, &msg, 0);
+      status = netlink_recv (nl, &msg, &iov);
       if (status < 0)
         {
           if (errno == EINTR)
@@ -310,109 +465,50 @@ netlink_parse_info (int (*filter) (struct sockaddr_nl *, struct nlmsghdr *),
                 nl->name, msg.msg_namelen);
           return -1;
         }
-      
-      for (h = (struct nlmsghdr *) buf; NLMSG_OK (h, (unsigned int) status);
-           h = NLMSG_NEXT (h, status))
-        {
-          /* Finish of reading. */
-          if (h->nlmsg_type == NLMSG_DONE)
-            return ret;
-
-          /* Error handling. */
-          if (h->nlmsg_type == NLMSG_ERROR)
-            {
-              struct nlmsgerr *err = (struct nlmsgerr *) NLMSG_DATA (h);
-	      int errnum = err->error;
-	      int msg_type = err->msg.nlmsg_type;
-
-              /* If the error field is zero, then this is an ACK */
-              if (err->error == 0)
-                {
-                  if (IS_ZEBRA_DEBUG_KERNEL)
-                    {
-                      zlog_debug ("%s: %s ACK: type=%s(%u), seq=%u, pid=%u",
-                                 __FUNCTION__, nl->name,
-                                 lookup (nlmsg_str, err->msg.nlmsg_type),
-                                 err->msg.nlmsg_type, err->msg.nlmsg_seq,
-                                 err->msg.nlmsg_pid);
-                    }
-
-                  /* return if not a multipart message, otherwise continue */
-                  if (!(h->nlmsg_flags & NLM_F_MULTI))
-                    {
-                      return 0;
-                    }
-                  continue;
-                }
-
-              if (h->nlmsg_len < NLMSG_LENGTH (sizeof (struct nlmsgerr)))
-                {
-                  zlog (NULL, LOG_ERR, "%s error: message truncated",
-                        nl->name);
-                  return -1;
-                }
 
-              /* Deal with errors that occur because of races in link handling */
-	      if (nl == &netlink_cmd
-		  && ((msg_type == RTM_DELROUTE &&
-		       (-errnum == ENODEV || -errnum == ESRCH))
-		      || (msg_type == RTM_NEWROUTE && -errnum == EEXIST)))
-		{
-		  if (IS_ZEBRA_DEBUG_KERNEL)
-		    zlog_debug ("%s: error: %s type=%s(%u), seq=%u, pid=%u",
-				nl->name, safe_strerror (-errnum),
-				lookup (nlmsg_str, msg_type),
-				msg_type, err->msg.nlmsg_seq, err->msg.nlmsg_pid);
-		  return 0;
-		}
-
-	      zlog_err ("%s error: %s, type=%s(%u), seq=%u, pid=%u",
-			nl->name, safe_strerror (-errnum),
-			lookup (nlmsg_str, msg_type),
-			msg_type, err->msg.nlmsg_seq, err->msg.nlmsg_pid);
-              return -1;
-            }
-
-          /* OK we got netlink message. */
-          if (IS_ZEBRA_DEBUG_KERNEL)
-            zlog_debug ("netlink_parse_info: %s type %s(%u), seq=%u, pid=%u",
-                       nl->name,
-                       lookup (nlmsg_str, h->nlmsg_type), h->nlmsg_type,
-                       h->nlmsg_seq, h->nlmsg_pid);
-
-          /* skip unsolicited messages originating from command socket */
-          if (nl != &netlink_cmd && h->nlmsg_pid == netlink_cmd.snl.nl_pid)
-            {
-              if (IS_ZEBRA_DEBUG_KERNEL)
-                zlog_debug ("netlink_parse_info: %s packet comes from %s",
-                            netlink_cmd.name, nl->name);
-              continue;
-            }
-
-          error = (*filter) (&snl, h);
-          if (error < 0)
-            {
-              zlog (NULL, LOG_ERR, "%s filter function error", nl->name);
-              ret = error;
-            }
-        }
-
-      /* After error care. */
+      /* Cannot happen as the buffer was sized by peeking, but a cut off
+         datagram must not be parsed. */
       if (msg.msg_flags & MSG_TRUNC)
         {
           zlog (NULL, LOG_ERR, "%s error: message truncated", nl->name);
           continue;
         }
-      if (status)
-        {
-          zlog (NULL, LOG_ERR, "%s error: data remnant size %d", nl->name,
-                status);
-          return -1;
-        }
+
+      nl_dump_stats.datagrams++;
+      nl_dump_stats.bytes += status;
+
+      if (netlink_parse_buf (filter, nl, &snl, nl_rcvbuf, status, &ret))
+        return ret;
     }
   return ret;
 }
 
+/* Reset the dump counters and note the time a dump is started. */
+static void
+netlink_dump_start (struct timeval *start)
+{
+  memset (&nl_dump_stats, 0, sizeof (nl_dump_stats));
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, start);
+}
+
+/* Log how much and how fast WHAT was read since netlink_dump_start(). */
+static void
+netlink_dump_finish (const char *what, struct timeval *start)
+{
+  struct timeval now;
+  double secs;
+
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, &now);
+  secs = (now.tv_sec - start->tv_sec)
+         + (now.tv_usec - start->tv_usec) / 1000000.0;
+
+  zlog_info ("%s: %lu messages, %lu bytes in %lu datagrams, "
+             "%.3f seconds (%.0f messages/s)", what,
+             nl_dump_stats.messages, nl_dump_stats.bytes,
+             nl_dump_stats.datagrams, secs,
+             secs > 0 ? nl_dump_stats.messages / secs : 0);
+}
+
 /* Utility function for parse rtattr. */
 static void
 netlink_parse_rtattr (struct rtattr **tb, int max, struct rtattr *rta,
@@ -639,13 +735,16 @@ netlink_interface_addr (struct sockaddr_nl *snl, struct nlmsghdr *h)
   return 0;
 }
 
-/* Looking up routing table by netlink interface. */
+/* Looking up routing table by netlink interface.  This runs once per
+   route of the startup dump, so rather than collecting every attribute
+   into a cleared tb[] array the few that are used are picked up while
+   walking the attributes in place. */
 static int
 netlink_routing_table (struct sockaddr_nl *snl, struct nlmsghdr *h)
 {
   int len;
   struct rtmsg *rtm;
-  struct rtattr *tb[RTA_MAX + 1];
+  struct rtattr *rta;
   u_char flags = 0;
 
   char anyaddr[16] = { 0 };
@@ -675,9 +774,6 @@ netlink_routing_table (struct sockaddr_nl *snl, struct nlmsghdr *h)
   if (len < 0)
     return -1;
 
-  memset (tb, 0, sizeof tb);
-  netlink_parse_rtattr (tb, RTA_MAX, RTM_RTA (rtm), len);
-
   if (rtm->rtm_flags & RTM_F_CLONED)
     return 0;
   if (rtm->rtm_protocol == RTPROT_REDIRECT)
@@ -694,27 +790,30 @@ netlink_routing_table (struct sockaddr_nl *snl, struct nlmsghdr *h)
 
   index = 0;
   metric = 0;
-  dest = NULL;
+  dest = anyaddr;
   gate = NULL;
   src = NULL;
 
-  if (tb[RTA_OIF])
-    index = *(int *) RTA_DATA (tb[RTA_OIF]);
-
-  if (tb[RTA_DST])
-    dest = RTA_DATA (tb[RTA_DST]);
-  else
-    dest = anyaddr;
-
-  if (tb[RTA_PREFSRC])
-    src = RTA_DATA (tb[RTA_PREFSRC]);
-
   /* Multipath treatment is needed. */
-  if (tb[RTA_GATEWAY])
-    gate = RTA_DATA (tb[RTA_GATEWAY]);
-
-  if (tb[RTA_PRIORITY])
-    metric = *(int *) RTA_DATA(tb[RTA_PRIORITY]);
+  for (rta = RTM_RTA (rtm); RTA_OK (rta, len); rta = RTA_NEXT (rta, len))
+    switch (rta->rta_type)
+      {
+      case RTA_OIF:
+	index = *(int *) RTA_DATA (rta);
+	break;
+      case RTA_DST:
+	dest = RTA_DATA (rta);
+	break;
+      case RTA_PREFSRC:
+	src = RTA_DATA (rta);
+	break;
+      case RTA_GATEWAY:
+	gate = RTA_DATA (rta);
+	break;
+      case RTA_PRIORITY:
+	metric = *(int *) RTA_DATA (rta);
+	break;
+      }
 
   if (rtm->rtm_family == AF_INET)
     {
@@ -1047,6 +1146,9 @@ int
 interface_lookup_netlink (void)
 {
   int ret;
+  struct timeval start;
+
+  netlink_dump_start (&start);
 
   /* Get interface information. */
   ret = netlink_request (AF_PACKET, RTM_GETLINK, &netlink_cmd);
@@ -1074,6 +1176,7 @@ interface_lookup_netlink (void)
     return ret;
 #endif /* HAVE_IPV6 */
 
+  netlink_dump_finish ("interface dump", &start);
   return 0;
 }
 
@@ -1083,6 +1186,9 @@ int
 netlink_route_read (void)
 {
   int ret;
+  struct timeval start;
+
+  netlink_dump_start (&start);
 
   /* Get IPv4 routing table. */
   ret = netlink_request (AF_INET, RTM_GETROUTE, &netlink_cmd);
@@ -1102,9 +1208,68 @@ netlink_route_read (void)
     return ret;
 #endif /* HAVE_IPV6 */
 
+  netlink_dump_finish ("route dump", &start);
   return 0;
 }
 
+/* Magic number "ip route save" puts in front of the netlink messages. */
+#define NL_ROUTE_SAVE_MAGIC 0x45311224
+
+/* Replay a captured route dump, i.e. the raw RTM_NEWROUTE messages as
+   written by "ip route save", through the same parser as
+   netlink_route_read().  Used by the testnetlink harness to measure
+   startup parsing without needing a kernel full of routes. */
+int
+netlink_route_read_file (const char *path)
+{
+  FILE *fp;
+  char *buf;
+  size_t size, len;
+  int ret = 0;
+  struct sockaddr_nl snl;
+  struct timeval start;
+
+  if ((fp = fopen (path, "r")) == NULL)
+    {
+      zlog_err ("%s: can't open %s: %s", __func__, path,
+		safe_strerror (errno));
+      return -1;
+    }
+
+  /* Slurp the file: a message may not span two reads. */
+  size = NL_PKT_BUF_SIZE;
+  buf = XMALLOC (MTYPE_TMP, size);
+  len = 0;
+  while (! feof (fp) && ! ferror (fp))
+    {
+      if (len == size)
+	buf = XREALLOC (MTYPE_TMP, buf, size *= 2);
+      len += fread (buf + len, 1, size - len, fp);
+    }
+  fclose (fp);
+
+  memset (&snl, 0, sizeof snl);
+  snl.nl_family = AF_NETLINK;
+
+  netlink_dump_start (&start);
+  nl_dump_stats.datagrams = 1;
+  nl_dump_stats.bytes = len;
+
+  if (len >= sizeof (u_int32_t)
+      && *(u_int32_t *) buf == NL_ROUTE_SAVE_MAGIC)
+    netlink_parse_buf (netlink_routing_table, &netlink_cmd, &snl,
+		       buf + sizeof (u_int32_t), len - sizeof (u_int32_t),
+		       &ret);
+  else
+    netlink_parse_buf (netlink_routing_table, &netlink_cmd, &snl,
+		       buf, len, &ret);
+
+  netlink_dump_finish (path, &start);
+
+  XFREE (MTYPE_TMP, buf);
+  return ret;
+}
+
 /* Utility function  comes from iproute2. 
    Authors:	Alexey Kuznetsov, <kuznet@ms2.inr.ac.ru> */
 static int
@@ -1323,6 +1488,11 @@ netlink_route_multipath (int cmd, struct prefix *p, struct rib *rib,
   req.n.nlmsg_type = cmd;
   req.r.rtm_family = family;
   req.r.rtm_table = rib->table;
+
+  /* Overwrite the stale route with the same key left behind by a
+   * previous zebra instance, rather than failing with EEXIST. */
+  if (cmd == RTM_NEWROUTE && CHECK_FLAG (rib->status, RIB_ENTRY_REPLACE))
+    req.n.nlmsg_flags |= NLM_F_REPLACE;
   req.r.rtm_dst_len = p->prefixlen;
   req.r.rtm_protocol = RTPROT_ZEBRA;
   req.r.rtm_scope = RT_SCOPE_UNIVERSE;
@@ -0,0 +1,118 @@
+/* Netlink route dump replay harness.
+ *
+ * This file is part of Quagga.
+ *
+ * Quagga is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Quagga is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Quagga; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+/*
+ * Feeds captured route dumps through zebra's startup netlink parser and
+ * into the RIB, then reports the parse throughput and the resulting
+ * table size.  A dump is captured on a box with a full table with:
+ *
+ *   ip route save table all > dump
+ *
+ * and replayed with:
+ *
+ *   testnetlink dump [dump...]
+ */
+
+#include <zebra.h>
+
+#include "command.h"
+#include "thread.h"
+#include "memory.h"
+#include "prefix.h"
+#include "table.h"
+#include "log.h"
+#include "privs.h"
+
+#include "zebra/rib.h"
+#include "zebra/zserv.h"
+#include "zebra/debug.h"
+#include "zebra/rt.h"
+
+/* Zebra instance */
+struct zebra_t zebrad =
+{
+  .rtm_table_default = 0,
+};
+
+/* process id. */
+pid_t pid;
+
+/* Pacify zclient.o in libzebra, which expects this variable. */
+struct thread_master *master;
+
+/* Used by rt_netlink.c; the harness never talks to the kernel. */
+u_int32_t nl_rcvbufsize = 0;
+struct zebra_privs_t zserv_privs;
+
+/* Count the routes in the IPv4 or IPv6 unicast RIB. */
+static unsigned long
+rib_count (afi_t afi)
+{
+  struct route_table *table;
+  struct route_node *rn;
+  struct rib *rib;
+  unsigned long count = 0;
+
+  if ((table = vrf_table (afi, SAFI_UNICAST, 0)) == NULL)
+    return 0;
+
+  for (rn = route_top (table); rn; rn = route_next (rn))
+    for (rib = rn->info; rib; rib = rib->next)
+      count++;
+  return count;
+}
+
+int
+main (int argc, char **argv)
+{
+  int i;
+  int fails = 0;
+
+  if (argc < 2)
+    {
+      fprintf (stderr, "Usage: %s DUMP-FILE...\n", argv[0]);
+      exit (1);
+    }
+
+  zlog_default = openzlog ("testnetlink", ZLOG_ZEBRA,
+			   LOG_CONS|LOG_NDELAY|LOG_PID, LOG_DAEMON);
+  zlog_set_level (NULL, ZLOG_DEST_SYSLOG, ZLOG_DISABLED);
+  zlog_set_level (NULL, ZLOG_DEST_STDOUT, LOG_INFO);
+
+  zebrad.master = thread_master_create ();
+  master = zebrad.master;
+  cmd_init (1);
+  memory_init ();
+  if_init ();
+  zebra_debug_init ();
+  rib_init ();
+
+  for (i = 1; i < argc; i++)
+    if (netlink_route_read_file (argv[i]) < 0)
+      {
+	printf ("%s: parse failed\n", argv[i]);
+	fails++;
+      }
+
+  printf ("RIB: %lu IPv4 routes, %lu IPv6 routes\n",
+	  rib_count (AFI_IP), rib_count (AFI_IP6));
+
+  return fails ? 1 : 0;
+}
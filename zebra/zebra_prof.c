@@ -0,0 +1,381 @@
+/*
+ * Zebra RIB convergence profiler.
+ *
+ * This file is part of Quagga routing suite.
+ *
+ * Quagga is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Quagga is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Zebra; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+/*
+ * With "debug zebra convergence" on, every route change is timestamped
+ * as it crosses the stages in enum zebra_prof_stage.  The events go to a
+ * fixed size ring, which "dump zebra convergence" writes out for offline
+ * analysis, and the time spent between consecutive stages is accumulated
+ * into the histograms shown by "show zebra convergence".
+ *
+ * zread, rib_addnode and rib_queue_add run back to back for a route, as
+ * do rib_process and the kernel writes it issues, so those intervals are
+ * measured against the previous event.  The wait on the RIB work queue is
+ * not, and the time a node was queued at is kept in a hash keyed by the
+ * route_node until rib_process picks it up.
+ */
+
+#include <zebra.h>
+
+#include "command.h"
+#include "memory.h"
+#include "hash.h"
+#include "prefix.h"
+#include "table.h"
+#include "thread.h"
+#include "log.h"
+
+#include "zebra/zebra_prof.h"
+
+static const char *zebra_prof_stage_str[ZEBRA_PROF_STAGE_MAX] =
+{
+  "zread", "addnode", "queue", "process", "install", "ack", "done",
+};
+
+/* Intervals a histogram is kept for. */
+enum zebra_prof_interval
+{
+  ZEBRA_PROF_I_DECODE,		/* zread -> addnode */
+  ZEBRA_PROF_I_LINK,		/* addnode -> queue */
+  ZEBRA_PROF_I_WAIT,		/* queue -> process */
+  ZEBRA_PROF_I_SELECT,		/* process -> install */
+  ZEBRA_PROF_I_KERNEL,		/* install -> ack */
+  ZEBRA_PROF_I_TOTAL,		/* zread, or queue if none, -> done */
+  ZEBRA_PROF_I_MAX,
+};
+
+static const char *zebra_prof_interval_str[ZEBRA_PROF_I_MAX] =
+{
+  "zread->rib", "rib->queue", "queue wait", "selection", "kernel",
+  "total",
+};
+
+/* Decade buckets, from <10us up to >=1s. */
+#define ZEBRA_PROF_BUCKETS	7
+
+struct zebra_prof_hist
+{
+  unsigned long count;
+  unsigned long max;
+  double sum;
+  unsigned long bucket[ZEBRA_PROF_BUCKETS];
+};
+
+struct zebra_prof_rec
+{
+  struct timeval tv;
+  enum zebra_prof_stage stage;
+  struct prefix p;
+};
+
+/* A route_node waiting on the RIB work queue. */
+struct zebra_prof_pending
+{
+  struct route_node *rn;
+  struct timeval origin;
+  struct timeval queued;
+};
+
+static struct
+{
+  struct zebra_prof_rec *ring;
+  unsigned long events;
+
+  struct hash *pending;
+
+  /* Previous event of the zserv read, and of the rib_process run, in
+   * progress.  A zero tv_sec means there is none. */
+  struct timeval zread;
+  struct timeval addnode;
+  struct timeval process;
+  struct timeval install;
+  struct timeval origin;
+
+  struct zebra_prof_hist hist[ZEBRA_PROF_I_MAX];
+} zprof;
+
+static unsigned int
+zebra_prof_pending_key (void *arg)
+{
+  struct zebra_prof_pending *pending = arg;
+
+  return (unsigned int) ((uintptr_t) pending->rn >> 4);
+}
+
+static int
+zebra_prof_pending_cmp (const void *a, const void *b)
+{
+  const struct zebra_prof_pending *p1 = a;
+  const struct zebra_prof_pending *p2 = b;
+
+  return p1->rn == p2->rn;
+}
+
+static void *
+zebra_prof_pending_alloc (void *arg)
+{
+  struct zebra_prof_pending *pending;
+
+  pending = XCALLOC (MTYPE_RIB_PROF, sizeof (struct zebra_prof_pending));
+  pending->rn = ((struct zebra_prof_pending *) arg)->rn;
+  return pending;
+}
+
+static void
+zebra_prof_pending_free (void *arg)
+{
+  XFREE (MTYPE_RIB_PROF, arg);
+}
+
+static void
+zebra_prof_account (enum zebra_prof_interval i, struct timeval *from,
+		    struct timeval *to)
+{
+  struct zebra_prof_hist *hist = &zprof.hist[i];
+  unsigned long usec, limit;
+  int b;
+
+  if (! from->tv_sec && ! from->tv_usec)
+    return;
+
+  usec = (to->tv_sec - from->tv_sec) * 1000000L
+	 + (to->tv_usec - from->tv_usec);
+
+  for (b = 0, limit = 10; b < ZEBRA_PROF_BUCKETS - 1; b++, limit *= 10)
+    if (usec < limit)
+      break;
+
+  hist->bucket[b]++;
+  hist->count++;
+  hist->sum += usec;
+  if (usec > hist->max)
+    hist->max = usec;
+}
+
+void
+zebra_prof_event (enum zebra_prof_stage stage, struct route_node *rn)
+{
+  struct zebra_prof_rec *rec;
+  struct zebra_prof_pending key, *pending;
+  struct timeval now;
+
+  if (! zprof.ring)
+    zebra_prof_reset ();
+
+  quagga_gettime (QUAGGA_CLK_MONOTONIC, &now);
+
+  rec = &zprof.ring[zprof.events++ % ZEBRA_PROF_RING_SIZE];
+  rec->tv = now;
+  rec->stage = stage;
+  if (rn)
+    prefix_copy (&rec->p, &rn->p);
+  else
+    memset (&rec->p, 0, sizeof (struct prefix));
+
+  switch (stage)
+    {
+    case ZEBRA_PROF_ZREAD:
+      zprof.zread = now;
+      break;
+    case ZEBRA_PROF_ADDNODE:
+      zebra_prof_account (ZEBRA_PROF_I_DECODE, &zprof.zread, &now);
+      zprof.addnode = now;
+      break;
+    case ZEBRA_PROF_QUEUE:
+      zebra_prof_account (ZEBRA_PROF_I_LINK, &zprof.addnode, &now);
+      memset (&zprof.addnode, 0, sizeof (struct timeval));
+
+      /* Keep the oldest change still waiting on the node. */
+      key.rn = rn;
+      pending = hash_get (zprof.pending, &key, zebra_prof_pending_alloc);
+      if (! pending->queued.tv_sec && ! pending->queued.tv_usec)
+	{
+	  pending->queued = now;
+	  pending->origin = zprof.zread.tv_sec ? zprof.zread : now;
+	}
+      break;
+    case ZEBRA_PROF_PROCESS:
+      key.rn = rn;
+      if ((pending = hash_release (zprof.pending, &key)) != NULL)
+	{
+	  zebra_prof_account (ZEBRA_PROF_I_WAIT, &pending->queued, &now);
+	  zprof.origin = pending->origin;
+	  zebra_prof_pending_free (pending);
+	}
+      else
+	zprof.origin = now;
+      zprof.process = now;
+      break;
+    case ZEBRA_PROF_INSTALL:
+      zebra_prof_account (ZEBRA_PROF_I_SELECT, &zprof.process, &now);
+      zprof.install = now;
+      break;
+    case ZEBRA_PROF_ACK:
+      zebra_prof_account (ZEBRA_PROF_I_KERNEL, &zprof.install, &now);
+      memset (&zprof.install, 0, sizeof (struct timeval));
+      break;
+    case ZEBRA_PROF_DONE:
+      zebra_prof_account (ZEBRA_PROF_I_TOTAL, &zprof.origin, &now);
+      memset (&zprof.process, 0, sizeof (struct timeval));
+      memset (&zprof.origin, 0, sizeof (struct timeval));
+      break;
+    default:
+      break;
+    }
+}
+
+/* The zserv message that started at ZEBRA_PROF_ZREAD has been handled. */
+void
+zebra_prof_zread_end (void)
+{
+  memset (&zprof.zread, 0, sizeof (struct timeval));
+  memset (&zprof.addnode, 0, sizeof (struct timeval));
+}
+
+/* Drop everything recorded so far. */
+void
+zebra_prof_reset (void)
+{
+  struct zebra_prof_rec *ring = zprof.ring;
+  struct hash *pending = zprof.pending;
+
+  if (! ring)
+    ring = XCALLOC (MTYPE_RIB_PROF,
+		    sizeof (struct zebra_prof_rec) * ZEBRA_PROF_RING_SIZE);
+  if (! pending)
+    pending = hash_create (zebra_prof_pending_key, zebra_prof_pending_cmp);
+  else
+    hash_clean (pending, zebra_prof_pending_free);
+
+  memset (&zprof, 0, sizeof (zprof));
+  zprof.ring = ring;
+  zprof.pending = pending;
+}
+
+DEFUN (show_zebra_convergence,
+       show_zebra_convergence_cmd,
+       "show zebra convergence",
+       SHOW_STR
+       "Zebra information\n"
+       "RIB convergence profile\n")
+{
+  struct zebra_prof_hist *hist;
+  int i, b;
+
+  vty_out (vty, "Convergence profiling is %s, %lu events recorded%s",
+	   IS_ZEBRA_DEBUG_CONVERGENCE ? "on" : "off", zprof.events,
+	   VTY_NEWLINE);
+  if (zprof.pending)
+    vty_out (vty, "%lu route nodes awaiting processing%s",
+	     zprof.pending->count, VTY_NEWLINE);
+  vty_out (vty, "%s%-12s %10s %10s %10s%s", VTY_NEWLINE,
+	   "Stage", "Count", "Avg(us)", "Max(us)", VTY_NEWLINE);
+
+  for (i = 0; i < ZEBRA_PROF_I_MAX; i++)
+    {
+      hist = &zprof.hist[i];
+      vty_out (vty, "%-12s %10lu %10.0f %10lu%s", zebra_prof_interval_str[i],
+	       hist->count, hist->count ? hist->sum / hist->count : 0.0,
+	       hist->max, VTY_NEWLINE);
+    }
+
+  vty_out (vty, "%s%-12s %8s %8s %8s %8s %8s %8s %8s%s", VTY_NEWLINE,
+	   "Stage", "<10us", "<100us", "<1ms", "<10ms", "<100ms", "<1s", ">=1s",
+	   VTY_NEWLINE);
+  for (i = 0; i < ZEBRA_PROF_I_MAX; i++)
+    {
+      hist = &zprof.hist[i];
+      vty_out (vty, "%-12s", zebra_prof_interval_str[i]);
+      for (b = 0; b < ZEBRA_PROF_BUCKETS; b++)
+	vty_out (vty, " %8lu", hist->bucket[b]);
+      vty_out (vty, "%s", VTY_NEWLINE);
+    }
+
+  return CMD_SUCCESS;
+}
+
+DEFUN (clear_zebra_convergence,
+       clear_zebra_convergence_cmd,
+       "clear zebra convergence",
+       CLEAR_STR
+       "Zebra information\n"
+       "RIB convergence profile\n")
+{
+  if (zprof.ring)
+    zebra_prof_reset ();
+  return CMD_SUCCESS;
+}
+
+DEFUN (dump_zebra_convergence,
+       dump_zebra_convergence_cmd,
+       "dump zebra convergence FILE",
+       "Dump information\n"
+       "Zebra information\n"
+       "RIB convergence profile events\n"
+       "Output file name\n")
+{
+  FILE *fp;
+  struct zebra_prof_rec *rec;
+  unsigned long i, first;
+  char buf[BUFSIZ];
+
+  if (! zprof.ring || ! zprof.events)
+    {
+      vty_out (vty, "No convergence events recorded%s", VTY_NEWLINE);
+      return CMD_WARNING;
+    }
+
+  if ((fp = fopen (argv[0], "w")) == NULL)
+    {
+      vty_out (vty, "Can't open %s: %s%s", argv[0], safe_strerror (errno),
+	       VTY_NEWLINE);
+      return CMD_WARNING;
+    }
+
+  first = zprof.events > ZEBRA_PROF_RING_SIZE
+	  ? zprof.events - ZEBRA_PROF_RING_SIZE : 0;
+
+  fprintf (fp, "# seconds stage prefix\n");
+  for (i = first; i < zprof.events; i++)
+    {
+      rec = &zprof.ring[i % ZEBRA_PROF_RING_SIZE];
+      if (rec->p.family)
+	prefix2str (&rec->p, buf, sizeof (buf));
+      else
+	strcpy (buf, "-");
+      fprintf (fp, "%ld.%06ld %s %s\n", (long) rec->tv.tv_sec,
+	       (long) rec->tv.tv_usec, zebra_prof_stage_str[rec->stage], buf);
+    }
+  fclose (fp);
+
+  vty_out (vty, "%lu events written to %s%s", zprof.events - first, argv[0],
+	   VTY_NEWLINE);
+  return CMD_SUCCESS;
+}
+
+void
+zebra_prof_init (void)
+{
+  install_element (VIEW_NODE, &show_zebra_convergence_cmd);
+  install_element (ENABLE_NODE, &show_zebra_convergence_cmd);
+  install_element (ENABLE_NODE, &clear_zebra_convergence_cmd);
+  install_element (ENABLE_NODE, &dump_zebra_convergence_cmd);
+}
@@ -0,0 +1,56 @@
+/*
+ * Zebra RIB convergence profiler.
+ *
+ * This file is part of Quagga routing suite.
+ *
+ * Quagga is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Quagga is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Zebra; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef _ZEBRA_PROF_H
+#define _ZEBRA_PROF_H
+
+#include "prefix.h"
+#include "table.h"
+#include "zebra/debug.h"
+
+/* Points on the way of a route from zserv to the kernel. */
+enum zebra_prof_stage
+{
+  ZEBRA_PROF_ZREAD,		/* zserv route message read */
+  ZEBRA_PROF_ADDNODE,		/* RIB entry linked to its route_node */
+  ZEBRA_PROF_QUEUE,		/* route_node put on the RIB work queue */
+  ZEBRA_PROF_PROCESS,		/* rib_process() picked the node up */
+  ZEBRA_PROF_INSTALL,		/* kernel write issued */
+  ZEBRA_PROF_ACK,		/* kernel write acknowledged */
+  ZEBRA_PROF_DONE,		/* rib_process() finished with the node */
+  ZEBRA_PROF_STAGE_MAX,
+};
+
+/* Number of events kept for "dump zebra convergence". */
+#define ZEBRA_PROF_RING_SIZE	8192
+
+#define ZEBRA_PROF(S,RN) \
+  do { \
+    if (IS_ZEBRA_DEBUG_CONVERGENCE) \
+      zebra_prof_event ((S), (RN)); \
+  } while (0)
+
+extern void zebra_prof_event (enum zebra_prof_stage, struct route_node *);
+extern void zebra_prof_zread_end (void);
+extern void zebra_prof_reset (void);
+extern void zebra_prof_init (void);
+
+#endif /* _ZEBRA_PROF_H */
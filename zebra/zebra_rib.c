@@ -40,6 +40,8 @@
 #include "zebra/zserv.h"
 #include "zebra/redistribute.h"
 #include "zebra/debug.h"
+#include "zebra/zebra_prof.h"
+#include "zebra/zebra_rnh.h"
 
 /* Default rtm_table for all clients */
 extern struct zebra_t zebrad;
@@ -68,6 +70,20 @@ static const struct
   {ZEBRA_ROUTE_ISIS,    115},
   {ZEBRA_ROUTE_BGP,      20  /* IBGP is 200. */}
 };
+
+/* Routes adopted from the kernel on a graceful restart, see
+ * rib_sweep_defer().  Counters are reported once every stale route has
+ * been taken over by a client or swept.
+ */
+static struct
+{
+  struct thread *t_sweep;
+  unsigned long pending;
+  unsigned long adopted;
+  unsigned long kept;
+  unsigned long rewritten;
+  unsigned long swept;
+} rib_stale;
 
 /* Vector for routing table.  */
 static vector vrf_vector;
@@ -908,6 +924,7 @@ rib_install_kernel (struct route_node *rn, struct rib *rib)
   int ret = 0;
   struct nexthop *nexthop;
 
+  ZEBRA_PROF (ZEBRA_PROF_INSTALL, rn);
   switch (PREFIX_FAMILY (&rn->p))
     {
     case AF_INET:
@@ -919,6 +936,7 @@ rib_install_kernel (struct route_node *rn, struct rib *rib)
       break;
 #endif /* HAVE_IPV6 */
     }
+  ZEBRA_PROF (ZEBRA_PROF_ACK, rn);
 
   /* This condition is never met, if we are using rt_socket.c */
   if (ret < 0)
@@ -968,6 +986,124 @@ rib_uninstall (struct route_node *rn, struct rib *rib)
 
 static void rib_unlink (struct route_node *, struct rib *);
 
+/* Return the address and interface the kernel was handed for a nexthop,
+ * following a recursive resolution to the nexthop actually installed.
+ */
+static void
+nexthop_fib_gate (struct nexthop *nexthop, enum nexthop_types_t *type,
+		  union g_addr **gate, unsigned int *ifindex)
+{
+  if (CHECK_FLAG (nexthop->flags, NEXTHOP_FLAG_RECURSIVE))
+    {
+      *type = nexthop->rtype;
+      *gate = &nexthop->rgate;
+      *ifindex = nexthop->rifindex;
+    }
+  else
+    {
+      *type = nexthop->type;
+      *gate = &nexthop->gate;
+      *ifindex = nexthop->ifindex;
+    }
+}
+
+/* Does the route left in the kernel by the previous zebra instance
+ * forward exactly like the newly selected RIB entry would?  Kernel routes
+ * are read back with a single nexthop, so multipath selections never
+ * match and are simply rewritten.
+ */
+static struct nexthop *
+rib_stale_match (struct rib *stale, struct rib *select)
+{
+  struct nexthop *nexthop, *active = NULL;
+  struct nexthop *old = stale->nexthop;
+  enum nexthop_types_t type;
+  union g_addr *gate;
+  unsigned int ifindex;
+
+  if (! old || old->next || stale->metric != select->metric)
+    return NULL;
+  if (CHECK_FLAG (select->flags, ZEBRA_FLAG_BLACKHOLE | ZEBRA_FLAG_REJECT))
+    return NULL;
+
+  for (nexthop = select->nexthop; nexthop; nexthop = nexthop->next)
+    if (CHECK_FLAG (nexthop->flags, NEXTHOP_FLAG_ACTIVE))
+      {
+	if (active)
+	  return NULL;
+	active = nexthop;
+      }
+  if (! active)
+    return NULL;
+
+  nexthop_fib_gate (active, &type, &gate, &ifindex);
+  if (ifindex && ifindex != old->ifindex)
+    return NULL;
+
+  switch (type)
+    {
+    case NEXTHOP_TYPE_IPV4:
+    case NEXTHOP_TYPE_IPV4_IFINDEX:
+      if ((old->type == NEXTHOP_TYPE_IPV4
+	   || old->type == NEXTHOP_TYPE_IPV4_IFINDEX)
+	  && IPV4_ADDR_SAME (&gate->ipv4, &old->gate.ipv4))
+	return active;
+      break;
+#ifdef HAVE_IPV6
+    case NEXTHOP_TYPE_IPV6:
+    case NEXTHOP_TYPE_IPV6_IFINDEX:
+    case NEXTHOP_TYPE_IPV6_IFNAME:
+      if ((old->type == NEXTHOP_TYPE_IPV6
+	   || old->type == NEXTHOP_TYPE_IPV6_IFINDEX)
+	  && IPV6_ADDR_SAME (&gate->ipv6, &old->gate.ipv6))
+	return active;
+      break;
+#endif /* HAVE_IPV6 */
+    case NEXTHOP_TYPE_IFINDEX:
+    case NEXTHOP_TYPE_IFNAME:
+      if (old->type == NEXTHOP_TYPE_IFINDEX && ifindex)
+	return active;
+      break;
+    default:
+      break;
+    }
+  return NULL;
+}
+
+/* A client has re-announced a prefix still covered by a stale kernel
+ * route.  Take the kernel entry over without touching the FIB when it
+ * already forwards the same way, otherwise write the new route over it.
+ */
+static void
+rib_stale_install (struct route_node *rn, struct rib *stale,
+		   struct rib *select)
+{
+  struct nexthop *nexthop;
+
+  if ((nexthop = rib_stale_match (stale, select)) != NULL)
+    {
+      SET_FLAG (nexthop->flags, NEXTHOP_FLAG_FIB);
+      rib_stale.kept++;
+      return;
+    }
+
+  /* Same metric means same kernel key: netlink replaces the old route
+   * in place, other kernels need it out of the way first. */
+  if (stale->metric == select->metric)
+    {
+#ifdef HAVE_NETLINK
+      SET_FLAG (select->status, RIB_ENTRY_REPLACE);
+#else
+      rib_uninstall_kernel (rn, stale);
+#endif /* HAVE_NETLINK */
+    }
+  rib_install_kernel (rn, select);
+  UNSET_FLAG (select->status, RIB_ENTRY_REPLACE);
+  if (stale->metric != select->metric)
+    rib_uninstall_kernel (rn, stale);
+  rib_stale.rewritten++;
+}
+
 /* Core function for processing routing information base. */
 static void
 rib_process (struct route_node *rn)
@@ -977,11 +1113,13 @@ rib_process (struct route_node *rn)
   struct rib *fib = NULL;
   struct rib *select = NULL;
   struct rib *del = NULL;
+  struct rib *stale = NULL;
   int installed = 0;
   struct nexthop *nexthop = NULL;
   char buf[INET6_ADDRSTRLEN];
   
   assert (rn);
+  ZEBRA_PROF (ZEBRA_PROF_PROCESS, rn);
   
   if (IS_ZEBRA_DEBUG_RIB || IS_ZEBRA_DEBUG_RIB_Q)
     inet_ntop (rn->p.family, &rn->p.u.prefix, buf, INET6_ADDRSTRLEN);
@@ -1017,6 +1155,10 @@ rib_process (struct route_node *rn)
           
           continue;
         }
+
+      /* Kernel route left over from a previous zebra instance. */
+      if (CHECK_FLAG (rib->status, RIB_ENTRY_STALE) && ! stale)
+        stale = rib;
       
       /* Skip unreachable nexthop. */
       if (! nexthop_active_update (rn, rib, 0))
@@ -1032,6 +1174,15 @@ rib_process (struct route_node *rn)
           select = rib;
           continue;
         }
+
+      /* Anything announced since the restart beats a stale route. */
+      if (CHECK_FLAG (rib->status, RIB_ENTRY_STALE)
+          != CHECK_FLAG (select->status, RIB_ENTRY_STALE))
+        {
+          if (CHECK_FLAG (select->status, RIB_ENTRY_STALE))
+            select = rib;
+          continue;
+        }
       
       /* filter route selection in following order:
        * - connected beats other types
@@ -1147,9 +1298,24 @@ rib_process (struct route_node *rn)
       nexthop_active_update (rn, select, 1);
 
       if (! RIB_SYSTEM_ROUTE (select))
-        rib_install_kernel (rn, select);
+        {
+          if (stale)
+            rib_stale_install (rn, stale, select);
+          else
+            rib_install_kernel (rn, select);
+        }
       SET_FLAG (select->flags, ZEBRA_FLAG_SELECTED);
       redistribute_add (&rn->p, select);
+
+      /* The stale kernel route has been taken over, drop it. */
+      if (stale && stale != select)
+        {
+          if (RIB_SYSTEM_ROUTE (select))
+            rib_uninstall_kernel (rn, stale);
+          if (stale == del)
+            del = NULL;
+          rib_unlink (rn, stale);
+        }
     }
 
   /* FIB route was removed, should be deleted */
@@ -1162,6 +1328,8 @@ rib_process (struct route_node *rn)
     }
 
 end:
+  zebra_rnh_changed (rn);
+  ZEBRA_PROF (ZEBRA_PROF_DONE, rn);
   if (IS_ZEBRA_DEBUG_RIB_Q)
     zlog_debug ("%s: %s/%d: rn %p dequeued", __func__, buf, rn->p.prefixlen, rn);
 }
@@ -1293,6 +1461,7 @@ rib_queue_add (struct zebra_t *zebra, struct route_node *rn)
     work_queue_add (zebra->ribq, zebra->mq);
 
   rib_meta_queue_add (zebra->mq, rn);
+  ZEBRA_PROF (ZEBRA_PROF_QUEUE, rn);
 }
 
 /* Create new meta queue.
@@ -1427,6 +1596,7 @@ rib_addnode (struct route_node *rn, struct rib *rib)
       UNSET_FLAG (rib->status, RIB_ENTRY_REMOVED);
       return;
     }
+  ZEBRA_PROF (ZEBRA_PROF_ADDNODE, rn);
   rib_link (rn, rib);
 }
 
@@ -1469,6 +1639,15 @@ rib_unlink (struct route_node *rn, struct rib *rib)
       next = nexthop->next;
       nexthop_free (nexthop);
     }
+  if (CHECK_FLAG (rib->status, RIB_ENTRY_STALE)
+      && --rib_stale.pending == 0 && rib_stale.t_sweep)
+    {
+      THREAD_OFF (rib_stale.t_sweep);
+      zlog_notice ("Graceful restart: all %lu stale routes taken over "
+		   "(%lu kept, %lu rewritten)",
+		   rib_stale.adopted, rib_stale.kept, rib_stale.rewritten);
+    }
+
   XFREE (MTYPE_RIB, rib);
 
   route_unlock_node (rn); /* rn route table reference */
@@ -2877,6 +3056,87 @@ rib_sweep_route (void)
   rib_sweep_table (vrf_table (AFI_IP, SAFI_UNICAST, 0));
   rib_sweep_table (vrf_table (AFI_IP6, SAFI_UNICAST, 0));
 }
+
+/* Mark self installed routes stale rather than deleting them.  */
+static unsigned long
+rib_stale_mark_table (struct route_table *table)
+{
+  struct route_node *rn;
+  struct rib *rib;
+  unsigned long count = 0;
+
+  if (table)
+    for (rn = route_top (table); rn; rn = route_next (rn))
+      for (rib = rn->info; rib; rib = rib->next)
+	if (! CHECK_FLAG (rib->status, RIB_ENTRY_REMOVED)
+	    && rib->type == ZEBRA_ROUTE_KERNEL
+	    && CHECK_FLAG (rib->flags, ZEBRA_FLAG_SELFROUTE))
+	  {
+	    SET_FLAG (rib->status, RIB_ENTRY_STALE);
+	    count++;
+	  }
+  return count;
+}
+
+/* Delete the stale routes nobody has claimed since the restart.  */
+static unsigned long
+rib_stale_sweep_table (struct route_table *table)
+{
+  struct route_node *rn;
+  struct rib *rib;
+  unsigned long count = 0;
+
+  if (table)
+    for (rn = route_top (table); rn; rn = route_next (rn))
+      for (rib = rn->info; rib; rib = rib->next)
+	if (! CHECK_FLAG (rib->status, RIB_ENTRY_REMOVED)
+	    && CHECK_FLAG (rib->status, RIB_ENTRY_STALE))
+	  {
+	    if (! rib_uninstall_kernel (rn, rib))
+	      {
+		rib_delnode (rn, rib);
+		count++;
+	      }
+	  }
+  return count;
+}
+
+static int
+rib_sweep_stale (struct thread *t)
+{
+  rib_stale.t_sweep = NULL;
+
+  rib_stale.swept += rib_stale_sweep_table (vrf_table (AFI_IP, SAFI_UNICAST, 0));
+  rib_stale.swept += rib_stale_sweep_table (vrf_table (AFI_IP6, SAFI_UNICAST, 0));
+
+  zlog_notice ("Graceful restart: %lu stale routes adopted, %lu kept, "
+	       "%lu rewritten, %lu swept",
+	       rib_stale.adopted, rib_stale.kept, rib_stale.rewritten,
+	       rib_stale.swept);
+  return 0;
+}
+
+/* Graceful restart alternative to rib_sweep_route(): routes installed by
+ * a previous zebra instance stay in the FIB as stale entries.  Clients
+ * re-announcing a prefix take its kernel route over, writing to the FIB
+ * only when the route differs, and whatever is still stale after
+ * 'seconds' is swept.
+ */
+void
+rib_sweep_defer (long seconds)
+{
+  rib_stale.adopted = rib_stale_mark_table (vrf_table (AFI_IP, SAFI_UNICAST, 0));
+  rib_stale.adopted += rib_stale_mark_table (vrf_table (AFI_IP6, SAFI_UNICAST, 0));
+  rib_stale.pending = rib_stale.adopted;
+
+  if (! rib_stale.adopted)
+    return;
+
+  zlog_notice ("Graceful restart: keeping %lu routes for up to %ld seconds",
+	       rib_stale.adopted, seconds);
+  rib_stale.t_sweep = thread_add_timer (zebrad.master, rib_sweep_stale,
+					NULL, seconds);
+}
 
 /* Close RIB and clean up kernel routes. */
 static void
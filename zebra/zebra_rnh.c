@@ -0,0 +1,384 @@
+/*
+ * Zebra nexthop tracking.
+ *
+ * This file is part of Quagga routing suite.
+ *
+ * Quagga is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Quagga is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Zebra; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+/*
+ * Clients register nexthop addresses with ZEBRA_NEXTHOP_REGISTER and
+ * get a ZEBRA_NEXTHOP_UPDATE back straight away and then whenever the
+ * route resolving the address changes, instead of polling with
+ * ZEBRA_IPV4_NEXTHOP_LOOKUP.
+ *
+ * rib_process() marks every registered address covered by the prefix
+ * it has just processed.  The marked addresses are resolved again from
+ * an event, so a burst of RIB changes is looked at once, and clients
+ * only hear about addresses whose resolution actually moved.
+ */
+
+#include <zebra.h>
+
+#include "prefix.h"
+#include "table.h"
+#include "memory.h"
+#include "stream.h"
+#include "thread.h"
+#include "linklist.h"
+#include "command.h"
+#include "log.h"
+#include "zclient.h"
+
+#include "zebra/rib.h"
+#include "zebra/zserv.h"
+#include "zebra/zebra_rnh.h"
+#include "zebra/debug.h"
+
+extern struct zebra_t zebrad;
+
+/* Registered addresses, keyed by host prefix. */
+static struct route_table *rnh_table[AFI_MAX];
+
+/* Addresses to resolve again, and the event doing it. */
+static struct list *rnh_dirty;
+static struct thread *t_rnh_eval;
+
+/* Scratch buffer for encoding a resolution. */
+static struct stream *rnh_buf;
+
+static struct rnh *
+rnh_new (struct route_node *rn)
+{
+  struct rnh *rnh;
+
+  rnh = XCALLOC (MTYPE_RNH, sizeof (struct rnh));
+  rnh->node = rn;
+  rnh->client = list_new ();
+  rn->info = rnh;
+  return rnh;
+}
+
+static void
+rnh_free (struct rnh *rnh)
+{
+  struct route_node *rn = rnh->node;
+
+  if (rnh->dirty)
+    listnode_delete (rnh_dirty, rnh);
+  list_delete (rnh->client);
+  if (rnh->state)
+    XFREE (MTYPE_RNH, rnh->state);
+  XFREE (MTYPE_RNH, rnh);
+
+  rn->info = NULL;
+  route_unlock_node (rn);
+}
+
+/* Encode the current resolution of RNH's address into rnh_buf, in the
+   layout of the nexthop lookup replies. */
+static void
+rnh_encode (struct rnh *rnh)
+{
+  struct stream *s = rnh_buf;
+  struct prefix *p = &rnh->node->p;
+  struct rib *rib = NULL;
+  struct nexthop *nexthop;
+  unsigned long nump;
+  u_char num;
+
+  stream_reset (s);
+  stream_putc (s, p->family);
+
+  if (p->family == AF_INET)
+    {
+      stream_put_in_addr (s, &p->u.prefix4);
+      rib = rib_match_ipv4 (p->u.prefix4);
+    }
+#ifdef HAVE_IPV6
+  else
+    {
+      stream_put (s, &p->u.prefix6, 16);
+      rib = rib_match_ipv6 (&p->u.prefix6);
+    }
+#endif /* HAVE_IPV6 */
+
+  if (! rib)
+    {
+      stream_putl (s, 0);
+      stream_putc (s, 0);
+      return;
+    }
+
+  stream_putl (s, rib->metric);
+  num = 0;
+  nump = stream_get_endp (s);
+  stream_putc (s, 0);
+  for (nexthop = rib->nexthop; nexthop; nexthop = nexthop->next)
+    if (CHECK_FLAG (nexthop->flags, NEXTHOP_FLAG_FIB))
+      {
+	stream_putc (s, nexthop->type);
+	switch (nexthop->type)
+	  {
+	  case ZEBRA_NEXTHOP_IPV4:
+	    stream_put_in_addr (s, &nexthop->gate.ipv4);
+	    break;
+	  case ZEBRA_NEXTHOP_IFINDEX:
+	  case ZEBRA_NEXTHOP_IFNAME:
+	    stream_putl (s, nexthop->ifindex);
+	    break;
+#ifdef HAVE_IPV6
+	  case ZEBRA_NEXTHOP_IPV6:
+	    stream_put (s, &nexthop->gate.ipv6, 16);
+	    break;
+	  case ZEBRA_NEXTHOP_IPV6_IFINDEX:
+	  case ZEBRA_NEXTHOP_IPV6_IFNAME:
+	    stream_put (s, &nexthop->gate.ipv6, 16);
+	    stream_putl (s, nexthop->ifindex);
+	    break;
+#endif /* HAVE_IPV6 */
+	  default:
+	    /* do nothing */
+	    break;
+	  }
+	num++;
+      }
+  stream_putc_at (s, nump, num);
+}
+
+/* Resolve RNH's address again.  If the answer differs from what the
+   clients were last told, tell all of them and return 1. */
+static int
+rnh_evaluate (struct rnh *rnh)
+{
+  struct listnode *node;
+  struct zserv *client;
+  size_t len;
+
+  rnh_encode (rnh);
+  len = stream_get_endp (rnh_buf);
+
+  if (rnh->state && rnh->state_len == len
+      && memcmp (rnh->state, STREAM_DATA (rnh_buf), len) == 0)
+    return 0;
+
+  if (rnh->state)
+    XFREE (MTYPE_RNH, rnh->state);
+  rnh->state = XMALLOC (MTYPE_RNH, len);
+  memcpy (rnh->state, STREAM_DATA (rnh_buf), len);
+  rnh->state_len = len;
+
+  if (IS_ZEBRA_DEBUG_EVENT)
+    {
+      char buf[INET6_ADDRSTRLEN];
+
+      zlog_debug ("nexthop %s changed, notifying %d client(s)",
+		  inet_ntop (rnh->node->p.family, &rnh->node->p.u.prefix,
+			     buf, sizeof (buf)),
+		  listcount (rnh->client));
+    }
+
+  for (ALL_LIST_ELEMENTS_RO (rnh->client, node, client))
+    zsend_nexthop_update (client, rnh->state, rnh->state_len);
+  return 1;
+}
+
+static int
+rnh_eval_event (struct thread *t)
+{
+  struct rnh *rnh;
+
+  t_rnh_eval = NULL;
+
+  while (listcount (rnh_dirty))
+    {
+      rnh = listgetdata (listhead (rnh_dirty));
+      list_delete_node (rnh_dirty, listhead (rnh_dirty));
+      rnh->dirty = 0;
+      rnh_evaluate (rnh);
+    }
+  return 0;
+}
+
+void
+zebra_rnh_register (struct zserv *client, struct prefix *p)
+{
+  struct route_node *rn;
+  struct rnh *rnh;
+  afi_t afi;
+
+  afi = family2afi (p->family);
+  if (! afi || ! rnh_table[afi])
+    return;
+
+  rn = route_node_get (rnh_table[afi], p);
+  if (rn->info)
+    {
+      rnh = rn->info;
+      route_unlock_node (rn);
+    }
+  else
+    rnh = rnh_new (rn);
+
+  if (listnode_lookup (rnh->client, client))
+    return;
+  listnode_add (rnh->client, client);
+
+  /* A newcomer needs the current answer even when nothing changed. */
+  if (! rnh_evaluate (rnh))
+    zsend_nexthop_update (client, rnh->state, rnh->state_len);
+}
+
+void
+zebra_rnh_unregister (struct zserv *client, struct prefix *p)
+{
+  struct route_node *rn;
+  struct rnh *rnh;
+  afi_t afi;
+
+  afi = family2afi (p->family);
+  if (! afi || ! rnh_table[afi])
+    return;
+
+  rn = route_node_lookup (rnh_table[afi], p);
+  if (! rn)
+    return;
+  route_unlock_node (rn);
+
+  rnh = rn->info;
+  listnode_delete (rnh->client, client);
+  if (! listcount (rnh->client))
+    rnh_free (rnh);
+}
+
+/* Drop every registration of a client going away. */
+void
+zebra_rnh_client_close (struct zserv *client)
+{
+  struct route_node *rn;
+  struct rnh *rnh;
+  afi_t afi;
+
+  for (afi = AFI_IP; afi < AFI_MAX; afi++)
+    {
+      if (! rnh_table[afi])
+	continue;
+
+      for (rn = route_top (rnh_table[afi]); rn; rn = route_next (rn))
+	if ((rnh = rn->info) != NULL)
+	  {
+	    listnode_delete (rnh->client, client);
+	    if (! listcount (rnh->client))
+	      rnh_free (rnh);
+	  }
+    }
+}
+
+/* rib_process() is done with RIB_RN.  Every registered address inside
+   its prefix may now resolve differently. */
+void
+zebra_rnh_changed (struct route_node *rib_rn)
+{
+  struct route_node *top;
+  struct route_node *rn;
+  struct rnh *rnh;
+  afi_t afi;
+
+  afi = family2afi (rib_rn->p.family);
+  if (! afi || ! rnh_table[afi] || ! rnh_table[afi]->top)
+    return;
+
+  top = route_node_get (rnh_table[afi], &rib_rn->p);
+  route_lock_node (top);
+
+  for (rn = top; rn; rn = route_next_until (rn, top))
+    if ((rnh = rn->info) != NULL && ! rnh->dirty)
+      {
+	rnh->dirty = 1;
+	listnode_add (rnh_dirty, rnh);
+      }
+
+  route_unlock_node (top);
+
+  if (listcount (rnh_dirty) && ! t_rnh_eval)
+    t_rnh_eval = thread_add_event (zebrad.master, rnh_eval_event, NULL, 0);
+}
+
+DEFUN (show_ip_nht,
+       show_ip_nht_cmd,
+       "show ip nht",
+       SHOW_STR
+       IP_STR
+       "Nexthop tracking\n")
+{
+  struct route_node *rn;
+  struct rnh *rnh;
+  struct listnode *node;
+  struct zserv *client;
+  afi_t afi;
+  char buf[INET6_ADDRSTRLEN];
+  u_int32_t metric;
+  u_char num;
+
+  for (afi = AFI_IP; afi < AFI_MAX; afi++)
+    {
+      if (! rnh_table[afi])
+	continue;
+
+      for (rn = route_top (rnh_table[afi]); rn; rn = route_next (rn))
+	if ((rnh = rn->info) != NULL)
+	  {
+	    inet_ntop (rn->p.family, &rn->p.u.prefix, buf, sizeof (buf));
+
+	    /* Skip family and address to metric and nexthop count. */
+	    metric = num = 0;
+	    if (rnh->state)
+	      {
+		size_t off = 1 + PSIZE (rn->p.prefixlen);
+
+		memcpy (&metric, rnh->state + off, sizeof (metric));
+		metric = ntohl (metric);
+		num = rnh->state[off + 4];
+	      }
+
+	    if (num)
+	      vty_out (vty, "%s resolved, metric %u, %d nexthop(s)%s",
+		       buf, metric, num, VTY_NEWLINE);
+	    else
+	      vty_out (vty, "%s unresolved%s", buf, VTY_NEWLINE);
+
+	    vty_out (vty, "  Client list:");
+	    for (ALL_LIST_ELEMENTS_RO (rnh->client, node, client))
+	      vty_out (vty, " fd %d", client->sock);
+	    vty_out (vty, "%s", VTY_NEWLINE);
+	  }
+    }
+  return CMD_SUCCESS;
+}
+
+void
+zebra_rnh_init (void)
+{
+  rnh_table[AFI_IP] = route_table_init ();
+#ifdef HAVE_IPV6
+  rnh_table[AFI_IP6] = route_table_init ();
+#endif /* HAVE_IPV6 */
+  rnh_dirty = list_new ();
+  rnh_buf = stream_new (ZEBRA_MAX_PACKET_SIZ);
+
+  install_element (VIEW_NODE, &show_ip_nht_cmd);
+  install_element (ENABLE_NODE, &show_ip_nht_cmd);
+}
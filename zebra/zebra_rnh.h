@@ -0,0 +1,53 @@
+/*
+ * Zebra nexthop tracking.
+ *
+ * This file is part of Quagga routing suite.
+ *
+ * Quagga is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Quagga is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GNU Zebra; see the file COPYING.  If not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef _ZEBRA_RNH_H
+#define _ZEBRA_RNH_H
+
+#include "prefix.h"
+#include "table.h"
+#include "zebra/zserv.h"
+
+/* A nexthop address some client asked to be told about.  Hangs off a
+   host route_node in the per-family rnh table. */
+struct rnh
+{
+  struct route_node *node;
+
+  /* Registered clients. */
+  struct list *client;
+
+  /* Body of the last ZEBRA_NEXTHOP_UPDATE sent for this address, used
+     to tell a real change from a RIB change that did not move it. */
+  u_char *state;
+  size_t state_len;
+
+  /* On the evaluation list. */
+  u_char dirty;
+};
+
+extern void zebra_rnh_register (struct zserv *, struct prefix *);
+extern void zebra_rnh_unregister (struct zserv *, struct prefix *);
+extern void zebra_rnh_client_close (struct zserv *);
+extern void zebra_rnh_changed (struct route_node *);
+extern void zebra_rnh_init (void);
+
+#endif /* _ZEBRA_RNH_H */
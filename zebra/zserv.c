@@ -41,6 +41,8 @@
 #include "zebra/router-id.h"
 #include "zebra/redistribute.h"
 #include "zebra/debug.h"
+#include "zebra/zebra_prof.h"
+#include "zebra/zebra_rnh.h"
 #include "zebra/ipforward.h"
 
 /* Event list of zebra. */
@@ -53,6 +55,7 @@ static void zebra_event (enum event event, int sock, struct zserv *client);
 extern struct zebra_privs_t zserv_privs;
 
 static void zebra_client_close (struct zserv *client);
+static void zserv_redist_flush (struct zserv *client);
 
 static int
 zserv_delayed_close(struct thread *thread)
@@ -87,18 +90,21 @@ zserv_flush_data(struct thread *thread)
       					 client, client->sock);
       break;
     case BUFFER_EMPTY:
+      /* Redistribution held back while the socket was busy. */
+      if (client->redist_pending && ! client->t_redist)
+	zserv_redist_flush (client);
       break;
     }
   return 0;
 }
 
 static int
-zebra_server_send_message(struct zserv *client)
+zebra_server_send_stream (struct zserv *client, struct stream *s)
 {
   if (client->t_suicide)
     return -1;
-  switch (buffer_write(client->wb, client->sock, STREAM_DATA(client->obuf),
-		       stream_get_endp(client->obuf)))
+  switch (buffer_write(client->wb, client->sock, STREAM_DATA(s),
+		       stream_get_endp(s)))
     {
     case BUFFER_ERROR:
       zlog_warn("%s: buffer_write failed to zserv client fd %d, closing",
@@ -121,6 +127,16 @@ zebra_server_send_message(struct zserv *client)
   return 0;
 }
 
+static int
+zebra_server_send_message(struct zserv *client)
+{
+  /* Redistribution still in the outbox goes first, so that the client
+     sees messages in the order they were made. */
+  if (client->redist_pending)
+    zserv_redist_flush (client);
+  return zebra_server_send_stream (client, client->obuf);
+}
+
 static void
 zserv_create_header (struct stream *s, uint16_t cmd)
 {
@@ -359,9 +375,9 @@ zsend_interface_update (int cmd, struct zserv *client, struct interface *ifp)
  * zapi_ipv{4,6}_{add, delete} should be re-written to avoid code
  * duplication.
  */
-int
-zsend_route_multipath (int cmd, struct zserv *client, struct prefix *p,
-                       struct rib *rib)
+static void
+zserv_encode_route_multipath (int cmd, struct zserv *client, struct prefix *p,
+                              struct rib *rib)
 {
   int psize;
   struct stream *s;
@@ -468,10 +484,163 @@ zsend_route_multipath (int cmd, struct zserv *client, struct prefix *p,
   
   /* Write packet size. */
   stream_putw_at (s, 0, stream_get_endp (s));
+}
 
+int
+zsend_route_multipath (int cmd, struct zserv *client, struct prefix *p,
+                       struct rib *rib)
+{
+  zserv_encode_route_multipath (cmd, client, p, rib);
   return zebra_server_send_message(client);
 }
 
+/* Pending redistribution messages for one prefix, one per route type
+ * so that a delete for the old best route is not lost when a route of
+ * another type replaces it. */
+struct zserv_redist_entry
+{
+  struct stream *msg[ZEBRA_ROUTE_MAX];
+};
+
+/* Free ENTRY's message for TYPE.  Returns 1 if ENTRY is now empty. */
+static int
+zserv_redist_entry_clear (struct zserv_redist_entry *entry, int type)
+{
+  int i;
+
+  if (entry->msg[type])
+    {
+      stream_free (entry->msg[type]);
+      entry->msg[type] = NULL;
+    }
+  for (i = 0; i < ZEBRA_ROUTE_MAX; i++)
+    if (entry->msg[i])
+      return 0;
+  return 1;
+}
+
+/* Send and empty the client's redistribution outbox, in prefix order. */
+static void
+zserv_redist_flush (struct zserv *client)
+{
+  afi_t afi;
+  int type;
+  struct route_node *rn;
+  struct zserv_redist_entry *entry;
+
+  THREAD_OFF (client->t_redist);
+
+  for (afi = AFI_IP; afi < AFI_MAX; afi++)
+    {
+      if (! client->redist_outbox[afi])
+	continue;
+
+      for (rn = route_top (client->redist_outbox[afi]); rn;
+	   rn = route_next (rn))
+	{
+	  if ((entry = rn->info) == NULL)
+	    continue;
+
+	  for (type = 0; type < ZEBRA_ROUTE_MAX; type++)
+	    if (entry->msg[type])
+	      {
+		zebra_server_send_stream (client, entry->msg[type]);
+		zserv_redist_entry_clear (entry, type);
+	      }
+
+	  XFREE (MTYPE_ZSERV_REDIST, entry);
+	  rn->info = NULL;
+	  route_unlock_node (rn);
+	}
+    }
+
+  client->redist_pending = 0;
+}
+
+static int
+zserv_redist_timer (struct thread *thread)
+{
+  struct zserv *client = THREAD_ARG (thread);
+
+  client->t_redist = NULL;
+
+  /* Keep collapsing changes while earlier data is still queued on the
+     socket, zserv_flush_data() sends the outbox once it drains. */
+  if (client->t_write)
+    return 0;
+
+  zserv_redist_flush (client);
+  return 0;
+}
+
+int
+zsend_redistribute_route (int cmd, struct zserv *client, struct prefix *p,
+                          struct rib *rib)
+{
+  afi_t afi;
+  struct route_node *rn;
+  struct zserv_redist_entry *entry;
+
+  if (client->t_suicide)
+    return -1;
+
+  afi = family2afi (p->family);
+  if (! client->redist_outbox[afi])
+    client->redist_outbox[afi] = route_table_init ();
+
+  rn = route_node_get (client->redist_outbox[afi], p);
+  if (rn->info)
+    {
+      entry = rn->info;
+      route_unlock_node (rn);
+    }
+  else
+    {
+      entry = XCALLOC (MTYPE_ZSERV_REDIST, sizeof (struct zserv_redist_entry));
+      rn->info = entry;
+      client->redist_pending++;
+    }
+
+  if (entry->msg[rib->type])
+    {
+      stream_free (entry->msg[rib->type]);
+      client->redist_coalesced++;
+    }
+
+  zserv_encode_route_multipath (cmd, client, p, rib);
+  entry->msg[rib->type] = stream_dup (client->obuf);
+  client->redist_queued++;
+
+  if (! client->t_redist)
+    client->t_redist = thread_add_timer_msec (zebrad.master,
+					      zserv_redist_timer, client,
+					      ZEBRA_REDIST_FLUSH_MSEC);
+  return 0;
+}
+
+void
+zserv_redist_purge (struct zserv *client, int type)
+{
+  afi_t afi;
+  struct route_node *rn;
+
+  for (afi = AFI_IP; afi < AFI_MAX; afi++)
+    {
+      if (! client->redist_outbox[afi])
+	continue;
+
+      for (rn = route_top (client->redist_outbox[afi]); rn;
+	   rn = route_next (rn))
+	if (rn->info && zserv_redist_entry_clear (rn->info, type))
+	  {
+	    XFREE (MTYPE_ZSERV_REDIST, rn->info);
+	    rn->info = NULL;
+	    route_unlock_node (rn);
+	    client->redist_pending--;
+	  }
+    }
+}
+
 #ifdef HAVE_IPV6
 static int
 zsend_ipv6_nexthop_lookup (struct zserv *client, struct in6_addr *addr)
@@ -653,6 +822,22 @@ zsend_ipv4_import_lookup (struct zserv *client, struct prefix_ipv4 *p)
   return zebra_server_send_message(client);
 }
 
+/* Resolution of a registered nexthop, already encoded by zebra_rnh.c. */
+int
+zsend_nexthop_update (struct zserv *client, u_char *data, size_t len)
+{
+  struct stream *s;
+
+  s = client->obuf;
+  stream_reset (s);
+
+  zserv_create_header (s, ZEBRA_NEXTHOP_UPDATE);
+  stream_put (s, data, len);
+  stream_putw_at (s, 0, stream_get_endp (s));
+
+  return zebra_server_send_message(client);
+}
+
 /* Router-id is updated. Send ZEBRA_ROUTER_ID_ADD to client. */
 int
 zsend_router_id_update (struct zserv *client, struct prefix *p)
@@ -881,6 +1066,139 @@ zread_ipv4_delete (struct zserv *client, u_short length)
   return 0;
 }
 
+/* Read the prefix length and prefix of the next entry of a bulk route
+   message into P, which must have its family set.  Returns -1 if the
+   entry is malformed or truncated. */
+static int
+zread_bulk_prefix (struct zserv *client, struct prefix *p)
+{
+  struct stream *s = client->ibuf;
+
+  if (STREAM_READABLE (s) < 1)
+    return -1;
+  p->prefixlen = stream_getc (s);
+  if (p->prefixlen > prefix_blen (p) * 8
+      || STREAM_READABLE (s) < (size_t) PSIZE (p->prefixlen))
+    return -1;
+  stream_get (&p->u.prefix, s, PSIZE (p->prefixlen));
+  return 0;
+}
+
+/* 
+ * Parse a ZEBRA_IPV4_ROUTE_BULK_ADD or ZEBRA_IPV4_ROUTE_BULK_DELETE
+ * sent from client, see zclient_bulk_add() for the format.  The route
+ * attributes are decoded once and then applied to every prefix of the
+ * message, exactly as zread_ipv4_add()/zread_ipv4_delete() would have
+ * done for the equivalent run of single route messages.
+ */
+static int
+zread_ipv4_bulk (struct zserv *client, u_short length, int add)
+{
+  int i;
+  struct rib *rib;
+  struct prefix_ipv4 p;
+  struct stream *s;
+  u_char type, flags, message;
+  u_char distance = 0;
+  u_int32_t metric = 0;
+  u_char nexthop_num = 0;
+  u_char nexthop_type[UCHAR_MAX];
+  struct in_addr nexthop_addr[UCHAR_MAX];
+  unsigned int nexthop_ifindex[UCHAR_MAX];
+  struct in_addr nexthop;
+  unsigned int ifindex;
+  u_char ifname_len;
+  u_int16_t count;
+
+  s = client->ibuf;
+  nexthop.s_addr = 0;
+  ifindex = 0;
+
+  /* Type, flags, message. */
+  type = stream_getc (s);
+  flags = stream_getc (s);
+  message = stream_getc (s);
+
+  /* Nexthops.  The last address and ifindex seen are what a delete
+     matches on, as in zread_ipv4_delete(). */
+  if (CHECK_FLAG (message, ZAPI_MESSAGE_NEXTHOP))
+    {
+      nexthop_num = stream_getc (s);
+
+      for (i = 0; i < nexthop_num; i++)
+	{
+	  nexthop_type[i] = stream_getc (s);
+
+	  switch (nexthop_type[i])
+	    {
+	    case ZEBRA_NEXTHOP_IFINDEX:
+	      ifindex = nexthop_ifindex[i] = stream_getl (s);
+	      break;
+	    case ZEBRA_NEXTHOP_IFNAME:
+	      ifname_len = stream_getc (s);
+	      stream_forward_getp (s, ifname_len);
+	      break;
+	    case ZEBRA_NEXTHOP_IPV4:
+	      nexthop.s_addr = stream_get_ipv4 (s);
+	      nexthop_addr[i] = nexthop;
+	      break;
+	    case ZEBRA_NEXTHOP_IPV6:
+	      stream_forward_getp (s, IPV6_MAX_BYTELEN);
+	      break;
+	    }
+	}
+    }
+
+  if (CHECK_FLAG (message, ZAPI_MESSAGE_DISTANCE))
+    distance = stream_getc (s);
+  if (CHECK_FLAG (message, ZAPI_MESSAGE_METRIC))
+    metric = stream_getl (s);
+
+  for (count = stream_getw (s); count; count--)
+    {
+      memset (&p, 0, sizeof (struct prefix_ipv4));
+      p.family = AF_INET;
+      if (zread_bulk_prefix (client, (struct prefix *) &p) < 0)
+	{
+	  zlog_warn ("%s: socket %d bulk message truncated, %u prefixes lost",
+		     __func__, client->sock, count);
+	  return -1;
+	}
+
+      if (! add)
+	{
+	  rib_delete_ipv4 (type, flags, &p, &nexthop, ifindex,
+			   client->rtm_table);
+	  continue;
+	}
+
+      rib = XCALLOC (MTYPE_RIB, sizeof (struct rib));
+      rib->type = type;
+      rib->flags = flags;
+      rib->distance = distance;
+      rib->metric = metric;
+      rib->uptime = time (NULL);
+      rib->table = zebrad.rtm_table_default;
+
+      for (i = 0; i < nexthop_num; i++)
+	switch (nexthop_type[i])
+	  {
+	  case ZEBRA_NEXTHOP_IFINDEX:
+	    nexthop_ifindex_add (rib, nexthop_ifindex[i]);
+	    break;
+	  case ZEBRA_NEXTHOP_IPV4:
+	    nexthop_ipv4_add (rib, &nexthop_addr[i], NULL);
+	    break;
+	  case ZEBRA_NEXTHOP_BLACKHOLE:
+	    nexthop_blackhole_add (rib);
+	    break;
+	  }
+
+      rib_add_ipv4_multipath (&p, rib);
+    }
+  return 0;
+}
+
 /* Nexthop lookup for IPv4. */
 static int
 zread_ipv4_nexthop_lookup (struct zserv *client, u_short length)
@@ -891,6 +1209,45 @@ zread_ipv4_nexthop_lookup (struct zserv *client, u_short length)
   return zsend_ipv4_nexthop_lookup (client, addr);
 }
 
+/* Nexthop registration: a list of family and address pairs. */
+static int
+zread_nexthop_register (struct zserv *client, u_short length, int reg)
+{
+  struct stream *s = client->ibuf;
+  struct prefix p;
+  size_t end;
+
+  end = stream_get_getp (s) + length;
+  while (stream_get_getp (s) < end)
+    {
+      memset (&p, 0, sizeof (struct prefix));
+      p.family = stream_getc (s);
+      if (p.family == AF_INET)
+	{
+	  p.prefixlen = IPV4_MAX_BITLEN;
+	  p.u.prefix4.s_addr = stream_get_ipv4 (s);
+	}
+#ifdef HAVE_IPV6
+      else if (p.family == AF_INET6)
+	{
+	  p.prefixlen = IPV6_MAX_BITLEN;
+	  stream_get (&p.u.prefix6, s, 16);
+	}
+#endif /* HAVE_IPV6 */
+      else
+	{
+	  zlog_warn ("%s: unknown nexthop family %d", __func__, p.family);
+	  return -1;
+	}
+
+      if (reg)
+	zebra_rnh_register (client, &p);
+      else
+	zebra_rnh_unregister (client, &p);
+    }
+  return 0;
+}
+
 /* Nexthop lookup for IPv4. */
 static int
 zread_ipv4_import_lookup (struct zserv *client, u_short length)
@@ -1036,6 +1393,79 @@ zread_ipv6_delete (struct zserv *client, u_short length)
   return 0;
 }
 
+/* IPv6 counterpart of zread_ipv4_bulk(). */
+static int
+zread_ipv6_bulk (struct zserv *client, u_short length, int add)
+{
+  int i;
+  struct stream *s;
+  struct prefix_ipv6 p;
+  u_char type, flags, message;
+  u_char distance = 0;
+  u_int32_t metric = 0;
+  u_char nexthop_num;
+  u_char nexthop_type;
+  struct in6_addr nexthop;
+  struct in6_addr *gate;
+  unsigned int ifindex;
+  u_int16_t count;
+
+  s = client->ibuf;
+  ifindex = 0;
+  memset (&nexthop, 0, sizeof (struct in6_addr));
+
+  /* Type, flags, message. */
+  type = stream_getc (s);
+  flags = stream_getc (s);
+  message = stream_getc (s);
+
+  /* Nexthop, ifindex, distance, metric. */
+  if (CHECK_FLAG (message, ZAPI_MESSAGE_NEXTHOP))
+    {
+      nexthop_num = stream_getc (s);
+      for (i = 0; i < nexthop_num; i++)
+	{
+	  nexthop_type = stream_getc (s);
+
+	  switch (nexthop_type)
+	    {
+	    case ZEBRA_NEXTHOP_IPV6:
+	      stream_get (&nexthop, s, 16);
+	      break;
+	    case ZEBRA_NEXTHOP_IFINDEX:
+	      ifindex = stream_getl (s);
+	      break;
+	    }
+	}
+    }
+
+  if (CHECK_FLAG (message, ZAPI_MESSAGE_DISTANCE))
+    distance = stream_getc (s);
+  if (CHECK_FLAG (message, ZAPI_MESSAGE_METRIC))
+    metric = stream_getl (s);
+
+  gate = IN6_IS_ADDR_UNSPECIFIED (&nexthop) ? NULL : &nexthop;
+
+  for (count = stream_getw (s); count; count--)
+    {
+      memset (&p, 0, sizeof (struct prefix_ipv6));
+      p.family = AF_INET6;
+      if (zread_bulk_prefix (client, (struct prefix *) &p) < 0)
+	{
+	  zlog_warn ("%s: socket %d bulk message truncated, %u prefixes lost",
+		     __func__, client->sock, count);
+	  return -1;
+	}
+
+      if (add)
+	rib_add_ipv6 (type, flags, &p, gate, ifindex,
+		      zebrad.rtm_table_default, metric, distance);
+      else
+	rib_delete_ipv6 (type, flags, &p, gate, ifindex, client->rtm_table);
+    }
+  return 0;
+}
+
 static int
 zread_ipv6_nexthop_lookup (struct zserv *client, u_short length)
 {
@@ -1075,6 +1505,9 @@ zread_router_id_delete (struct zserv *client, u_short length)
 static void
 zebra_client_close (struct zserv *client)
 {
+  afi_t afi;
+  int type;
+
   /* Close file descriptor. */
   if (client->sock)
     {
@@ -1097,6 +1530,20 @@ zebra_client_close (struct zserv *client)
     thread_cancel (client->t_write);
   if (client->t_suicide)
     thread_cancel (client->t_suicide);
+  if (client->t_redist)
+    thread_cancel (client->t_redist);
+
+  /* Drop unsent redistribution messages. */
+  for (type = 0; type < ZEBRA_ROUTE_MAX; type++)
+    zserv_redist_purge (client, type);
+  for (afi = AFI_IP; afi < AFI_MAX; afi++)
+    if (client->redist_outbox[afi])
+      {
+	route_table_finish (client->redist_outbox[afi]);
+	client->redist_outbox[afi] = NULL;
+      }
+
+  zebra_rnh_client_close (client);
 
   /* Free client structure. */
   listnode_delete (zebrad.client_list, client);
@@ -1232,6 +1679,8 @@ zebra_client_read (struct thread *thread)
     zlog_debug ("zebra message received [%s] %d", 
 	       zserv_command_string (command), length);
 
+  ZEBRA_PROF (ZEBRA_PROF_ZREAD, NULL);
+
   switch (command) 
     {
     case ZEBRA_ROUTER_ID_ADD:
@@ -1252,6 +1701,12 @@ zebra_client_read (struct thread *thread)
     case ZEBRA_IPV4_ROUTE_DELETE:
       zread_ipv4_delete (client, length);
       break;
+    case ZEBRA_IPV4_ROUTE_BULK_ADD:
+      zread_ipv4_bulk (client, length, 1);
+      break;
+    case ZEBRA_IPV4_ROUTE_BULK_DELETE:
+      zread_ipv4_bulk (client, length, 0);
+      break;
 #ifdef HAVE_IPV6
     case ZEBRA_IPV6_ROUTE_ADD:
       zread_ipv6_add (client, length);
@@ -1259,6 +1714,12 @@ zebra_client_read (struct thread *thread)
     case ZEBRA_IPV6_ROUTE_DELETE:
       zread_ipv6_delete (client, length);
       break;
+    case ZEBRA_IPV6_ROUTE_BULK_ADD:
+      zread_ipv6_bulk (client, length, 1);
+      break;
+    case ZEBRA_IPV6_ROUTE_BULK_DELETE:
+      zread_ipv6_bulk (client, length, 0);
+      break;
 #endif /* HAVE_IPV6 */
     case ZEBRA_REDISTRIBUTE_ADD:
       zebra_redistribute_add (command, client, length);
@@ -1283,11 +1744,20 @@ zebra_client_read (struct thread *thread)
     case ZEBRA_IPV4_IMPORT_LOOKUP:
       zread_ipv4_import_lookup (client, length);
       break;
+    case ZEBRA_NEXTHOP_REGISTER:
+      zread_nexthop_register (client, length, 1);
+      break;
+    case ZEBRA_NEXTHOP_UNREGISTER:
+      zread_nexthop_register (client, length, 0);
+      break;
     default:
       zlog_info ("Zebra received unknown command %d", command);
       break;
     }
 
+  if (IS_ZEBRA_DEBUG_CONVERGENCE)
+    zebra_prof_zread_end ();
+
   if (client->t_suicide)
     {
       /* No need to wait for thread callback, just kill immediately. */
@@ -1553,7 +2023,12 @@ DEFUN (show_zebra_client,
   struct zserv *client;
 
   for (ALL_LIST_ELEMENTS_RO (zebrad.client_list, node, client))
-    vty_out (vty, "Client fd %d%s", client->sock, VTY_NEWLINE);
+    {
+      vty_out (vty, "Client fd %d%s", client->sock, VTY_NEWLINE);
+      vty_out (vty, "  Redistribution: %lu queued, %lu coalesced, "
+	       "%lu prefixes pending%s", client->redist_queued,
+	       client->redist_coalesced, client->redist_pending, VTY_NEWLINE);
+    }
   
   return CMD_SUCCESS;
 }
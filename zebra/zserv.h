@@ -32,6 +32,10 @@
 /* Default configuration filename. */
 #define DEFAULT_CONFIG_FILE "zebra.conf"
 
+/* How long redistributed route changes are held back, so that repeated
+   changes to the same prefix reach the client as a single message. */
+#define ZEBRA_REDIST_FLUSH_MSEC       100
+
 /* Client structure. */
 struct zserv
 {
@@ -66,6 +70,17 @@ struct zserv
 
   /* Router-id information. */
   u_char ridinfo;
+
+  /* Redistributed route messages not yet sent, keyed by prefix, see
+     zsend_redistribute_route(). */
+  struct route_table *redist_outbox[AFI_MAX];
+  struct thread *t_redist;
+
+  /* Outbox statistics: prefixes pending, messages queued and messages
+     replaced by a later change before being sent. */
+  unsigned long redist_pending;
+  unsigned long redist_queued;
+  unsigned long redist_coalesced;
 };
 
 /* Zebra instance */
@@ -106,7 +121,20 @@ extern int zsend_interface_address (int, struct zserv *, struct interface *,
 extern int zsend_interface_update (int, struct zserv *, struct interface *);
 extern int zsend_route_multipath (int, struct zserv *, struct prefix *, 
                                   struct rib *);
+
+/* Queue a ZEBRA_IPV{4,6}_ROUTE_ADD/DELETE for RIB in the client's
+   redistribution outbox.  A message still queued for the same prefix
+   and route type is replaced, and the outbox is sent after
+   ZEBRA_REDIST_FLUSH_MSEC, or once the client's socket drains if it is
+   backed up at that time, and ahead of any other message to the
+   client. */
+extern int zsend_redistribute_route (int, struct zserv *, struct prefix *,
+                                     struct rib *);
+
+/* Drop queued redistribution messages of route TYPE for the client. */
+extern void zserv_redist_purge (struct zserv *, int type);
 extern int zsend_router_id_update(struct zserv *, struct prefix *);
+extern int zsend_nexthop_update (struct zserv *, u_char *, size_t);
 
 extern pid_t pid;
 